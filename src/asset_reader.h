@@ -37,9 +37,12 @@
 #include "dcp_assert.h"
 #include "asset.h"
 #include "crypto_context.h"
+#include "essence_reader.h"
+#include "io_backend.h"
 #include <asdcp/AS_DCP.h>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
+#include <vector>
 
 namespace dcp {
 
@@ -49,13 +52,23 @@ class AssetReader : public boost::noncopyable
 public:
 	explicit AssetReader (Asset const * asset, boost::optional<Key> key, Standard standard)
 		: _crypto_context (new DecryptionContext (key, standard))
+		, _key (key)
+		, _standard (standard)
 	{
 		_reader = new R ();
 		DCP_ASSERT (asset->file ());
-		Kumu::Result_t const r = _reader->OpenRead (asset->file()->string().c_str());
+		_file = asset->file().get();
+		Kumu::Result_t const r = _reader->OpenRead (_file.string().c_str());
 		if (ASDCP_FAILURE (r)) {
 			delete _reader;
-			boost::throw_exception (FileError ("could not open MXF file for reading", asset->file().get(), r));
+			boost::throw_exception (FileError ("could not open MXF file for reading", _file, r));
+		}
+
+		try {
+			set_io_backend (IOBackend::default_type ());
+		} catch (...) {
+			delete _reader;
+			throw;
 		}
 	}
 
@@ -66,12 +79,86 @@ public:
 
 	boost::shared_ptr<const F> get_frame (int n) const
 	{
-		return boost::shared_ptr<const F> (new F (_reader, n, _crypto_context));
+		return boost::shared_ptr<const F> (new F (_reader, n, _crypto_context, _essence));
+	}
+
+	/** Read a frame's data, decrypting it if required, into a buffer without making a Frame;
+	 *  this lets AssetWriters copy frames from one asset to another without extra copies.
+	 *  @param n Frame index.
+	 *  @param buffer Buffer to read into, which must be big enough for the frame.
+	 */
+	template <class B>
+	void read_frame (int n, B& buffer) const
+	{
+		if (_essence && _essence->read_frame (_reader, n, buffer)) {
+			return;
+		}
+
+		if (ASDCP_FAILURE (_crypto_context->read_frame (_reader, n, buffer))) {
+			boost::throw_exception (DCPReadError ("could not read frame"));
+		}
+	}
+
+	/** Read some consecutive frames into buffers, as read_frame() does.  Unencrypted frames
+	 *  which are read using an IOBackend are fetched with one batch of requests.
+	 *  @param first Index of the first frame.
+	 *  @param buffers Buffers to read into, one per frame.
+	 */
+	template <class B>
+	void read_frames (int first, std::vector<B*> const & buffers) const
+	{
+		if (_essence) {
+			std::vector<ASDCP::FrameBuffer*> b (buffers.begin(), buffers.end());
+			if (_essence->read_frames (_reader, first, b)) {
+				return;
+			}
+		}
+
+		for (size_t i = 0; i < buffers.size(); ++i) {
+			read_frame (first + i, *buffers[i]);
+		}
+	}
+
+	/** Change how frames from this reader are decrypted.
+	 *  @param backend Backend to use.
+	 *  @param check_hmac true to check the HMAC of each frame; see DecryptionContext.
+	 */
+	void set_decryption (DecryptionContext::Backend backend, bool check_hmac)
+	{
+		_crypto_context.reset (new DecryptionContext (_key, _standard, backend, check_hmac));
+	}
+
+	/** Change how unencrypted frames are read from the MXF file; encrypted frames
+	 *  are always read by asdcplib.  The default is given by IOBackend::default_type().
+	 *  @param type Type of backend to use.
+	 */
+	void set_io_backend (IOBackend::Type type)
+	{
+		set_io_backend (IOBackend::create (_file, type));
+	}
+
+	/** Change how unencrypted frames are read from the MXF file; encrypted frames
+	 *  are always read by asdcplib.
+	 *  @param io Backend to use, which must be reading this reader's file, or 0 to
+	 *  let asdcplib read the file.
+	 */
+	void set_io_backend (boost::shared_ptr<IOBackend> io)
+	{
+		if (io) {
+			_essence.reset (new EssenceReader (io));
+		} else {
+			_essence.reset ();
+		}
 	}
 
 protected:
 	R* _reader;
+	boost::filesystem::path _file;
+	/** reader for unencrypted frames, or 0 to read everything with asdcplib */
+	boost::shared_ptr<EssenceReader> _essence;
 	boost::shared_ptr<DecryptionContext> _crypto_context;
+	boost::optional<Key> _key;
+	Standard _standard;
 };
 
 }
@@ -39,8 +39,18 @@
 #include "mxf.h"
 #include "dcp_assert.h"
 #include "crypto_context.h"
+#include "exceptions.h"
 #include <asdcp/AS_DCP.h>
 #include <asdcp/KM_prng.h>
+#include <cerrno>
+#ifdef LIBDCP_POSIX
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/falloc.h>
+#endif
 
 using namespace dcp;
 
@@ -55,6 +65,7 @@ AssetWriter::AssetWriter (MXF* mxf, boost::filesystem::path file)
 	, _finalized (false)
 	, _started (false)
 	, _crypto_context (new EncryptionContext (mxf->key(), mxf->standard()))
+	, _preallocated (false)
 {
 
 }
@@ -67,3 +78,76 @@ AssetWriter::finalize ()
 	_finalized = true;
 	return _started;
 }
+
+/** Reserve disk space for our file, if we know how big it is likely to be, so that
+ *  the filesystem can give it one contiguous area rather than growing it a frame at
+ *  a time.  The size of the file is not changed.  This must be called once the file
+ *  has been opened for writing.  Space is reserved on Linux and macOS; elsewhere this
+ *  does nothing.
+ */
+void
+AssetWriter::preallocate ()
+{
+	if (!_expected_size || *_expected_size <= 0) {
+		return;
+	}
+
+#if defined(__linux__) || defined(__APPLE__)
+	int const fd = open (_file.string().c_str(), O_WRONLY);
+	if (fd == -1) {
+		return;
+	}
+
+	/* This is only an optimisation, so it does not matter if the filesystem can't do it */
+#ifdef __linux__
+	_preallocated = fallocate (fd, FALLOC_FL_KEEP_SIZE, 0, *_expected_size) == 0;
+#else
+	fstore_t store;
+	store.fst_flags = F_ALLOCATECONTIG | F_ALLOCATEALL;
+	store.fst_posmode = F_PEOFPOSMODE;
+	store.fst_offset = 0;
+	store.fst_length = *_expected_size;
+	if (fcntl (fd, F_PREALLOCATE, &store) == -1) {
+		/* Try again without asking for the space to be contiguous */
+		store.fst_flags = F_ALLOCATEALL;
+		_preallocated = fcntl (fd, F_PREALLOCATE, &store) != -1;
+	} else {
+		_preallocated = true;
+	}
+#endif
+
+	close (fd);
+#endif
+}
+
+/** Give back any disk space reserved by preallocate() which was not used.  This
+ *  must be called once the file has been completely written.
+ */
+void
+AssetWriter::release_preallocation ()
+{
+	if (!_preallocated) {
+		return;
+	}
+
+	_preallocated = false;
+
+#if defined(__linux__) || defined(__APPLE__)
+	int const fd = open (_file.string().c_str(), O_WRONLY);
+	if (fd == -1) {
+		return;
+	}
+
+	/* Truncating to the current size frees blocks allocated beyond the end of the file;
+	   punching a hole there does not free anything on some filesystems (e.g. ext4).
+	*/
+	struct stat st;
+	if (fstat (fd, &st) == 0 && ftruncate (fd, st.st_size) == -1) {
+		int const e = errno;
+		close (fd);
+		throw FileError ("could not release unused disk space", _file, e);
+	}
+
+	close (fd);
+#endif
+}
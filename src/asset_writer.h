@@ -42,6 +42,7 @@
 #include "crypto_context.h"
 #include <boost/filesystem.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
 
 namespace dcp {
 
@@ -66,6 +67,9 @@ public:
 protected:
 	AssetWriter (MXF* mxf, boost::filesystem::path file);
 
+	void preallocate ();
+	void release_preallocation ();
+
 	/** MXF that we are writing */
 	MXF* _mxf;
 	/** File that we are writing to */
@@ -79,6 +83,10 @@ protected:
 	/** true if something has been written to this asset */
 	bool _started;
 	boost::shared_ptr<EncryptionContext> _crypto_context;
+	/** Expected size of the file in bytes, if we have been told it */
+	boost::optional<int64_t> _expected_size;
+	/** true if disk space has been reserved for the file */
+	bool _preallocated;
 };
 
 }
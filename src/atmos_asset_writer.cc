@@ -37,10 +37,12 @@
 #include "dcp_assert.h"
 #include "compose.hpp"
 #include "crypto_context.h"
+#include "instrumentation.h"
 #include <asdcp/AS_DCP.h>
 
 using std::min;
 using std::max;
+using boost::shared_ptr;
 using namespace dcp;
 
 struct AtmosAssetWriter::ASDCPState
@@ -70,25 +72,66 @@ AtmosAssetWriter::AtmosAssetWriter (AtmosAsset* asset, boost::filesystem::path f
 	_asset->fill_writer_info (&_state->writer_info, _asset->id());
 }
 
+void
+AtmosAssetWriter::start ()
+{
+	Kumu::Result_t r = _state->mxf_writer.OpenWrite (_file.string().c_str(), _state->writer_info, _state->desc);
+	if (ASDCP_FAILURE (r)) {
+		boost::throw_exception (FileError ("could not open atmos MXF for writing", _file.string(), r));
+	}
+
+	_asset->set_file (_file);
+	_started = true;
+}
+
 void
 AtmosAssetWriter::write (uint8_t const * data, int size)
 {
 	DCP_ASSERT (!_finalized);
 
 	if (!_started) {
-		Kumu::Result_t r = _state->mxf_writer.OpenWrite (_file.string().c_str(), _state->writer_info, _state->desc);
-		if (ASDCP_FAILURE (r)) {
-			boost::throw_exception (FileError ("could not open atmos MXF for writing", _file.string(), r));
-		}
-
-		_asset->set_file (_file);
-		_started = true;
+		start ();
 	}
 
 	_state->frame_buffer.Capacity (size);
 	_state->frame_buffer.Size (size);
 	memcpy (_state->frame_buffer.Data(), data, size);
 
+	write_current_frame ();
+}
+
+/** Copy a range of frames from another asset.  The frames' data are read straight into
+ *  this writer's frame buffer and written from there.  If the source asset is encrypted
+ *  the reader must have its key.
+ *  @param reader Reader for the source asset.
+ *  @param from First frame index to copy.
+ *  @param to Frame index to stop copying at (so the last frame copied is to - 1).
+ */
+void
+AtmosAssetWriter::copy_frames (shared_ptr<const AtmosAssetReader> reader, int64_t from, int64_t to)
+{
+	DCP_ASSERT (!_finalized);
+
+	if (!_started) {
+		start ();
+	}
+
+	/* XXX: the same guesswork on this buffer size as in Frame */
+	if (_state->frame_buffer.Capacity() < Kumu::Megabyte) {
+		_state->frame_buffer.Capacity (Kumu::Megabyte);
+	}
+
+	for (int64_t i = from; i < to; ++i) {
+		reader->read_frame (i, _state->frame_buffer);
+		write_current_frame ();
+	}
+}
+
+void
+AtmosAssetWriter::write_current_frame ()
+{
+	Instrumentation::Span span (Instrumentation::MXF_WRITE, _state->frame_buffer.Size ());
+
 	ASDCP::Result_t const r = _state->mxf_writer.WriteFrame (_state->frame_buffer, _crypto_context->context(), _crypto_context->hmac());
 	if (ASDCP_FAILURE (r)) {
 		boost::throw_exception (MiscError (String::compose ("could not write atmos MXF frame (%1)", int (r))));
@@ -38,6 +38,7 @@
 #include "asset_writer.h"
 #include "types.h"
 #include "atmos_frame.h"
+#include "atmos_asset_reader.h"
 #include <boost/shared_ptr.hpp>
 #include <boost/filesystem.hpp>
 
@@ -54,6 +55,7 @@ class AtmosAssetWriter : public AssetWriter
 {
 public:
 	void write (uint8_t const * data, int size);
+	void copy_frames (boost::shared_ptr<const AtmosAssetReader> reader, int64_t from, int64_t to);
 	bool finalize ();
 
 private:
@@ -61,6 +63,9 @@ private:
 
 	AtmosAssetWriter (AtmosAsset *, boost::filesystem::path);
 
+	void start ();
+	void write_current_frame ();
+
 	/* do this with an opaque pointer so we don't have to include
 	   ASDCP headers
 	*/
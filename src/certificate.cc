@@ -47,6 +47,9 @@
 #include <openssl/asn1.h>
 #include <openssl/err.h>
 #include <boost/algorithm/string.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
 #include <cerrno>
 #include <iostream>
 #include <algorithm>
@@ -55,15 +58,43 @@ using std::list;
 using std::string;
 using std::ostream;
 using std::min;
+using boost::optional;
 using namespace dcp;
 
 static string const begin_certificate = "-----BEGIN CERTIFICATE-----";
 static string const end_certificate = "-----END CERTIFICATE-----";
 
+/** @struct Certificate::Data
+ *  @brief The parts of a Certificate which are shared by copies of it.
+ */
+struct Certificate::Data : public boost::noncopyable
+{
+	explicit Data (X509* c)
+		: certificate (c)
+		, public_key (0)
+	{}
+
+	~Data ()
+	{
+		X509_free (certificate);
+		RSA_free (public_key);
+	}
+
+	X509* certificate;
+
+	/** mutex for the things below, which are worked out from certificate when they are first needed */
+	boost::mutex mutex;
+	RSA* public_key;
+	optional<string> pem;
+	optional<string> serial;
+	optional<string> issuer;
+	optional<string> subject;
+	optional<string> thumbprint;
+};
+
 /** @param c X509 certificate, which this object will take ownership of */
 Certificate::Certificate (X509* c)
-	: _certificate (c)
-	, _public_key (0)
+	: _data (new Data (c))
 {
 
 }
@@ -72,8 +103,6 @@ Certificate::Certificate (X509* c)
  *  @param cert String to read from.
  */
 Certificate::Certificate (string cert)
-	: _certificate (0)
-	, _public_key (0)
 {
 	string const s = read_string (cert);
 	if (!s.empty ()) {
@@ -81,16 +110,10 @@ Certificate::Certificate (string cert)
 	}
 }
 
-/** Copy constructor.
- *  @param other Certificate to copy.
- */
-Certificate::Certificate (Certificate const & other)
-	: _certificate (0)
-	, _public_key (0)
+X509 *
+Certificate::x509 () const
 {
-	if (other._certificate) {
-		read_string (other.certificate (true));
-	}
+	return _data ? _data->certificate : 0;
 }
 
 /** Read a certificate from a string.
@@ -170,12 +193,14 @@ Certificate::read_string (string cert)
 		throw MiscError ("could not create memory BIO");
 	}
 
-	_certificate = PEM_read_bio_X509 (bio, 0, 0, 0);
-	if (!_certificate) {
+	X509* c = PEM_read_bio_X509 (bio, 0, 0, 0);
+	BIO_free (bio);
+	if (!c) {
 		throw MiscError ("could not read X509 certificate from memory BIO");
 	}
 
-	BIO_free (bio);
+	/* Any copies of this Certificate keep the X509 that they already share with us */
+	_data.reset (new Data (c));
 
 	string extra;
 
@@ -189,33 +214,6 @@ Certificate::read_string (string cert)
 	return extra;
 }
 
-/** Destructor */
-Certificate::~Certificate ()
-{
-	X509_free (_certificate);
-	RSA_free (_public_key);
-}
-
-/** operator= for Certificate.
- *  @param other Certificate to read from.
- */
-Certificate &
-Certificate::operator= (Certificate const & other)
-{
-	if (this == &other) {
-		return *this;
-	}
-
-	X509_free (_certificate);
-	_certificate = 0;
-	RSA_free (_public_key);
-	_public_key = 0;
-
-	read_string (other.certificate (true));
-
-	return *this;
-}
-
 /** Return the certificate as a string.
  *  @param with_begin_end true to include the -----BEGIN CERTIFICATE--- / -----END CERTIFICATE----- markers.
  *  @return Certificate string.
@@ -223,23 +221,26 @@ Certificate::operator= (Certificate const & other)
 string
 Certificate::certificate (bool with_begin_end) const
 {
-	DCP_ASSERT (_certificate);
+	DCP_ASSERT (_data);
 
-	BIO* bio = BIO_new (BIO_s_mem ());
-	if (!bio) {
-		throw MiscError ("could not create memory BIO");
-	}
+	boost::mutex::scoped_lock lm (_data->mutex);
 
-	PEM_write_bio_X509 (bio, _certificate);
+	if (!_data->pem) {
+		BIO* bio = BIO_new (BIO_s_mem ());
+		if (!bio) {
+			throw MiscError ("could not create memory BIO");
+		}
+
+		PEM_write_bio_X509 (bio, _data->certificate);
+
+		char* data;
+		long int const data_length = BIO_get_mem_data (bio, &data);
+		_data->pem = string (data, data_length);
 
-	string s;
-	char* data;
-	long int const data_length = BIO_get_mem_data (bio, &data);
-	for (long int i = 0; i < data_length; ++i) {
-		s += data[i];
+		BIO_free (bio);
 	}
 
-	BIO_free (bio);
+	string s = _data->pem.get ();
 
 	if (!with_begin_end) {
 		boost::replace_all (s, begin_certificate + "\n", "");
@@ -256,8 +257,13 @@ Certificate::certificate (bool with_begin_end) const
 string
 Certificate::issuer () const
 {
-	DCP_ASSERT (_certificate);
-	return name_for_xml (X509_get_issuer_name (_certificate));
+	DCP_ASSERT (_data);
+
+	boost::mutex::scoped_lock lm (_data->mutex);
+	if (!_data->issuer) {
+		_data->issuer = name_for_xml (X509_get_issuer_name (_data->certificate));
+	}
+	return _data->issuer.get ();
 }
 
 string
@@ -308,33 +314,37 @@ Certificate::name_for_xml (X509_NAME* name)
 string
 Certificate::subject () const
 {
-	DCP_ASSERT (_certificate);
+	DCP_ASSERT (_data);
 
-	return name_for_xml (X509_get_subject_name (_certificate));
+	boost::mutex::scoped_lock lm (_data->mutex);
+	if (!_data->subject) {
+		_data->subject = name_for_xml (X509_get_subject_name (_data->certificate));
+	}
+	return _data->subject.get ();
 }
 
 string
 Certificate::subject_common_name () const
 {
-	DCP_ASSERT (_certificate);
+	DCP_ASSERT (_data);
 
-	return get_name_part (X509_get_subject_name (_certificate), NID_commonName);
+	return get_name_part (X509_get_subject_name (_data->certificate), NID_commonName);
 }
 
 string
 Certificate::subject_organization_name () const
 {
-	DCP_ASSERT (_certificate);
+	DCP_ASSERT (_data);
 
-	return get_name_part (X509_get_subject_name (_certificate), NID_organizationName);
+	return get_name_part (X509_get_subject_name (_data->certificate), NID_organizationName);
 }
 
 string
 Certificate::subject_organizational_unit_name () const
 {
-	DCP_ASSERT (_certificate);
+	DCP_ASSERT (_data);
 
-	return get_name_part (X509_get_subject_name (_certificate), NID_organizationalUnitName);
+	return get_name_part (X509_get_subject_name (_data->certificate), NID_organizationalUnitName);
 }
 
 static
@@ -360,56 +370,66 @@ convert_time (ASN1_TIME const * time)
 struct tm
 Certificate::not_before () const
 {
-	DCP_ASSERT (_certificate);
+	DCP_ASSERT (_data);
 #if OPENSSL_VERSION_NUMBER > 0x10100000L
-	return convert_time(X509_get0_notBefore(_certificate));
+	return convert_time(X509_get0_notBefore(_data->certificate));
 #else
-	return convert_time(X509_get_notBefore(_certificate));
+	return convert_time(X509_get_notBefore(_data->certificate));
 #endif
 }
 
 struct tm
 Certificate::not_after () const
 {
-	DCP_ASSERT (_certificate);
+	DCP_ASSERT (_data);
 #if OPENSSL_VERSION_NUMBER > 0x10100000L
-	return convert_time(X509_get0_notAfter(_certificate));
+	return convert_time(X509_get0_notAfter(_data->certificate));
 #else
-	return convert_time(X509_get_notAfter(_certificate));
+	return convert_time(X509_get_notAfter(_data->certificate));
 #endif
 }
 
 string
 Certificate::serial () const
 {
-	DCP_ASSERT (_certificate);
+	DCP_ASSERT (_data);
 
-	ASN1_INTEGER* s = X509_get_serialNumber (_certificate);
-	DCP_ASSERT (s);
+	boost::mutex::scoped_lock lm (_data->mutex);
 
-	BIGNUM* b = ASN1_INTEGER_to_BN (s, 0);
-	char* c = BN_bn2dec (b);
-	BN_free (b);
+	if (!_data->serial) {
+		ASN1_INTEGER* s = X509_get_serialNumber (_data->certificate);
+		DCP_ASSERT (s);
 
-	string st (c);
-	OPENSSL_free (c);
+		BIGNUM* b = ASN1_INTEGER_to_BN (s, 0);
+		char* c = BN_bn2dec (b);
+		BN_free (b);
 
-	return st;
+		_data->serial = string (c);
+		OPENSSL_free (c);
+	}
+
+	return _data->serial.get ();
 }
 
 /** @return thumbprint of the to-be-signed portion of this certificate */
 string
 Certificate::thumbprint () const
 {
-	DCP_ASSERT (_certificate);
+	DCP_ASSERT (_data);
+
+	boost::mutex::scoped_lock lm (_data->mutex);
+
+	if (_data->thumbprint) {
+		return _data->thumbprint.get ();
+	}
 
 	uint8_t buffer[8192];
 	uint8_t* p = buffer;
 
 #if OPENSSL_VERSION_NUMBER > 0x10100000L
-	i2d_re_X509_tbs(_certificate, &p);
+	i2d_re_X509_tbs(_data->certificate, &p);
 #else
-	i2d_X509_CINF (_certificate->cert_info, &p);
+	i2d_X509_CINF (_data->certificate->cert_info, &p);
 #endif
 	unsigned int const length = p - buffer;
 	if (length > sizeof (buffer)) {
@@ -423,30 +443,34 @@ Certificate::thumbprint () const
 	SHA1_Final (digest, &sha);
 
 	char digest_base64[64];
-	return Kumu::base64encode (digest, 20, digest_base64, 64);
+	_data->thumbprint = Kumu::base64encode (digest, 20, digest_base64, 64);
+	return _data->thumbprint.get ();
 }
 
 /** @return RSA public key from this Certificate.  Caller must not free the returned value. */
 RSA *
 Certificate::public_key () const
 {
-	DCP_ASSERT (_certificate);
+	DCP_ASSERT (_data);
+
+	boost::mutex::scoped_lock lm (_data->mutex);
 
-	if (_public_key) {
-		return _public_key;
+	if (_data->public_key) {
+		return _data->public_key;
 	}
 
-	EVP_PKEY* key = X509_get_pubkey (_certificate);
+	EVP_PKEY* key = X509_get_pubkey (_data->certificate);
 	if (!key) {
 		throw MiscError ("could not get public key from certificate");
 	}
 
-	_public_key = EVP_PKEY_get1_RSA (key);
-	if (!_public_key) {
+	_data->public_key = EVP_PKEY_get1_RSA (key);
+	EVP_PKEY_free (key);
+	if (!_data->public_key) {
 		throw MiscError (String::compose ("could not get RSA public key (%1)", ERR_error_string (ERR_get_error(), 0)));
 	}
 
-	return _public_key;
+	return _data->public_key;
 }
 
 static bool string_is_utf8 (X509_NAME* n, int nid)
@@ -459,7 +483,8 @@ static bool string_is_utf8 (X509_NAME* n, int nid)
 bool
 Certificate::has_utf8_strings () const
 {
-	X509_NAME* n = X509_get_subject_name (_certificate);
+	DCP_ASSERT (_data);
+	X509_NAME* n = X509_get_subject_name (_data->certificate);
 	return string_is_utf8(n, NID_commonName) ||
 		string_is_utf8(n, NID_organizationName) ||
 		string_is_utf8(n, NID_organizationalUnitName);
@@ -468,6 +493,10 @@ Certificate::has_utf8_strings () const
 bool
 dcp::operator== (Certificate const & a, Certificate const & b)
 {
+	if (a.x509() == b.x509()) {
+		return true;
+	}
+
 	return a.certificate() == b.certificate();
 }
 
@@ -41,6 +41,7 @@
 #undef X509_NAME
 #include <openssl/x509.h>
 #include <boost/filesystem.hpp>
+#include <boost/shared_ptr.hpp>
 #include <string>
 #include <list>
 
@@ -54,21 +55,17 @@ namespace dcp {
  *  @brief A wrapper for an X509 certificate.
  *
  *  This class can take a Certificate from a string or an OpenSSL X509 object.
+ *  Copies of a Certificate share the same X509 object, and also share the
+ *  results of methods such as thumbprint() and subject() which are worked out
+ *  the first time that they are needed.
  */
 class Certificate
 {
 public:
-	Certificate ()
-		: _certificate (0)
-		, _public_key (0)
-	{}
+	Certificate () {}
 
 	explicit Certificate (std::string);
 	explicit Certificate (X509 *);
-	Certificate (Certificate const &);
-	~Certificate ();
-
-	Certificate& operator= (Certificate const &);
 
 	std::string read_string (std::string);
 
@@ -84,9 +81,10 @@ public:
 	struct tm not_before () const;
 	struct tm not_after () const;
 
-	X509* x509 () const {
-		return _certificate;
-	}
+	/** @return Our X509 object, which is shared with any copies of this
+	 *  Certificate and so must not be modified.
+	 */
+	X509* x509 () const;
 
 	RSA* public_key () const;
 
@@ -100,8 +98,8 @@ private:
 	static std::string asn_to_utf8 (ASN1_STRING *);
 	static std::string get_name_part (X509_NAME *, int);
 
-	X509* _certificate;
-	mutable RSA* _public_key;
+	struct Data;
+	boost::shared_ptr<Data> _data;
 };
 
 bool operator== (Certificate const & a, Certificate const & b);
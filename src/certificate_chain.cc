@@ -36,6 +36,7 @@
  */
 
 #include "certificate_chain.h"
+#include "signer.h"
 #include "exceptions.h"
 #include "util.h"
 #include "dcp_assert.h"
@@ -43,278 +44,270 @@
 #include <asdcp/KM_util.h>
 #include <libcxml/cxml.h>
 #include <libxml++/libxml++.h>
-#include <xmlsec/xmldsig.h>
-#include <xmlsec/dl.h>
-#include <xmlsec/app.h>
-#include <xmlsec/crypto.h>
 #include <openssl/sha.h>
 #include <openssl/bio.h>
 #include <openssl/evp.h>
 #include <openssl/pem.h>
 #include <openssl/rsa.h>
+#include <openssl/x509v3.h>
+#include <openssl/err.h>
 #include <boost/filesystem.hpp>
-#include <boost/algorithm/string.hpp>
 #include <boost/foreach.hpp>
-#include <fstream>
+#include <boost/thread/mutex.hpp>
 #include <iostream>
 
 using std::string;
-using std::ofstream;
-using std::ifstream;
-using std::runtime_error;
+using boost::shared_ptr;
 using namespace dcp;
 
-/** Run a shell command.
- *  @param cmd Command to run (UTF8-encoded).
+/** Generate a 2048-bit RSA key.
+ *  @return Key, which the caller must free with EVP_PKEY_free.
  */
-static void
-command (string cmd)
+static EVP_PKEY*
+make_key ()
 {
-#ifdef LIBDCP_WINDOWS
-	/* We need to use CreateProcessW on Windows so that the UTF-8/16 mess
-	   is handled correctly.
-	*/
-	int const wn = MultiByteToWideChar (CP_UTF8, 0, cmd.c_str(), -1, 0, 0);
-	wchar_t* buffer = new wchar_t[wn];
-	if (MultiByteToWideChar (CP_UTF8, 0, cmd.c_str(), -1, buffer, wn) == 0) {
-		delete[] buffer;
-		return;
-	}
+	BIGNUM* e = BN_new ();
+	RSA* rsa = RSA_new ();
+	EVP_PKEY* key = EVP_PKEY_new ();
 
-	int code = 1;
-
-	STARTUPINFOW startup_info;
-	memset (&startup_info, 0, sizeof (startup_info));
-	startup_info.cb = sizeof (startup_info);
-	PROCESS_INFORMATION process_info;
-
-	/* XXX: this doesn't actually seem to work; failing commands end up with
-	   a return code of 0
-	*/
-	if (CreateProcessW (0, buffer, 0, 0, FALSE, CREATE_NO_WINDOW, 0, 0, &startup_info, &process_info)) {
-		WaitForSingleObject (process_info.hProcess, INFINITE);
-		DWORD c;
-		if (GetExitCodeProcess (process_info.hProcess, &c)) {
-			code = c;
-		}
-		CloseHandle (process_info.hProcess);
-		CloseHandle (process_info.hThread);
+	if (!e || !rsa || !key || !BN_set_word (e, RSA_F4) || !RSA_generate_key_ex (rsa, 2048, e, 0) || !EVP_PKEY_assign_RSA (key, rsa)) {
+		BN_free (e);
+		RSA_free (rsa);
+		EVP_PKEY_free (key);
+		throw MiscError (String::compose ("could not generate RSA key (%1)", ERR_error_string (ERR_get_error(), 0)));
 	}
 
-	delete[] buffer;
-#else
-	cmd += " 2> /dev/null";
-	int const r = system (cmd.c_str ());
-	int const code = WEXITSTATUS (r);
-#endif
-	if (code) {
-		throw dcp::MiscError (String::compose ("error %1 in %2 within %3", code, cmd, boost::filesystem::current_path().string()));
-	}
+	BN_free (e);
+	return key;
 }
 
-/** Extract a public key from a private key and create a SHA1 digest of it.
- *  @param private_key Private key
- *  @param openssl openssl binary name (or full path if openssl is not on the system path).
- *  @return SHA1 digest of corresponding public key, with escaped / characters.
+/** Create a SHA1 digest of a key's public key.
+ *  @param key Key.
+ *  @return Base64-encoded SHA1 digest of the public key.
  */
 static string
-public_key_digest (boost::filesystem::path private_key, boost::filesystem::path openssl)
+public_key_digest (EVP_PKEY* key)
 {
-	boost::filesystem::path public_name = private_key.string() + ".public";
-
-	/* Create the public key from the private key */
-	command (String::compose("\"%1\" rsa -outform PEM -pubout -in %2 -out %3", openssl.string(), private_key.string(), public_name.string ()));
-
-	/* Read in the public key from the file */
-
-	string pub;
-	ifstream f (public_name.string().c_str ());
-	if (!f.good ()) {
-		throw dcp::MiscError ("public key not found");
-	}
-
-	bool read = false;
-	while (f.good ()) {
-		string line;
-		getline (f, line);
-		if (line.length() >= 10 && line.substr(0, 10) == "-----BEGIN") {
-			read = true;
-		} else if (line.length() >= 8 && line.substr(0, 8) == "-----END") {
-			break;
-		} else if (read) {
-			pub += line;
-		}
+	unsigned char* buffer = 0;
+	int const N = i2d_PUBKEY (key, &buffer);
+	if (N <= 24) {
+		OPENSSL_free (buffer);
+		throw MiscError ("could not encode public key");
 	}
 
-	/* Decode the base64 of the public key */
-
-	unsigned char buffer[512];
-	int const N = dcp::base64_decode (pub, buffer, 1024);
-
 	/* Hash it with SHA1 (without the first 24 bytes, for reasons that are not entirely clear) */
 
 	SHA_CTX context;
 	if (!SHA1_Init (&context)) {
+		OPENSSL_free (buffer);
 		throw dcp::MiscError ("could not init SHA1 context");
 	}
 
 	if (!SHA1_Update (&context, buffer + 24, N - 24)) {
+		OPENSSL_free (buffer);
 		throw dcp::MiscError ("could not update SHA1 digest");
 	}
 
+	OPENSSL_free (buffer);
+
 	unsigned char digest[SHA_DIGEST_LENGTH];
 	if (!SHA1_Final (digest, &context)) {
 		throw dcp::MiscError ("could not finish SHA1 digest");
 	}
 
 	char digest_base64[64];
-	string dig = Kumu::base64encode (digest, SHA_DIGEST_LENGTH, digest_base64, 64);
-#ifdef LIBDCP_WINDOWS
-	boost::replace_all (dig, "/", "\\/");
-#else
-	boost::replace_all (dig, "/", "\\\\/");
-#endif
-	return dig;
+	return Kumu::base64encode (digest, SHA_DIGEST_LENGTH, digest_base64, 64);
 }
 
-CertificateChain::CertificateChain (
-	boost::filesystem::path openssl,
+/** Add an entry to an X509 name, using the same string types as
+ *  the openssl tool would with string_mask = nombstr.
+ */
+static void
+add_name_entry (X509_NAME* name, int nid, string value)
+{
+	ASN1_STRING* s = 0;
+	if (ASN1_mbstring_copy (&s, reinterpret_cast<unsigned char const *> (value.c_str()), value.length(), MBSTRING_ASC, B_ASN1_PRINTABLESTRING | B_ASN1_T61STRING) < 0) {
+		throw MiscError (String::compose ("could not make certificate name entry %1", value));
+	}
+
+	int const r = X509_NAME_add_entry_by_NID (name, nid, s->type, s->data, s->length, -1, 0);
+	ASN1_STRING_free (s);
+	if (!r) {
+		throw MiscError (String::compose ("could not add certificate name entry %1", value));
+	}
+}
+
+static void
+add_extension (X509* certificate, X509* issuer, int nid, string value)
+{
+	X509V3_CTX context;
+	X509V3_set_ctx (&context, issuer, certificate, 0, 0, 0);
+	X509_EXTENSION* extension = X509V3_EXT_conf_nid (0, &context, nid, const_cast<char *> (value.c_str()));
+	if (!extension) {
+		throw MiscError (String::compose ("could not make certificate extension %1", value));
+	}
+
+	int const r = X509_add_ext (certificate, extension, -1);
+	X509_EXTENSION_free (extension);
+	if (!r) {
+		throw MiscError (String::compose ("could not add certificate extension %1", value));
+	}
+}
+
+/** Make and sign a certificate.
+ *  @param key Key whose public key should go in the certificate.
+ *  @param issuer Certificate of the issuer, or 0 to make a self-signed certificate.
+ *  @param issuer_key Issuer's key (the same as key for a self-signed certificate).
+ *  @param serial Serial number.
+ *  @param days Number of days for which the certificate should be valid.
+ *  @param basic_constraints Value of the basicConstraints extension.
+ *  @param key_usage Value of the keyUsage extension.
+ *  @param authority_key_identifier Value of the authorityKeyIdentifier extension.
+ *  @return Certificate, which the caller must free with X509_free.
+ */
+static X509*
+make_certificate (
+	EVP_PKEY* key,
+	X509* issuer,
+	EVP_PKEY* issuer_key,
+	int serial,
+	int days,
 	string organisation,
 	string organisational_unit,
-	string root_common_name,
-	string intermediate_common_name,
-	string leaf_common_name
+	string common_name,
+	string basic_constraints,
+	string key_usage,
+	string authority_key_identifier
 	)
 {
-	boost::filesystem::path directory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path ();
-	boost::filesystem::create_directories (directory);
-
-	boost::filesystem::path const cwd = boost::filesystem::current_path ();
-	boost::filesystem::current_path (directory);
-
-	string quoted_openssl = "\"" + openssl.string() + "\"";
-
-	command (quoted_openssl + " genrsa -out ca.key 2048");
-
-	{
-		ofstream f ("ca.cnf");
-		f << "[ req ]\n"
-		  << "distinguished_name = req_distinguished_name\n"
-		  << "x509_extensions	= v3_ca\n"
-		  << "string_mask = nombstr\n"
-		  << "[ v3_ca ]\n"
-		  << "basicConstraints = critical,CA:true,pathlen:3\n"
-		  << "keyUsage = keyCertSign,cRLSign\n"
-		  << "subjectKeyIdentifier = hash\n"
-		  << "authorityKeyIdentifier = keyid:always,issuer:always\n"
-		  << "[ req_distinguished_name ]\n"
-		  << "O = Unique organization name\n"
-		  << "OU = Organization unit\n"
-		  << "CN = Entity and dnQualifier\n";
+	X509* certificate = X509_new ();
+	if (!certificate) {
+		throw MiscError ("could not create certificate");
 	}
 
-	string const ca_subject = "/O=" + organisation +
-		"/OU=" + organisational_unit +
-		"/CN=" + root_common_name +
-		"/dnQualifier=" + public_key_digest ("ca.key", openssl);
-
-	{
-		command (
-			String::compose (
-				"%1 req -new -x509 -sha256 -config ca.cnf -days 3650 -set_serial 5"
-				" -subj \"%2\" -key ca.key -outform PEM -out ca.self-signed.pem",
-				quoted_openssl, ca_subject
-				)
-			);
-	}
+	try {
+		if (
+			!X509_set_version (certificate, 2) ||
+			!ASN1_INTEGER_set (X509_get_serialNumber (certificate), serial) ||
+			!X509_gmtime_adj (X509_get_notBefore (certificate), 0) ||
+			!X509_gmtime_adj (X509_get_notAfter (certificate), long (days) * 24 * 60 * 60) ||
+			!X509_set_pubkey (certificate, key)
+			) {
+			throw MiscError ("could not set up certificate");
+		}
 
-	command (quoted_openssl + " genrsa -out intermediate.key 2048");
-
-	{
-		ofstream f ("intermediate.cnf");
-		f << "[ default ]\n"
-		  << "distinguished_name = req_distinguished_name\n"
-		  << "x509_extensions = v3_ca\n"
-		  << "string_mask = nombstr\n"
-		  << "[ v3_ca ]\n"
-		  << "basicConstraints = critical,CA:true,pathlen:2\n"
-		  << "keyUsage = keyCertSign,cRLSign\n"
-		  << "subjectKeyIdentifier = hash\n"
-		  << "authorityKeyIdentifier = keyid:always,issuer:always\n"
-		  << "[ req_distinguished_name ]\n"
-		  << "O = Unique organization name\n"
-		  << "OU = Organization unit\n"
-		  << "CN = Entity and dnQualifier\n";
-	}
+		X509_NAME* name = X509_get_subject_name (certificate);
+		add_name_entry (name, NID_organizationName, organisation);
+		add_name_entry (name, NID_organizationalUnitName, organisational_unit);
+		add_name_entry (name, NID_commonName, common_name);
+		add_name_entry (name, NID_dnQualifier, public_key_digest (key));
 
-	string const inter_subject = "/O=" + organisation +
-		"/OU=" + organisational_unit +
-		"/CN=" + intermediate_common_name +
-		"/dnQualifier="	+ public_key_digest ("intermediate.key", openssl);
-
-	{
-		command (
-			String::compose (
-				"%1 req -new -config intermediate.cnf -days 3649 -subj \"%2\" -key intermediate.key -out intermediate.csr",
-				quoted_openssl, inter_subject
-				)
-			);
+		if (!X509_set_issuer_name (certificate, issuer ? X509_get_subject_name (issuer) : name)) {
+			throw MiscError ("could not set certificate issuer");
+		}
+
+		X509* extension_issuer = issuer ? issuer : certificate;
+		add_extension (certificate, extension_issuer, NID_basic_constraints, basic_constraints);
+		add_extension (certificate, extension_issuer, NID_key_usage, key_usage);
+		add_extension (certificate, extension_issuer, NID_subject_key_identifier, "hash");
+		add_extension (certificate, extension_issuer, NID_authority_key_identifier, authority_key_identifier);
+
+		if (!X509_sign (certificate, issuer_key, EVP_sha256 ())) {
+			throw MiscError (String::compose ("could not sign certificate (%1)", ERR_error_string (ERR_get_error(), 0)));
+		}
+	} catch (...) {
+		X509_free (certificate);
+		throw;
 	}
 
-	command (
-		quoted_openssl +
-		" x509 -req -sha256 -days 3649 -CA ca.self-signed.pem -CAkey ca.key -set_serial 6"
-		" -in intermediate.csr -extfile intermediate.cnf -extensions v3_ca -out intermediate.signed.pem"
-		);
-
-	command (quoted_openssl + " genrsa -out leaf.key 2048");
-
-	{
-		ofstream f ("leaf.cnf");
-		f << "[ default ]\n"
-		  << "distinguished_name = req_distinguished_name\n"
-		  << "x509_extensions	= v3_ca\n"
-		  << "string_mask = nombstr\n"
-		  << "[ v3_ca ]\n"
-		  << "basicConstraints = critical,CA:false\n"
-		  << "keyUsage = digitalSignature,keyEncipherment\n"
-		  << "subjectKeyIdentifier = hash\n"
-		  << "authorityKeyIdentifier = keyid,issuer:always\n"
-		  << "[ req_distinguished_name ]\n"
-		  << "O = Unique organization name\n"
-		  << "OU = Organization unit\n"
-		  << "CN = Entity and dnQualifier\n";
+	return certificate;
+}
+
+/** @return PEM-encoded RSA private key */
+static string
+private_key_pem (EVP_PKEY* key)
+{
+	BIO* bio = BIO_new (BIO_s_mem ());
+	if (!bio) {
+		throw MiscError ("could not create memory BIO");
 	}
 
-	string const leaf_subject = "/O=" + organisation +
-		"/OU=" + organisational_unit +
-		"/CN=" + leaf_common_name +
-		"/dnQualifier="	+ public_key_digest ("leaf.key", openssl);
-
-	{
-		command (
-			String::compose (
-				"%1 req -new -config leaf.cnf -days 3648 -subj \"%2\" -key leaf.key -outform PEM -out leaf.csr",
-				quoted_openssl, leaf_subject
-				)
-			);
+	RSA* rsa = EVP_PKEY_get1_RSA (key);
+	int const r = PEM_write_bio_RSAPrivateKey (bio, rsa, 0, 0, 0, 0, 0);
+	RSA_free (rsa);
+	if (!r) {
+		BIO_free (bio);
+		throw MiscError ("could not write private key");
 	}
 
-	command (
-		quoted_openssl +
-		" x509 -req -sha256 -days 3648 -CA intermediate.signed.pem -CAkey intermediate.key"
-		" -set_serial 7 -in leaf.csr -extfile leaf.cnf -extensions v3_ca -out leaf.signed.pem"
-		);
+	char* data;
+	long const N = BIO_get_mem_data (bio, &data);
+	string const pem (data, N);
+	BIO_free (bio);
+	return pem;
+}
 
-	boost::filesystem::current_path (cwd);
+/** Create a chain of a self-signed root certificate, an intermediate and a leaf,
+ *  with a new 2048-bit RSA key for each.  This is done in-process so several chains
+ *  may be made at the same time from different threads.
+ */
+CertificateChain::CertificateChain (
+	boost::filesystem::path,
+	string organisation,
+	string organisational_unit,
+	string root_common_name,
+	string intermediate_common_name,
+	string leaf_common_name
+	)
+{
+	EVP_PKEY* ca_key = 0;
+	EVP_PKEY* intermediate_key = 0;
+	EVP_PKEY* leaf_key = 0;
+	X509* ca = 0;
+	X509* intermediate = 0;
+	X509* leaf = 0;
 
-	_certificates.push_back (dcp::Certificate (dcp::file_to_string (directory / "ca.self-signed.pem")));
-	_certificates.push_back (dcp::Certificate (dcp::file_to_string (directory / "intermediate.signed.pem")));
-	_certificates.push_back (dcp::Certificate (dcp::file_to_string (directory / "leaf.signed.pem")));
+	try {
+		ca_key = make_key ();
+		ca = make_certificate (
+			ca_key, 0, ca_key, 5, 3650,
+			organisation, organisational_unit, root_common_name,
+			"critical,CA:true,pathlen:3", "keyCertSign,cRLSign", "keyid:always,issuer:always"
+			);
 
-	_key = dcp::file_to_string (directory / "leaf.key");
+		intermediate_key = make_key ();
+		intermediate = make_certificate (
+			intermediate_key, ca, ca_key, 6, 3649,
+			organisation, organisational_unit, intermediate_common_name,
+			"critical,CA:true,pathlen:2", "keyCertSign,cRLSign", "keyid:always,issuer:always"
+			);
+
+		leaf_key = make_key ();
+		leaf = make_certificate (
+			leaf_key, intermediate, intermediate_key, 7, 3648,
+			organisation, organisational_unit, leaf_common_name,
+			"critical,CA:false", "digitalSignature,keyEncipherment", "keyid,issuer:always"
+			);
 
-	boost::filesystem::remove_all (directory);
+		_key = private_key_pem (leaf_key);
+	} catch (...) {
+		X509_free (ca);
+		X509_free (intermediate);
+		X509_free (leaf);
+		EVP_PKEY_free (ca_key);
+		EVP_PKEY_free (intermediate_key);
+		EVP_PKEY_free (leaf_key);
+		throw;
+	}
+
+	/* The Certificates take ownership of the X509s */
+	_certificates.push_back (Certificate (ca));
+	_certificates.push_back (Certificate (intermediate));
+	_certificates.push_back (Certificate (leaf));
+
+	EVP_PKEY_free (ca_key);
+	EVP_PKEY_free (intermediate_key);
+	EVP_PKEY_free (leaf_key);
 }
 
 CertificateChain::CertificateChain (string s)
@@ -372,6 +365,7 @@ void
 CertificateChain::add (Certificate c)
 {
 	_certificates.push_back (c);
+	_signer.reset ();
 }
 
 /** Remove a certificate from the chain.
@@ -381,6 +375,7 @@ void
 CertificateChain::remove (Certificate c)
 {
 	_certificates.remove (c);
+	_signer.reset ();
 }
 
 /** Remove the i'th certificate in the list, as listed
@@ -397,6 +392,7 @@ CertificateChain::remove (int i)
 
 	if (j != _certificates.end ()) {
 		_certificates.erase (j);
+		_signer.reset ();
 	}
 }
 
@@ -560,54 +556,9 @@ CertificateChain::root_to_leaf () const
 void
 CertificateChain::sign (xmlpp::Element* parent, Standard standard) const
 {
-	/* <Signer> */
-
-	parent->add_child_text("  ");
-	xmlpp::Element* signer = parent->add_child("Signer");
-	signer->set_namespace_declaration ("http://www.w3.org/2000/09/xmldsig#", "dsig");
-	xmlpp::Element* data = signer->add_child("X509Data", "dsig");
-	xmlpp::Element* serial_element = data->add_child("X509IssuerSerial", "dsig");
-	serial_element->add_child("X509IssuerName", "dsig")->add_child_text (leaf().issuer());
-	serial_element->add_child("X509SerialNumber", "dsig")->add_child_text (leaf().serial());
-	data->add_child("X509SubjectName", "dsig")->add_child_text (leaf().subject());
-
-	indent (signer, 2);
-
-	/* <Signature> */
-
-	parent->add_child_text("\n  ");
-	xmlpp::Element* signature = parent->add_child("Signature");
-	signature->set_namespace_declaration ("http://www.w3.org/2000/09/xmldsig#", "dsig");
-	signature->set_namespace ("dsig");
-	parent->add_child_text("\n");
-
-	xmlpp::Element* signed_info = signature->add_child ("SignedInfo", "dsig");
-	signed_info->add_child("CanonicalizationMethod", "dsig")->set_attribute ("Algorithm", "http://www.w3.org/TR/2001/REC-xml-c14n-20010315");
-
-	if (standard == INTEROP) {
-		signed_info->add_child("SignatureMethod", "dsig")->set_attribute("Algorithm", "http://www.w3.org/2000/09/xmldsig#rsa-sha1");
-	} else {
-		signed_info->add_child("SignatureMethod", "dsig")->set_attribute("Algorithm", "http://www.w3.org/2001/04/xmldsig-more#rsa-sha256");
-	}
-
-	xmlpp::Element* reference = signed_info->add_child("Reference", "dsig");
-	reference->set_attribute ("URI", "");
-
-	xmlpp::Element* transforms = reference->add_child("Transforms", "dsig");
-	transforms->add_child("Transform", "dsig")->set_attribute (
-		"Algorithm", "http://www.w3.org/2000/09/xmldsig#enveloped-signature"
-		);
-
-	reference->add_child("DigestMethod", "dsig")->set_attribute("Algorithm", "http://www.w3.org/2000/09/xmldsig#sha1");
-	/* This will be filled in by the signing later */
-	reference->add_child("DigestValue", "dsig");
-
-	signature->add_child("SignatureValue", "dsig");
-	signature->add_child("KeyInfo", "dsig");
-	add_signature_value (signature, "dsig", true);
+	signer()->sign (parent, standard);
 }
 
-
 /** Sign an XML node.
  *
  *  @param parent Node to sign.
@@ -616,44 +567,23 @@ CertificateChain::sign (xmlpp::Element* parent, Standard standard) const
 void
 CertificateChain::add_signature_value (xmlpp::Element* parent, string ns, bool add_indentation) const
 {
-	cxml::Node cp (parent);
-	xmlpp::Node* key_info = cp.node_child("KeyInfo")->node ();
-
-	/* Add the certificate chain to the KeyInfo child node of parent */
-	BOOST_FOREACH (Certificate const & i, leaf_to_root ()) {
-		xmlpp::Element* data = key_info->add_child("X509Data", ns);
-
-		{
-			xmlpp::Element* serial = data->add_child("X509IssuerSerial", ns);
-			serial->add_child("X509IssuerName", ns)->add_child_text (i.issuer ());
-			serial->add_child("X509SerialNumber", ns)->add_child_text (i.serial ());
-		}
-
-		data->add_child("X509Certificate", ns)->add_child_text (i.certificate());
-	}
-
-	xmlSecDSigCtxPtr signature_context = xmlSecDSigCtxCreate (0);
-	if (signature_context == 0) {
-		throw MiscError ("could not create signature context");
-	}
+	signer()->add_signature_value (parent, ns, add_indentation);
+}
 
-	signature_context->signKey = xmlSecCryptoAppKeyLoadMemory (
-		reinterpret_cast<const unsigned char *> (_key->c_str()), _key->size(), xmlSecKeyDataFormatPem, 0, 0, 0
-		);
+/** Protects the creation of CertificateChain::_signer */
+static boost::mutex signer_mutex;
 
-	if (signature_context->signKey == 0) {
-		throw runtime_error ("could not read private key");
-	}
-
-	if (add_indentation) {
-		indent (parent, 2);
-	}
-	int const r = xmlSecDSigCtxSign (signature_context, parent->cobj ());
-	if (r < 0) {
-		throw MiscError (String::compose ("could not sign (%1)", r));
+/** @return A Signer for this chain and its key, which is made the first time it is
+ *  needed and then re-used until the chain or key is changed.
+ */
+shared_ptr<const Signer>
+CertificateChain::signer () const
+{
+	boost::mutex::scoped_lock lm (signer_mutex);
+	if (!_signer) {
+		_signer.reset (new Signer (*this));
 	}
-
-	xmlSecDSigCtxDestroy (signature_context);
+	return _signer;
 }
 
 string
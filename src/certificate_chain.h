@@ -42,6 +42,7 @@
 #include "types.h"
 #include <boost/filesystem.hpp>
 #include <boost/optional.hpp>
+#include <boost/shared_ptr.hpp>
 #include <sys/wait.h>
 
 namespace xmlpp {
@@ -59,6 +60,8 @@ struct certificates_validation8;
 
 namespace dcp {
 
+class Signer;
+
 /** @class CertificateChain
  *  @brief A chain of any number of certificates, from root to leaf.
  */
@@ -67,13 +70,9 @@ class CertificateChain
 public:
 	CertificateChain () {}
 
-	/** Create a chain of certificates for signing things.
-	 *  @param openssl Name of openssl binary (if it is on the path) or full path.
-	 *  @return Directory (which should be deleted by the caller) containing:
-	 *    - ca.self-signed.pem      self-signed root certificate
-	 *    - intermediate.signed.pem intermediate certificate
-	 *    - leaf.key                leaf certificate private key
-	 *    - leaf.signed.pem         leaf certificate
+	/** Create a chain of certificates (root, intermediate and leaf) for signing things,
+	 *  and the private key for the leaf.
+	 *  @param openssl Unused; chains used to be made by running openssl but are now made in-process.
 	 */
 	CertificateChain (
 		boost::filesystem::path openssl,
@@ -105,6 +104,7 @@ public:
 
 	void sign (xmlpp::Element* parent, Standard standard) const;
 	void add_signature_value (xmlpp::Element* parent, std::string ns, bool add_indentation) const;
+	boost::shared_ptr<const Signer> signer () const;
 
 	boost::optional<std::string> key () const {
 		return _key;
@@ -112,6 +112,7 @@ public:
 
 	void set_key (std::string k) {
 		_key = k;
+		_signer.reset ();
 	}
 
 	std::string chain () const;
@@ -132,6 +133,8 @@ private:
 	List _certificates;
 	/** Leaf certificate's private key, if known */
 	boost::optional<std::string> _key;
+	/** Signer prepared from our certificates and key, or 0 if it has not yet been needed */
+	mutable boost::shared_ptr<const Signer> _signer;
 };
 
 }
@@ -0,0 +1,147 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+#include "crypto_context.h"
+#include "dcp_assert.h"
+#include "instrumentation.h"
+#include <openssl/evp.h>
+#include <cstring>
+
+using namespace dcp;
+
+/** Value which must be found in the first encrypted block of each frame; see SMPTE 429-6 */
+static uint8_t const check_value[ASDCP::CBC_BLOCK_SIZE] = {
+	0x43, 0x48, 0x55, 0x4b, 0x43, 0x48, 0x55, 0x4b, 0x43, 0x48, 0x55, 0x4b, 0x43, 0x48, 0x55, 0x4b
+};
+
+DecryptionContext::~DecryptionContext ()
+{
+	if (_evp) {
+		EVP_CIPHER_CTX_free (_evp);
+	}
+}
+
+/** Decrypt a frame which asdcplib has read without decrypting it.
+ *  @param in Encrypted frame; if its SourceLength is 0 the frame was not encrypted in the file,
+ *  and is copied to out.
+ *  @param out Buffer for the decrypted frame.
+ */
+ASDCP::Result_t
+DecryptionContext::decrypt (ASDCP::FrameBuffer const & in, ASDCP::FrameBuffer& out) const
+{
+	if (in.SourceLength() == 0) {
+		if (out.Capacity() < in.Size()) {
+			return ASDCP::RESULT_SMALLBUF;
+		}
+		memcpy (out.Data(), in.RoData(), in.Size());
+		out.Size (in.Size());
+		out.PlaintextOffset (0);
+		out.FrameNumber (in.FrameNumber());
+		return ASDCP::RESULT_OK;
+	}
+
+	DCP_ASSERT (_key);
+
+	Instrumentation::Span span (Instrumentation::DECRYPT, in.SourceLength ());
+
+	/* The encrypted source value is the IV, then the check value, then the plaintext part of the
+	   frame, then the rest of the frame encrypted, padded to a whole number of blocks.  The check
+	   value and the encrypted data are one CBC chain.
+	*/
+	int const block = ASDCP::CBC_BLOCK_SIZE;
+	int const plaintext = in.PlaintextOffset ();
+	int const ciphertext = in.SourceLength() - plaintext;
+	int const remainder = ciphertext % block;
+	int const whole = ciphertext - remainder;
+
+	if (out.Capacity() < in.SourceLength()) {
+		return ASDCP::RESULT_SMALLBUF;
+	}
+
+	if (int (in.Size()) < block * 2 + plaintext + whole + (remainder ? block : 0)) {
+		return ASDCP::RESULT_FORMAT;
+	}
+
+	uint8_t const * p = in.RoData ();
+
+	if (!_evp) {
+		_evp = EVP_CIPHER_CTX_new ();
+		if (!_evp) {
+			throw MiscError ("could not create EVP cipher context");
+		}
+	}
+
+	EVP_CIPHER_CTX* ctx = _evp;
+
+	ASDCP::Result_t result = ASDCP::RESULT_OK;
+	int done = 0;
+	uint8_t check[block];
+	uint8_t last[block];
+
+	if (!EVP_DecryptInit_ex (ctx, EVP_aes_128_cbc(), 0, _key->value(), p) || !EVP_CIPHER_CTX_set_padding (ctx, 0)) {
+		result = ASDCP::RESULT_CRYPT_INIT;
+	}
+	p += block;
+
+	if (ASDCP_SUCCESS (result)) {
+		if (!EVP_DecryptUpdate (ctx, check, &done, p, block) || memcmp (check, check_value, block) != 0) {
+			result = ASDCP::RESULT_CHECKFAIL;
+		}
+		p += block;
+	}
+
+	if (ASDCP_SUCCESS (result)) {
+		memcpy (out.Data(), p, plaintext);
+		p += plaintext;
+		if (whole > 0 && !EVP_DecryptUpdate (ctx, out.Data() + plaintext, &done, p, whole)) {
+			result = ASDCP::RESULT_FAIL;
+		}
+		p += whole;
+	}
+
+	if (ASDCP_SUCCESS (result) && remainder) {
+		/* The last block contains the remainder of the frame and then padding */
+		if (!EVP_DecryptUpdate (ctx, last, &done, p, block)) {
+			result = ASDCP::RESULT_FAIL;
+		}
+		memcpy (out.Data() + plaintext + whole, last, remainder);
+	}
+
+	if (ASDCP_SUCCESS (result)) {
+		out.Size (in.SourceLength());
+		out.PlaintextOffset (plaintext);
+		out.FrameNumber (in.FrameNumber());
+	}
+
+	return result;
+}
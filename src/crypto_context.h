@@ -40,6 +40,9 @@
 #include <asdcp/AS_DCP.h>
 #include <asdcp/KM_prng.h>
 #include <boost/optional.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <openssl/evp.h>
 
 namespace dcp {
 
@@ -101,7 +104,146 @@ private:
 };
 
 typedef CryptoContext<ASDCP::AESEncContext> EncryptionContext;
-typedef CryptoContext<ASDCP::AESDecContext> DecryptionContext;
+
+/** @class DecryptionContext
+ *  @brief Context for decrypting frames as they are read from MXF files.
+ *
+ *  With the ASDCPLIB backend frames are decrypted by asdcplib as they are read.  With
+ *  OPENSSL_EVP asdcplib hands back the encrypted frame and we decrypt it using OpenSSL's
+ *  EVP interface, which will use the CPU's AES instructions if it has them; asdcplib's
+ *  own code does one block at a time with no hardware support.
+ *
+ *  asdcplib only checks HMACs when it does the decryption, so they cannot be checked
+ *  with OPENSSL_EVP; asking for that is an error.
+ *
+ *  A DecryptionContext keeps some scratch space between frames, so it must only be used
+ *  by one thread at a time.
+ */
+class DecryptionContext : public boost::noncopyable
+{
+public:
+	enum Backend {
+		ASDCPLIB,
+		OPENSSL_EVP
+	};
+
+	/** @param key Key, or empty if no decryption is required.
+	 *  @param standard Standard of the MXF that will be read.
+	 *  @param backend Backend to use.
+	 *  @param check_hmac true to check frames' HMAC values; frames which fail the check will
+	 *  not be read.  Checking can be skipped if the source is trusted, and must be skipped
+	 *  with the OPENSSL_EVP backend.
+	 */
+	DecryptionContext (
+		boost::optional<Key> key,
+		Standard standard,
+		Backend backend = ASDCPLIB,
+		bool check_hmac = true
+		)
+		: _key (key)
+		, _backend (backend)
+		, _check_hmac (check_hmac)
+		, _evp (0)
+	{
+		if (backend == ASDCPLIB) {
+			_asdcp.reset (new CryptoContext<ASDCP::AESDecContext> (key, standard));
+		} else if (key && check_hmac) {
+			throw MiscError ("HMAC values cannot be checked when decrypting with OpenSSL EVP");
+		}
+	}
+
+	~DecryptionContext ();
+
+	/** @return context to pass to asdcplib's ReadFrame methods */
+	ASDCP::AESDecContext* context () const {
+		return _asdcp ? _asdcp->context() : 0;
+	}
+
+	/** @return HMAC context to pass to asdcplib's ReadFrame methods */
+	ASDCP::HMACContext* hmac () const {
+		return (_asdcp && _check_hmac) ? _asdcp->hmac() : 0;
+	}
+
+	Backend backend () const {
+		return _backend;
+	}
+
+	/** Read a frame, decrypting it if required.
+	 *  @param reader asdcplib reader.
+	 *  @param n Frame index.
+	 *  @param buffer Buffer to read into.
+	 */
+	template <class R, class B>
+	ASDCP::Result_t read_frame (R* reader, int n, B& buffer) const
+	{
+		if (!_key || _backend == ASDCPLIB) {
+			return reader->ReadFrame (n, buffer, context(), hmac());
+		}
+
+		B& encrypted = scratch<B> (buffer.Capacity ());
+		ASDCP::Result_t const r = reader->ReadFrame (n, encrypted, 0, 0);
+		if (ASDCP_FAILURE (r)) {
+			return r;
+		}
+
+		return decrypt (encrypted, buffer);
+	}
+
+	/** Read one eye of a stereoscopic frame, decrypting it if required.
+	 *  @param reader asdcplib reader.
+	 *  @param n Frame index.
+	 *  @param phase Eye to read.
+	 *  @param buffer Buffer to read into.
+	 */
+	template <class R, class P, class B>
+	ASDCP::Result_t read_frame (R* reader, int n, P phase, B& buffer) const
+	{
+		if (!_key || _backend == ASDCPLIB) {
+			return reader->ReadFrame (n, phase, buffer, context(), hmac());
+		}
+
+		B& encrypted = scratch<B> (buffer.Capacity ());
+		ASDCP::Result_t const r = reader->ReadFrame (n, phase, encrypted, 0, 0);
+		if (ASDCP_FAILURE (r)) {
+			return r;
+		}
+
+		return decrypt (encrypted, buffer);
+	}
+
+	ASDCP::Result_t decrypt (ASDCP::FrameBuffer const & in, ASDCP::FrameBuffer& out) const;
+
+private:
+	/** @param capacity Capacity of the buffer that a frame will be decrypted into.
+	 *  @return Buffer which is big enough to read the encrypted version of the frame into;
+	 *  as well as the frame it holds the IV, the check value and up to a block of padding.
+	 */
+	template <class B>
+	B& scratch (ui32_t capacity) const
+	{
+		B* b = dynamic_cast<B*> (_scratch.get ());
+		if (!b) {
+			b = new B;
+			_scratch.reset (b);
+		}
+
+		ui32_t const needed = capacity + 3 * ASDCP::CBC_BLOCK_SIZE;
+		if (b->Capacity() < needed && ASDCP_FAILURE (b->Capacity (needed))) {
+			throw MiscError ("could not allocate buffer for encrypted frame");
+		}
+
+		return *b;
+	}
+
+	boost::shared_ptr<CryptoContext<ASDCP::AESDecContext> > _asdcp;
+	boost::optional<Key> _key;
+	Backend _backend;
+	bool _check_hmac;
+	/** buffer that encrypted frames are read into for OPENSSL_EVP, kept to save allocating one per frame */
+	mutable boost::shared_ptr<ASDCP::FrameBuffer> _scratch;
+	/** OpenSSL cipher context for OPENSSL_EVP, created when it is first needed */
+	mutable EVP_CIPHER_CTX* _evp;
+};
 
 }
 
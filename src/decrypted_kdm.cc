@@ -48,6 +48,9 @@
 #include <openssl/pem.h>
 #include <openssl/err.h>
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 using std::list;
 using std::vector;
@@ -141,6 +144,27 @@ DecryptedKDM::DecryptedKDM (EncryptedKDM const & kdm, string private_key)
 		throw FileError ("could not read RSA private key file", private_key, errno);
 	}
 
+	try {
+		decrypt (kdm, rsa);
+	} catch (...) {
+		RSA_free (rsa);
+		BIO_free (bio);
+		throw;
+	}
+
+	RSA_free (rsa);
+	BIO_free (bio);
+}
+
+DecryptedKDM::DecryptedKDM (EncryptedKDM const & kdm, RSA* private_key)
+{
+	decrypt (kdm, private_key);
+}
+
+/** Use a private key to decrypt the keys from an EncryptedKDM and add them to this object */
+void
+DecryptedKDM::decrypt (EncryptedKDM const & kdm, RSA* rsa)
+{
 	/* Use the private key to decrypt the keys */
 
 	BOOST_FOREACH (string const & i, kdm.keys ()) {
@@ -210,9 +234,6 @@ DecryptedKDM::DecryptedKDM (EncryptedKDM const & kdm, string private_key)
 		delete[] decrypted;
 	}
 
-	RSA_free (rsa);
-	BIO_free (bio);
-
 	_annotation_text = kdm.annotation_text ();
 	_content_title_text = kdm.content_title_text ();
 	_issue_date = kdm.issue_date ();
@@ -300,6 +321,40 @@ DecryptedKDM::add_key (DecryptedKDMKey key)
 	_keys.push_back (key);
 }
 
+/** @return The blocks of plaintext which will be encrypted for each key; these are the same for every recipient */
+vector<vector<uint8_t> >
+DecryptedKDM::key_blocks (shared_ptr<const CertificateChain> signer) const
+{
+	uint8_t thumbprint[20];
+	base64_decode (signer->leaf().thumbprint (), thumbprint, 20);
+
+	string const not_valid_before = _not_valid_before.as_string ();
+	string const not_valid_after = _not_valid_after.as_string ();
+
+	vector<vector<uint8_t> > blocks;
+	BOOST_FOREACH (DecryptedKDMKey const & i, _keys) {
+		/* We're making SMPTE keys so we must have a type for each one */
+		DCP_ASSERT (i.type());
+
+		/* XXX: SMPTE only */
+		uint8_t block[138];
+		uint8_t* p = block;
+
+		put (&p, smpte_structure_id, 16);
+		put (&p, thumbprint, 20);
+		put_uuid (&p, i.cpl_id ());
+		put (&p, i.type().get());
+		put_uuid (&p, i.id ());
+		put (&p, not_valid_before);
+		put (&p, not_valid_after);
+		put (&p, i.key().value(), ASDCP::KeyLen);
+
+		blocks.push_back (vector<uint8_t> (block, p));
+	}
+
+	return blocks;
+}
+
 EncryptedKDM
 DecryptedKDM::encrypt (
 	shared_ptr<const CertificateChain> signer,
@@ -312,33 +367,35 @@ DecryptedKDM::encrypt (
 {
 	DCP_ASSERT (!_keys.empty ());
 
+	return encrypt (
+		signer, key_blocks (signer), recipient, trusted_devices, formulation, disable_forensic_marking_picture, disable_forensic_marking_audio
+		);
+}
+
+/** Encrypt some prepared key blocks using a recipient's public key and make the KDM */
+EncryptedKDM
+DecryptedKDM::encrypt (
+	shared_ptr<const CertificateChain> signer,
+	vector<vector<uint8_t> > const & blocks,
+	Certificate recipient,
+	vector<string> trusted_devices,
+	Formulation formulation,
+	bool disable_forensic_marking_picture,
+	optional<int> disable_forensic_marking_audio
+	) const
+{
 	list<pair<string, string> > key_ids;
-	list<string> keys;
 	BOOST_FOREACH (DecryptedKDMKey const & i, _keys) {
-		/* We're making SMPTE keys so we must have a type for each one */
-		DCP_ASSERT (i.type());
 		key_ids.push_back (make_pair (i.type().get(), i.id ()));
+	}
 
-		/* XXX: SMPTE only */
-		uint8_t block[138];
-		uint8_t* p = block;
-
-		put (&p, smpte_structure_id, 16);
-
-		base64_decode (signer->leaf().thumbprint (), p, 20);
-		p += 20;
-
-		put_uuid (&p, i.cpl_id ());
-		put (&p, i.type().get());
-		put_uuid (&p, i.id ());
-		put (&p, _not_valid_before.as_string ());
-		put (&p, _not_valid_after.as_string ());
-		put (&p, i.key().value(), ASDCP::KeyLen);
+	/* Encrypt using the projector's public key */
+	RSA* rsa = recipient.public_key ();
 
-		/* Encrypt using the projector's public key */
-		RSA* rsa = recipient.public_key ();
+	list<string> keys;
+	BOOST_FOREACH (vector<uint8_t> const & j, blocks) {
 		unsigned char encrypted[RSA_size(rsa)];
-		int const encrypted_len = RSA_public_encrypt (p - block, block, encrypted, rsa, RSA_PKCS1_OAEP_PADDING);
+		int const encrypted_len = RSA_public_encrypt (j.size(), &j[0], encrypted, rsa, RSA_PKCS1_OAEP_PADDING);
 		if (encrypted_len == -1) {
 			throw MiscError (String::compose ("Could not encrypt KDM (%1)", ERR_error_string (ERR_get_error(), 0)));
 		}
@@ -379,3 +436,119 @@ DecryptedKDM::encrypt (
 		keys
 		);
 }
+
+/** State shared by the threads of the many-recipient encrypt() */
+struct DecryptedKDM::Batch
+{
+	Batch (
+		shared_ptr<const CertificateChain> signer_,
+		vector<vector<uint8_t> > blocks_,
+		vector<Recipient> const & recipients_,
+		Formulation formulation_,
+		bool disable_forensic_marking_picture_,
+		optional<int> disable_forensic_marking_audio_,
+		boost::function<void (int, EncryptedKDM const &)> handler_
+		)
+		: signer (signer_)
+		, blocks (blocks_)
+		, recipients (recipients_)
+		, formulation (formulation_)
+		, disable_forensic_marking_picture (disable_forensic_marking_picture_)
+		, disable_forensic_marking_audio (disable_forensic_marking_audio_)
+		, handler (handler_)
+		, next (0)
+	{}
+
+	shared_ptr<const CertificateChain> signer;
+	vector<vector<uint8_t> > blocks;
+	vector<Recipient> const & recipients;
+	Formulation formulation;
+	bool disable_forensic_marking_picture;
+	optional<int> disable_forensic_marking_audio;
+	boost::function<void (int, EncryptedKDM const &)> handler;
+
+	/** mutex for next and error */
+	boost::mutex mutex;
+	/** index of the next recipient to make a KDM for */
+	int next;
+	/** first error that any thread hit */
+	optional<string> error;
+	/** mutex to serialise calls to handler */
+	boost::mutex handler_mutex;
+};
+
+float
+DecryptedKDM::encrypt (
+	shared_ptr<const CertificateChain> signer,
+	vector<Recipient> const & recipients,
+	Formulation formulation,
+	bool disable_forensic_marking_picture,
+	optional<int> disable_forensic_marking_audio,
+	boost::function<void (int, EncryptedKDM const &)> handler,
+	int threads
+	) const
+{
+	DCP_ASSERT (!_keys.empty ());
+	DCP_ASSERT (threads > 0);
+
+	boost::posix_time::ptime const start = boost::posix_time::microsec_clock::universal_time ();
+
+	Batch batch (
+		signer, key_blocks (signer), recipients, formulation, disable_forensic_marking_picture, disable_forensic_marking_audio, handler
+		);
+
+	boost::thread_group group;
+	for (int i = 0; i < threads; ++i) {
+		group.create_thread (boost::bind (&DecryptedKDM::encrypt_batch, this, &batch));
+	}
+	group.join_all ();
+
+	if (batch.error) {
+		throw MiscError (*batch.error);
+	}
+
+	boost::posix_time::time_duration const taken = boost::posix_time::microsec_clock::universal_time() - start;
+	if (taken.total_microseconds() == 0) {
+		return 0;
+	}
+
+	return recipients.size() * 1e6 / taken.total_microseconds();
+}
+
+/** Body of each of the threads of the many-recipient encrypt() */
+void
+DecryptedKDM::encrypt_batch (Batch* batch) const
+{
+	while (true) {
+		int n;
+		{
+			boost::mutex::scoped_lock lm (batch->mutex);
+			if (batch->error || batch->next >= int (batch->recipients.size())) {
+				return;
+			}
+			n = batch->next++;
+		}
+
+		try {
+			Recipient const & r = batch->recipients[n];
+			EncryptedKDM kdm = encrypt (
+				batch->signer,
+				batch->blocks,
+				r.certificate,
+				r.trusted_devices,
+				batch->formulation,
+				batch->disable_forensic_marking_picture,
+				batch->disable_forensic_marking_audio
+				);
+
+			boost::mutex::scoped_lock lm (batch->handler_mutex);
+			batch->handler (n, kdm);
+		} catch (std::exception& e) {
+			boost::mutex::scoped_lock lm (batch->mutex);
+			if (!batch->error) {
+				batch->error = e.what ();
+			}
+			return;
+		}
+	}
+}
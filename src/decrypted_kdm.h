@@ -45,6 +45,7 @@
 #include "certificate.h"
 #include <boost/filesystem.hpp>
 #include <boost/optional.hpp>
+#include <boost/function.hpp>
 
 class decrypted_kdm_test;
 
@@ -73,6 +74,13 @@ public:
 	 */
 	DecryptedKDM (EncryptedKDM const & kdm, std::string private_key);
 
+	/** @param kdm Encrypted KDM.
+	 *  @param private_key Private key which has already been read, for callers who
+	 *  decrypt many KDMs with the same key.  It will not be freed.  OpenSSL may update
+	 *  its blinding state, so it should not be in use by another thread at the same time.
+	 */
+	DecryptedKDM (EncryptedKDM const & kdm, RSA* private_key);
+
 	/** Create an empty DecryptedKDM.  After creation you must call
 	 *  add_key() to add each key that you want in the KDM.
 	 *
@@ -138,6 +146,47 @@ public:
 		boost::optional<int> disable_forensic_marking_audio
 		) const;
 
+	/** @struct Recipient
+	 *  @brief One recipient of a KDM made by the many-recipient version of encrypt().
+	 */
+	struct Recipient
+	{
+		Recipient (Certificate certificate_, std::vector<std::string> trusted_devices_)
+			: certificate (certificate_)
+			, trusted_devices (trusted_devices_)
+		{}
+
+		/** Certificate of the projector/server which should receive the KDM */
+		Certificate certificate;
+		/** Thumbprints of extra trusted devices to write to the KDM */
+		std::vector<std::string> trusted_devices;
+	};
+
+	/** Encrypt this KDM's keys and sign the whole KDM for each of a list of recipients.
+	 *  The parts of the KDM which are the same for every recipient are prepared once, and
+	 *  the encryption and signing for the different recipients are done by a pool of threads.
+	 *
+	 *  @param signer Chain to sign with.
+	 *  @param recipients Recipients to make KDMs for.
+	 *  @param formulation Formulation to use for the encrypted KDMs.
+	 *  @param disable_forensic_marking_picture true to disable forensic marking of picture.
+	 *  @param disable_forensic_marking_audio as for the single-recipient encrypt().
+	 *  @param handler Function which will be called with the index (in recipients) of each
+	 *  recipient, and its KDM, as each KDM is made.  The calls will come from the pool's threads
+	 *  in no particular order, but never more than one at a time.
+	 *  @param threads Number of threads to use.
+	 *  @return Number of KDMs made per second.
+	 */
+	float encrypt (
+		boost::shared_ptr<const CertificateChain> signer,
+		std::vector<Recipient> const & recipients,
+		Formulation formulation,
+		bool disable_forensic_marking_picture,
+		boost::optional<int> disable_forensic_marking_audio,
+		boost::function<void (int, EncryptedKDM const &)> handler,
+		int threads
+		) const;
+
 	void add_key (boost::optional<std::string> type, std::string key_id, Key key, std::string cpl_id, Standard standard);
 	void add_key (DecryptedKDMKey key);
 
@@ -162,6 +211,21 @@ private:
 
 	friend class ::decrypted_kdm_test;
 
+	struct Batch;
+
+	std::vector<std::vector<uint8_t> > key_blocks (boost::shared_ptr<const CertificateChain> signer) const;
+	EncryptedKDM encrypt (
+		boost::shared_ptr<const CertificateChain> signer,
+		std::vector<std::vector<uint8_t> > const & blocks,
+		Certificate recipient,
+		std::vector<std::string> trusted_devices,
+		Formulation formulation,
+		bool disable_forensic_marking_picture,
+		boost::optional<int> disable_forensic_marking_audio
+		) const;
+	void encrypt_batch (Batch* batch) const;
+	void decrypt (EncryptedKDM const & kdm, RSA* private_key);
+
 	static void put_uuid (uint8_t ** d, std::string id);
 	static std::string get_uuid (unsigned char ** p);
 
@@ -36,20 +36,24 @@
 #include "certificate_chain.h"
 #include "exceptions.h"
 #include "compose.hpp"
+#include "dcp_assert.h"
 #include <libcxml/cxml.h>
 #include <libxml++/document.h>
 #include <libxml++/nodes/element.h>
 #include <libxml/parser.h>
+#include <libxml/xmlreader.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/foreach.hpp>
 #include <boost/format.hpp>
+#include <set>
 
 using std::list;
 using std::vector;
 using std::string;
 using std::map;
 using std::pair;
+using std::set;
 using boost::shared_ptr;
 using boost::optional;
 using boost::starts_with;
@@ -167,7 +171,6 @@ public:
 		authenticated_private.as_xml (node->add_child ("Reference", "ds"));
 	}
 
-private:
 	Reference authenticated_public;
 	Reference authenticated_private;
 };
@@ -208,14 +211,6 @@ class AuthenticatedPrivate
 public:
 	AuthenticatedPrivate () {}
 
-	explicit AuthenticatedPrivate (shared_ptr<const cxml::Node> node)
-	{
-		list<shared_ptr<cxml::Node> > encrypted_key_nodes = node->node_children ("EncryptedKey");
-		for (list<shared_ptr<cxml::Node> >::const_iterator i = encrypted_key_nodes.begin(); i != encrypted_key_nodes.end(); ++i) {
-			encrypted_key.push_back ((*i)->node_child("CipherData")->string_child ("CipherValue"));
-		}
-	}
-
 	void as_xml (xmlpp::Element* node, map<string, xmlpp::Attribute *>& references) const
 	{
 		references["ID_AuthenticatedPrivate"] = node->set_attribute ("Id", "ID_AuthenticatedPrivate");
@@ -243,13 +238,6 @@ class TypedKeyId
 public:
 	TypedKeyId () {}
 
-	explicit TypedKeyId (shared_ptr<const cxml::Node> node)
-		: key_type (node->string_child ("KeyType"))
-		, key_id (remove_urn_uuid (node->string_child ("KeyId")))
-	{
-
-	}
-
 	TypedKeyId (string type, string id)
 		: key_type (type)
 		, key_id (id)
@@ -277,14 +265,6 @@ class KeyIdList
 public:
 	KeyIdList () {}
 
-	explicit KeyIdList (shared_ptr<const cxml::Node> node)
-	{
-		list<shared_ptr<cxml::Node> > typed_key_id_nodes = node->node_children ("TypedKeyId");
-		for (list<shared_ptr<cxml::Node> >::const_iterator i = typed_key_id_nodes.begin(); i != typed_key_id_nodes.end(); ++i) {
-			typed_key_id.push_back (TypedKeyId (*i));
-		}
-	}
-
 	void as_xml (xmlpp::Element* node) const
 	{
 		for (list<TypedKeyId>::const_iterator i = typed_key_id.begin(); i != typed_key_id.end(); ++i) {
@@ -300,15 +280,6 @@ class AuthorizedDeviceInfo
 public:
 	AuthorizedDeviceInfo () {}
 
-	explicit AuthorizedDeviceInfo (shared_ptr<const cxml::Node> node)
-		: device_list_identifier (remove_urn_uuid (node->string_child ("DeviceListIdentifier")))
-		, device_list_description (node->optional_string_child ("DeviceListDescription"))
-	{
-		BOOST_FOREACH (cxml::ConstNodePtr i, node->node_child("DeviceList")->node_children("CertificateThumbprint")) {
-			certificate_thumbprints.push_back (i->content ());
-		}
-	}
-
 	void as_xml (xmlpp::Element* node) const
 	{
 		node->add_child ("DeviceListIdentifier")->add_child_text ("urn:uuid:" + device_list_identifier);
@@ -332,13 +303,6 @@ class X509IssuerSerial
 public:
 	X509IssuerSerial () {}
 
-	explicit X509IssuerSerial (shared_ptr<const cxml::Node> node)
-		: x509_issuer_name (node->string_child ("X509IssuerName"))
-		, x509_serial_number (node->string_child ("X509SerialNumber"))
-	{
-
-	}
-
 	void as_xml (xmlpp::Element* node) const
 	{
 		node->add_child("X509IssuerName", "ds")->add_child_text (x509_issuer_name);
@@ -354,13 +318,6 @@ class Recipient
 public:
 	Recipient () {}
 
-	explicit Recipient (shared_ptr<const cxml::Node> node)
-		: x509_issuer_serial (node->node_child ("X509IssuerSerial"))
-		, x509_subject_name (node->string_child ("X509SubjectName"))
-	{
-
-	}
-
 	void as_xml (xmlpp::Element* node) const
 	{
 		x509_issuer_serial.as_xml (node->add_child ("X509IssuerSerial"));
@@ -374,37 +331,9 @@ public:
 class KDMRequiredExtensions
 {
 public:
-	KDMRequiredExtensions () {}
-
-	explicit KDMRequiredExtensions (shared_ptr<const cxml::Node> node)
-		: recipient (node->node_child ("Recipient"))
-		, composition_playlist_id (remove_urn_uuid (node->string_child ("CompositionPlaylistId")))
-		, content_title_text (node->string_child ("ContentTitleText"))
-		, not_valid_before (node->string_child ("ContentKeysNotValidBefore"))
-		, not_valid_after (node->string_child ("ContentKeysNotValidAfter"))
-		, authorized_device_info (node->node_child ("AuthorizedDeviceInfo"))
-		, key_id_list (node->node_child ("KeyIdList"))
-	{
-		disable_forensic_marking_picture = false;
-		disable_forensic_marking_audio = optional<int>();
-		if (node->optional_node_child("ForensicMarkFlagList")) {
-			BOOST_FOREACH (cxml::ConstNodePtr i, node->node_child("ForensicMarkFlagList")->node_children("ForensicMarkFlag")) {
-				if (i->content() == picture_disable) {
-					disable_forensic_marking_picture = true;
-				} else if (starts_with(i->content(), audio_disable)) {
-					disable_forensic_marking_audio = 0;
-					string const above = audio_disable + "-above-channel-";
-					if (starts_with(i->content(), above)) {
-						string above_number = i->content().substr(above.length());
-						if (above_number == "") {
-							throw KDMFormatError("Badly-formatted ForensicMarkFlag");
-						}
-						disable_forensic_marking_audio = atoi(above_number.c_str());
-					}
-				}
-			}
-		}
-	}
+	KDMRequiredExtensions ()
+		: disable_forensic_marking_picture (false)
+	{}
 
 	void as_xml (xmlpp::Element* node) const
 	{
@@ -449,7 +378,6 @@ public:
 	boost::optional<AuthorizedDeviceInfo> authorized_device_info;
 	KeyIdList key_id_list;
 
-private:
 	static const string picture_disable;
 	static const string audio_disable;
 };
@@ -462,12 +390,6 @@ class RequiredExtensions
 public:
 	RequiredExtensions () {}
 
-	explicit RequiredExtensions (shared_ptr<const cxml::Node> node)
-		: kdm_required_extensions (node->node_child ("KDMRequiredExtensions"))
-	{
-
-	}
-
 	void as_xml (xmlpp::Element* node) const
 	{
 		kdm_required_extensions.as_xml (node->add_child ("KDMRequiredExtensions"));
@@ -486,16 +408,6 @@ public:
 		, issue_date (LocalTime().as_string ())
 	{}
 
-	explicit AuthenticatedPublic (shared_ptr<const cxml::Node> node)
-		: message_id (remove_urn_uuid (node->string_child ("MessageId")))
-		, annotation_text (node->optional_string_child ("AnnotationText"))
-		, issue_date (node->string_child ("IssueDate"))
-		, signer (node->node_child ("Signer"))
-		, required_extensions (node->node_child ("RequiredExtensions"))
-	{
-
-	}
-
 	void as_xml (xmlpp::Element* node, map<string, xmlpp::Attribute *>& references) const
 	{
 		references["ID_AuthenticatedPublic"] = node->set_attribute ("Id", "ID_AuthenticatedPublic");
@@ -531,14 +443,6 @@ public:
 
 	}
 
-	explicit EncryptedKDMData (shared_ptr<const cxml::Node> node)
-		: authenticated_public (node->node_child ("AuthenticatedPublic"))
-		, authenticated_private (node->node_child ("AuthenticatedPrivate"))
-		, signature (node->node_child ("Signature"))
-	{
-
-	}
-
 	shared_ptr<xmlpp::Document> as_xml () const
 	{
 		shared_ptr<xmlpp::Document> document (new xmlpp::Document ());
@@ -561,20 +465,262 @@ public:
 	AuthenticatedPublic authenticated_public;
 	AuthenticatedPrivate authenticated_private;
 	Signature signature;
+	/** The signed XML of this KDM, which is what as_xml() gives back */
+	string xml;
+};
+
+/** @class Parser
+ *  @brief Parser which fills an EncryptedKDMData from KDM XML using libxml2's
+ *  xmlTextReader, so that the KDM is read in one pass without building a DOM.
+ */
+class Parser
+{
+public:
+	Parser (string const & xml, EncryptedKDMData* data)
+		: _data (data)
+		, _kre (data->authenticated_public.required_extensions.kdm_required_extensions)
+		, _reference (0)
+	{
+		xmlTextReaderPtr reader = xmlReaderForMemory (xml.c_str(), xml.length(), 0, 0, XML_PARSE_NONET);
+		if (!reader) {
+			throw KDMFormatError ("could not create XML reader");
+		}
+
+		try {
+			parse (reader);
+		} catch (...) {
+			xmlFreeTextReader (reader);
+			throw;
+		}
+
+		xmlFreeTextReader (reader);
+		check ();
+	}
+
+private:
+	void parse (xmlTextReaderPtr reader)
+	{
+		/* Length of _path before each open element was added to it */
+		vector<size_t> lengths;
+
+		int r;
+		while ((r = xmlTextReaderRead (reader)) == 1) {
+			switch (xmlTextReaderNodeType (reader)) {
+			case XML_READER_TYPE_ELEMENT:
+			{
+				string const name = reinterpret_cast<char const *> (xmlTextReaderConstLocalName (reader));
+				if (lengths.empty ()) {
+					if (name != "DCinemaSecurityMessage") {
+						throw KDMFormatError (String::compose ("unexpected root node %1", name));
+					}
+					lengths.push_back (0);
+				} else {
+					lengths.push_back (_path.length ());
+					if (lengths.size() > 2) {
+						_path += "/";
+					}
+					_path += name;
+				}
+				_text.clear ();
+				start (reader);
+				if (xmlTextReaderIsEmptyElement (reader)) {
+					end ();
+					_path.resize (lengths.back ());
+					lengths.pop_back ();
+				}
+				break;
+			}
+			case XML_READER_TYPE_TEXT:
+			case XML_READER_TYPE_CDATA:
+			case XML_READER_TYPE_SIGNIFICANT_WHITESPACE:
+			case XML_READER_TYPE_WHITESPACE:
+			{
+				xmlChar const * value = xmlTextReaderConstValue (reader);
+				if (value) {
+					_text += reinterpret_cast<char const *> (value);
+				}
+				break;
+			}
+			case XML_READER_TYPE_END_ELEMENT:
+				DCP_ASSERT (!lengths.empty ());
+				end ();
+				_path.resize (lengths.back ());
+				lengths.pop_back ();
+				break;
+			}
+		}
+
+		if (r != 0) {
+			xmlError const * e = xmlGetLastError ();
+			throw KDMFormatError (e && e->message ? e->message : "could not parse KDM");
+		}
+	}
+
+	/** Called at the start of each element, with _path set up */
+	void start (xmlTextReaderPtr reader)
+	{
+		if (_path == "AuthenticatedPublic/RequiredExtensions/KDMRequiredExtensions/AuthorizedDeviceInfo") {
+			_kre.authorized_device_info = AuthorizedDeviceInfo ();
+		} else if (_path == "AuthenticatedPublic/RequiredExtensions/KDMRequiredExtensions/KeyIdList") {
+			_seen.insert (_path);
+		} else if (_path == "AuthenticatedPublic/RequiredExtensions/KDMRequiredExtensions/KeyIdList/TypedKeyId") {
+			_kre.key_id_list.typed_key_id.push_back (TypedKeyId ());
+		} else if (_path == "Signature/SignedInfo/Reference") {
+			xmlChar* uri = xmlTextReaderGetAttribute (reader, reinterpret_cast<xmlChar const *> ("URI"));
+			string const u = uri ? reinterpret_cast<char const *> (uri) : "";
+			xmlFree (uri);
+			/* XXX: do something if we don't recognise the URI */
+			_reference = 0;
+			if (u == "#ID_AuthenticatedPublic") {
+				_reference = &_data->signature.signed_info.authenticated_public;
+			} else if (u == "#ID_AuthenticatedPrivate") {
+				_reference = &_data->signature.signed_info.authenticated_private;
+			}
+			if (_reference) {
+				*_reference = Reference (u);
+			}
+		} else if (_path == "Signature/KeyInfo/X509Data") {
+			_data->signature.x509_data.push_back (X509Data ());
+		}
+	}
+
+	/** Called at the end of each element, with _path and _text set up */
+	void end ()
+	{
+		string const kre_prefix = "AuthenticatedPublic/RequiredExtensions/KDMRequiredExtensions/";
+
+		AuthenticatedPublic& aup = _data->authenticated_public;
+
+		if (_path == "AuthenticatedPublic/MessageId") {
+			aup.message_id = remove_urn_uuid (_text);
+		} else if (_path == "AuthenticatedPublic/AnnotationText") {
+			aup.annotation_text = _text;
+		} else if (_path == "AuthenticatedPublic/IssueDate") {
+			aup.issue_date = _text;
+		} else if (_path == "AuthenticatedPublic/Signer/X509IssuerName") {
+			aup.signer.x509_issuer_name = _text;
+		} else if (_path == "AuthenticatedPublic/Signer/X509SerialNumber") {
+			aup.signer.x509_serial_number = _text;
+		} else if (_path == "AuthenticatedPrivate/EncryptedKey/CipherData/CipherValue") {
+			_data->authenticated_private.encrypted_key.push_back (_text);
+		} else if (_path == "Signature/SignedInfo/Reference/DigestValue") {
+			if (_reference) {
+				_reference->digest_value = _text;
+			}
+		} else if (_path == "Signature/SignatureValue") {
+			_data->signature.signature_value = _text;
+		} else if (_path == "Signature/KeyInfo/X509Data/X509IssuerSerial/X509IssuerName") {
+			_data->signature.x509_data.back().x509_issuer_serial.x509_issuer_name = _text;
+		} else if (_path == "Signature/KeyInfo/X509Data/X509IssuerSerial/X509SerialNumber") {
+			_data->signature.x509_data.back().x509_issuer_serial.x509_serial_number = _text;
+		} else if (_path == "Signature/KeyInfo/X509Data/X509Certificate") {
+			_data->signature.x509_data.back().x509_certificate = _text;
+		} else if (starts_with (_path, kre_prefix)) {
+			end_kdm_required_extensions (_path.substr (kre_prefix.length ()));
+		} else {
+			return;
+		}
+
+		_seen.insert (_path);
+	}
+
+	/** Called at the end of each element inside KDMRequiredExtensions
+	 *  @param path Path of the element relative to KDMRequiredExtensions.
+	 */
+	void end_kdm_required_extensions (string const & path)
+	{
+		if (path == "Recipient/X509IssuerSerial/X509IssuerName") {
+			_kre.recipient.x509_issuer_serial.x509_issuer_name = _text;
+		} else if (path == "Recipient/X509IssuerSerial/X509SerialNumber") {
+			_kre.recipient.x509_issuer_serial.x509_serial_number = _text;
+		} else if (path == "Recipient/X509SubjectName") {
+			_kre.recipient.x509_subject_name = _text;
+		} else if (path == "CompositionPlaylistId") {
+			_kre.composition_playlist_id = remove_urn_uuid (_text);
+		} else if (path == "ContentTitleText") {
+			_kre.content_title_text = _text;
+		} else if (path == "ContentAuthenticator") {
+			_kre.content_authenticator = _text;
+		} else if (path == "ContentKeysNotValidBefore") {
+			_kre.not_valid_before = LocalTime (_text);
+		} else if (path == "ContentKeysNotValidAfter") {
+			_kre.not_valid_after = LocalTime (_text);
+		} else if (path == "AuthorizedDeviceInfo/DeviceListIdentifier") {
+			_kre.authorized_device_info->device_list_identifier = remove_urn_uuid (_text);
+		} else if (path == "AuthorizedDeviceInfo/DeviceListDescription") {
+			_kre.authorized_device_info->device_list_description = _text;
+		} else if (path == "AuthorizedDeviceInfo/DeviceList/CertificateThumbprint") {
+			_kre.authorized_device_info->certificate_thumbprints.push_back (_text);
+		} else if (path == "KeyIdList/TypedKeyId/KeyType") {
+			_kre.key_id_list.typed_key_id.back().key_type = _text;
+		} else if (path == "KeyIdList/TypedKeyId/KeyId") {
+			_kre.key_id_list.typed_key_id.back().key_id = remove_urn_uuid (_text);
+		} else if (path == "ForensicMarkFlagList/ForensicMarkFlag") {
+			if (_text == KDMRequiredExtensions::picture_disable) {
+				_kre.disable_forensic_marking_picture = true;
+			} else if (starts_with (_text, KDMRequiredExtensions::audio_disable)) {
+				_kre.disable_forensic_marking_audio = 0;
+				string const above = KDMRequiredExtensions::audio_disable + "-above-channel-";
+				if (starts_with (_text, above)) {
+					string above_number = _text.substr (above.length());
+					if (above_number == "") {
+						throw KDMFormatError ("Badly-formatted ForensicMarkFlag");
+					}
+					_kre.disable_forensic_marking_audio = atoi (above_number.c_str());
+				}
+			}
+		}
+	}
+
+	/** Check that we saw all the nodes that must be present */
+	void check () const
+	{
+		char const * required[] = {
+			"AuthenticatedPublic/MessageId",
+			"AuthenticatedPublic/IssueDate",
+			"AuthenticatedPublic/Signer/X509IssuerName",
+			"AuthenticatedPublic/Signer/X509SerialNumber",
+			"AuthenticatedPublic/RequiredExtensions/KDMRequiredExtensions/Recipient/X509IssuerSerial/X509IssuerName",
+			"AuthenticatedPublic/RequiredExtensions/KDMRequiredExtensions/Recipient/X509IssuerSerial/X509SerialNumber",
+			"AuthenticatedPublic/RequiredExtensions/KDMRequiredExtensions/Recipient/X509SubjectName",
+			"AuthenticatedPublic/RequiredExtensions/KDMRequiredExtensions/CompositionPlaylistId",
+			"AuthenticatedPublic/RequiredExtensions/KDMRequiredExtensions/ContentTitleText",
+			"AuthenticatedPublic/RequiredExtensions/KDMRequiredExtensions/ContentKeysNotValidBefore",
+			"AuthenticatedPublic/RequiredExtensions/KDMRequiredExtensions/ContentKeysNotValidAfter",
+			"AuthenticatedPublic/RequiredExtensions/KDMRequiredExtensions/AuthorizedDeviceInfo/DeviceListIdentifier",
+			"AuthenticatedPublic/RequiredExtensions/KDMRequiredExtensions/KeyIdList",
+			"Signature/SignatureValue",
+			0
+		};
+
+		for (int i = 0; required[i]; ++i) {
+			if (_seen.find (required[i]) == _seen.end ()) {
+				throw KDMFormatError (String::compose ("missing node %1", required[i]));
+			}
+		}
+	}
+
+	EncryptedKDMData* _data;
+	KDMRequiredExtensions& _kre;
+	/** Reference that we are currently reading, or 0 */
+	Reference* _reference;
+	/** Local names of the open elements below the root, separated by / */
+	string _path;
+	/** Text content of the current element */
+	string _text;
+	/** Paths of elements that we have read something from */
+	set<string> _seen;
 };
 
 }
 }
 
 EncryptedKDM::EncryptedKDM (string s)
+	: _data (new data::EncryptedKDMData)
 {
-	try {
-		shared_ptr<cxml::Document> doc (new cxml::Document ("DCinemaSecurityMessage"));
-		doc->read_string (s);
-		_data = new data::EncryptedKDMData (doc);
-	} catch (xmlpp::parse_error& e) {
-		throw KDMFormatError (e.what ());
-	}
+	data::Parser parser (s, _data.get ());
+	/* Keep the original XML so that as_xml() gives back exactly what was signed */
+	_data->xml = s;
 }
 
 /** @param trusted_devices Trusted device thumbprints */
@@ -678,29 +824,8 @@ EncryptedKDM::EncryptedKDM (
 	/* Read the bits that add_signature_value did back into our variables */
 	shared_ptr<cxml::Node> signed_doc (new cxml::Node (doc->get_root_node ()));
 	_data->signature = data::Signature (signed_doc->node_child ("Signature"));
-}
-
-EncryptedKDM::EncryptedKDM (EncryptedKDM const & other)
-	: _data (new data::EncryptedKDMData (*other._data))
-{
-
-}
-
-EncryptedKDM &
-EncryptedKDM::operator= (EncryptedKDM const & other)
-{
-	if (this == &other) {
-		return *this;
-	}
 
-	delete _data;
-	_data = new data::EncryptedKDMData (*other._data);
-	return *this;
-}
-
-EncryptedKDM::~EncryptedKDM ()
-{
-	delete _data;
+	_data->xml = _data->as_xml()->write_to_string ("UTF-8");
 }
 
 void
@@ -715,7 +840,7 @@ EncryptedKDM::as_xml (boost::filesystem::path path) const
 string
 EncryptedKDM::as_xml () const
 {
-	return _data->as_xml()->write_to_string ("UTF-8");
+	return _data->xml;
 }
 
 list<string>
@@ -786,6 +911,5 @@ EncryptedKDM::signer_certificate_chain () const
 bool
 dcp::operator== (EncryptedKDM const & a, EncryptedKDM const & b)
 {
-	/* Not exactly efficient... */
-	return a.as_xml() == b.as_xml();
+	return a._data == b._data || a.as_xml() == b.as_xml();
 }
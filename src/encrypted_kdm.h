@@ -42,6 +42,7 @@
 #include "types.h"
 #include <boost/filesystem.hpp>
 #include <boost/optional.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/date_time/local_time/local_time.hpp>
 
 namespace cxml {
@@ -68,9 +69,6 @@ class EncryptedKDM
 {
 public:
 	explicit EncryptedKDM (std::string);
-	EncryptedKDM (EncryptedKDM const & kdm);
-	EncryptedKDM & operator= (EncryptedKDM const &);
-	~EncryptedKDM ();
 
 	/** Write this KDM as XML to a file.
 	 *  @param file File to write to.
@@ -117,7 +115,10 @@ private:
 		std::list<std::string> keys
 		);
 
-	data::EncryptedKDMData* _data;
+	friend bool operator== (EncryptedKDM const & a, EncryptedKDM const & b);
+
+	/** Our data, which is never changed after construction and so can be shared between copies */
+	boost::shared_ptr<data::EncryptedKDMData> _data;
 };
 
 extern bool operator== (EncryptedKDM const & a, EncryptedKDM const & b);
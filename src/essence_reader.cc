@@ -0,0 +1,411 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/essence_reader.cc
+ *  @brief EssenceReader class.
+ */
+
+#include "essence_reader.h"
+#include "dcp_assert.h"
+#include <algorithm>
+#include <climits>
+
+using std::min;
+using std::vector;
+using boost::shared_ptr;
+using boost::optional;
+using namespace dcp;
+
+/** Size of a KLV key */
+static int const key_size = 16;
+/** Largest KLV header (key and BER-encoded length) that we will deal with */
+static int const max_header_size = key_size + 9;
+
+EssenceReader::EssenceReader (shared_ptr<IOBackend> io)
+	: _io (io)
+	, _usable (true)
+	  /* Key and 4-byte BER length, as asdcplib writes */
+	, _header_size (key_size + 4)
+{
+	DCP_ASSERT (_io);
+}
+
+bool
+EssenceReader::read_frame (ASDCP::JP2K::MXFReader* reader, int n, ASDCP::FrameBuffer& buffer)
+{
+	return read_frames_from (reader, n, vector<ASDCP::FrameBuffer*> (1, &buffer));
+}
+
+/** Read some consecutive frames, making all the requests to our IOBackend at once where we can.
+ *  @param reader asdcplib reader, used to find the frames.
+ *  @param first Index of the first frame.
+ *  @param buffers Buffers to read into, one per frame; they are enlarged if required.
+ *  @return true if the frames were read, false if asdcplib should read them instead.
+ */
+bool
+EssenceReader::read_frames (ASDCP::JP2K::MXFReader* reader, int first, vector<ASDCP::FrameBuffer*> const & buffers)
+{
+	return read_frames_from (reader, first, buffers);
+}
+
+/** Find an unencrypted JPEG2000 frame in memory, if our IOBackend can give views of its file.
+ *  @param reader asdcplib reader, used to find the frame.
+ *  @param n Frame index.
+ *  @param data Filled in with a pointer to the frame's codestream, which stays valid for as long
+ *  as our IOBackend exists.
+ *  @param size Filled in with the size of the codestream in bytes.
+ *  @return true if data and size were filled in, false if the frame must be read some other way.
+ */
+bool
+EssenceReader::view_frame (ASDCP::JP2K::MXFReader* reader, int n, uint8_t const *& data, int& size)
+{
+	if (!_io->can_view ()) {
+		return false;
+	}
+
+	Kumu::fpos_t stream_offset;
+	i8_t temporal_offset;
+	i8_t key_frame_offset;
+	if (ASDCP_FAILURE (reader->LocateFrame (n, stream_offset, temporal_offset, key_frame_offset))) {
+		return false;
+	}
+
+	int64_t offset;
+	int64_t length;
+	if (!find_value (stream_offset, false, offset, length) || length > INT_MAX) {
+		return false;
+	}
+
+	data = _io->view (offset, length);
+	size = length;
+	return true;
+}
+
+/** Read one eye of a stereoscopic frame; the index gives the position of the left eye,
+ *  and the right eye's KLV packet follows it.
+ */
+bool
+EssenceReader::read_frame (ASDCP::JP2K::MXFSReader* reader, int n, ASDCP::JP2K::StereoscopicPhase_t phase, ASDCP::FrameBuffer& buffer)
+{
+	Kumu::fpos_t offset;
+	i8_t temporal_offset;
+	i8_t key_frame_offset;
+	if (ASDCP_FAILURE (reader->LocateFrame (n, offset, temporal_offset, key_frame_offset))) {
+		return false;
+	}
+
+	return read (offset, phase == ASDCP::JP2K::SP_RIGHT, n, buffer);
+}
+
+bool
+EssenceReader::read_frame (ASDCP::PCM::MXFReader* reader, int n, ASDCP::FrameBuffer& buffer)
+{
+	return read_frames_from (reader, n, vector<ASDCP::FrameBuffer*> (1, &buffer));
+}
+
+bool
+EssenceReader::read_frames (ASDCP::PCM::MXFReader* reader, int first, vector<ASDCP::FrameBuffer*> const & buffers)
+{
+	return read_frames_from (reader, first, buffers);
+}
+
+template <class R>
+bool
+EssenceReader::read_frames_from (R* reader, int first, vector<ASDCP::FrameBuffer*> const & buffers)
+{
+	optional<int64_t> start = essence_start ();
+	if (!start) {
+		return false;
+	}
+
+	int const count = buffers.size ();
+
+	/* Find where each frame starts, and where the one after the last starts, if there is one */
+	vector<Kumu::fpos_t> offsets;
+	for (int i = 0; i <= count; ++i) {
+		Kumu::fpos_t offset;
+		i8_t temporal_offset;
+		i8_t key_frame_offset;
+		if (ASDCP_FAILURE (reader->LocateFrame (first + i, offset, temporal_offset, key_frame_offset))) {
+			if (i < count) {
+				return false;
+			}
+			break;
+		}
+		offsets.push_back (offset);
+	}
+
+	int guess;
+	{
+		boost::mutex::scoped_lock lm (_mutex);
+		guess = _header_size;
+	}
+
+	/* Read the header of each frame whose packet size we know, and the value where we
+	   guess it will be, all at once.
+	*/
+	vector<uint8_t> headers (count * max_header_size);
+	vector<IOBackend::Request> requests;
+	/* number of frames that we are guessing about (the rest are read the slow way below) */
+	int guessed = 0;
+	for (int i = 0; i < count && i + 1 < int (offsets.size()); ++i) {
+		int64_t const offset = *start + offsets[i];
+		int64_t const packet = offsets[i + 1] - offsets[i];
+		int64_t const value = packet - guess;
+		if (value <= 0 || value > 0xffffffff || (offset + packet) > _io->size()) {
+			break;
+		}
+		if (buffers[i]->Capacity() < value && ASDCP_FAILURE (buffers[i]->Capacity (value))) {
+			return false;
+		}
+		requests.push_back (IOBackend::Request (offset, min (int64_t (max_header_size), packet), &headers[i * max_header_size]));
+		requests.push_back (IOBackend::Request (offset + guess, value, buffers[i]->Data ()));
+		++guessed;
+	}
+
+	if (!requests.empty ()) {
+		_io->read (requests);
+	}
+
+	for (int i = 0; i < count; ++i) {
+		ASDCP::FrameBuffer& buffer = *buffers[i];
+
+		if (i < guessed) {
+			int header_size;
+			int64_t length;
+			Contents contents;
+			if (!parse_header (&headers[i * max_header_size], int (requests[i * 2].size), header_size, length, contents) || contents != ESSENCE) {
+				disable ();
+				return false;
+			}
+
+			if (header_size == guess && length <= requests[i * 2 + 1].size) {
+				/* The guess was right (perhaps with some fill after the value, which we ignore) */
+				buffer.Size (length);
+				buffer.FrameNumber (first + i);
+				continue;
+			}
+
+			boost::mutex::scoped_lock lm (_mutex);
+			_header_size = header_size;
+		}
+
+		if (!read (offsets[i], false, first + i, buffer)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/** Read the value of an essence KLV packet.
+ *  @param stream_offset Offset of the packet from the start of the essence, as given by the index.
+ *  @param second true to read the packet after the one at stream_offset.
+ *  @param n Frame index.
+ *  @param buffer Buffer to read into.
+ *  @return true if the frame was read, false if asdcplib should read it instead.
+ */
+bool
+EssenceReader::read (Kumu::fpos_t stream_offset, bool second, int n, ASDCP::FrameBuffer& buffer)
+{
+	int64_t offset;
+	int64_t length;
+	if (!find_value (stream_offset, second, offset, length)) {
+		return false;
+	}
+
+	if (buffer.Capacity() < length && ASDCP_FAILURE (buffer.Capacity (length))) {
+		return false;
+	}
+
+	_io->read (offset, length, buffer.Data ());
+	buffer.Size (length);
+	buffer.FrameNumber (n);
+	return true;
+}
+
+/** Find the value of an essence KLV packet.
+ *  @param stream_offset Offset of the packet from the start of the essence, as given by the index.
+ *  @param second true to find the packet after the one at stream_offset.
+ *  @param offset Filled in with the offset of the value in the file.
+ *  @param length Filled in with the length of the value in bytes.
+ *  @return true if the value was found, false if asdcplib should read the frame instead.
+ */
+bool
+EssenceReader::find_value (Kumu::fpos_t stream_offset, bool second, int64_t& offset, int64_t& length)
+{
+	optional<int64_t> start = essence_start ();
+	if (!start) {
+		return false;
+	}
+
+	offset = *start + stream_offset;
+	int header_size;
+	Contents contents;
+	if (!read_header (offset, header_size, length, contents) || contents != ESSENCE) {
+		disable ();
+		return false;
+	}
+
+	if (!second) {
+		boost::mutex::scoped_lock lm (_mutex);
+		_header_size = header_size;
+	}
+
+	if (second) {
+		offset += header_size + length;
+		if (!read_header (offset, header_size, length, contents) || contents != ESSENCE) {
+			disable ();
+			return false;
+		}
+	}
+
+	offset += header_size;
+	if (length > 0xffffffff || (offset + length) > _io->size()) {
+		disable ();
+		return false;
+	}
+
+	return true;
+}
+
+/** Read and parse a KLV packet's key and length.
+ *  @param offset Offset of the packet in the file.
+ *  @param header_size Filled in with the size of the key and length in bytes.
+ *  @param length Filled in with the length of the packet's value.
+ *  @param contents Filled in with what the packet contains.
+ *  @return true if the header could be read and parsed.
+ */
+bool
+EssenceReader::read_header (int64_t offset, int& header_size, int64_t& length, Contents& contents) const
+{
+	int const size = min (int64_t (max_header_size), _io->size() - offset);
+	if (size <= key_size) {
+		return false;
+	}
+
+	uint8_t header[max_header_size];
+	_io->read (offset, size, header);
+	return parse_header (header, size, header_size, length, contents);
+}
+
+/** Parse a KLV packet's key and length.
+ *  @param header Start of the packet.
+ *  @param size Number of bytes at header (which may be more than the key and length).
+ *  @param header_size Filled in with the size of the key and length in bytes.
+ *  @param length Filled in with the length of the packet's value.
+ *  @param contents Filled in with what the packet contains.
+ *  @return true if the header could be parsed.
+ */
+bool
+EssenceReader::parse_header (uint8_t const * header, int size, int& header_size, int64_t& length, Contents& contents)
+{
+	if (size <= key_size) {
+		return false;
+	}
+
+	contents = OTHER;
+	if (header[0] == 0x06 && header[1] == 0x0e && header[2] == 0x2b && header[3] == 0x34) {
+		if (header[4] == 0x01 && header[5] == 0x02 && header[6] == 0x01 &&
+		    header[8] == 0x0d && header[9] == 0x01 && header[10] == 0x03 && header[11] == 0x01) {
+			/* Generic container essence element (SMPTE 379M) */
+			contents = ESSENCE;
+		} else if (header[4] == 0x02 && header[5] == 0x04 && header[6] == 0x01 &&
+			   header[8] == 0x0d && header[9] == 0x01 && header[10] == 0x03 && header[11] == 0x01 &&
+			   header[12] == 0x02 && header[13] == 0x7e) {
+			/* Encrypted triplet (SMPTE 429-6) */
+			contents = ENCRYPTED;
+		}
+	}
+
+	/* BER-encoded length */
+	uint8_t const first = header[key_size];
+	if (first < 0x80) {
+		length = first;
+		header_size = key_size + 1;
+		return true;
+	}
+
+	int const bytes = first & 0x7f;
+	if (bytes == 0 || bytes > 8 || key_size + 1 + bytes > size) {
+		return false;
+	}
+
+	length = 0;
+	for (int i = 0; i < bytes; ++i) {
+		length = (length << 8) | header[key_size + 1 + i];
+	}
+
+	header_size = key_size + 1 + bytes;
+	return length >= 0;
+}
+
+/** @return Offset of the first essence KLV packet in the file, or none if we cannot read the essence.
+ *  The index's offsets are relative to this.
+ */
+optional<int64_t>
+EssenceReader::essence_start ()
+{
+	boost::mutex::scoped_lock lm (_mutex);
+
+	if (_essence_start || !_usable) {
+		return _essence_start;
+	}
+
+	/* Step over the partition pack and header metadata */
+	int64_t offset = 0;
+	while (offset < _io->size()) {
+		int header_size;
+		int64_t length;
+		Contents contents;
+		if (!read_header (offset, header_size, length, contents) || contents == ENCRYPTED) {
+			break;
+		} else if (contents == ESSENCE) {
+			_essence_start = offset;
+			return _essence_start;
+		}
+
+		offset += header_size + length;
+	}
+
+	_usable = false;
+	return optional<int64_t> ();
+}
+
+void
+EssenceReader::disable ()
+{
+	boost::mutex::scoped_lock lm (_mutex);
+	_usable = false;
+	_essence_start = optional<int64_t> ();
+}
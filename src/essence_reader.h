@@ -0,0 +1,132 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/essence_reader.h
+ *  @brief EssenceReader class.
+ */
+
+#ifndef LIBDCP_ESSENCE_READER_H
+#define LIBDCP_ESSENCE_READER_H
+
+#include "io_backend.h"
+#include <asdcp/AS_DCP.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/optional.hpp>
+#include <boost/thread/mutex.hpp>
+#include <vector>
+
+namespace dcp {
+
+/** @class EssenceReader
+ *  @brief Reader for unencrypted frames of MXF essence using an IOBackend.
+ *
+ *  asdcplib is asked where each frame is (using the MXF's index) and then the frame's KLV
+ *  packet is read using the IOBackend.  If the essence turns out not to be something that
+ *  we can read (for example because it is encrypted) the read_frame methods return false,
+ *  and keep doing so, so that the caller can use asdcplib instead.
+ *
+ *  Where the index says how big a frame's KLV packet is (from where the next frame starts)
+ *  the packet's header and value are read with one batch of requests to the IOBackend,
+ *  guessing the size of the header from the last one that was read; read_frames() puts
+ *  the requests for several frames into one batch.
+ *
+ *  If the IOBackend can give views of the file (see IOBackend::view()), view_frame() gives
+ *  a JPEG2000 frame's position in memory without copying it.
+ */
+class EssenceReader : public boost::noncopyable
+{
+public:
+	explicit EssenceReader (boost::shared_ptr<IOBackend> io);
+
+	bool read_frame (ASDCP::JP2K::MXFReader* reader, int n, ASDCP::FrameBuffer& buffer);
+	bool read_frame (ASDCP::JP2K::MXFSReader* reader, int n, ASDCP::JP2K::StereoscopicPhase_t phase, ASDCP::FrameBuffer& buffer);
+	bool read_frame (ASDCP::PCM::MXFReader* reader, int n, ASDCP::FrameBuffer& buffer);
+
+	bool read_frames (ASDCP::JP2K::MXFReader* reader, int first, std::vector<ASDCP::FrameBuffer*> const & buffers);
+	bool read_frames (ASDCP::PCM::MXFReader* reader, int first, std::vector<ASDCP::FrameBuffer*> const & buffers);
+
+	/** Stereoscopic frames are read one eye at a time */
+	bool read_frames (ASDCP::JP2K::MXFSReader *, int, std::vector<ASDCP::FrameBuffer*> const &) {
+		return false;
+	}
+
+	bool view_frame (ASDCP::JP2K::MXFReader* reader, int n, uint8_t const *& data, int& size);
+
+	/** Atmos frames are always read by asdcplib */
+	bool read_frame (ASDCP::ATMOS::MXFReader *, int, ASDCP::FrameBuffer &) {
+		return false;
+	}
+
+	bool read_frames (ASDCP::ATMOS::MXFReader *, int, std::vector<ASDCP::FrameBuffer*> const &) {
+		return false;
+	}
+
+	boost::shared_ptr<IOBackend> io () const {
+		return _io;
+	}
+
+private:
+	template <class R>
+	bool read_frames_from (R* reader, int first, std::vector<ASDCP::FrameBuffer*> const & buffers);
+	bool read (Kumu::fpos_t stream_offset, bool second, int n, ASDCP::FrameBuffer& buffer);
+	bool find_value (Kumu::fpos_t stream_offset, bool second, int64_t& offset, int64_t& length);
+	enum Contents {
+		/** unencrypted essence */
+		ESSENCE,
+		/** an encrypted triplet */
+		ENCRYPTED,
+		/** anything else */
+		OTHER
+	};
+
+	bool read_header (int64_t offset, int& header_size, int64_t& length, Contents& contents) const;
+	static bool parse_header (uint8_t const * header, int size, int& header_size, int64_t& length, Contents& contents);
+	boost::optional<int64_t> essence_start ();
+	void disable ();
+
+	boost::shared_ptr<IOBackend> _io;
+
+	/** mutex for _essence_start, _usable and _header_size */
+	boost::mutex _mutex;
+	/** offset in the file of the first essence KLV packet, if we have found it */
+	boost::optional<int64_t> _essence_start;
+	/** false if we have found that we cannot read this essence */
+	bool _usable;
+	/** size of the last essence KLV header that we read, used to guess where the next frame's value starts */
+	int _header_size;
+};
+
+}
+
+#endif
@@ -35,7 +35,9 @@
 #define LIBDCP_FRAME_H
 
 #include "crypto_context.h"
+#include "essence_reader.h"
 #include "exceptions.h"
+#include "instrumentation.h"
 #include <asdcp/KM_fileio.h>
 #include <asdcp/AS_DCP.h>
 #include <boost/noncopyable.hpp>
@@ -46,14 +48,28 @@ template <class R, class B>
 class Frame : public boost::noncopyable
 {
 public:
-	Frame (R* reader, int n, boost::shared_ptr<const DecryptionContext> c)
+	Frame (
+		R* reader,
+		int n,
+		boost::shared_ptr<const DecryptionContext> c,
+		boost::shared_ptr<EssenceReader> essence = boost::shared_ptr<EssenceReader> ()
+		)
 	{
+		Instrumentation::Span span (Instrumentation::MXF_READ);
+
 		/* XXX: unfortunate guesswork on this buffer size */
 		_buffer = new B (Kumu::Megabyte);
 
-		if (ASDCP_FAILURE (reader->ReadFrame (n, *_buffer, c->context(), c->hmac()))) {
+		if (essence && essence->read_frame (reader, n, *_buffer)) {
+			span.set_bytes (_buffer->Size ());
+			return;
+		}
+
+		if (ASDCP_FAILURE (c->read_frame (reader, n, *_buffer))) {
 			boost::throw_exception (DCPReadError ("could not read frame"));
 		}
+
+		span.set_bytes (_buffer->Size ());
 	}
 
 	~Frame ()
@@ -0,0 +1,521 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/frame_cache.cc
+ *  @brief FrameCache and CachedFrame classes.
+ */
+
+#include "frame_cache.h"
+#include "mono_picture_asset.h"
+#include "mono_picture_asset_reader.h"
+#include "mono_picture_frame.h"
+#include "stereo_picture_asset.h"
+#include "stereo_picture_asset_reader.h"
+#include "stereo_picture_frame.h"
+#include "openjpeg_image.h"
+#include "rgb_xyz.h"
+#include "exceptions.h"
+#include "dcp_assert.h"
+#include <boost/bind.hpp>
+
+using std::max;
+using std::map;
+using std::list;
+using std::string;
+using std::make_pair;
+using boost::shared_ptr;
+using boost::optional;
+using boost::dynamic_pointer_cast;
+using namespace dcp;
+
+CachedFrame::CachedFrame (shared_ptr<const OpenJPEGImage> xyz)
+	: _size (xyz->size ())
+	, _xyz (xyz)
+{
+
+}
+
+/** Make an RGBA frame by converting an XYZ image */
+CachedFrame::CachedFrame (shared_ptr<const OpenJPEGImage> xyz, ColourConversion const & conversion)
+	: _size (xyz->size ())
+	, _rgba (new uint8_t[_size.width * _size.height * 4])
+{
+	xyz_to_rgba (xyz, conversion, _rgba.get(), _size.width * 4);
+}
+
+/** @return Approximate number of bytes used by this frame's image */
+int64_t
+CachedFrame::memory () const
+{
+	int64_t const pixels = static_cast<int64_t> (_size.width) * _size.height;
+	if (_xyz) {
+		return pixels * 3 * sizeof (int);
+	}
+	return pixels * 4;
+}
+
+/** @class FrameCache::Source
+ *  @brief A reader for one asset.
+ */
+class FrameCache::Source : public boost::noncopyable
+{
+public:
+	explicit Source (shared_ptr<const PictureAsset> asset)
+		: _asset (asset)
+		, _key (asset->key ())
+	{
+		shared_ptr<const MonoPictureAsset> mono = dynamic_pointer_cast<const MonoPictureAsset> (asset);
+		shared_ptr<const StereoPictureAsset> stereo = dynamic_pointer_cast<const StereoPictureAsset> (asset);
+		if (mono) {
+			_mono = mono->start_read ();
+		} else if (stereo) {
+			_stereo = stereo->start_read ();
+		} else {
+			throw MiscError ("unknown type of picture asset");
+		}
+	}
+
+	shared_ptr<OpenJPEGImage> xyz (int64_t frame, Eye eye, int reduce)
+	{
+		/* A reader can only be used by one thread at a time, but the frames that
+		   it gives us can be decoded by several at once.
+		*/
+		if (_mono) {
+			shared_ptr<const MonoPictureFrame> f;
+			{
+				boost::mutex::scoped_lock lm (_mutex);
+				f = _mono->get_frame (frame);
+			}
+			return f->xyz_image (reduce);
+		}
+
+		shared_ptr<const StereoPictureFrame> f;
+		{
+			boost::mutex::scoped_lock lm (_mutex);
+			f = _stereo->get_frame (frame);
+		}
+		return f->xyz_image (eye, reduce);
+	}
+
+	/** @return true if this source's reader was made from this asset object with its current key,
+	 *  so that it can still be used to read the asset.
+	 */
+	bool matches (shared_ptr<const PictureAsset> asset) const
+	{
+		return asset == _asset && asset->key() == _key;
+	}
+
+private:
+	shared_ptr<const PictureAsset> _asset;
+	/** key that _asset had when the reader was made */
+	optional<dcp::Key> _key;
+	boost::mutex _mutex;
+	shared_ptr<MonoPictureAssetReader> _mono;
+	shared_ptr<StereoPictureAssetReader> _stereo;
+};
+
+bool
+FrameCache::Key::operator< (Key const & other) const
+{
+	if (asset != other.asset) {
+		return asset < other.asset;
+	}
+	if (frame != other.frame) {
+		return frame < other.frame;
+	}
+	if (eye != other.eye) {
+		return eye < other.eye;
+	}
+	if (reduce != other.reduce) {
+		return reduce < other.reduce;
+	}
+	return format < other.format;
+}
+
+/** @param memory_budget Number of bytes of decoded images to keep.
+ *  @param threads Number of threads to prefetch with.
+ *  @param conversion Colour conversion to use when making RGBA frames.
+ */
+FrameCache::FrameCache (int64_t memory_budget, int threads, ColourConversion conversion)
+	: _memory_budget (memory_budget)
+	, _memory_used (0)
+	, _prefetch (0)
+	, _hits (0)
+	, _misses (0)
+	, _conversion (conversion)
+	, _stop (false)
+{
+	for (int i = 0; i < threads; ++i) {
+		_threads.create_thread (boost::bind (&FrameCache::thread, this));
+	}
+}
+
+/** Stop our threads once they have finished the frames they are decoding */
+FrameCache::~FrameCache ()
+{
+	{
+		boost::mutex::scoped_lock lm (_mutex);
+		_stop = true;
+		_prefetch_queue.clear ();
+		_condition.notify_all ();
+	}
+
+	_threads.join_all ();
+}
+
+/** Get a decoded frame, from the cache if it is there or by decoding it if not.
+ *  @param asset Mono or stereo picture asset.
+ *  @param frame Frame index within the asset, not taking its entry point into account.
+ *  @param eye Eye to get; ignored for mono assets.
+ *  @param reduce Power of two by which to reduce the image, as for decompress_j2k().
+ *  @param format Format of image to return.
+ */
+shared_ptr<const CachedFrame>
+FrameCache::get (shared_ptr<const PictureAsset> asset, int64_t frame, Eye eye, int reduce, Format format)
+{
+	DCP_ASSERT (asset);
+
+	if (!dynamic_pointer_cast<const StereoPictureAsset> (asset)) {
+		eye = EYE_LEFT;
+	}
+
+	Key const key (asset->id(), frame, eye, reduce, format);
+
+	boost::mutex::scoped_lock lm (_mutex);
+
+	shared_ptr<Source> source = find_source (asset);
+	schedule_prefetch (asset, key);
+
+	while (true) {
+		shared_ptr<const CachedFrame> f = find (key);
+		if (f) {
+			++_hits;
+			return f;
+		}
+
+		if (_decoding.find (key) == _decoding.end ()) {
+			break;
+		}
+
+		/* One of our threads is prefetching this frame, so wait for it rather than decoding it again */
+		_condition.wait (lm);
+		source = find_source (asset);
+	}
+
+	++_misses;
+	_decoding.insert (key);
+	lm.unlock ();
+
+	shared_ptr<const CachedFrame> f;
+	try {
+		f = decode (source, key);
+	} catch (...) {
+		lm.lock ();
+		_decoding.erase (key);
+		_condition.notify_all ();
+		throw;
+	}
+
+	lm.lock ();
+	_decoding.erase (key);
+	if (current (key, source)) {
+		add (key, f);
+	}
+	_condition.notify_all ();
+	return f;
+}
+
+/** @param frames Number of frames to decode ahead of each frame that is asked for, or 0 for none */
+void
+FrameCache::set_prefetch (int frames)
+{
+	boost::mutex::scoped_lock lm (_mutex);
+	_prefetch = max (0, frames);
+	if (_prefetch == 0) {
+		_prefetch_queue.clear ();
+	}
+}
+
+void
+FrameCache::set_memory_budget (int64_t bytes)
+{
+	boost::mutex::scoped_lock lm (_mutex);
+	_memory_budget = bytes;
+	evict ();
+}
+
+/** Drop all cached frames and readers, and any prefetches which have not started */
+void
+FrameCache::clear ()
+{
+	boost::mutex::scoped_lock lm (_mutex);
+	_frames.clear ();
+	_lru.clear ();
+	_memory_used = 0;
+	_prefetch_queue.clear ();
+	_sources.clear ();
+	_positions.clear ();
+}
+
+int64_t
+FrameCache::memory_used () const
+{
+	boost::mutex::scoped_lock lm (_mutex);
+	return _memory_used;
+}
+
+/** @return Number of calls to get() which did not have to decode their frame */
+int64_t
+FrameCache::hits () const
+{
+	boost::mutex::scoped_lock lm (_mutex);
+	return _hits;
+}
+
+/** @return Number of calls to get() which decoded their frame */
+int64_t
+FrameCache::misses () const
+{
+	boost::mutex::scoped_lock lm (_mutex);
+	return _misses;
+}
+
+/** Find a frame in the cache, marking it as recently used.  _mutex must be held */
+shared_ptr<const CachedFrame>
+FrameCache::find (Key const & key)
+{
+	map<Key, Entry>::iterator i = _frames.find (key);
+	if (i == _frames.end ()) {
+		return shared_ptr<const CachedFrame> ();
+	}
+
+	_lru.splice (_lru.begin(), _lru, i->second.lru);
+	return i->second.frame;
+}
+
+/** @return Our reader for an asset, making a new one if we have none or if the one we have
+ *  was made from another asset object with the same ID, or before the asset's key was
+ *  changed.  When a reader is replaced, the frames that it decoded and any prefetches
+ *  of the asset which have not started are dropped.  _mutex must be held.
+ */
+shared_ptr<FrameCache::Source>
+FrameCache::find_source (shared_ptr<const PictureAsset> asset)
+{
+	map<string, shared_ptr<Source> >::const_iterator i = _sources.find (asset->id ());
+	if (i != _sources.end ()) {
+		if (i->second->matches (asset)) {
+			return i->second;
+		}
+		drop (asset->id ());
+	}
+
+	shared_ptr<Source> source (new Source (asset));
+	_sources[asset->id()] = source;
+	return source;
+}
+
+/** @return true if source is still our reader for the asset of key, so that frames it
+ *  decoded may be cached.  _mutex must be held.
+ */
+bool
+FrameCache::current (Key const & key, shared_ptr<Source> source) const
+{
+	map<string, shared_ptr<Source> >::const_iterator i = _sources.find (key.asset);
+	return i != _sources.end () && i->second == source;
+}
+
+/** Drop all cached frames and queued prefetches of an asset.  _mutex must be held */
+void
+FrameCache::drop (string asset)
+{
+	list<Key>::iterator i = _lru.begin ();
+	while (i != _lru.end ()) {
+		list<Key>::iterator j = i;
+		++j;
+		if (i->asset == asset) {
+			map<Key, Entry>::iterator k = _frames.find (*i);
+			DCP_ASSERT (k != _frames.end ());
+			_memory_used -= k->second.frame->memory ();
+			_frames.erase (k);
+			_lru.erase (i);
+		}
+		i = j;
+	}
+
+	list<Prefetch>::iterator k = _prefetch_queue.begin ();
+	while (k != _prefetch_queue.end ()) {
+		list<Prefetch>::iterator l = k;
+		++l;
+		if (k->key.asset == asset) {
+			_prefetch_queue.erase (k);
+		}
+		k = l;
+	}
+}
+
+/** Read and decode a frame.  This is called without _mutex held */
+shared_ptr<const CachedFrame>
+FrameCache::decode (shared_ptr<Source> source, Key const & key)
+{
+	shared_ptr<const OpenJPEGImage> xyz = source->xyz (key.frame, key.eye, key.reduce);
+	if (key.format == RGBA) {
+		return shared_ptr<const CachedFrame> (new CachedFrame (xyz, _conversion));
+	}
+
+	return shared_ptr<const CachedFrame> (new CachedFrame (xyz));
+}
+
+/** Add a frame to the cache and drop old frames if we are over budget.  _mutex must be held */
+void
+FrameCache::add (Key const & key, shared_ptr<const CachedFrame> frame)
+{
+	if (_frames.find (key) != _frames.end ()) {
+		return;
+	}
+
+	_lru.push_front (key);
+	Entry e;
+	e.frame = frame;
+	e.lru = _lru.begin ();
+	_frames[key] = e;
+	_memory_used += frame->memory ();
+
+	evict ();
+}
+
+/** Drop least-recently-used frames until we are within budget.  _mutex must be held */
+void
+FrameCache::evict ()
+{
+	while (_memory_used > _memory_budget && !_lru.empty ()) {
+		map<Key, Entry>::iterator i = _frames.find (_lru.back ());
+		DCP_ASSERT (i != _frames.end ());
+		_memory_used -= i->second.frame->memory ();
+		_frames.erase (i);
+		_lru.pop_back ();
+	}
+}
+
+/** Note a request for a frame and queue prefetches of the frames after it, in the
+ *  direction that the caller is moving through the asset.  _mutex must be held.
+ */
+void
+FrameCache::schedule_prefetch (shared_ptr<const PictureAsset> asset, Key const & key)
+{
+	int direction = 1;
+	map<string, std::pair<int64_t, int> >::const_iterator i = _positions.find (key.asset);
+	if (i != _positions.end ()) {
+		if (key.frame > i->second.first) {
+			direction = 1;
+		} else if (key.frame < i->second.first) {
+			direction = -1;
+		} else {
+			direction = i->second.second;
+		}
+	}
+	_positions[key.asset] = make_pair (key.frame, direction);
+
+	if (_prefetch == 0) {
+		return;
+	}
+
+	/* Prefetches of this asset which have not started are for an old position */
+	list<Prefetch>::iterator j = _prefetch_queue.begin ();
+	while (j != _prefetch_queue.end ()) {
+		list<Prefetch>::iterator k = j;
+		++k;
+		if (j->key.asset == key.asset) {
+			_prefetch_queue.erase (j);
+		}
+		j = k;
+	}
+
+	for (int n = 1; n <= _prefetch; ++n) {
+		Key k = key;
+		k.frame = key.frame + n * direction;
+		if (k.frame < 0 || k.frame >= asset->intrinsic_duration ()) {
+			break;
+		}
+		if (_frames.find (k) == _frames.end () && _decoding.find (k) == _decoding.end ()) {
+			_prefetch_queue.push_back (Prefetch (asset, k));
+		}
+	}
+
+	_condition.notify_all ();
+}
+
+void
+FrameCache::thread ()
+{
+	while (true) {
+		boost::mutex::scoped_lock lm (_mutex);
+		while (_prefetch_queue.empty () && !_stop) {
+			_condition.wait (lm);
+		}
+
+		if (_stop) {
+			return;
+		}
+
+		Prefetch const p = _prefetch_queue.front ();
+		_prefetch_queue.pop_front ();
+		if (_frames.find (p.key) != _frames.end () || _decoding.find (p.key) != _decoding.end ()) {
+			continue;
+		}
+
+		shared_ptr<Source> source;
+		try {
+			source = find_source (p.asset);
+		} catch (std::exception& e) {
+			/* The asset can't be opened; if the frame is asked for get() will report the error */
+			continue;
+		}
+
+		_decoding.insert (p.key);
+		lm.unlock ();
+
+		shared_ptr<const CachedFrame> f;
+		try {
+			f = decode (source, p.key);
+		} catch (std::exception& e) {
+			/* Leave it; if the frame is asked for get() will try again and report the error */
+		}
+
+		lm.lock ();
+		_decoding.erase (p.key);
+		if (f && current (p.key, source)) {
+			add (p.key, f);
+		}
+		_condition.notify_all ();
+	}
+}
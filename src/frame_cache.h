@@ -0,0 +1,209 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/frame_cache.h
+ *  @brief FrameCache and CachedFrame classes.
+ */
+
+#ifndef LIBDCP_FRAME_CACHE_H
+#define LIBDCP_FRAME_CACHE_H
+
+#include "colour_conversion.h"
+#include "types.h"
+#include <boost/shared_ptr.hpp>
+#include <boost/shared_array.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <stdint.h>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+
+namespace dcp {
+
+class OpenJPEGImage;
+class PictureAsset;
+
+/** @class CachedFrame
+ *  @brief A decoded picture frame, as held by a FrameCache.
+ */
+class CachedFrame : public boost::noncopyable
+{
+public:
+	explicit CachedFrame (boost::shared_ptr<const OpenJPEGImage> xyz);
+	CachedFrame (boost::shared_ptr<const OpenJPEGImage> xyz, ColourConversion const & conversion);
+
+	Size size () const {
+		return _size;
+	}
+
+	/** @return XYZ image, or 0 if this frame was converted to RGBA */
+	boost::shared_ptr<const OpenJPEGImage> xyz () const {
+		return _xyz;
+	}
+
+	/** @return Image as written by xyz_to_rgba(), with a stride of size().width * 4,
+	 *  or 0 if this frame is XYZ.
+	 */
+	uint8_t const * rgba () const {
+		return _rgba.get ();
+	}
+
+	int64_t memory () const;
+
+private:
+	Size _size;
+	boost::shared_ptr<const OpenJPEGImage> _xyz;
+	boost::shared_array<uint8_t> _rgba;
+};
+
+/** @class FrameCache
+ *  @brief A cache of decoded picture frames, for players and review tools which
+ *  go back and forth over the same frames.
+ *
+ *  Frames are kept, up to a memory budget, keyed on their asset ID, index, eye,
+ *  reduction and format; when the budget is used up the least recently used frames are
+ *  dropped.  The cache keeps its own reader for each asset that it is asked about; if it
+ *  is then given another asset object with the same ID, or the asset's key changes, the
+ *  reader is re-opened and the frames that it decoded are dropped.
+ *
+ *  If prefetch is set with set_prefetch() the cache's threads decode some frames
+ *  ahead of each frame that is asked for, in the direction that the caller is moving
+ *  through the asset (so backwards for reverse playback).  Prefetches which have not
+ *  started are abandoned when the position or direction changes.
+ *
+ *  All methods may be called from any thread.
+ */
+class FrameCache : public boost::noncopyable
+{
+public:
+	enum Format {
+		/** OpenJPEGImage of XYZ, as from decompress_j2k() */
+		XYZ,
+		/** 8 bits per component RGBA, as from xyz_to_rgba() */
+		RGBA
+	};
+
+	FrameCache (int64_t memory_budget, int threads = 2, ColourConversion conversion = ColourConversion::srgb_to_xyz ());
+	~FrameCache ();
+
+	boost::shared_ptr<const CachedFrame> get (
+		boost::shared_ptr<const PictureAsset> asset, int64_t frame, Eye eye = EYE_LEFT, int reduce = 0, Format format = XYZ
+		);
+
+	void set_prefetch (int frames);
+	void set_memory_budget (int64_t bytes);
+	void clear ();
+
+	int64_t memory_used () const;
+	int64_t hits () const;
+	int64_t misses () const;
+
+private:
+	struct Key
+	{
+		Key (std::string asset_, int64_t frame_, Eye eye_, int reduce_, Format format_)
+			: asset (asset_)
+			, frame (frame_)
+			, eye (eye_)
+			, reduce (reduce_)
+			, format (format_)
+		{}
+
+		bool operator< (Key const & other) const;
+
+		std::string asset;
+		int64_t frame;
+		Eye eye;
+		int reduce;
+		Format format;
+	};
+
+	struct Entry
+	{
+		boost::shared_ptr<const CachedFrame> frame;
+		/** our position in _lru */
+		std::list<Key>::iterator lru;
+	};
+
+	struct Prefetch
+	{
+		Prefetch (boost::shared_ptr<const PictureAsset> asset_, Key key_)
+			: asset (asset_)
+			, key (key_)
+		{}
+
+		boost::shared_ptr<const PictureAsset> asset;
+		Key key;
+	};
+
+	class Source;
+
+	boost::shared_ptr<const CachedFrame> find (Key const & key);
+	boost::shared_ptr<Source> find_source (boost::shared_ptr<const PictureAsset> asset);
+	bool current (Key const & key, boost::shared_ptr<Source> source) const;
+	void drop (std::string asset);
+	boost::shared_ptr<const CachedFrame> decode (boost::shared_ptr<Source> source, Key const & key);
+	void add (Key const & key, boost::shared_ptr<const CachedFrame> frame);
+	void evict ();
+	void schedule_prefetch (boost::shared_ptr<const PictureAsset> asset, Key const & key);
+	void thread ();
+
+	mutable boost::mutex _mutex;
+	boost::condition_variable _condition;
+	std::map<Key, Entry> _frames;
+	/** keys of frames in _frames, most recently used first */
+	std::list<Key> _lru;
+	/** keys of frames which are being decoded */
+	std::set<Key> _decoding;
+	/** readers for the assets that we have been asked about, keyed on asset ID */
+	std::map<std::string, boost::shared_ptr<Source> > _sources;
+	/** last frame asked for from each asset, and the direction of the last move (1 or -1) */
+	std::map<std::string, std::pair<int64_t, int> > _positions;
+	std::list<Prefetch> _prefetch_queue;
+	int64_t _memory_budget;
+	int64_t _memory_used;
+	int _prefetch;
+	int64_t _hits;
+	int64_t _misses;
+	ColourConversion _conversion;
+	bool _stop;
+	boost::thread_group _threads;
+};
+
+}
+
+#endif
@@ -0,0 +1,282 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/instrumentation.cc
+ *  @brief Instrumentation class.
+ */
+
+#include "instrumentation.h"
+#include "exceptions.h"
+#include "dcp_assert.h"
+#include "util.h"
+#include <boost/thread.hpp>
+#ifdef LIBDCP_WINDOWS
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include <cerrno>
+#include <cstdio>
+#include <map>
+
+using std::min;
+using std::max;
+using std::map;
+using std::string;
+using std::vector;
+using namespace dcp;
+
+boost::atomic<bool> Instrumentation::_enabled (false);
+boost::atomic<bool> Instrumentation::_tracing (false);
+
+/** One run of a stage, kept for write_trace() */
+struct TraceSpan
+{
+	TraceSpan (Instrumentation::Stage stage_, int64_t start_, int64_t end_, int64_t bytes_, int thread_)
+		: stage (stage_)
+		, start (start_)
+		, end (end_)
+		, bytes (bytes_)
+		, thread (thread_)
+	{}
+
+	Instrumentation::Stage stage;
+	int64_t start;
+	int64_t end;
+	int64_t bytes;
+	int thread;
+};
+
+static boost::mutex stats_mutex[Instrumentation::STAGES];
+static StageStats stage_stats[Instrumentation::STAGES];
+
+static boost::mutex trace_mutex;
+static vector<TraceSpan> trace_spans;
+static size_t max_trace_spans = 0;
+/** Small numbers for the threads that have recorded spans, to use as trace thread IDs */
+static map<boost::thread::id, int> trace_threads;
+
+double
+StageStats::mean () const
+{
+	if (count == 0) {
+		return 0;
+	}
+
+	return static_cast<double> (total) / count;
+}
+
+/** @param p Percentile from 0 to 100.
+ *  @return Approximate time in nanoseconds within which p% of runs finished; this
+ *  is the top of the histogram bucket that the percentile falls in, so it may be up
+ *  to twice the true value.
+ */
+int64_t
+StageStats::percentile (double p) const
+{
+	if (count == 0) {
+		return 0;
+	}
+
+	double const target = p * count / 100;
+	int64_t seen = 0;
+	for (size_t i = 0; i < histogram.size(); ++i) {
+		seen += histogram[i];
+		if (seen >= target && seen > 0) {
+			int64_t const top = i < 62 ? ((int64_t (1) << (i + 1)) - 1) : max;
+			return std::max (min, std::min (top, max));
+		}
+	}
+
+	return max;
+}
+
+void
+Instrumentation::set_enabled (bool e)
+{
+	_enabled.store (e, boost::memory_order_relaxed);
+}
+
+/** @param t true to record each run of each stage as well as counting them.
+ *  @param max_spans Number of runs to keep; any after that are not recorded, so that
+ *  leaving tracing on by mistake cannot use up all the memory.
+ */
+void
+Instrumentation::set_tracing (bool t, int max_spans)
+{
+	boost::mutex::scoped_lock lm (trace_mutex);
+	max_trace_spans = max_spans;
+	_tracing.store (t, boost::memory_order_relaxed);
+}
+
+StageStats
+Instrumentation::stats (Stage stage)
+{
+	DCP_ASSERT (stage >= 0 && stage < STAGES);
+	boost::mutex::scoped_lock lm (stats_mutex[stage]);
+	return stage_stats[stage];
+}
+
+string
+Instrumentation::name (Stage stage)
+{
+	switch (stage) {
+	case MXF_READ:
+		return "mxf_read";
+	case DECRYPT:
+		return "decrypt";
+	case J2K_DECOMPRESS:
+		return "j2k_decompress";
+	case J2K_COMPRESS:
+		return "j2k_compress";
+	case XYZ_TO_RGBA:
+		return "xyz_to_rgba";
+	case XYZ_TO_RGB:
+		return "xyz_to_rgb";
+	case RGB_TO_XYZ:
+		return "rgb_to_xyz";
+	case MXF_WRITE:
+		return "mxf_write";
+	case STAGES:
+		break;
+	}
+
+	DCP_ASSERT (false);
+	return "";
+}
+
+/** Clear all counters and any recorded trace */
+void
+Instrumentation::reset ()
+{
+	for (int i = 0; i < STAGES; ++i) {
+		boost::mutex::scoped_lock lm (stats_mutex[i]);
+		stage_stats[i] = StageStats ();
+	}
+
+	boost::mutex::scoped_lock lm (trace_mutex);
+	trace_spans.clear ();
+	trace_threads.clear ();
+}
+
+/** @return Time from a monotonic clock, in nanoseconds */
+int64_t
+Instrumentation::now ()
+{
+#ifdef LIBDCP_WINDOWS
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER count;
+	QueryPerformanceFrequency (&frequency);
+	QueryPerformanceCounter (&count);
+	return static_cast<int64_t> (count.QuadPart / double (frequency.QuadPart) * 1e9);
+#else
+	struct timespec t;
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return static_cast<int64_t> (t.tv_sec) * 1000000000 + t.tv_nsec;
+#endif
+}
+
+/** Record a run of a stage.  This is called by Span, and need not normally be called directly.
+ *  @param start Start time from now().
+ *  @param end End time from now().
+ *  @param bytes Number of bytes handled.
+ */
+void
+Instrumentation::record (Stage stage, int64_t start, int64_t end, int64_t bytes)
+{
+	int64_t const time = max (int64_t (0), end - start);
+
+	int bucket = 0;
+	while (bucket < 63 && (time >> (bucket + 1)) > 0) {
+		++bucket;
+	}
+
+	{
+		boost::mutex::scoped_lock lm (stats_mutex[stage]);
+		StageStats& s = stage_stats[stage];
+		if (s.count == 0 || time < s.min) {
+			s.min = time;
+		}
+		s.max = max (s.max, time);
+		++s.count;
+		s.bytes += bytes;
+		s.total += time;
+		++s.histogram[bucket];
+	}
+
+	if (!tracing ()) {
+		return;
+	}
+
+	boost::mutex::scoped_lock lm (trace_mutex);
+	if (trace_spans.size() >= max_trace_spans) {
+		return;
+	}
+
+	boost::thread::id const id = boost::this_thread::get_id ();
+	map<boost::thread::id, int>::const_iterator i = trace_threads.find (id);
+	int thread;
+	if (i == trace_threads.end ()) {
+		thread = trace_threads.size() + 1;
+		trace_threads[id] = thread;
+	} else {
+		thread = i->second;
+	}
+
+	trace_spans.push_back (TraceSpan (stage, start, end, bytes, thread));
+}
+
+/** Write the spans recorded so far as a JSON file in Chrome's trace event format */
+void
+Instrumentation::write_trace (boost::filesystem::path file)
+{
+	boost::mutex::scoped_lock lm (trace_mutex);
+
+	FILE* f = fopen_boost (file, "w");
+	if (!f) {
+		throw FileError ("could not open trace file for writing", file, errno);
+	}
+
+	fprintf (f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	for (vector<TraceSpan>::const_iterator i = trace_spans.begin(); i != trace_spans.end(); ++i) {
+		/* Times in the trace are in microseconds */
+		fprintf (
+			f, "{\"name\":\"%s\",\"cat\":\"libdcp\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"bytes\":%lld}}%s\n",
+			name(i->stage).c_str(), i->thread, i->start / 1e3, (i->end - i->start) / 1e3, static_cast<long long> (i->bytes),
+			(i + 1) == trace_spans.end() ? "" : ","
+			);
+	}
+	fprintf (f, "]}\n");
+
+	fclose (f);
+}
@@ -0,0 +1,177 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/instrumentation.h
+ *  @brief Instrumentation class.
+ */
+
+#ifndef LIBDCP_INSTRUMENTATION_H
+#define LIBDCP_INSTRUMENTATION_H
+
+#include <boost/atomic.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace dcp {
+
+/** @class StageStats
+ *  @brief Counters and a latency histogram for one Instrumentation::Stage.
+ */
+class StageStats
+{
+public:
+	StageStats ()
+		: count (0)
+		, bytes (0)
+		, total (0)
+		, min (0)
+		, max (0)
+		, histogram (64, 0)
+	{}
+
+	double mean () const;
+	int64_t percentile (double p) const;
+
+	/** number of times the stage has run; for most stages this is a number of frames */
+	int64_t count;
+	/** number of bytes which the stage has read, decoded or written */
+	int64_t bytes;
+	/** total time spent in the stage, in nanoseconds */
+	int64_t total;
+	/** shortest time of any run, in nanoseconds */
+	int64_t min;
+	/** longest time of any run, in nanoseconds */
+	int64_t max;
+	/** histogram[i] is the number of runs which took from 2^i to 2^(i + 1) - 1 nanoseconds */
+	std::vector<int64_t> histogram;
+};
+
+/** @class Instrumentation
+ *  @brief Timing of the stages that each frame goes through on its way into or out of an MXF.
+ *
+ *  Instrumentation is always compiled in but does nothing until set_enabled(true) is
+ *  called; while it is disabled each instrumented stage costs one test of a flag.  When
+ *  enabled, every run of a stage adds to that stage's StageStats, which can be fetched
+ *  with stats().  If tracing is enabled as well each run is also recorded as a span which
+ *  can be written out with write_trace() and viewed in Chrome's about://tracing or Perfetto.
+ *
+ *  All methods may be called from any thread.
+ */
+class Instrumentation
+{
+public:
+	enum Stage {
+		/** reading a frame from an MXF, including any decryption by asdcplib */
+		MXF_READ,
+		/** decrypting a frame with OpenSSL */
+		DECRYPT,
+		/** decoding a JPEG2000 codestream */
+		J2K_DECOMPRESS,
+		/** encoding a JPEG2000 codestream */
+		J2K_COMPRESS,
+		/** xyz_to_rgba() */
+		XYZ_TO_RGBA,
+		/** xyz_to_rgb() */
+		XYZ_TO_RGB,
+		/** rgb_to_xyz() */
+		RGB_TO_XYZ,
+		/** writing a frame to an MXF, including any encryption */
+		MXF_WRITE,
+		STAGES
+	};
+
+	static void set_enabled (bool e);
+
+	static bool enabled () {
+		return _enabled.load (boost::memory_order_relaxed);
+	}
+
+	static void set_tracing (bool t, int max_spans = 1000000);
+
+	static bool tracing () {
+		return _tracing.load (boost::memory_order_relaxed);
+	}
+
+	static StageStats stats (Stage stage);
+	static std::string name (Stage stage);
+	static void reset ();
+	static void write_trace (boost::filesystem::path file);
+
+	static int64_t now ();
+	static void record (Stage stage, int64_t start, int64_t end, int64_t bytes);
+
+	/** @class Span
+	 *  @brief Times one run of a stage, from its construction to its destruction.
+	 */
+	class Span : public boost::noncopyable
+	{
+	public:
+		explicit Span (Stage stage, int64_t bytes = 0)
+			: _stage (stage)
+			, _bytes (bytes)
+			, _start (Instrumentation::enabled() ? Instrumentation::now() : -1)
+		{}
+
+		~Span ()
+		{
+			if (_start >= 0) {
+				Instrumentation::record (_stage, _start, Instrumentation::now(), _bytes);
+			}
+		}
+
+		/** Set the number of bytes handled, for stages which only know it at the end */
+		void set_bytes (int64_t bytes) {
+			_bytes = bytes;
+		}
+
+	private:
+		Stage _stage;
+		int64_t _bytes;
+		/** start time in nanoseconds, or -1 if instrumentation was disabled when we were made */
+		int64_t _start;
+	};
+
+private:
+	/* These are read by every decoding and writing thread, so they are atomic; relaxed
+	   loads are enough as nothing else is published through them.
+	*/
+	static boost::atomic<bool> _enabled;
+	static boost::atomic<bool> _tracing;
+};
+
+}
+
+#endif
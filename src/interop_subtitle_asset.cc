@@ -34,24 +34,28 @@
 #include "interop_subtitle_asset.h"
 #include "interop_load_font_node.h"
 #include "subtitle_asset_internal.h"
-#include "xml.h"
 #include "raw_convert.h"
 #include "util.h"
 #include "font_asset.h"
 #include "dcp_assert.h"
 #include "compose.hpp"
 #include "subtitle_image.h"
+#include "xml_reader.h"
+#include "xml_writer.h"
+#include "exceptions.h"
 #include <libxml++/libxml++.h>
 #include <boost/foreach.hpp>
 #include <boost/weak_ptr.hpp>
 #include <cmath>
 #include <cstdio>
+#include <set>
 
 using std::list;
 using std::string;
 using std::cout;
 using std::cerr;
 using std::map;
+using std::set;
 using boost::shared_ptr;
 using boost::shared_array;
 using boost::optional;
@@ -61,29 +65,52 @@ using namespace dcp;
 InteropSubtitleAsset::InteropSubtitleAsset (boost::filesystem::path file)
 	: SubtitleAsset (file)
 {
-	shared_ptr<cxml::Document> xml (new cxml::Document ("DCSubtitle"));
-	xml->read_file (file);
-	_id = xml->string_child ("SubtitleID");
-	_reel_number = xml->string_child ("ReelNumber");
-	_language = xml->string_child ("Language");
-	_movie_title = xml->string_child ("MovieTitle");
-	_load_font_nodes = type_children<InteropLoadFontNode> (xml, "LoadFont");
-
-	/* Now we need to drop down to xmlpp */
-
-	list<ParseState> ps;
-	xmlpp::Node::NodeList c = xml->node()->get_children ();
-	for (xmlpp::Node::NodeList::const_iterator i = c.begin(); i != c.end(); ++i) {
-		xmlpp::Element const * e = dynamic_cast<xmlpp::Element const *> (*i);
-		if (e && (e->get_name() == "Font" || e->get_name() == "Subtitle")) {
-			parse_subtitles (e, ps, optional<int>(), INTEROP);
+	XMLReader xml (file);
+	xml.root ("DCSubtitle");
+
+	/* Names of the elements that we have read */
+	set<string> seen;
+
+	while (xml.next_child (0)) {
+		string const name = xml.name ();
+		if (name == "SubtitleID") {
+			_id = xml.content ();
+		} else if (name == "ReelNumber") {
+			_reel_number = xml.content ();
+		} else if (name == "Language") {
+			_language = xml.content ();
+		} else if (name == "MovieTitle") {
+			_movie_title = xml.content ();
+		} else if (name == "LoadFont") {
+			optional<string> id = xml.optional_attribute ("Id");
+			if (!id) {
+				id = xml.optional_attribute ("ID");
+			}
+			_load_font_nodes.push_back (
+				shared_ptr<InteropLoadFontNode> (new InteropLoadFontNode (id.get_value_or (""), xml.attribute ("URI")))
+				);
+		} else if (name == "Font" || name == "Subtitle") {
+			parse_subtitles (xml, optional<int>(), INTEROP);
+		}
+
+		seen.insert (name);
+	}
+
+	char const * required[] = { "SubtitleID", "ReelNumber", "Language", "MovieTitle", 0 };
+	for (int i = 0; required[i]; ++i) {
+		if (seen.find (required[i]) == seen.end ()) {
+			throw XMLError (String::compose ("missing XML tag %1", required[i]));
 		}
 	}
 
 	BOOST_FOREACH (shared_ptr<Subtitle> i, _subtitles) {
 		shared_ptr<SubtitleImage> si = dynamic_pointer_cast<SubtitleImage>(i);
 		if (si) {
-			si->read_png_file (file.parent_path() / String::compose("%1.png", si->id()));
+			boost::filesystem::path const png = file.parent_path() / String::compose("%1.png", si->id());
+			if (!boost::filesystem::is_regular_file (png)) {
+				throw MissingSubtitleImageError (si->id());
+			}
+			si->read_png_file (png);
 		}
 	}
 }
@@ -96,24 +123,33 @@ InteropSubtitleAsset::InteropSubtitleAsset ()
 string
 InteropSubtitleAsset::xml_as_string () const
 {
-	xmlpp::Document doc;
-	xmlpp::Element* root = doc.create_root_node ("DCSubtitle");
-	root->set_attribute ("Version", "1.0");
+	XMLWriter writer;
+	write_xml (writer);
+	writer.finish ();
+	return writer.as_string ();
+}
+
+void
+InteropSubtitleAsset::write_xml (XMLWriter& writer) const
+{
+	writer.start_element ("DCSubtitle");
+	writer.attribute ("Version", "1.0");
 
-	root->add_child("SubtitleID")->add_child_text (_id);
-	root->add_child("MovieTitle")->add_child_text (_movie_title);
-	root->add_child("ReelNumber")->add_child_text (raw_convert<string> (_reel_number));
-	root->add_child("Language")->add_child_text (_language);
+	writer.element ("SubtitleID", _id);
+	writer.element ("MovieTitle", _movie_title);
+	writer.element ("ReelNumber", raw_convert<string> (_reel_number));
+	writer.element ("Language", _language);
 
 	for (list<shared_ptr<InteropLoadFontNode> >::const_iterator i = _load_font_nodes.begin(); i != _load_font_nodes.end(); ++i) {
-		xmlpp::Element* load_font = root->add_child("LoadFont");
-		load_font->set_attribute ("Id", (*i)->id);
-		load_font->set_attribute ("URI", (*i)->uri);
+		writer.start_element ("LoadFont");
+		writer.attribute ("Id", (*i)->id);
+		writer.attribute ("URI", (*i)->uri);
+		writer.end_element ();
 	}
 
-	subtitles_as_xml (root, 250, INTEROP);
+	subtitles_as_xml (writer, 250, INTEROP);
 
-	return doc.write_to_string ("UTF-8");
+	writer.end_element ();
 }
 
 void
@@ -173,15 +209,9 @@ InteropSubtitleAsset::load_font_nodes () const
 void
 InteropSubtitleAsset::write (boost::filesystem::path p) const
 {
-	FILE* f = fopen_boost (p, "w");
-	if (!f) {
-		throw FileError ("Could not open file for writing", p, -1);
-	}
-
-	string const s = xml_as_string ();
-	/* length() here gives bytes not characters */
-	fwrite (s.c_str(), 1, s.length(), f);
-	fclose (f);
+	XMLWriter writer (p);
+	write_xml (writer);
+	writer.finish ();
 
 	_file = p;
 
@@ -195,17 +225,24 @@ InteropSubtitleAsset::write (boost::filesystem::path p) const
 
 	/* Fonts */
 	BOOST_FOREACH (shared_ptr<InteropLoadFontNode> i, _load_font_nodes) {
+		list<Font>::const_iterator j = _fonts.begin ();
+		while (j != _fonts.end() && j->load_id != i->id) {
+			++j;
+		}
+
+		/* Get the font data before opening the file, as they may be read from it */
+		Data data;
+		if (j != _fonts.end ()) {
+			data = j->data.get ();
+		}
+
 		boost::filesystem::path file = p.parent_path() / i->uri;
 		FILE* f = fopen_boost (file, "wb");
 		if (!f) {
 			throw FileError ("could not open font file for writing", file, errno);
 		}
-		list<Font>::const_iterator j = _fonts.begin ();
-		while (j != _fonts.end() && j->load_id != i->id) {
-			++j;
-		}
 		if (j != _fonts.end ()) {
-			fwrite (j->data.data().get(), 1, j->data.size(), f);
+			fwrite (data.data().get(), 1, data.size(), f);
 			j->file = file;
 		}
 		fclose (f);
@@ -272,8 +309,7 @@ InteropSubtitleAsset::add_to_pkl (shared_ptr<PKL> pkl, boost::filesystem::path r
 	BOOST_FOREACH (shared_ptr<dcp::Subtitle> i, _subtitles) {
 		shared_ptr<dcp::SubtitleImage> im = dynamic_pointer_cast<dcp::SubtitleImage> (i);
 		if (im) {
-			Data png_image = im->png_image ();
-			pkl->add_asset (im->id(), optional<string>(), make_digest(png_image), png_image.size(), "image/png");
+			pkl->add_asset (im->id(), optional<string>(), im->png_image_digest(), im->png_image().size(), "image/png");
 		}
 	}
 }
@@ -119,6 +119,8 @@ protected:
 	}
 
 private:
+	void write_xml (XMLWriter& writer) const;
+
 	std::string _reel_number;
 	std::string _language;
 	std::string _movie_title;
@@ -0,0 +1,474 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/io_backend.cc
+ *  @brief IOBackend class and its implementations.
+ */
+
+#include "io_backend.h"
+#include "exceptions.h"
+#include "dcp_assert.h"
+#include <boost/thread/mutex.hpp>
+#include <boost/foreach.hpp>
+#ifdef LIBDCP_POSIX
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef LIBDCP_IO_URING
+#include <liburing.h>
+#endif
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+using std::min;
+using std::vector;
+using boost::shared_ptr;
+using namespace dcp;
+
+static boost::mutex default_mutex;
+static IOBackend::Type default_type_ = IOBackend::ASDCPLIB;
+static int64_t default_readahead_ = 0;
+
+/** Read several pieces of data, throwing a FileError if any of them cannot be read.
+ *  This implementation reads them one after the other.
+ */
+void
+IOBackend::read (vector<Request> const & requests)
+{
+	BOOST_FOREACH (Request const & i, requests) {
+		read (i.offset, i.size, i.data);
+	}
+}
+
+#ifdef LIBDCP_POSIX
+
+namespace dcp {
+
+/** @class FileBackend
+ *  @brief Parent for IOBackends which read a file using a POSIX file descriptor.
+ */
+class FileBackend : public IOBackend
+{
+public:
+	explicit FileBackend (boost::filesystem::path file)
+		: _file (file)
+		, _fd (-1)
+		, _size (0)
+	{
+		_fd = open (file.string().c_str(), O_RDONLY);
+		if (_fd == -1) {
+			boost::throw_exception (FileError ("could not open file for reading", file, errno));
+		}
+
+		struct stat st;
+		if (fstat (_fd, &st) == -1) {
+			int const e = errno;
+			::close (_fd);
+			boost::throw_exception (FileError ("could not find size of file", file, e));
+		}
+
+		_size = st.st_size;
+	}
+
+	~FileBackend ()
+	{
+		::close (_fd);
+	}
+
+	int64_t size () const {
+		return _size;
+	}
+
+protected:
+	/** Throw a FileError if a request goes outside the file */
+	void check (int64_t offset, int64_t size) const
+	{
+		if (offset < 0 || size < 0 || (offset + size) > _size) {
+			boost::throw_exception (FileError ("attempt to read outside file", _file, EINVAL));
+		}
+	}
+
+	/** Read with pread(), carrying on after short reads */
+	void read_fully (int64_t offset, int64_t size, uint8_t* data) const
+	{
+		while (size > 0) {
+			ssize_t const r = pread (_fd, data, size, offset);
+			if (r == -1 && errno == EINTR) {
+				continue;
+			} else if (r == -1) {
+				boost::throw_exception (FileError ("could not read from file", _file, errno));
+			} else if (r == 0) {
+				boost::throw_exception (FileError ("unexpected end of file", _file, 0));
+			}
+			offset += r;
+			size -= r;
+			data += r;
+		}
+	}
+
+	boost::filesystem::path _file;
+	int _fd;
+	int64_t _size;
+};
+
+/** @class PreadBackend
+ *  @brief IOBackend which uses pread(), optionally reading ahead.
+ *
+ *  With a readahead window, a read of less than the window's size which is not already in the
+ *  window fills the window with data starting at the read's offset; later reads from inside
+ *  the window are copied from it.  This turns the small reads of each frame's header, and
+ *  the frames themselves, into a few large reads which suits filesystems with a high latency
+ *  for each request.
+ */
+class PreadBackend : public FileBackend
+{
+public:
+	PreadBackend (boost::filesystem::path file, int64_t readahead)
+		: FileBackend (file)
+		, _readahead (readahead)
+		, _window_offset (0)
+		, _window_size (0)
+	{
+		if (_readahead > 0) {
+			_window.resize (_readahead);
+#ifdef POSIX_FADV_SEQUENTIAL
+			posix_fadvise (_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+		}
+	}
+
+	void read (int64_t offset, int64_t size, uint8_t* data)
+	{
+		check (offset, size);
+
+		if (size >= _readahead) {
+			read_fully (offset, size, data);
+			return;
+		}
+
+		boost::mutex::scoped_lock lm (_mutex);
+
+		if (offset < _window_offset || (offset + size) > (_window_offset + _window_size)) {
+			_window_size = 0;
+			int64_t const window_size = min (_readahead, _size - offset);
+			read_fully (offset, window_size, &_window[0]);
+			_window_offset = offset;
+			_window_size = window_size;
+		}
+
+		memcpy (data, &_window[offset - _window_offset], size);
+	}
+
+	using IOBackend::read;
+
+private:
+	int64_t _readahead;
+	/** mutex for _window, _window_offset and _window_size */
+	boost::mutex _mutex;
+	std::vector<uint8_t> _window;
+	int64_t _window_offset;
+	int64_t _window_size;
+};
+
+/** @class MmapBackend
+ *  @brief IOBackend which maps the whole file into memory.
+ *
+ *  If the file is truncated by someone else while it is mapped, reads from the part
+ *  that has gone will raise SIGBUS.
+ */
+class MmapBackend : public FileBackend
+{
+public:
+	explicit MmapBackend (boost::filesystem::path file)
+		: FileBackend (file)
+		, _data (0)
+	{
+		if (_size == 0) {
+			return;
+		}
+
+		void* m = mmap (0, _size, PROT_READ, MAP_SHARED, _fd, 0);
+		if (m == MAP_FAILED) {
+			boost::throw_exception (FileError ("could not map file", _file, errno));
+		}
+
+		_data = reinterpret_cast<uint8_t*> (m);
+	}
+
+	~MmapBackend ()
+	{
+		if (_data) {
+			munmap (_data, _size);
+		}
+	}
+
+	void read (int64_t offset, int64_t size, uint8_t* data)
+	{
+		check (offset, size);
+		memcpy (data, _data + offset, size);
+	}
+
+	using IOBackend::read;
+
+	bool can_view () const {
+		return _data != 0;
+	}
+
+	uint8_t const * view (int64_t offset, int64_t size) const
+	{
+		check (offset, size);
+		return _data + offset;
+	}
+
+private:
+	uint8_t* _data;
+};
+
+#ifdef LIBDCP_IO_URING
+
+/** @class IOUringBackend
+ *  @brief IOBackend which uses io_uring to submit batches of reads to the kernel at once.
+ *
+ *  This is only worthwhile for reads which are made in batches (see EssenceReader::read_frames());
+ *  a single read is no faster than pread().
+ */
+class IOUringBackend : public FileBackend
+{
+public:
+	explicit IOUringBackend (boost::filesystem::path file)
+		: FileBackend (file)
+	{
+		int const r = io_uring_queue_init (queue_depth, &_ring, 0);
+		if (r < 0) {
+			boost::throw_exception (FileError ("could not set up io_uring", _file, -r));
+		}
+	}
+
+	~IOUringBackend ()
+	{
+		io_uring_queue_exit (&_ring);
+	}
+
+	void read (int64_t offset, int64_t size, uint8_t* data)
+	{
+		read (vector<Request> (1, Request (offset, size, data)));
+	}
+
+	/** Read some requests, submitting up to queue_depth of them to the kernel at once and
+	 *  waiting for them all to complete before returning.
+	 */
+	void read (vector<Request> const & requests)
+	{
+		BOOST_FOREACH (Request const & i, requests) {
+			check (i.offset, i.size);
+		}
+
+		boost::mutex::scoped_lock lm (_mutex);
+
+		int error = 0;
+		size_t next = 0;
+		while (next < requests.size()) {
+			int const batch = min (requests.size() - next, size_t (queue_depth));
+			for (int i = 0; i < batch; ++i) {
+				Request const & q = requests[next + i];
+				io_uring_sqe* sqe = io_uring_get_sqe (&_ring);
+				DCP_ASSERT (sqe);
+				io_uring_prep_read (sqe, _fd, q.data, q.size, q.offset);
+				io_uring_sqe_set_data (sqe, const_cast<Request*> (&q));
+			}
+
+			/* The kernel may take fewer requests than we prepared, in which case the rest
+			   are still in the submission queue and we must submit them again.
+			*/
+			int submitted = 0;
+			int completed = 0;
+			while (submitted < batch) {
+				int const r = io_uring_submit (&_ring);
+				if (r > 0) {
+					submitted += r;
+				} else if (r == -EINTR) {
+					continue;
+				} else if ((r == 0 || r == -EAGAIN || r == -EBUSY) && completed < submitted) {
+					/* Make some room by collecting a completion, then try again */
+					complete (error);
+					++completed;
+				} else {
+					/* Wait for what we did submit, since it is reading into the caller's
+					   buffers, then start a new ring to throw away the requests which
+					   are still queued.
+					*/
+					while (completed < submitted) {
+						complete (error);
+						++completed;
+					}
+					io_uring_queue_exit (&_ring);
+					int const e = io_uring_queue_init (queue_depth, &_ring, 0);
+					if (e < 0) {
+						boost::throw_exception (FileError ("could not set up io_uring", _file, -e));
+					}
+					boost::throw_exception (FileError ("could not submit reads to io_uring", _file, r < 0 ? -r : EIO));
+				}
+			}
+
+			/* Collect every completion before reporting any error so that the ring is left empty */
+			while (completed < submitted) {
+				complete (error);
+				++completed;
+			}
+
+			next += batch;
+		}
+
+		if (error) {
+			boost::throw_exception (FileError ("could not read from file", _file, error));
+		}
+	}
+
+private:
+	/** Wait for a request to complete, finishing it off if the read was short.
+	 *  @param error Set to an errno value if the request failed.
+	 */
+	void complete (int& error)
+	{
+		io_uring_cqe* cqe = 0;
+		int r;
+		do {
+			r = io_uring_wait_cqe (&_ring, &cqe);
+		} while (r == -EINTR);
+
+		if (r < 0) {
+			boost::throw_exception (FileError ("could not wait for io_uring read", _file, -r));
+		}
+
+		Request const * q = reinterpret_cast<Request const *> (io_uring_cqe_get_data (cqe));
+		int const res = cqe->res;
+		io_uring_cqe_seen (&_ring, cqe);
+		if (res < 0) {
+			error = -res;
+		} else if (res < q->size) {
+			/* Short read; fetch the rest the simple way, but don't throw while other
+			   requests may still be reading into the caller's buffers.
+			*/
+			try {
+				read_fully (q->offset + res, q->size - res, q->data + res);
+			} catch (FileError& e) {
+				error = e.number() ? e.number() : EIO;
+			}
+		}
+	}
+
+	static int const queue_depth = 64;
+	/** mutex for _ring */
+	boost::mutex _mutex;
+	io_uring _ring;
+};
+
+#endif
+
+}
+
+#endif
+
+/** Make an IOBackend, using the default readahead (see set_default()) for PREAD.
+ *  @param file File to read.
+ *  @param type Type of backend.
+ *  @return New IOBackend, or 0 for ASDCPLIB (or for any type on platforms other than POSIX).
+ */
+shared_ptr<IOBackend>
+IOBackend::create (boost::filesystem::path file, Type type)
+{
+	return create (file, type, default_readahead ());
+}
+
+/** Make an IOBackend.
+ *  @param file File to read.
+ *  @param type Type of backend.
+ *  @param readahead Size of readahead window for PREAD, in bytes, or 0 for none.
+ *  @return New IOBackend, or 0 for ASDCPLIB (or for any type on platforms other than POSIX).
+ */
+shared_ptr<IOBackend>
+IOBackend::create (boost::filesystem::path file, Type type, int64_t readahead)
+{
+	switch (type) {
+	case ASDCPLIB:
+		return shared_ptr<IOBackend> ();
+#ifdef LIBDCP_POSIX
+	case PREAD:
+		return shared_ptr<IOBackend> (new PreadBackend (file, readahead));
+	case MMAP:
+		return shared_ptr<IOBackend> (new MmapBackend (file));
+	case IO_URING:
+#ifdef LIBDCP_IO_URING
+		return shared_ptr<IOBackend> (new IOUringBackend (file));
+#else
+		return shared_ptr<IOBackend> (new PreadBackend (file, readahead));
+#endif
+#else
+	default:
+		return shared_ptr<IOBackend> ();
+#endif
+	}
+
+	DCP_ASSERT (false);
+	return shared_ptr<IOBackend> ();
+}
+
+/** Set the IOBackend that AssetReaders will use when they are created.
+ *  @param type Type of backend.
+ *  @param readahead Size of readahead window for PREAD, in bytes, or 0 for none.
+ */
+void
+IOBackend::set_default (Type type, int64_t readahead)
+{
+	boost::mutex::scoped_lock lm (default_mutex);
+	default_type_ = type;
+	default_readahead_ = readahead;
+}
+
+IOBackend::Type
+IOBackend::default_type ()
+{
+	boost::mutex::scoped_lock lm (default_mutex);
+	return default_type_;
+}
+
+int64_t
+IOBackend::default_readahead ()
+{
+	boost::mutex::scoped_lock lm (default_mutex);
+	return default_readahead_;
+}
@@ -0,0 +1,129 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/io_backend.h
+ *  @brief IOBackend class.
+ */
+
+#ifndef LIBDCP_IO_BACKEND_H
+#define LIBDCP_IO_BACKEND_H
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/filesystem.hpp>
+#include <stdint.h>
+#include <vector>
+
+namespace dcp {
+
+/** @class IOBackend
+ *  @brief A way of reading pieces of a file, used by AssetReaders to fetch frames from MXFs.
+ *
+ *  By default asdcplib reads MXF files itself.  An IOBackend can be given to an AssetReader
+ *  (or set as the default for all new readers with IOBackend::set_default()) to read unencrypted
+ *  frames from picture and sound MXFs using the MXF's index instead; encrypted frames are still
+ *  read by asdcplib.
+ *
+ *  IOBackends may be used from several threads at once.
+ */
+class IOBackend : public boost::noncopyable
+{
+public:
+	virtual ~IOBackend () {}
+
+	enum Type {
+		/** let asdcplib read the file */
+		ASDCPLIB,
+		/** pread() with an optional readahead window; good for network filesystems */
+		PREAD,
+		/** map the whole file into memory; good for local disks */
+		MMAP,
+		/** io_uring, reading batches of requests at once; only available on Linux if libdcp
+		 *  was built with liburing (otherwise PREAD is used).
+		 */
+		IO_URING
+	};
+
+	/** A piece of the file to read */
+	struct Request
+	{
+		Request (int64_t offset_, int64_t size_, uint8_t* data_)
+			: offset (offset_)
+			, size (size_)
+			, data (data_)
+		{}
+
+		/** offset in the file, in bytes */
+		int64_t offset;
+		/** number of bytes to read */
+		int64_t size;
+		/** buffer to read into */
+		uint8_t* data;
+	};
+
+	/** Read some data, throwing a FileError if it cannot all be read.
+	 *  @param offset Offset in the file in bytes.
+	 *  @param size Number of bytes to read.
+	 *  @param data Buffer to read into.
+	 */
+	virtual void read (int64_t offset, int64_t size, uint8_t* data) = 0;
+	virtual void read (std::vector<Request> const & requests);
+
+	/** @return true if view() can be used */
+	virtual bool can_view () const {
+		return false;
+	}
+
+	/** @param offset Offset in the file in bytes.
+	 *  @param size Number of bytes.
+	 *  @return Pointer to the given part of the file which stays valid for the life of this
+	 *  IOBackend, or 0 if this backend cannot do that.
+	 */
+	virtual uint8_t const * view (int64_t, int64_t) const {
+		return 0;
+	}
+
+	/** @return Size of the file in bytes */
+	virtual int64_t size () const = 0;
+
+	static boost::shared_ptr<IOBackend> create (boost::filesystem::path file, Type type);
+	static boost::shared_ptr<IOBackend> create (boost::filesystem::path file, Type type, int64_t readahead);
+
+	static void set_default (Type type, int64_t readahead = 0);
+	static Type default_type ();
+	static int64_t default_readahead ();
+};
+
+}
+
+#endif
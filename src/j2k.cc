@@ -37,6 +37,7 @@
 #include "data.h"
 #include "dcp_assert.h"
 #include "compose.hpp"
+#include "instrumentation.h"
 #include <openjpeg.h>
 #include <cmath>
 #include <iostream>
@@ -108,6 +109,8 @@ error_callback (char const * msg, void *)
 shared_ptr<dcp::OpenJPEGImage>
 dcp::decompress_j2k (uint8_t* data, int64_t size, int reduce)
 {
+	Instrumentation::Span span (Instrumentation::J2K_DECOMPRESS, size);
+
 	DCP_ASSERT (reduce >= 0);
 
 	uint8_t const jp2_magic[] = {
@@ -181,6 +184,8 @@ dcp::decompress_j2k (uint8_t* data, int64_t size, int reduce)
 shared_ptr<dcp::OpenJPEGImage>
 dcp::decompress_j2k (uint8_t* data, int64_t size, int reduce)
 {
+	Instrumentation::Span span (Instrumentation::J2K_DECOMPRESS, size);
+
 	opj_dinfo_t* decoder = opj_create_decompress (CODEC_J2K);
 	opj_dparameters_t parameters;
 	opj_set_default_decoder_parameters (&parameters);
@@ -267,6 +272,8 @@ seek_function (OPJ_OFF_T nb_bytes, void* data)
 Data
 dcp::compress_j2k (shared_ptr<const OpenJPEGImage> xyz, int bandwidth, int frames_per_second, bool threed, bool fourk)
 {
+	Instrumentation::Span span (Instrumentation::J2K_COMPRESS);
+
 	/* get a J2K compressor handle */
 	opj_codec_t* encoder = opj_create_compress (OPJ_CODEC_J2K);
 	if (encoder == 0) {
@@ -334,6 +341,7 @@ dcp::compress_j2k (shared_ptr<const OpenJPEGImage> xyz, int bandwidth, int frame
 	opj_destroy_codec (encoder);
 	opj_stream_destroy (stream);
 
+	span.set_bytes (enc.size ());
 	return enc;
 }
 #endif
@@ -342,6 +350,8 @@ dcp::compress_j2k (shared_ptr<const OpenJPEGImage> xyz, int bandwidth, int frame
 Data
 dcp::compress_j2k (shared_ptr<const OpenJPEGImage> xyz, int bandwidth, int frames_per_second, bool threed, bool fourk)
 {
+	Instrumentation::Span span (Instrumentation::J2K_COMPRESS);
+
 	/* Set the max image and component sizes based on frame_rate */
 	int max_cs_len = ((float) bandwidth) / 8 / frames_per_second;
 	if (threed) {
@@ -452,6 +462,7 @@ dcp::compress_j2k (shared_ptr<const OpenJPEGImage> xyz, int bandwidth, int frame
 	free (parameters.cp_comment);
 	opj_destroy_compress (cinfo);
 
+	span.set_bytes (enc.size ());
 	return enc;
 }
 
@@ -0,0 +1,503 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/kdm_store.cc
+ *  @brief KDMStore class.
+ */
+
+#include "kdm_store.h"
+#include "encrypted_kdm.h"
+#include "decrypted_kdm.h"
+#include "dcp.h"
+#include "cpl.h"
+#include "reel.h"
+#include "data.h"
+#include "exceptions.h"
+#include "dcp_assert.h"
+#include "compose.hpp"
+#include <openssl/pem.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <openssl/hmac.h>
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+#include <openssl/err.h>
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <sstream>
+#include <cstring>
+
+using std::string;
+using std::vector;
+using std::list;
+using std::set;
+using std::istringstream;
+using std::ostringstream;
+using boost::shared_ptr;
+using boost::optional;
+using namespace dcp;
+
+/** First line of the plaintext of a cache file */
+static string const cache_magic = "libdcp KDM store 2";
+
+KDMStore::KDMStore (string private_key, optional<boost::filesystem::path> cache)
+	: _cache (cache)
+{
+	BIO* bio = BIO_new_mem_buf (const_cast<char *> (private_key.c_str ()), -1);
+	if (!bio) {
+		throw MiscError ("could not create memory BIO");
+	}
+
+	_private_key = PEM_read_bio_RSAPrivateKey (bio, 0, 0, 0);
+	BIO_free (bio);
+	if (!_private_key) {
+		throw FileError ("could not read RSA private key file", private_key, errno);
+	}
+
+	if (_cache && boost::filesystem::exists (*_cache)) {
+		read_cache ();
+	}
+}
+
+KDMStore::~KDMStore ()
+{
+	RSA_free (_private_key);
+}
+
+struct KDMStore::Batch
+{
+	explicit Batch (vector<EncryptedKDM const *> const & kdms_)
+		: kdms (kdms_)
+		, next (0)
+	{}
+
+	vector<EncryptedKDM const *> const & kdms;
+
+	/** mutex for next and error */
+	boost::mutex mutex;
+	int next;
+	optional<string> error;
+};
+
+/** Decrypt some KDMs and add their keys to the store.  KDMs which are already in the
+ *  store (or which appear more than once in the list) are only decrypted once.
+ *  @param kdms KDMs to add.
+ *  @param threads Number of threads to decrypt with.
+ *  @return Number of new KDMs that were added.
+ */
+int
+KDMStore::add (vector<EncryptedKDM> const & kdms, int threads)
+{
+	DCP_ASSERT (threads > 0);
+
+	vector<EncryptedKDM const *> todo;
+	{
+		boost::mutex::scoped_lock lm (_mutex);
+		set<string> seen = _kdm_ids;
+		BOOST_FOREACH (EncryptedKDM const & i, kdms) {
+			if (seen.insert(i.id()).second) {
+				todo.push_back (&i);
+			}
+		}
+	}
+
+	if (todo.empty ()) {
+		return 0;
+	}
+
+	Batch batch (todo);
+
+	boost::thread_group group;
+	for (int i = 0; i < threads; ++i) {
+		group.create_thread (boost::bind (&KDMStore::add_batch, this, &batch));
+	}
+	group.join_all ();
+
+	if (batch.error) {
+		throw MiscError (*batch.error);
+	}
+
+	if (_cache) {
+		write_cache ();
+	}
+
+	return todo.size ();
+}
+
+/** Body of each of the threads of add() */
+void
+KDMStore::add_batch (Batch* batch)
+{
+	/* Each thread gets its own copy of the key so that they do not contend for its blinding state */
+	RSA* rsa = RSAPrivateKey_dup (_private_key);
+	if (!rsa) {
+		boost::mutex::scoped_lock lm (batch->mutex);
+		batch->error = "could not copy RSA private key";
+		return;
+	}
+
+	while (true) {
+		int n;
+		{
+			boost::mutex::scoped_lock lm (batch->mutex);
+			if (batch->error || batch->next >= int (batch->kdms.size())) {
+				break;
+			}
+			n = batch->next++;
+		}
+
+		try {
+			EncryptedKDM const * kdm = batch->kdms[n];
+			DecryptedKDM decrypted (*kdm, rsa);
+			LocalTime const not_valid_before = kdm->not_valid_before ();
+			LocalTime const not_valid_after = kdm->not_valid_after ();
+			list<Entry> entries;
+			BOOST_FOREACH (DecryptedKDMKey const & i, decrypted.keys()) {
+				entries.push_back (Entry (i, not_valid_before, not_valid_after));
+			}
+			add_kdm (kdm->id(), entries);
+		} catch (std::exception& e) {
+			boost::mutex::scoped_lock lm (batch->mutex);
+			if (!batch->error) {
+				batch->error = e.what ();
+			}
+			break;
+		}
+	}
+
+	RSA_free (rsa);
+}
+
+void
+KDMStore::add_kdm (string id, list<Entry> const & entries)
+{
+	boost::mutex::scoped_lock lm (_mutex);
+
+	if (!_kdm_ids.insert(id).second) {
+		return;
+	}
+
+	BOOST_FOREACH (Entry const & i, entries) {
+		add_entry (i);
+	}
+}
+
+/** Add an entry and index it; _mutex must be held by the caller */
+void
+KDMStore::add_entry (Entry const & entry)
+{
+	_by_key_id[entry.key.id()].push_back (_entries.size());
+	_by_cpl_id[entry.key.cpl_id()].push_back (_entries.size());
+	_entries.push_back (entry);
+}
+
+/** @param key_id Key ID.
+ *  @param time Time at which the key is to be used.
+ *  @return Key with the given ID from a KDM which is valid at the given time, if there is one.
+ */
+optional<Key>
+KDMStore::key (string key_id, LocalTime time) const
+{
+	boost::mutex::scoped_lock lm (_mutex);
+	return key_unlocked (key_id, time);
+}
+
+optional<Key>
+KDMStore::key_unlocked (string key_id, LocalTime time) const
+{
+	boost::unordered_map<string, vector<size_t> >::const_iterator i = _by_key_id.find (key_id);
+	if (i == _by_key_id.end()) {
+		return optional<Key> ();
+	}
+
+	BOOST_FOREACH (size_t j, i->second) {
+		if (_entries[j].valid_at (time)) {
+			return _entries[j].key.key ();
+		}
+	}
+
+	return optional<Key> ();
+}
+
+/** @param cpl_id CPL ID.
+ *  @param time Time at which the keys are to be used.
+ *  @return Keys for the given CPL from KDMs which are valid at the given time.
+ */
+list<DecryptedKDMKey>
+KDMStore::keys (string cpl_id, LocalTime time) const
+{
+	boost::mutex::scoped_lock lm (_mutex);
+
+	list<DecryptedKDMKey> keys;
+
+	boost::unordered_map<string, vector<size_t> >::const_iterator i = _by_cpl_id.find (cpl_id);
+	if (i == _by_cpl_id.end()) {
+		return keys;
+	}
+
+	BOOST_FOREACH (size_t j, i->second) {
+		if (_entries[j].valid_at (time)) {
+			keys.push_back (_entries[j].key);
+		}
+	}
+
+	return keys;
+}
+
+/** Give keys to the encrypted assets of a CPL's reels.
+ *  @param cpl CPL.
+ *  @param time Time at which the keys are to be used.
+ *  @return Number of assets which were given keys.
+ */
+int
+KDMStore::give_keys (shared_ptr<const CPL> cpl, LocalTime time) const
+{
+	boost::mutex::scoped_lock lm (_mutex);
+
+	int n = 0;
+	BOOST_FOREACH (shared_ptr<Reel> i, cpl->reels()) {
+		n += i->give_keys (boost::bind (&KDMStore::key_unlocked, this, _1, time));
+	}
+	return n;
+}
+
+/** Give keys to the encrypted assets of all of a DCP's CPLs.
+ *  @param dcp DCP.
+ *  @param time Time at which the keys are to be used.
+ *  @return Number of assets which were given keys.
+ */
+int
+KDMStore::give_keys (shared_ptr<const DCP> dcp, LocalTime time) const
+{
+	int n = 0;
+	BOOST_FOREACH (shared_ptr<CPL> i, dcp->cpls()) {
+		n += give_keys (i, time);
+	}
+	return n;
+}
+
+int
+KDMStore::kdms () const
+{
+	boost::mutex::scoped_lock lm (_mutex);
+	return _kdm_ids.size ();
+}
+
+/** @param purpose Label for what the key is for; keys for different purposes are unrelated.
+ *  @return 256-bit key for the cache file, derived from our private key.
+ */
+vector<uint8_t>
+KDMStore::cache_key (string purpose) const
+{
+	int const length = i2d_RSAPrivateKey (_private_key, 0);
+	if (length <= 0) {
+		throw MiscError ("could not serialise RSA private key");
+	}
+
+	vector<uint8_t> der (length);
+	uint8_t* p = &der[0];
+	i2d_RSAPrivateKey (_private_key, &p);
+
+	string const label = cache_magic + " " + purpose;
+	der.insert (der.begin(), label.begin(), label.end());
+
+	vector<uint8_t> key (SHA256_DIGEST_LENGTH);
+	SHA256 (&der[0], der.size(), &key[0]);
+	OPENSSL_cleanse (&der[0], der.size());
+	return key;
+}
+
+/** @param data Data to authenticate.
+ *  @param size Size of data in bytes.
+ *  @return HMAC-SHA256 of data, with a key derived from our private key.
+ */
+vector<uint8_t>
+KDMStore::cache_mac (uint8_t const * data, int size) const
+{
+	vector<uint8_t> const key = cache_key ("authentication");
+	vector<uint8_t> mac (SHA256_DIGEST_LENGTH);
+	unsigned int length = mac.size ();
+	if (!HMAC (EVP_sha256(), &key[0], key.size(), data, size, &mac[0], &length)) {
+		throw MiscError ("could not authenticate KDM cache");
+	}
+	return mac;
+}
+
+/** Read keys from our cache file, which holds the IV, the AES-256-CBC ciphertext of the
+ *  keys and then an HMAC-SHA256 of the IV and ciphertext.
+ */
+void
+KDMStore::read_cache ()
+{
+	Data const data (*_cache);
+	int const iv_length = EVP_CIPHER_iv_length (EVP_aes_256_cbc());
+	int const mac_length = SHA256_DIGEST_LENGTH;
+	if (data.size() <= iv_length + mac_length) {
+		return;
+	}
+
+	int const ciphertext_length = data.size() - iv_length - mac_length;
+	vector<uint8_t> const mac = cache_mac (data.data().get(), iv_length + ciphertext_length);
+	if (CRYPTO_memcmp (&mac[0], data.data().get() + iv_length + ciphertext_length, mac_length) != 0) {
+		/* Corrupt, tampered with, or written for a different private key; it will be replaced next time we write */
+		return;
+	}
+
+	vector<uint8_t> const key = cache_key ("encryption");
+	vector<uint8_t> plain (ciphertext_length + EVP_CIPHER_block_size (EVP_aes_256_cbc()));
+
+	EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new ();
+	if (!ctx) {
+		throw MiscError ("could not create cipher context");
+	}
+
+	int length = 0;
+	int final_length = 0;
+	bool const ok =
+		EVP_DecryptInit_ex (ctx, EVP_aes_256_cbc(), 0, &key[0], data.data().get()) == 1 &&
+		EVP_DecryptUpdate (ctx, &plain[0], &length, data.data().get() + iv_length, ciphertext_length) == 1 &&
+		EVP_DecryptFinal_ex (ctx, &plain[length], &final_length) == 1;
+	EVP_CIPHER_CTX_free (ctx);
+
+	if (!ok) {
+		/* The MAC was right, so this should not happen; treat it like a bad MAC */
+		return;
+	}
+
+	istringstream s (string (reinterpret_cast<char const *> (&plain[0]), length + final_length));
+	OPENSSL_cleanse (&plain[0], plain.size());
+
+	string line;
+	if (!getline (s, line) || line != cache_magic) {
+		return;
+	}
+
+	set<string> kdm_ids;
+	list<Entry> entries;
+	while (getline (s, line)) {
+		istringstream l (line);
+		string type;
+		l >> type;
+		if (type == "kdm") {
+			string id;
+			l >> id;
+			kdm_ids.insert (id);
+		} else if (type == "key") {
+			string key_type, id, cpl_id, standard, value, not_valid_before, not_valid_after;
+			l >> key_type >> id >> cpl_id >> standard >> value >> not_valid_before >> not_valid_after;
+			if (!l) {
+				throw MiscError (String::compose ("bad line in KDM cache %1", _cache->string()));
+			}
+			entries.push_back (
+				Entry (
+					DecryptedKDMKey (
+						key_type == "-" ? optional<string>() : key_type,
+						id,
+						Key (value),
+						cpl_id,
+						standard == "SMPTE" ? SMPTE : INTEROP
+						),
+					LocalTime (not_valid_before),
+					LocalTime (not_valid_after)
+					)
+				);
+		}
+	}
+
+	boost::mutex::scoped_lock lm (_mutex);
+	_kdm_ids.insert (kdm_ids.begin(), kdm_ids.end());
+	BOOST_FOREACH (Entry const & i, entries) {
+		add_entry (i);
+	}
+}
+
+void
+KDMStore::write_cache () const
+{
+	ostringstream s;
+	s << cache_magic << "\n";
+
+	{
+		boost::mutex::scoped_lock lm (_mutex);
+		BOOST_FOREACH (string const & i, _kdm_ids) {
+			s << "kdm " << i << "\n";
+		}
+		BOOST_FOREACH (Entry const & i, _entries) {
+			s << "key "
+			  << (i.key.type() ? i.key.type().get() : "-") << " "
+			  << i.key.id() << " "
+			  << i.key.cpl_id() << " "
+			  << (i.key.standard() == SMPTE ? "SMPTE" : "INTEROP") << " "
+			  << i.key.key().hex() << " "
+			  << i.not_valid_before.as_string() << " "
+			  << i.not_valid_after.as_string() << "\n";
+		}
+	}
+
+	string plain = s.str ();
+	vector<uint8_t> const key = cache_key ("encryption");
+	int const iv_length = EVP_CIPHER_iv_length (EVP_aes_256_cbc());
+	int const mac_length = SHA256_DIGEST_LENGTH;
+	Data data (iv_length + plain.size() + EVP_CIPHER_block_size (EVP_aes_256_cbc()) + mac_length);
+	uint8_t* out = data.data().get();
+
+	if (RAND_bytes (out, iv_length) != 1) {
+		throw MiscError ("could not make IV for KDM cache");
+	}
+
+	EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new ();
+	if (!ctx) {
+		throw MiscError ("could not create cipher context");
+	}
+
+	int length = 0;
+	int final_length = 0;
+	bool const ok =
+		EVP_EncryptInit_ex (ctx, EVP_aes_256_cbc(), 0, &key[0], out) == 1 &&
+		EVP_EncryptUpdate (ctx, out + iv_length, &length, reinterpret_cast<uint8_t const *> (plain.c_str()), plain.size()) == 1 &&
+		EVP_EncryptFinal_ex (ctx, out + iv_length + length, &final_length) == 1;
+	EVP_CIPHER_CTX_free (ctx);
+	OPENSSL_cleanse (&plain[0], plain.size());
+
+	if (!ok) {
+		throw MiscError (String::compose ("could not encrypt KDM cache (%1)", ERR_error_string (ERR_get_error(), 0)));
+	}
+
+	int const ciphertext_length = length + final_length;
+	vector<uint8_t> const mac = cache_mac (out, iv_length + ciphertext_length);
+	memcpy (out + iv_length + ciphertext_length, &mac[0], mac_length);
+
+	data.set_size (iv_length + ciphertext_length + mac_length);
+	data.write_via_temp (_cache->string() + ".tmp", *_cache);
+}
@@ -0,0 +1,140 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/kdm_store.h
+ *  @brief KDMStore class.
+ */
+
+#ifndef LIBDCP_KDM_STORE_H
+#define LIBDCP_KDM_STORE_H
+
+#include "decrypted_kdm_key.h"
+#include "local_time.h"
+#include <openssl/rsa.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/optional.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <string>
+#include <vector>
+#include <list>
+#include <set>
+
+namespace dcp {
+
+class EncryptedKDM;
+class DCP;
+class CPL;
+
+/** @class KDMStore
+ *  @brief A collection of decrypted keys from many KDMs, all for the same private key.
+ *
+ *  The private key is read once, new KDMs are decrypted by a pool of threads, and the
+ *  keys are indexed by key ID and CPL ID along with the validity window of the KDM
+ *  that they came from.  If a cache file is given the decrypted keys are kept there,
+ *  encrypted and authenticated with keys derived from the private key, so that they do
+ *  not need to be decrypted again when a new KDMStore is made.  A cache file which has
+ *  been changed, or which was written for another private key, is ignored.
+ */
+class KDMStore : public boost::noncopyable
+{
+public:
+	/** @param private_key Private key as a PEM-format string.
+	 *  @param cache File to keep decrypted keys in between runs.  Keys will be read from it
+	 *  if it exists, and it will be rewritten whenever add() finds new KDMs.
+	 */
+	explicit KDMStore (std::string private_key, boost::optional<boost::filesystem::path> cache = boost::optional<boost::filesystem::path> ());
+	~KDMStore ();
+
+	int add (std::vector<EncryptedKDM> const & kdms, int threads);
+
+	boost::optional<Key> key (std::string key_id, LocalTime time) const;
+	std::list<DecryptedKDMKey> keys (std::string cpl_id, LocalTime time) const;
+
+	int give_keys (boost::shared_ptr<const CPL> cpl, LocalTime time) const;
+	int give_keys (boost::shared_ptr<const DCP> dcp, LocalTime time) const;
+
+	/** @return Number of KDMs whose keys are in this store */
+	int kdms () const;
+
+private:
+	/** @struct Entry
+	 *  @brief A key along with the validity window of the KDM that it came from.
+	 */
+	struct Entry
+	{
+		Entry (DecryptedKDMKey key_, LocalTime not_valid_before_, LocalTime not_valid_after_)
+			: key (key_)
+			, not_valid_before (not_valid_before_)
+			, not_valid_after (not_valid_after_)
+		{}
+
+		bool valid_at (LocalTime time) const {
+			return !(time < not_valid_before) && !(not_valid_after < time);
+		}
+
+		DecryptedKDMKey key;
+		LocalTime not_valid_before;
+		LocalTime not_valid_after;
+	};
+
+	struct Batch;
+
+	void add_batch (Batch* batch);
+	void add_kdm (std::string id, std::list<Entry> const & entries);
+	void add_entry (Entry const & entry);
+	boost::optional<Key> key_unlocked (std::string key_id, LocalTime time) const;
+	std::vector<uint8_t> cache_key (std::string purpose) const;
+	std::vector<uint8_t> cache_mac (uint8_t const * data, int size) const;
+	void read_cache ();
+	void write_cache () const;
+
+	RSA* _private_key;
+	boost::optional<boost::filesystem::path> _cache;
+
+	/** mutex for everything below */
+	mutable boost::mutex _mutex;
+	std::vector<Entry> _entries;
+	/** indices into _entries for each key ID */
+	boost::unordered_map<std::string, std::vector<size_t> > _by_key_id;
+	/** indices into _entries for each CPL ID */
+	boost::unordered_map<std::string, std::vector<size_t> > _by_cpl_id;
+	/** IDs of the KDMs whose keys we have */
+	std::set<std::string> _kdm_ids;
+};
+
+}
+
+#endif
@@ -0,0 +1,273 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/lazy_data.cc
+ *  @brief DataSource, FileDataSource and LazyData classes.
+ */
+
+#include "lazy_data.h"
+#include "exceptions.h"
+#include "util.h"
+#include "dcp_assert.h"
+#include "compose.hpp"
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <list>
+
+using std::list;
+using std::string;
+using boost::shared_ptr;
+using boost::optional;
+using namespace dcp;
+
+Data
+FileDataSource::read () const
+{
+	return Data (_file);
+}
+
+string
+FileDataSource::description () const
+{
+	return _file.string ();
+}
+
+struct LazyData::State : public boost::noncopyable
+{
+	State (optional<Data> data_, shared_ptr<const DataSource> source_)
+		: data (data_)
+		, source (source_)
+		, in_lru (false)
+	{}
+
+	~State ()
+	{
+		boost::mutex::scoped_lock lm (mutex);
+		if (in_lru) {
+			drop ();
+		}
+	}
+
+	/** Note that our data have just been used.  Must be called with mutex held */
+	void touch ()
+	{
+		if (in_lru) {
+			lru.splice (lru.end(), lru, position);
+		} else {
+			position = lru.insert (lru.end(), this);
+			in_lru = true;
+			used += data->size ();
+		}
+	}
+
+	/** Forget our data.  Must be called with mutex held */
+	void drop ()
+	{
+		DCP_ASSERT (in_lru);
+		used -= data->size ();
+		lru.erase (position);
+		in_lru = false;
+		data = optional<Data> ();
+	}
+
+	/** Drop least-recently-used data until we are within budget.  Must be called with mutex held.
+	 *  @param keep State whose data should not be dropped.
+	 */
+	static void enforce_budget (State* keep)
+	{
+		list<State*>::iterator i = lru.begin ();
+		while (used > budget && i != lru.end()) {
+			list<State*>::iterator j = i;
+			++i;
+			if (*j != keep) {
+				(*j)->drop ();
+			}
+		}
+	}
+
+	optional<Data> data;
+	shared_ptr<const DataSource> source;
+	/** digest of our data, if we have worked it out */
+	optional<string> digest;
+	/** true if our data were fetched from source and are in lru */
+	bool in_lru;
+	list<State*>::iterator position;
+
+	/** mutex for everything in all States */
+	static boost::mutex mutex;
+	/** States whose data came from their source, least-recently-used first */
+	static list<State*> lru;
+	/** total size of the data of States in lru, in bytes */
+	static int64_t used;
+	static int64_t budget;
+};
+
+boost::mutex LazyData::State::mutex;
+list<LazyData::State*> LazyData::State::lru;
+int64_t LazyData::State::used = 0;
+int64_t LazyData::State::budget = 256 * 1024 * 1024;
+
+LazyData::LazyData ()
+{
+
+}
+
+LazyData::LazyData (Data data)
+	: _state (new State (data, shared_ptr<const DataSource> ()))
+{
+
+}
+
+LazyData::LazyData (shared_ptr<const DataSource> source)
+	: _state (new State (optional<Data> (), source))
+{
+
+}
+
+/** @return Our data, fetching them from our source if required; an empty Data is
+ *  returned if we have no data.
+ */
+Data
+LazyData::get () const
+{
+	if (!_state) {
+		return Data ();
+	}
+
+	{
+		boost::mutex::scoped_lock lm (State::mutex);
+		if (_state->data) {
+			if (_state->source) {
+				_state->touch ();
+			}
+			return _state->data.get ();
+		}
+	}
+
+	/* Fetch without the lock held so that other LazyData can be used in the mean time */
+	DCP_ASSERT (_state->source);
+	Data data = _state->source->read ();
+	string const digest = make_digest (data);
+
+	boost::mutex::scoped_lock lm (State::mutex);
+
+	if (_state->digest && _state->digest.get() != digest) {
+		throw MiscError (String::compose ("%1 has changed since it was first read", _state->source->description ()));
+	}
+	_state->digest = digest;
+
+	if (!_state->data) {
+		_state->data = data;
+	}
+	_state->touch ();
+	State::enforce_budget (_state.get ());
+
+	return _state->data.get ();
+}
+
+/** @return Digest of our data, as returned by make_digest (Data); the data will
+ *  be fetched if this has not been done before.
+ */
+string
+LazyData::digest () const
+{
+	if (!_state) {
+		return make_digest (Data ());
+	}
+
+	{
+		boost::mutex::scoped_lock lm (State::mutex);
+		if (_state->digest) {
+			return _state->digest.get ();
+		}
+	}
+
+	Data data = get ();
+
+	boost::mutex::scoped_lock lm (State::mutex);
+	if (!_state->digest) {
+		_state->digest = make_digest (data);
+	}
+	return _state->digest.get ();
+}
+
+bool
+LazyData::empty () const
+{
+	return !_state || (!_state->source && !_state->data);
+}
+
+/** @return true if our data are in memory */
+bool
+LazyData::loaded () const
+{
+	if (!_state) {
+		return false;
+	}
+
+	boost::mutex::scoped_lock lm (State::mutex);
+	return static_cast<bool> (_state->data);
+}
+
+/** Drop our data from memory if they can be fetched again */
+void
+LazyData::evict () const
+{
+	if (!_state) {
+		return;
+	}
+
+	boost::mutex::scoped_lock lm (State::mutex);
+	if (_state->in_lru) {
+		_state->drop ();
+	}
+}
+
+/** Set the maximum amount of data fetched from DataSources which will be kept in memory.
+ *  The default is 256MB.
+ */
+void
+LazyData::set_memory_budget (int64_t bytes)
+{
+	boost::mutex::scoped_lock lm (State::mutex);
+	State::budget = bytes;
+	State::enforce_budget (0);
+}
+
+/** @return Amount of data fetched from DataSources which is currently in memory, in bytes */
+int64_t
+LazyData::memory_used ()
+{
+	boost::mutex::scoped_lock lm (State::mutex);
+	return State::used;
+}
@@ -0,0 +1,117 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/lazy_data.h
+ *  @brief DataSource, FileDataSource and LazyData classes.
+ */
+
+#ifndef LIBDCP_LAZY_DATA_H
+#define LIBDCP_LAZY_DATA_H
+
+#include "data.h"
+#include <boost/shared_ptr.hpp>
+#include <boost/optional.hpp>
+#include <boost/filesystem.hpp>
+#include <stdint.h>
+#include <string>
+
+namespace dcp {
+
+/** @class DataSource
+ *  @brief Somewhere that a block of data can be fetched from when it is needed.
+ */
+class DataSource
+{
+public:
+	virtual ~DataSource () {}
+
+	/** Fetch the data; this may be called more than once if the data is evicted from memory */
+	virtual Data read () const = 0;
+	/** @return Description of where the data comes from, for error messages */
+	virtual std::string description () const = 0;
+};
+
+/** @class FileDataSource
+ *  @brief A DataSource which reads the whole of a file.
+ */
+class FileDataSource : public DataSource
+{
+public:
+	explicit FileDataSource (boost::filesystem::path file)
+		: _file (file)
+	{}
+
+	Data read () const;
+	std::string description () const;
+
+private:
+	boost::filesystem::path _file;
+};
+
+/** @class LazyData
+ *  @brief A handle to some data which is fetched from a DataSource the first time that it is asked for.
+ *
+ *  Data fetched from a source are counted against a memory budget which is shared by
+ *  all LazyData objects; when the budget is exceeded the least-recently-used data are
+ *  dropped, to be fetched again if they are needed.  The size and digest of data are
+ *  noted when they are first fetched, and a re-fetch which gives something different
+ *  results in a MiscError.  Data given to the constructor directly are never dropped.
+ *
+ *  Copies of a LazyData share the same data.
+ */
+class LazyData
+{
+public:
+	LazyData ();
+	LazyData (Data data);
+	explicit LazyData (boost::shared_ptr<const DataSource> source);
+
+	Data get () const;
+	std::string digest () const;
+
+	/** @return true if there is no data and nowhere to get it from */
+	bool empty () const;
+	bool loaded () const;
+	void evict () const;
+
+	static void set_memory_budget (int64_t bytes);
+	static int64_t memory_used ();
+
+private:
+	struct State;
+	boost::shared_ptr<State> _state;
+};
+
+}
+
+#endif
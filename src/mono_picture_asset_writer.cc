@@ -40,8 +40,12 @@
 #include "picture_asset.h"
 #include "dcp_assert.h"
 #include "crypto_context.h"
+#include "instrumentation.h"
+#include "ordered_writes.h"
 #include <asdcp/AS_DCP.h>
 #include <asdcp/KM_fileio.h>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
 
 #include "picture_asset_writer_common.cc"
 
@@ -52,8 +56,41 @@ using namespace dcp;
 struct MonoPictureAssetWriter::ASDCPState : public ASDCPStateBase
 {
 	ASDCP::JP2K::MXFWriter mxf_writer;
+	/** buffers for frames which are being copied from another asset */
+	std::vector<shared_ptr<ASDCP::JP2K::FrameBuffer> > copy_buffers;
+	OrderedWrites<shared_ptr<ASDCP::JP2K::FrameBuffer>, FrameInfo> ordered;
 };
 
+/** Number of frames that copy_frames() reads at once */
+static int const copy_batch = 4;
+
+/** Set the plaintext offset of a JPEG2000 frame which has not been through a CodestreamParser
+ *  (for example because it was read from another MXF) to where the parser would put it: just
+ *  after the SOD marker, so that the codestream headers are not encrypted.
+ */
+static void
+set_plaintext_offset (ASDCP::JP2K::FrameBuffer& buffer)
+{
+	uint8_t const * p = buffer.RoData ();
+	uint32_t const size = buffer.Size ();
+
+	if (size < 2 || p[0] != 0xff || p[1] != 0x4f) {
+		boost::throw_exception (MiscError ("J2K frame does not start with SOC"));
+	}
+
+	/* Every marker after SOC and before SOD is followed by the length of its segment */
+	uint32_t pos = 2;
+	while (pos + 4 <= size && p[pos] == 0xff) {
+		if (p[pos + 1] == 0x93) {
+			buffer.PlaintextOffset (pos + 2);
+			return;
+		}
+		pos += 2 + ((p[pos + 2] << 8) | p[pos + 3]);
+	}
+
+	boost::throw_exception (MiscError ("could not find SOD in J2K frame"));
+}
+
 /** @param a Asset to write to.  `a' must not be deleted while
  *  this writer class still exists, or bad things will happen.
  */
@@ -64,6 +101,12 @@ MonoPictureAssetWriter::MonoPictureAssetWriter (PictureAsset* asset, boost::file
 
 }
 
+MonoPictureAssetWriter::~MonoPictureAssetWriter ()
+{
+	/* Stop any write-behind thread before our state goes away */
+	stop_write_behind ();
+}
+
 void
 MonoPictureAssetWriter::start (uint8_t const * data, int size)
 {
@@ -75,6 +118,7 @@ FrameInfo
 MonoPictureAssetWriter::write (uint8_t const * data, int size)
 {
 	DCP_ASSERT (!_finalized);
+	wait_for_write_behind ();
 
 	if (!_started) {
 		start (data, size);
@@ -84,10 +128,124 @@ MonoPictureAssetWriter::write (uint8_t const * data, int size)
  		boost::throw_exception (MiscError ("could not parse J2K frame"));
  	}
 
+	return write_frame_buffer (_state->frame_buffer);
+}
+
+/** Write a frame which may be given out of order; this method may be called
+ *  by several threads at once.  Each frame is parsed by the calling thread
+ *  and then written (and, if required, encrypted) once all the frames before
+ *  it have been written.
+ *  @param index Index of the frame within the asset, starting from 0.
+ *  @param data JPEG2000 data.
+ *  @param size Size of data in bytes.
+ *  @return Details of the written frame; this method returns once the frame has been written.
+ */
+FrameInfo
+MonoPictureAssetWriter::write_frame (int64_t index, uint8_t const * data, int size)
+{
+	DCP_ASSERT (!_finalized);
+
+	shared_ptr<ASDCP::JP2K::FrameBuffer> buffer (new ASDCP::JP2K::FrameBuffer (size));
+	ASDCP::JP2K::CodestreamParser parser;
+	if (ASDCP_FAILURE (parser.OpenReadFrame (data, size, *buffer))) {
+		boost::throw_exception (MiscError ("could not parse J2K frame"));
+	}
+
+	return _state->ordered.submit (index, buffer, boost::bind (&MonoPictureAssetWriter::write_ordered_frame, this, _1));
+}
+
+/** As write_frame (int64_t, uint8_t const *, int) but with a frame that is already in a buffer,
+ *  such as one read from another MXF.  The frame is written from the buffer without being copied
+ *  or parsed; the only work done is to find the end of the codestream headers if this asset is
+ *  encrypted.  The caller may re-use the buffer once this method has returned.
+ *  @param index Index of the frame within the asset, starting from 0.
+ *  @param buffer Frame; its plaintext offset may be changed.
+ *  @return Details of the written frame.
+ */
+FrameInfo
+MonoPictureAssetWriter::write_frame (int64_t index, shared_ptr<ASDCP::JP2K::FrameBuffer> buffer)
+{
+	DCP_ASSERT (!_finalized);
+
+	if (_crypto_context->context ()) {
+		set_plaintext_offset (*buffer);
+	}
+
+	return _state->ordered.submit (index, buffer, boost::bind (&MonoPictureAssetWriter::write_ordered_frame, this, _1));
+}
+
+/** Copy a range of frames from another asset.  The frames' data are read a batch of
+ *  frames at a time (see AssetReader::read_frames()) straight into buffers and written
+ *  from there, so the codestreams are not copied again or re-parsed (other than the
+ *  first, if this writer has not yet started, and a scan of the headers to find where
+ *  encryption should start if this asset is encrypted).  If the source asset is encrypted
+ *  the reader must have its key.
+ *  @param reader Reader for the source asset.
+ *  @param from First frame index to copy.
+ *  @param to Frame index to stop copying at (so the last frame copied is to - 1).
+ */
+void
+MonoPictureAssetWriter::copy_frames (shared_ptr<const MonoPictureAssetReader> reader, int64_t from, int64_t to)
+{
+	DCP_ASSERT (!_finalized);
+	wait_for_write_behind ();
+
+	while (_state->copy_buffers.size() < size_t (copy_batch)) {
+		_state->copy_buffers.push_back (shared_ptr<ASDCP::JP2K::FrameBuffer> (new ASDCP::JP2K::FrameBuffer (4 * Kumu::Megabyte)));
+	}
+
+	for (int64_t i = from; i < to; i += copy_batch) {
+		std::vector<ASDCP::JP2K::FrameBuffer*> buffers;
+		for (int j = 0; j < std::min (int64_t (copy_batch), to - i); ++j) {
+			buffers.push_back (_state->copy_buffers[j].get());
+		}
+
+		reader->read_frames (i, buffers);
+
+		BOOST_FOREACH (ASDCP::JP2K::FrameBuffer* j, buffers) {
+			if (!_started) {
+				start (j->RoData(), j->Size());
+			}
+			if (_crypto_context->context ()) {
+				/* The reader may have left the plaintext offset at 0, or at its value
+				   from an earlier frame, and the codestream headers must not be encrypted.
+				*/
+				set_plaintext_offset (*j);
+			}
+			write_frame_buffer (*j);
+		}
+	}
+}
+
+/** Stop writing frames with write_frame(); any threads which are waiting in
+ *  write_frame(), or which call it later, will throw MiscError.
+ *  @param error Description of why writing has been stopped.
+ */
+void
+MonoPictureAssetWriter::abort_frames (string error)
+{
+	_state->ordered.abort (error);
+}
+
+FrameInfo
+MonoPictureAssetWriter::write_ordered_frame (shared_ptr<ASDCP::JP2K::FrameBuffer> buffer)
+{
+	if (!_started) {
+		start (buffer->RoData(), buffer->Size());
+	}
+
+	return write_frame_buffer (*buffer);
+}
+
+FrameInfo
+MonoPictureAssetWriter::write_frame_buffer (ASDCP::JP2K::FrameBuffer const & buffer)
+{
+	Instrumentation::Span span (Instrumentation::MXF_WRITE, buffer.Size ());
+
 	uint64_t const before_offset = _state->mxf_writer.Tell ();
 
 	string hash;
-	ASDCP::Result_t const r = _state->mxf_writer.WriteFrame (_state->frame_buffer, _crypto_context->context(), _crypto_context->hmac(), &hash);
+	ASDCP::Result_t const r = _state->mxf_writer.WriteFrame (buffer, _crypto_context->context(), _crypto_context->hmac(), &hash);
 	if (ASDCP_FAILURE (r)) {
 		boost::throw_exception (MXFFileError ("error in writing video MXF", _file.string(), r));
 	}
@@ -99,8 +257,9 @@ MonoPictureAssetWriter::write (uint8_t const * data, int size)
 void
 MonoPictureAssetWriter::fake_write (int size)
 {
-	DCP_ASSERT (_started);
 	DCP_ASSERT (!_finalized);
+	wait_for_write_behind ();
+	DCP_ASSERT (_started);
 
 	Kumu::Result_t r = _state->mxf_writer.FakeWriteFrame (size);
 	if (ASDCP_FAILURE (r)) {
@@ -113,11 +272,16 @@ MonoPictureAssetWriter::fake_write (int size)
 bool
 MonoPictureAssetWriter::finalize ()
 {
+	wait_for_write_behind ();
+	stop_write_behind ();
+	_state->ordered.check_complete ();
+
 	if (_started) {
 		Kumu::Result_t r = _state->mxf_writer.Finalize();
 		if (ASDCP_FAILURE (r)) {
 			boost::throw_exception (MXFFileError ("error in finalizing video MXF", _file.string(), r));
 		}
+		release_preallocation ();
 	}
 
 	_picture_asset->_intrinsic_duration = _frames_written;
@@ -39,11 +39,18 @@
 #define LIBDCP_MONO_PICTURE_ASSET_WRITER_H
 
 #include "picture_asset_writer.h"
+#include "mono_picture_asset_reader.h"
 #include <boost/shared_ptr.hpp>
 #include <boost/utility.hpp>
 #include <stdint.h>
 #include <string>
 
+namespace ASDCP {
+	namespace JP2K {
+		class FrameBuffer;
+	}
+}
+
 namespace dcp {
 
 /** @class MonoPictureAssetWriter
@@ -55,11 +62,28 @@ namespace dcp {
  *  (a verbatim .j2c file).  finalize() must be called after the last frame has been written.
  *  The action of finalize() can't be done in MonoPictureAssetWriter's destructor as it may
  *  throw an exception.
+ *
+ *  Alternatively, several threads may call write_frame() at the same time, each with a frame
+ *  and its index; frames are parsed on the calling threads and written to the file in index
+ *  order.  write() and write_frame() should not be used on the same writer.  If a thread
+ *  cannot produce its frame it should call abort_frames() so that the others do not wait for
+ *  it forever, and finalize() will throw if any frames were left waiting for a missing one.
+ *
+ *  asdcplib's writer does the AES encryption and HMAC itself as each frame is written, and
+ *  cannot be given frames which are already encrypted, so write_frame() does not spread
+ *  encryption across the calling threads: for an encrypted asset it is done one frame at
+ *  a time.
  */
 class MonoPictureAssetWriter : public PictureAssetWriter
 {
 public:
+	~MonoPictureAssetWriter ();
+
 	FrameInfo write (uint8_t const *, int);
+	FrameInfo write_frame (int64_t index, uint8_t const *, int);
+	FrameInfo write_frame (int64_t index, boost::shared_ptr<ASDCP::JP2K::FrameBuffer> buffer);
+	void copy_frames (boost::shared_ptr<const MonoPictureAssetReader> reader, int64_t from, int64_t to);
+	void abort_frames (std::string error);
 	void fake_write (int size);
 	bool finalize ();
 
@@ -68,6 +92,11 @@ private:
 
 	MonoPictureAssetWriter (PictureAsset *, boost::filesystem::path file, bool);
 	void start (uint8_t const *, int);
+	int writes_per_frame () const {
+		return 1;
+	}
+	FrameInfo write_frame_buffer (ASDCP::JP2K::FrameBuffer const &);
+	FrameInfo write_ordered_frame (boost::shared_ptr<ASDCP::JP2K::FrameBuffer>);
 
 	/* do this with an opaque pointer so we don't have to include
 	   ASDCP headers
@@ -43,6 +43,7 @@
 #include "compose.hpp"
 #include "j2k.h"
 #include "crypto_context.h"
+#include "instrumentation.h"
 #include <asdcp/KM_fileio.h>
 #include <asdcp/AS_DCP.h>
 
@@ -55,6 +56,8 @@ using namespace dcp;
  *  @param path Path to JPEG2000 file.
  */
 MonoPictureFrame::MonoPictureFrame (boost::filesystem::path path)
+	: _view (0)
+	, _view_size (0)
 {
 	boost::uintmax_t const size = boost::filesystem::file_size (path);
 	_buffer = new ASDCP::JP2K::FrameBuffer (size);
@@ -77,20 +80,43 @@ MonoPictureFrame::MonoPictureFrame (boost::filesystem::path path)
  *  @param reader Reader for the asset's MXF file.
  *  @param n Frame within the asset, not taking EntryPoint into account.
  *  @param c Context for decryption, or 0.
+ *  @param essence Reader to use for unencrypted frames, or 0 to use asdcplib.  If the reader's
+ *  IOBackend has the file mapped into memory the frame will point to its data there rather than
+ *  taking a copy.
  */
-MonoPictureFrame::MonoPictureFrame (ASDCP::JP2K::MXFReader* reader, int n, shared_ptr<DecryptionContext> c)
+MonoPictureFrame::MonoPictureFrame (ASDCP::JP2K::MXFReader* reader, int n, shared_ptr<DecryptionContext> c, shared_ptr<EssenceReader> essence)
+	: _buffer (0)
+	, _view (0)
+	, _view_size (0)
 {
+	Instrumentation::Span span (Instrumentation::MXF_READ);
+
+	if (essence && essence->view_frame (reader, n, _view, _view_size)) {
+		_view_owner = essence->io ();
+		span.set_bytes (_view_size);
+		return;
+	}
+
 	/* XXX: unfortunate guesswork on this buffer size */
 	_buffer = new ASDCP::JP2K::FrameBuffer (4 * Kumu::Megabyte);
 
-	ASDCP::Result_t const r = reader->ReadFrame (n, *_buffer, c->context(), c->hmac());
+	if (essence && essence->read_frame (reader, n, *_buffer)) {
+		span.set_bytes (_buffer->Size ());
+		return;
+	}
+
+	ASDCP::Result_t const r = c->read_frame (reader, n, *_buffer);
 
 	if (ASDCP_FAILURE (r)) {
 		boost::throw_exception (DCPReadError (String::compose ("could not read video frame %1 (%2)", n, static_cast<int>(r))));
 	}
+
+	span.set_bytes (_buffer->Size ());
 }
 
 MonoPictureFrame::MonoPictureFrame (uint8_t const * data, int size)
+	: _view (0)
+	, _view_size (0)
 {
 	_buffer = new ASDCP::JP2K::FrameBuffer (size);
 	_buffer->Size (size);
@@ -107,13 +133,23 @@ MonoPictureFrame::~MonoPictureFrame ()
 uint8_t const *
 MonoPictureFrame::j2k_data () const
 {
-	return _buffer->RoData ();
+	return _buffer ? _buffer->RoData() : _view;
 }
 
 /** @return Pointer to JPEG2000 data */
 uint8_t *
 MonoPictureFrame::j2k_data ()
 {
+	if (!_buffer) {
+		/* The data we are looking at are read-only so we must make our own copy */
+		_buffer = new ASDCP::JP2K::FrameBuffer (_view_size);
+		memcpy (_buffer->Data(), _view, _view_size);
+		_buffer->Size (_view_size);
+		_view = 0;
+		_view_size = 0;
+		_view_owner.reset ();
+	}
+
 	return _buffer->Data ();
 }
 
@@ -121,7 +157,14 @@ MonoPictureFrame::j2k_data ()
 int
 MonoPictureFrame::j2k_size () const
 {
-	return _buffer->Size ();
+	return _buffer ? _buffer->Size() : _view_size;
+}
+
+/** @return true if this frame's data are in a memory-mapped file rather than a copy of our own */
+bool
+MonoPictureFrame::mapped () const
+{
+	return _view_owner.get() != 0;
 }
 
 /** @param reduce a factor by which to reduce the resolution
@@ -131,5 +174,5 @@ MonoPictureFrame::j2k_size () const
 shared_ptr<OpenJPEGImage>
 MonoPictureFrame::xyz_image (int reduce) const
 {
-	return decompress_j2k (const_cast<uint8_t*> (_buffer->RoData()), _buffer->Size(), reduce);
+	return decompress_j2k (const_cast<uint8_t*> (j2k_data()), j2k_size(), reduce);
 }
@@ -61,6 +61,9 @@ class OpenJPEGImage;
 
 /** @class MonoPictureFrame
  *  @brief A single frame of a 2D (monoscopic) picture asset.
+ *
+ *  Unencrypted frames from a reader whose IOBackend is MMAP point straight into the mapped
+ *  MXF, and keep the mapping alive, rather than having a copy of their data.
  */
 class MonoPictureFrame : public boost::noncopyable
 {
@@ -74,6 +77,7 @@ public:
 	uint8_t const * j2k_data () const;
 	uint8_t* j2k_data ();
 	int j2k_size () const;
+	bool mapped () const;
 
 private:
 	/* XXX: this is a bit of a shame, but I tried friend MonoPictureAssetReader and it's
@@ -81,9 +85,15 @@ private:
 	*/
 	friend class AssetReader<ASDCP::JP2K::MXFReader, MonoPictureFrame>;
 
-	MonoPictureFrame (ASDCP::JP2K::MXFReader* reader, int n, boost::shared_ptr<DecryptionContext>);
+	MonoPictureFrame (ASDCP::JP2K::MXFReader* reader, int n, boost::shared_ptr<DecryptionContext>, boost::shared_ptr<EssenceReader>);
 
+	/** our copy of the frame's data, or 0 if we are using _view */
 	ASDCP::JP2K::FrameBuffer* _buffer;
+	/** the frame's data in someone else's memory, if _buffer is 0 */
+	uint8_t const * _view;
+	int _view_size;
+	/** the holder of _view's memory, which we keep alive */
+	boost::shared_ptr<IOBackend> _view_owner;
 };
 
 }
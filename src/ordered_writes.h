@@ -0,0 +1,183 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/ordered_writes.h
+ *  @brief OrderedWrites class.
+ */
+
+#ifndef LIBDCP_ORDERED_WRITES_H
+#define LIBDCP_ORDERED_WRITES_H
+
+#include "exceptions.h"
+#include "dcp_assert.h"
+#include "compose.hpp"
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
+#include <map>
+#include <string>
+#include <stdint.h>
+
+namespace dcp {
+
+/** @class OrderedWrites
+ *  @brief Helper which lets several threads hand frames to a writer which must write them in order.
+ *
+ *  Each thread prepares its frame and then calls submit() with the frame's index.  A frame
+ *  is written by whichever submitting thread finds that all the frames before it have been
+ *  written, and submit() returns the result of writing the caller's frame once that has
+ *  happened.  If a write fails, the exception is thrown to the thread which was doing the
+ *  write and a MiscError is thrown to any others that are waiting.
+ */
+template <class F, class R>
+class OrderedWrites : public boost::noncopyable
+{
+public:
+	OrderedWrites ()
+		: _next (0)
+		, _writing (false)
+	{}
+
+	/** @param index Index of the frame, starting from 0.
+	 *  @param frame Frame.
+	 *  @param write Function to write a frame; it will be called for each frame in index order.
+	 *  @return Result of writing frame.
+	 */
+	R submit (int64_t index, F frame, boost::function<R (F)> write)
+	{
+		boost::mutex::scoped_lock lm (_mutex);
+		DCP_ASSERT (index >= _next);
+		DCP_ASSERT (_pending.find(index) == _pending.end());
+		_pending[index] = frame;
+
+		while (true) {
+			if (_error) {
+				throw MiscError (*_error);
+			}
+
+			typename std::map<int64_t, R>::iterator i = _done.find (index);
+			if (i != _done.end()) {
+				R const r = i->second;
+				_done.erase (i);
+				return r;
+			}
+
+			if (_writing || _pending.find(_next) == _pending.end()) {
+				_condition.wait (lm);
+				continue;
+			}
+
+			_writing = true;
+			typename std::map<int64_t, F>::iterator j = _pending.find (_next);
+			while (j != _pending.end()) {
+				F const f = j->second;
+				_pending.erase (j);
+				lm.unlock ();
+				R r;
+				try {
+					r = write (f);
+				} catch (std::exception& e) {
+					lm.lock ();
+					_error = e.what ();
+					_writing = false;
+					_condition.notify_all ();
+					throw;
+				} catch (...) {
+					lm.lock ();
+					_error = "unknown exception while writing a frame";
+					_writing = false;
+					_condition.notify_all ();
+					throw;
+				}
+				lm.lock ();
+				_done[_next] = r;
+				++_next;
+				_condition.notify_all ();
+				j = _pending.find (_next);
+			}
+			_writing = false;
+			_condition.notify_all ();
+		}
+	}
+
+	/** Give up on writing any more frames, for example because some thread
+	 *  cannot produce the frame it was supposed to submit.  Any threads which
+	 *  are waiting in submit(), and any which call it later, will throw MiscError.
+	 *  @param error Description of the problem.
+	 */
+	void abort (std::string error)
+	{
+		boost::mutex::scoped_lock lm (_mutex);
+		if (!_error) {
+			_error = error;
+		}
+		_condition.notify_all ();
+	}
+
+	/** Throw MiscError if any frames were submitted but not written because a frame
+	 *  before them never was; a writer should call this before it is finalized.
+	 */
+	void check_complete () const
+	{
+		boost::mutex::scoped_lock lm (_mutex);
+		if (!_pending.empty ()) {
+			throw MiscError (
+				String::compose ("frame %1 was never written, so %2 later frame(s) could not be", _next, _pending.size())
+				);
+		}
+	}
+
+	/** @return index of the next frame to be written */
+	int64_t next () const {
+		boost::mutex::scoped_lock lm (_mutex);
+		return _next;
+	}
+
+private:
+	mutable boost::mutex _mutex;
+	boost::condition_variable _condition;
+	/** frames which have been submitted but not yet written */
+	std::map<int64_t, F> _pending;
+	/** results of writes which have not yet been collected by their submitters */
+	std::map<int64_t, R> _done;
+	int64_t _next;
+	/** true if some thread is writing frames */
+	bool _writing;
+	boost::optional<std::string> _error;
+};
+
+}
+
+#endif
@@ -34,12 +34,23 @@
 #include "picture_asset_writer.h"
 #include "exceptions.h"
 #include "picture_asset.h"
+#include "write_behind.h"
+#include "data.h"
+#include "dcp_assert.h"
+#include "crypto_context.h"
+#include "util.h"
 #include <asdcp/KM_fileio.h>
 #include <asdcp/AS_DCP.h>
+#include <openssl/md5.h>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 #include <inttypes.h>
 #include <stdint.h>
+#include <cstdio>
 
 using std::string;
+using std::vector;
+using std::min;
 using boost::shared_ptr;
 using namespace dcp;
 
@@ -47,6 +58,327 @@ PictureAssetWriter::PictureAssetWriter (PictureAsset* asset, boost::filesystem::
 	: AssetWriter (asset, file)
 	, _picture_asset (asset)
 	, _overwrite (overwrite)
+	, _write_behind_queue_length (16)
 {
 	asset->set_file (file);
 }
+
+PictureAssetWriter::~PictureAssetWriter ()
+{
+	/* Subclasses should already have done this, as our thread uses their state */
+	stop_write_behind ();
+}
+
+/** Queue a frame to be written by this writer's own thread, so that the caller need not wait
+ *  for it to be written.  The frame is copied, so the caller may re-use its data once this
+ *  method has returned.  Frames are written in the order that they are given to this method.
+ *
+ *  This method only blocks if the queue is full (see set_write_behind_queue_length()).  If
+ *  writing a queued frame fails, the error is thrown as a MiscError by the next call to this
+ *  method or by finalize().  Calls to write() and fake_write() wait for the queue to be
+ *  written first.
+ *
+ *  @param data JPEG2000 data.
+ *  @param size Size of data in bytes.
+ *  @param done Function to call with the details of the frame once it has been written; this
+ *  will be called from the writer's thread.
+ */
+void
+PictureAssetWriter::write_async (uint8_t const * data, int size, boost::function<void (FrameInfo)> done)
+{
+	DCP_ASSERT (!_finalized);
+
+	if (!_write_behind) {
+		_write_behind.reset (new WriteBehind (_write_behind_queue_length));
+	}
+
+	_write_behind->submit (boost::bind (&PictureAssetWriter::write_queued, this, Data (data, size), done));
+}
+
+/** Set the number of frames given to write_async() which may be waiting to be written
+ *  before write_async() blocks.  The default is 16.  This must be called before
+ *  write_async() is first called.
+ */
+void
+PictureAssetWriter::set_write_behind_queue_length (int frames)
+{
+	DCP_ASSERT (!_write_behind);
+	_write_behind_queue_length = frames;
+}
+
+/** Say how big the asset being written is likely to be, so that disk space can be reserved
+ *  for it up-front.  This must be called before the first write.
+ *  @param frames Expected duration in frames (at the asset's edit rate).
+ *  @param bit_rate Expected average bit rate of the JPEG2000 data in bits per second.
+ */
+void
+PictureAssetWriter::set_size_hint (int64_t frames, int64_t bit_rate)
+{
+	DCP_ASSERT (!_started);
+	Fraction const rate = _picture_asset->edit_rate ();
+	/* Some slack for the KLV wrapping of each frame and the index */
+	_expected_size = frames * bit_rate * rate.denominator / (8 * rate.numerator) + frames * 64 + 1024 * 1024;
+}
+
+void
+PictureAssetWriter::write_queued (Data data, boost::function<void (FrameInfo)> done)
+{
+	FrameInfo const info = write (data.data().get(), data.size());
+	if (done) {
+		done (info);
+	}
+}
+
+/** Wait for any frames given to write_async() to be written, throwing MiscError if
+ *  there was a problem writing them.  This does nothing if it is called from the
+ *  thread which writes those frames.
+ */
+void
+PictureAssetWriter::wait_for_write_behind ()
+{
+	if (_write_behind && !_write_behind->in_thread ()) {
+		_write_behind->flush ();
+	}
+}
+
+/** Stop the thread which writes frames given to write_async(), dropping any which have
+ *  not yet been written.  This must be called by subclass destructors.
+ */
+void
+PictureAssetWriter::stop_write_behind ()
+{
+	_write_behind.reset ();
+}
+
+/** Seek from the start of a file, allowing offsets beyond 2GB */
+static int
+seek (FILE* f, int64_t offset)
+{
+#ifdef LIBDCP_WINDOWS
+	return _fseeki64 (f, offset, SEEK_SET);
+#else
+	return fseeko (f, offset, SEEK_SET);
+#endif
+}
+
+/** @return MD5 digest of some data as a hex string, as asdcplib gives in FrameInfo::hash */
+static string
+md5_digest (uint8_t const * data, int64_t size)
+{
+	MD5_CTX md5;
+	MD5_Init (&md5);
+	MD5_Update (&md5, data, size);
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	MD5_Final (digest, &md5);
+
+	char hex[MD5_DIGEST_LENGTH * 2 + 1];
+	for (int i = 0; i < MD5_DIGEST_LENGTH; ++i) {
+		snprintf (hex + i * 2, 3, "%02x", digest[i]);
+	}
+	return hex;
+}
+
+/** Check some frames in a file against their FrameInfos, stopping at the first one which is wrong.
+ *  @param file File to check.
+ *  @param frames FrameInfos.
+ *  @param from First index in frames to check.
+ *  @param to Index in frames to stop at.
+ *  @param good Entries in this are set to 1 for frames which are correct.
+ */
+static void
+check_frames (boost::filesystem::path file, vector<FrameInfo> const * frames, size_t from, size_t to, vector<uint8_t>* good)
+{
+	FILE* f = fopen_boost (file, "rb");
+	if (!f) {
+		return;
+	}
+
+	vector<uint8_t> data;
+	for (size_t i = from; i < to; ++i) {
+		FrameInfo const & info = (*frames)[i];
+		data.resize (info.size);
+		if (
+			info.size == 0 ||
+			seek (f, info.offset) != 0 ||
+			fread (&data[0], 1, info.size, f) != info.size ||
+			md5_digest (&data[0], info.size) != info.hash
+			) {
+			break;
+		}
+		(*good)[i] = 1;
+	}
+
+	fclose (f);
+}
+
+/** Read a BER-encoded length, moving p past it.
+ *  @return false if there is no valid length at p.
+ */
+static bool
+read_ber (uint8_t const *& p, uint8_t const * end, uint64_t& length)
+{
+	if (p >= end) {
+		return false;
+	}
+
+	if (*p < 0x80) {
+		length = *p++;
+		return true;
+	}
+
+	int const bytes = *p++ & 0x7f;
+	if (bytes == 0 || bytes > 8 || (end - p) < bytes) {
+		return false;
+	}
+
+	length = 0;
+	for (int i = 0; i < bytes; ++i) {
+		length = (length << 8) | *p++;
+	}
+	return true;
+}
+
+/** @return JPEG2000 codestream of a frame which is already in our file, decrypting it if required */
+Data
+PictureAssetWriter::existing_frame (FrameInfo const & info) const
+{
+	Data packet (info.size);
+	FILE* f = fopen_boost (_file, "rb");
+	if (!f) {
+		boost::throw_exception (FileError ("could not open MXF to resume writing", _file, errno));
+	}
+	bool const ok = seek (f, info.offset) == 0 && fread (packet.data().get(), 1, info.size, f) == info.size;
+	fclose (f);
+	if (!ok) {
+		boost::throw_exception (FileError ("could not read frame from MXF", _file, errno));
+	}
+
+	/* Frames are a KLV packet; skip the key and find the value */
+	uint8_t const * key = packet.data().get();
+	uint8_t const * p = key + 16;
+	uint8_t const * end = key + packet.size();
+	uint64_t length;
+	if (packet.size() < 17 || !read_ber (p, end, length) || length > uint64_t (end - p)) {
+		boost::throw_exception (MiscError ("could not parse frame in MXF"));
+	}
+	end = p + length;
+
+	if (key[4] != 0x02 || key[5] != 0x04) {
+		/* Not an encrypted triplet, so it is the codestream */
+		return Data (p, length);
+	}
+
+	/* Encrypted triplet (SMPTE 429-6): cryptographic context ID, plaintext offset, source key,
+	   source length and encrypted source value, each with a BER-encoded length.
+	*/
+	uint8_t const * items[5];
+	uint64_t sizes[5];
+	for (int i = 0; i < 5; ++i) {
+		if (!read_ber (p, end, sizes[i]) || sizes[i] > uint64_t (end - p)) {
+			boost::throw_exception (MiscError ("could not parse encrypted frame in MXF"));
+		}
+		items[i] = p;
+		p += sizes[i];
+	}
+
+	if (sizes[1] != 8 || sizes[3] != 8) {
+		boost::throw_exception (MiscError ("could not parse encrypted frame in MXF"));
+	}
+
+	uint64_t plaintext_offset = 0;
+	uint64_t source_length = 0;
+	for (int i = 0; i < 8; ++i) {
+		plaintext_offset = (plaintext_offset << 8) | items[1][i];
+		source_length = (source_length << 8) | items[3][i];
+	}
+
+	if (!_picture_asset->key()) {
+		boost::throw_exception (MiscError ("cannot resume writing an encrypted MXF without its key"));
+	}
+
+	ASDCP::JP2K::FrameBuffer in (sizes[4]);
+	memcpy (in.Data(), items[4], sizes[4]);
+	in.Size (sizes[4]);
+	in.PlaintextOffset (plaintext_offset);
+	in.SourceLength (source_length);
+
+	ASDCP::JP2K::FrameBuffer out (source_length);
+	DecryptionContext context (_picture_asset->key(), _picture_asset->standard(), DecryptionContext::OPENSSL_EVP, false);
+	if (ASDCP_FAILURE (context.decrypt (in, out))) {
+		boost::throw_exception (MiscError ("could not decrypt frame in MXF"));
+	}
+
+	return Data (out.RoData(), out.Size());
+}
+
+/** Carry on writing an MXF which was partly written before (by a writer which was not finalized,
+ *  perhaps because of a crash).  This writer must have been created with overwrite set to true,
+ *  for the same file and an asset with the same details (ID, key and so on), and nothing must have
+ *  been written with it yet.
+ *
+ *  The frames in the file are checked against their FrameInfos, using several threads.  The file is
+ *  cut off after the last correct frame (so that any partly-written frame is removed) and this writer
+ *  is set up so that the next write() will write the frame after it.  Frames are not re-written,
+ *  but the index will include them when the writer is finalized.
+ *
+ *  @param frames The FrameInfo returned by each write() to the file, in order.
+ *  @return Number of frames (not writes, for stereoscopic assets) which are already in the file;
+ *  the caller should carry on by writing the frame with this index.
+ */
+int64_t
+PictureAssetWriter::resume (vector<FrameInfo> const & frames)
+{
+	DCP_ASSERT (_overwrite);
+	DCP_ASSERT (!_started);
+	DCP_ASSERT (!_finalized);
+
+	if (!boost::filesystem::exists (_file)) {
+		_overwrite = false;
+		return 0;
+	}
+
+	/* Only frames which follow on from each other and fit in the file can be used */
+	boost::uintmax_t const file_size = boost::filesystem::file_size (_file);
+	size_t candidates = 0;
+	while (
+		candidates < frames.size() &&
+		(candidates == 0 || frames[candidates].offset == frames[candidates - 1].offset + frames[candidates - 1].size) &&
+		(frames[candidates].offset + frames[candidates].size) <= file_size
+		) {
+		++candidates;
+	}
+
+	vector<uint8_t> good (candidates, 0);
+	int const threads = min (size_t (std::max (1U, boost::thread::hardware_concurrency ())), std::max (size_t (1), candidates));
+	boost::thread_group group;
+	for (int i = 0; i < threads; ++i) {
+		group.create_thread (
+			boost::bind (&check_frames, _file, &frames, candidates * i / threads, candidates * (i + 1) / threads, &good)
+			);
+	}
+	group.join_all ();
+
+	size_t valid = 0;
+	while (valid < candidates && good[valid]) {
+		++valid;
+	}
+
+	/* Only whole frames of stereoscopic assets can be used */
+	valid -= valid % writes_per_frame ();
+
+	if (valid == 0) {
+		boost::filesystem::remove (_file);
+		_overwrite = false;
+		return 0;
+	}
+
+	boost::filesystem::resize_file (_file, frames[valid - 1].offset + frames[valid - 1].size);
+
+	Data first = existing_frame (frames[0]);
+	start (first.data().get(), first.size());
+	for (size_t i = 0; i < valid; ++i) {
+		fake_write (frames[i].size);
+	}
+
+	return valid / writes_per_frame ();
+}
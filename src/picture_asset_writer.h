@@ -43,12 +43,16 @@
 #include "asset_writer.h"
 #include <boost/shared_ptr.hpp>
 #include <boost/utility.hpp>
+#include <boost/function.hpp>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 namespace dcp {
 
 class PictureAsset;
+class WriteBehind;
+class Data;
 
 /** @class FrameInfo
  *  @brief Information about a single frame (either a monoscopic frame or a left *or* right eye stereoscopic frame)
@@ -73,21 +77,52 @@ struct FrameInfo
 
 /** @class PictureAssetWriter
  *  @brief Parent class for classes which write picture assets.
+ *
+ *  As well as being written with write(), frames can be handed to write_async(), which
+ *  copies them into a queue and returns straight away; they are then written in order
+ *  by a thread belonging to the writer.
+ *
+ *  If writing an asset is interrupted (by a crash, for example) the writing can be carried
+ *  on later by making a writer for the same file with overwrite set to true, and then
+ *  calling resume() with the FrameInfo of each frame that was written.
  */
 class PictureAssetWriter : public AssetWriter
 {
 public:
+	~PictureAssetWriter ();
+
 	virtual FrameInfo write (uint8_t const *, int) = 0;
 	virtual void fake_write (int) = 0;
 
+	void write_async (uint8_t const * data, int size, boost::function<void (FrameInfo)> done = boost::function<void (FrameInfo)> ());
+	void set_write_behind_queue_length (int frames);
+	void set_size_hint (int64_t frames, int64_t bit_rate);
+	int64_t resume (std::vector<FrameInfo> const & frames);
+
 protected:
 	template <class P, class Q>
 	friend void start (PictureAssetWriter *, boost::shared_ptr<P>, Q *, uint8_t const *, int);
 
 	PictureAssetWriter (PictureAsset *, boost::filesystem::path, bool);
 
+	/** Open the MXF for writing, taking details of the picture from a JPEG2000 frame */
+	virtual void start (uint8_t const * data, int size) = 0;
+	/** @return number of calls to write() for each frame of the asset */
+	virtual int writes_per_frame () const = 0;
+
+	void wait_for_write_behind ();
+	void stop_write_behind ();
+
 	PictureAsset* _picture_asset;
 	bool _overwrite;
+
+private:
+	void write_queued (Data data, boost::function<void (FrameInfo)> done);
+	Data existing_frame (FrameInfo const & info) const;
+
+	/** queue and thread for frames given to write_async(), created when it is first called */
+	boost::shared_ptr<WriteBehind> _write_behind;
+	int _write_behind_queue_length;
 };
 
 }
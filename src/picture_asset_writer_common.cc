@@ -79,4 +79,5 @@ void dcp::start (PictureAssetWriter* writer, shared_ptr<P> state, Q* asset, uint
 	}
 
 	writer->_started = true;
+	writer->preallocate ();
 }
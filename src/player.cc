@@ -0,0 +1,515 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/player.cc
+ *  @brief Player, PlayerSound and PlayerStatistics classes.
+ */
+
+#include "player.h"
+#include "cpl.h"
+#include "reel.h"
+#include "reel_picture_asset.h"
+#include "reel_sound_asset.h"
+#include "picture_asset.h"
+#include "sound_asset.h"
+#include "sound_asset_reader.h"
+#include "sound_frame.h"
+#include "instrumentation.h"
+#include "exceptions.h"
+#include "dcp_assert.h"
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <algorithm>
+
+using std::max;
+using std::min;
+using std::string;
+using std::exception;
+using boost::shared_ptr;
+using boost::function;
+using boost::shared_array;
+using boost::optional;
+using namespace dcp;
+
+/** @param frame Sound frame.
+ *  @param channels Number of channels in the frame.
+ *  @param sampling_rate Sampling rate of the frame, in Hz.
+ */
+PlayerSound::PlayerSound (shared_ptr<const SoundFrame> frame, int channels, int sampling_rate)
+	: _channels (channels)
+	, _samples (frame->samples ())
+	, _sampling_rate (sampling_rate)
+	, _data (new float[channels * frame->samples()])
+{
+	for (int i = 0; i < _channels; ++i) {
+		float* d = _data.get() + i * _samples;
+		for (int j = 0; j < _samples; ++j) {
+			int32_t v = frame->get (i, j);
+			/* Samples are 24-bit signed */
+			if (v & 0x800000) {
+				v -= 0x1000000;
+			}
+			d[j] = v / 8388608.0f;
+		}
+	}
+}
+
+/** @param cpl CPL to play; its assets must have been resolved.
+ *  @param threads Number of threads to prepare frames with; must be at least 1.
+ *  @param conversion Colour conversion to use when making RGBA pictures.
+ */
+Player::Player (shared_ptr<const CPL> cpl, int threads, ColourConversion conversion)
+	: _length (0)
+	, _pictures (0, 0, conversion)
+	, _threads (threads)
+	, _drop_policy (DROP_LATE)
+	, _lookahead (8)
+	, _eye (EYE_LEFT)
+	, _reduce (0)
+	, _next_job (0)
+	, _next_delivery (0)
+	, _decode_time (0)
+	, _running (false)
+	, _stop (false)
+	, _finished (false)
+	, _clock (0)
+{
+	DCP_ASSERT (cpl);
+	DCP_ASSERT (threads > 0);
+
+	BOOST_FOREACH (shared_ptr<Reel> i, cpl->reels ()) {
+		Segment s;
+		s.start = _length;
+
+		if (i->main_picture ()) {
+			s.picture = i->main_picture()->asset ();
+			s.picture_entry_point = i->main_picture()->entry_point().get_value_or (0);
+			s.length = i->main_picture()->actual_duration ();
+			if (_segments.empty ()) {
+				_edit_rate = i->main_picture()->edit_rate ();
+			}
+		}
+
+		if (i->main_sound ()) {
+			shared_ptr<const SoundAsset> sound = i->main_sound()->asset ();
+			s.sound = sound->start_read ();
+			s.sound_mutex.reset (new boost::mutex);
+			s.sound_entry_point = i->main_sound()->entry_point().get_value_or (0);
+			s.channels = sound->channels ();
+			s.sampling_rate = sound->sampling_rate ();
+			if (!s.picture) {
+				s.length = i->main_sound()->actual_duration ();
+				if (_segments.empty ()) {
+					_edit_rate = i->main_sound()->edit_rate ();
+				}
+			}
+		}
+
+		if (s.length > 0) {
+			_segments.push_back (s);
+			_length += s.length;
+		}
+	}
+
+	if (_segments.empty ()) {
+		throw MiscError ("CPL has nothing to play");
+	}
+}
+
+Player::~Player ()
+{
+	stop ();
+}
+
+/** Set the handler to be called with each frame's picture.  The handler is not called for
+ *  pictures which are dropped, or for frames in reels which have no picture.
+ */
+void
+Player::set_picture_handler (function<void (int64_t, shared_ptr<const CachedFrame>)> handler)
+{
+	DCP_ASSERT (!_running);
+	_picture_handler = handler;
+}
+
+/** Set the handler to be called with each frame's sound; it is called just before the
+ *  picture handler for the same frame.
+ */
+void
+Player::set_sound_handler (function<void (int64_t, shared_ptr<const PlayerSound>)> handler)
+{
+	DCP_ASSERT (!_running);
+	_sound_handler = handler;
+}
+
+void
+Player::set_drop_policy (DropPolicy policy)
+{
+	DCP_ASSERT (!_running);
+	_drop_policy = policy;
+}
+
+/** @param frames Greatest number of frames to prepare ahead of the one that is next due */
+void
+Player::set_lookahead (int frames)
+{
+	DCP_ASSERT (!_running);
+	_lookahead = max (1, frames);
+}
+
+/** @param eye Eye to play from stereo picture assets; ignored for mono ones */
+void
+Player::set_eye (Eye eye)
+{
+	DCP_ASSERT (!_running);
+	_eye = eye;
+}
+
+/** @param reduce Power of two by which to reduce pictures, as for decompress_j2k() */
+void
+Player::set_reduce (int reduce)
+{
+	DCP_ASSERT (!_running);
+	_reduce = reduce;
+}
+
+/** Start playing.  This returns at once; the first frame is handed over as soon as
+ *  it is ready, and the rest follow at the CPL's edit rate.
+ *  @param from Frame index within the CPL to start from.
+ */
+void
+Player::start (int64_t from)
+{
+	DCP_ASSERT (!_running);
+	DCP_ASSERT (from >= 0 && from < _length);
+
+	_slots.clear ();
+	_next_job = from;
+	_next_delivery = from;
+	_decode_time = 0;
+	_stop = false;
+	_finished = false;
+	_error = optional<string> ();
+	_statistics = PlayerStatistics ();
+	_running = true;
+
+	for (int i = 0; i < _threads; ++i) {
+		_workers.push_back (new boost::thread (boost::bind (&Player::worker, this)));
+	}
+
+	_clock = new boost::thread (boost::bind (&Player::clock, this));
+}
+
+/** Stop playing, waiting for any handler which is being called to return */
+void
+Player::stop ()
+{
+	if (!_running) {
+		return;
+	}
+
+	{
+		boost::mutex::scoped_lock lm (_mutex);
+		_stop = true;
+		_condition.notify_all ();
+	}
+
+	BOOST_FOREACH (boost::thread* i, _workers) {
+		i->join ();
+		delete i;
+	}
+	_workers.clear ();
+
+	_clock->join ();
+	delete _clock;
+	_clock = 0;
+	_running = false;
+}
+
+/** Wait for the last frame to be handed over.  If playback stopped because a frame
+ *  could not be read or decoded, or because a handler threw an exception, a MiscError
+ *  is thrown.
+ */
+void
+Player::wait ()
+{
+	if (!_running) {
+		return;
+	}
+
+	{
+		boost::mutex::scoped_lock lm (_mutex);
+		while (!_finished && !_stop) {
+			_condition.wait (lm);
+		}
+	}
+
+	stop ();
+
+	if (_error) {
+		throw MiscError (_error.get ());
+	}
+}
+
+PlayerStatistics
+Player::statistics () const
+{
+	boost::mutex::scoped_lock lm (_mutex);
+	return _statistics;
+}
+
+Player::Segment const &
+Player::segment (int64_t frame) const
+{
+	BOOST_FOREACH (Segment const & i, _segments) {
+		if (frame < i.start + i.length) {
+			return i;
+		}
+	}
+
+	DCP_ASSERT (false);
+	return _segments.back ();
+}
+
+void
+Player::worker ()
+{
+	while (true) {
+		boost::mutex::scoped_lock lm (_mutex);
+		while (!_stop && _next_job < _length && _next_job >= _next_delivery + _lookahead) {
+			_condition.wait (lm);
+		}
+
+		if (_stop || _next_job >= _length) {
+			return;
+		}
+
+		int64_t const frame = _next_job++;
+		_slots[frame];
+		lm.unlock ();
+
+		Segment const & s = segment (frame);
+
+		try {
+			shared_ptr<const PlayerSound> sound;
+			if (s.sound) {
+				shared_ptr<const SoundFrame> f;
+				{
+					boost::mutex::scoped_lock slm (*s.sound_mutex);
+					f = s.sound->get_frame (s.sound_entry_point + frame - s.start);
+				}
+				sound.reset (new PlayerSound (f, s.channels, s.sampling_rate));
+			}
+
+			lm.lock ();
+			std::map<int64_t, Slot>::iterator i = _slots.find (frame);
+			if (i == _slots.end ()) {
+				continue;
+			}
+			i->second.sound = sound;
+			i->second.sound_done = true;
+			bool const skip = i->second.dropped || i->second.skip;
+			_condition.notify_all ();
+			lm.unlock ();
+
+			shared_ptr<const CachedFrame> picture;
+			if (s.picture && !skip) {
+				int64_t const start = Instrumentation::now ();
+				picture = _pictures.get (s.picture, s.picture_entry_point + frame - s.start, _eye, _reduce, FrameCache::RGBA);
+				int64_t const time = Instrumentation::now () - start;
+				lm.lock ();
+				_decode_time = _decode_time ? (_decode_time * 7 + time) / 8 : time;
+				lm.unlock ();
+			}
+
+			lm.lock ();
+			i = _slots.find (frame);
+			if (i != _slots.end ()) {
+				i->second.picture = picture;
+				i->second.picture_done = true;
+				_condition.notify_all ();
+			}
+		} catch (exception& e) {
+			fail (lm, frame, e.what ());
+		} catch (...) {
+			fail (lm, frame, "unknown exception while preparing a frame");
+		}
+	}
+}
+
+/** Record an error in preparing a frame, so that the clock thread will stop when it gets there */
+void
+Player::fail (boost::mutex::scoped_lock& lm, int64_t frame, string error)
+{
+	if (!lm.owns_lock ()) {
+		lm.lock ();
+	}
+
+	std::map<int64_t, Slot>::iterator i = _slots.find (frame);
+	if (i != _slots.end ()) {
+		i->second.error = error;
+		i->second.sound_done = true;
+		i->second.picture_done = true;
+		_condition.notify_all ();
+	}
+}
+
+/** Called when the picture of frame has been dropped, to tell the workers not to decode the
+ *  pictures after it which would not be ready in time either; they still read their sound.
+ *  Frames which are already being decoded are left to finish.  _mutex must be held.
+ *  @param frame Frame which has been dropped.
+ *  @param from First frame that the clock delivered.
+ *  @param base Time at which the first frame was delivered.
+ *  @param period Length of a frame, in nanoseconds.
+ */
+void
+Player::skip_late (int64_t frame, int64_t from, int64_t base, int64_t period)
+{
+	int64_t const ready = Instrumentation::now () + _decode_time;
+	for (int64_t i = max (frame + 1, _next_job); i < _length && base + (i - from) * period < ready; ++i) {
+		_slots[i].skip = true;
+	}
+	_condition.notify_all ();
+}
+
+void
+Player::clock ()
+{
+	int64_t const period = int64_t (1000000000) * _edit_rate.denominator / _edit_rate.numerator;
+	int64_t const from = _next_delivery;
+	int64_t base = 0;
+
+	for (int64_t frame = from; frame < _length; ++frame) {
+		boost::mutex::scoped_lock lm (_mutex);
+
+		Slot* slot = &_slots[frame];
+
+		int64_t deadline;
+		if (frame == from) {
+			/* Wait for the first frame to be ready and start the clock from there */
+			while (!_stop && !(slot->sound_done && slot->picture_done)) {
+				_condition.wait (lm);
+			}
+			base = Instrumentation::now ();
+			deadline = base;
+		} else {
+			deadline = base + (frame - from) * period;
+			while (!_stop) {
+				int64_t const left = deadline - Instrumentation::now ();
+				if (left <= 0) {
+					break;
+				}
+				_condition.timed_wait (lm, boost::posix_time::microseconds (left / 1000 + 1));
+			}
+		}
+
+		if (!_stop && !slot->picture_done) {
+			if (_drop_policy == DROP_LATE) {
+				slot->dropped = true;
+				++_statistics.dropped;
+				skip_late (frame, from, base, period);
+			} else {
+				while (!_stop && !slot->picture_done) {
+					_condition.wait (lm);
+				}
+			}
+		}
+
+		while (!_stop && !slot->sound_done) {
+			_condition.wait (lm);
+		}
+
+		if (_stop) {
+			break;
+		}
+
+		if (slot->error) {
+			_error = slot->error;
+			break;
+		}
+
+		if (slot->skip && !slot->dropped) {
+			/* A worker has already given up on this picture */
+			slot->dropped = true;
+			++_statistics.dropped;
+		}
+
+		shared_ptr<const PlayerSound> sound = slot->sound;
+		shared_ptr<const CachedFrame> picture = slot->dropped ? shared_ptr<const CachedFrame> () : slot->picture;
+		_slots.erase (frame);
+		_next_delivery = frame + 1;
+		_condition.notify_all ();
+
+		int64_t const lateness = Instrumentation::now () - deadline;
+		if (lateness > period / 10) {
+			++_statistics.late;
+		}
+		if (lateness > 0) {
+			_statistics.max_lateness = max (_statistics.max_lateness, lateness);
+			_statistics.total_lateness += lateness;
+			if (_drop_policy == NEVER_DROP) {
+				/* Everything after this frame is now late by the same amount */
+				base += lateness;
+			}
+		}
+		if (picture) {
+			++_statistics.delivered;
+		}
+
+		lm.unlock ();
+
+		optional<string> error;
+		try {
+			if (sound && _sound_handler) {
+				_sound_handler (frame, sound);
+			}
+
+			if (picture && _picture_handler) {
+				_picture_handler (frame, picture);
+			}
+		} catch (exception& e) {
+			error = e.what ();
+		} catch (...) {
+			error = string ("unknown exception in a handler");
+		}
+
+		if (error) {
+			lm.lock ();
+			_error = error;
+			break;
+		}
+	}
+
+	boost::mutex::scoped_lock lm (_mutex);
+	_finished = true;
+	_condition.notify_all ();
+}
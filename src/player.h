@@ -0,0 +1,264 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/player.h
+ *  @brief Player, PlayerSound and PlayerStatistics classes.
+ */
+
+#ifndef LIBDCP_PLAYER_H
+#define LIBDCP_PLAYER_H
+
+#include "frame_cache.h"
+#include "colour_conversion.h"
+#include "sound_asset_reader.h"
+#include "types.h"
+#include <boost/shared_ptr.hpp>
+#include <boost/shared_array.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace dcp {
+
+class CPL;
+class PictureAsset;
+class SoundFrame;
+
+/** @class PlayerSound
+ *  @brief The sound for one frame of a Player's CPL.
+ */
+class PlayerSound : public boost::noncopyable
+{
+public:
+	PlayerSound (boost::shared_ptr<const SoundFrame> frame, int channels, int sampling_rate);
+
+	int channels () const {
+		return _channels;
+	}
+
+	int samples () const {
+		return _samples;
+	}
+
+	int sampling_rate () const {
+		return _sampling_rate;
+	}
+
+	/** @return samples() samples of a channel, scaled to be between -1 and 1 */
+	float const * data (int channel) const {
+		return _data.get() + channel * _samples;
+	}
+
+private:
+	int _channels;
+	int _samples;
+	int _sampling_rate;
+	boost::shared_array<float> _data;
+};
+
+/** @class PlayerStatistics
+ *  @brief Counts of how well a Player has kept up.
+ */
+class PlayerStatistics
+{
+public:
+	PlayerStatistics ()
+		: delivered (0)
+		, dropped (0)
+		, late (0)
+		, max_lateness (0)
+		, total_lateness (0)
+	{}
+
+	/** number of frames whose picture was given to the picture handler */
+	int64_t delivered;
+	/** number of frames whose picture was dropped because it was not ready in time */
+	int64_t dropped;
+	/** number of frames which were handed over more than a tenth of a frame after they were due */
+	int64_t late;
+	/** greatest time by which a frame was handed over after it was due, in nanoseconds */
+	int64_t max_lateness;
+	/** total of the times by which frames were handed over after they were due, in nanoseconds */
+	int64_t total_lateness;
+};
+
+/** @class Player
+ *  @brief Plays a CPL in real time, giving RGBA pictures and PCM sound to handlers at the CPL's edit rate.
+ *
+ *  The reels of the CPL are played one after the other, honouring each asset's entry point and
+ *  duration.  A pool of threads reads, decrypts, decodes and colour-converts frames a little
+ *  ahead of time; set_lookahead() sets how far, which bounds both the memory used and the delay
+ *  between start() and the first frame.  A clock thread then hands each frame's sound and
+ *  picture to the handlers when it is due.  The handlers are called from that thread, so they
+ *  should return quickly.
+ *
+ *  If a picture has not been decoded when it is due the drop policy decides what happens: by
+ *  default it is dropped, and the clock carries on; with NEVER_DROP the player waits for it and
+ *  everything after it is delayed by the same amount.  When a picture is dropped the pictures
+ *  after it which could not be decoded in time are not decoded at all, so that the player
+ *  catches up rather than finishing each one just too late.  Sound is never dropped.
+ *
+ *  The CPL's assets must have been resolved (for example by DCP::read()), and any keys that are
+ *  needed to decrypt them must have been set.
+ */
+class Player : public boost::noncopyable
+{
+public:
+	enum DropPolicy {
+		/** drop pictures that are not ready when they are due */
+		DROP_LATE,
+		/** wait for every picture, delaying everything after one which is late */
+		NEVER_DROP
+	};
+
+	Player (boost::shared_ptr<const CPL> cpl, int threads = 4, ColourConversion conversion = ColourConversion::srgb_to_xyz ());
+	~Player ();
+
+	void set_picture_handler (boost::function<void (int64_t, boost::shared_ptr<const CachedFrame>)> handler);
+	void set_sound_handler (boost::function<void (int64_t, boost::shared_ptr<const PlayerSound>)> handler);
+	void set_drop_policy (DropPolicy policy);
+	void set_lookahead (int frames);
+	void set_eye (Eye eye);
+	void set_reduce (int reduce);
+
+	void start (int64_t from = 0);
+	void stop ();
+	void wait ();
+
+	/** @return length of the CPL in frames */
+	int64_t length () const {
+		return _length;
+	}
+
+	Fraction edit_rate () const {
+		return _edit_rate;
+	}
+
+	PlayerStatistics statistics () const;
+
+private:
+	/** Part of the CPL which comes from one reel */
+	struct Segment
+	{
+		Segment ()
+			: start (0)
+			, length (0)
+			, picture_entry_point (0)
+			, sound_entry_point (0)
+			, channels (0)
+			, sampling_rate (0)
+		{}
+
+		/** position of the reel's first frame in the CPL */
+		int64_t start;
+		int64_t length;
+		boost::shared_ptr<const PictureAsset> picture;
+		int64_t picture_entry_point;
+		boost::shared_ptr<SoundAssetReader> sound;
+		/** used to let one thread at a time use the sound reader */
+		boost::shared_ptr<boost::mutex> sound_mutex;
+		int64_t sound_entry_point;
+		int channels;
+		int sampling_rate;
+	};
+
+	/** A frame which is being prepared for delivery */
+	struct Slot
+	{
+		Slot ()
+			: sound_done (false)
+			, picture_done (false)
+			, dropped (false)
+			, skip (false)
+		{}
+
+		bool sound_done;
+		bool picture_done;
+		/** true if the frame's picture was not ready in time and will not be delivered */
+		bool dropped;
+		/** true if the frame's picture should not be decoded as it could not be ready in time */
+		bool skip;
+		boost::shared_ptr<const PlayerSound> sound;
+		boost::shared_ptr<const CachedFrame> picture;
+		boost::optional<std::string> error;
+	};
+
+	Segment const & segment (int64_t frame) const;
+	void worker ();
+	void fail (boost::mutex::scoped_lock& lm, int64_t frame, std::string error);
+	void clock ();
+	void skip_late (int64_t frame, int64_t from, int64_t base, int64_t period);
+
+	std::vector<Segment> _segments;
+	int64_t _length;
+	Fraction _edit_rate;
+	/** used by the workers to decode pictures; it keeps nothing, but lets readers be shared between threads */
+	FrameCache _pictures;
+	int _threads;
+
+	boost::function<void (int64_t, boost::shared_ptr<const CachedFrame>)> _picture_handler;
+	boost::function<void (int64_t, boost::shared_ptr<const PlayerSound>)> _sound_handler;
+	DropPolicy _drop_policy;
+	int _lookahead;
+	Eye _eye;
+	int _reduce;
+
+	mutable boost::mutex _mutex;
+	boost::condition_variable _condition;
+	std::map<int64_t, Slot> _slots;
+	/** next frame for a worker to start on */
+	int64_t _next_job;
+	/** next frame for the clock to deliver */
+	int64_t _next_delivery;
+	/** recent average time taken to decode a picture, in nanoseconds, or 0 if none has been */
+	int64_t _decode_time;
+	bool _running;
+	bool _stop;
+	/** true when the clock thread has delivered the last frame, or given up because of an error */
+	bool _finished;
+	boost::optional<std::string> _error;
+	PlayerStatistics _statistics;
+	std::vector<boost::thread*> _workers;
+	boost::thread* _clock;
+};
+
+}
+
+#endif
@@ -58,6 +58,7 @@ using std::cout;
 using std::max;
 using boost::shared_ptr;
 using boost::dynamic_pointer_cast;
+using boost::optional;
 using namespace dcp;
 
 Reel::Reel (boost::shared_ptr<const cxml::Node> node)
@@ -258,6 +259,64 @@ Reel::add (DecryptedKDM const & kdm)
 	}
 }
 
+/** Give keys to those of this reel's encrypted assets whose keys are known, looking
+ *  each asset's key ID up once.
+ *  @param key Function which returns the key with a given ID, or none if it is not known.
+ *  @return Number of assets which were given keys.
+ */
+int
+Reel::give_keys (boost::function<optional<Key> (string)> key) const
+{
+	int n = 0;
+
+	if (_main_picture && _main_picture->key_id()) {
+		optional<Key> k = key (_main_picture->key_id().get());
+		if (k) {
+			_main_picture->asset()->set_key (*k);
+			++n;
+		}
+	}
+
+	if (_main_sound && _main_sound->key_id()) {
+		optional<Key> k = key (_main_sound->key_id().get());
+		if (k) {
+			_main_sound->asset()->set_key (*k);
+			++n;
+		}
+	}
+
+	if (_main_subtitle && _main_subtitle->key_id()) {
+		shared_ptr<SMPTESubtitleAsset> s = dynamic_pointer_cast<SMPTESubtitleAsset> (_main_subtitle->asset());
+		optional<Key> k = key (_main_subtitle->key_id().get());
+		if (s && k) {
+			s->set_key (*k);
+			++n;
+		}
+	}
+
+	BOOST_FOREACH (shared_ptr<ReelClosedCaptionAsset> i, _closed_captions) {
+		if (!i->key_id()) {
+			continue;
+		}
+		shared_ptr<SMPTESubtitleAsset> s = dynamic_pointer_cast<SMPTESubtitleAsset> (i->asset());
+		optional<Key> k = key (i->key_id().get());
+		if (s && k) {
+			s->set_key (*k);
+			++n;
+		}
+	}
+
+	if (_atmos && _atmos->key_id()) {
+		optional<Key> k = key (_atmos->key_id().get());
+		if (k) {
+			_atmos->asset()->set_key (*k);
+			++n;
+		}
+	}
+
+	return n;
+}
+
 void
 Reel::add (shared_ptr<ReelAsset> asset)
 {
@@ -39,6 +39,7 @@
 #include "ref.h"
 #include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
+#include <boost/optional.hpp>
 #include <list>
 
 namespace cxml {
@@ -118,6 +119,7 @@ public:
 	bool equals (boost::shared_ptr<const Reel> other, EqualityOptions opt, NoteHandler notes) const;
 
 	void add (DecryptedKDM const &);
+	int give_keys (boost::function<boost::optional<Key> (std::string)> key) const;
 
 	void resolve_refs (std::list<boost::shared_ptr<Asset> >);
 
@@ -37,6 +37,7 @@
 #include "transfer_function.h"
 #include "dcp_assert.h"
 #include "compose.hpp"
+#include "instrumentation.h"
 #include <cmath>
 
 using std::min;
@@ -71,6 +72,8 @@ dcp::xyz_to_rgba (
 	int stride
 	)
 {
+	Instrumentation::Span span (Instrumentation::XYZ_TO_RGBA, static_cast<int64_t> (xyz_image->size().height) * stride);
+
 	int const max_colour = pow (2, 16) - 1;
 
 	struct {
@@ -157,6 +160,8 @@ dcp::xyz_to_rgb (
 	optional<NoteHandler> note
 	)
 {
+	Instrumentation::Span span (Instrumentation::XYZ_TO_RGB, static_cast<int64_t> (xyz_image->size().height) * stride);
+
 	struct {
 		double x, y, z;
 	} s;
@@ -287,6 +292,8 @@ dcp::rgb_to_xyz (
 	optional<NoteHandler> note
 	)
 {
+	Instrumentation::Span span (Instrumentation::RGB_TO_XYZ, static_cast<int64_t> (size.height) * stride);
+
 	shared_ptr<OpenJPEGImage> xyz (new OpenJPEGImage (size));
 
 	struct {
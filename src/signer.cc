@@ -0,0 +1,205 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/signer.cc
+ *  @brief Signer class.
+ */
+
+#include "signer.h"
+#include "certificate_chain.h"
+#include "exceptions.h"
+#include "util.h"
+#include "dcp_assert.h"
+#include "compose.hpp"
+#include <libcxml/cxml.h>
+#include <libxml++/libxml++.h>
+#include <xmlsec/xmldsig.h>
+#include <xmlsec/app.h>
+#include <xmlsec/crypto.h>
+#include <boost/foreach.hpp>
+
+using std::string;
+using namespace dcp;
+
+/** Prepare a certificate chain for signing.
+ *  @param chain Chain, which must have a private key.
+ */
+Signer::Signer (CertificateChain const & chain)
+	: _key (0)
+{
+	if (!chain.key()) {
+		throw MiscError ("no private key to sign with");
+	}
+
+	BOOST_FOREACH (dcp::Certificate const & i, chain.leaf_to_root ()) {
+		CertificateDetails c;
+		c.issuer = i.issuer ();
+		c.serial = i.serial ();
+		c.subject = i.subject ();
+		c.certificate = i.certificate ();
+		_certificates.push_back (c);
+	}
+
+	DCP_ASSERT (!_certificates.empty ());
+
+	string const key = chain.key().get ();
+	_key = xmlSecCryptoAppKeyLoadMemory (
+		reinterpret_cast<const unsigned char *> (key.c_str()), key.size(), xmlSecKeyDataFormatPem, 0, 0, 0
+		);
+
+	if (!_key) {
+		throw MiscError ("could not read private key");
+	}
+}
+
+Signer::~Signer ()
+{
+	xmlSecKeyDestroy (_key);
+}
+
+/** @return A new copy of our key, which shares the parsed key data with the original;
+ *  the caller must destroy it.
+ */
+xmlSecKeyPtr
+Signer::key () const
+{
+	xmlSecKeyPtr key = xmlSecKeyDuplicate (_key);
+	if (!key) {
+		throw MiscError ("could not copy private key");
+	}
+	return key;
+}
+
+/** Add a &lt;Signer&gt; and &lt;ds:Signature&gt; nodes to an XML node.
+ *  @param parent XML node to add to.
+ *  @param standard INTEROP or SMPTE.
+ */
+void
+Signer::sign (xmlpp::Element* parent, Standard standard) const
+{
+	/* <Signer> */
+
+	parent->add_child_text("  ");
+	xmlpp::Element* signer = parent->add_child("Signer");
+	signer->set_namespace_declaration ("http://www.w3.org/2000/09/xmldsig#", "dsig");
+	xmlpp::Element* data = signer->add_child("X509Data", "dsig");
+	xmlpp::Element* serial_element = data->add_child("X509IssuerSerial", "dsig");
+	serial_element->add_child("X509IssuerName", "dsig")->add_child_text (_certificates.front().issuer);
+	serial_element->add_child("X509SerialNumber", "dsig")->add_child_text (_certificates.front().serial);
+	data->add_child("X509SubjectName", "dsig")->add_child_text (_certificates.front().subject);
+
+	indent (signer, 2);
+
+	/* <Signature> */
+
+	parent->add_child_text("\n  ");
+	xmlpp::Element* signature = parent->add_child("Signature");
+	signature->set_namespace_declaration ("http://www.w3.org/2000/09/xmldsig#", "dsig");
+	signature->set_namespace ("dsig");
+	parent->add_child_text("\n");
+
+	xmlpp::Element* signed_info = signature->add_child ("SignedInfo", "dsig");
+	signed_info->add_child("CanonicalizationMethod", "dsig")->set_attribute ("Algorithm", "http://www.w3.org/TR/2001/REC-xml-c14n-20010315");
+
+	if (standard == INTEROP) {
+		signed_info->add_child("SignatureMethod", "dsig")->set_attribute("Algorithm", "http://www.w3.org/2000/09/xmldsig#rsa-sha1");
+	} else {
+		signed_info->add_child("SignatureMethod", "dsig")->set_attribute("Algorithm", "http://www.w3.org/2001/04/xmldsig-more#rsa-sha256");
+	}
+
+	xmlpp::Element* reference = signed_info->add_child("Reference", "dsig");
+	reference->set_attribute ("URI", "");
+
+	xmlpp::Element* transforms = reference->add_child("Transforms", "dsig");
+	transforms->add_child("Transform", "dsig")->set_attribute (
+		"Algorithm", "http://www.w3.org/2000/09/xmldsig#enveloped-signature"
+		);
+
+	reference->add_child("DigestMethod", "dsig")->set_attribute("Algorithm", "http://www.w3.org/2000/09/xmldsig#sha1");
+	/* This will be filled in by the signing later */
+	reference->add_child("DigestValue", "dsig");
+
+	signature->add_child("SignatureValue", "dsig");
+	signature->add_child("KeyInfo", "dsig");
+	add_signature_value (signature, "dsig", true);
+}
+
+/** Sign an XML node.
+ *
+ *  @param parent Node to sign.
+ *  @param ns Namespace to use for the signature XML nodes.
+ */
+void
+Signer::add_signature_value (xmlpp::Element* parent, string ns, bool add_indentation) const
+{
+	cxml::Node cp (parent);
+	xmlpp::Node* key_info = cp.node_child("KeyInfo")->node ();
+
+	/* Add the certificate chain to the KeyInfo child node of parent */
+	BOOST_FOREACH (CertificateDetails const & i, _certificates) {
+		xmlpp::Element* data = key_info->add_child("X509Data", ns);
+
+		{
+			xmlpp::Element* serial = data->add_child("X509IssuerSerial", ns);
+			serial->add_child("X509IssuerName", ns)->add_child_text (i.issuer);
+			serial->add_child("X509SerialNumber", ns)->add_child_text (i.serial);
+		}
+
+		data->add_child("X509Certificate", ns)->add_child_text (i.certificate);
+	}
+
+	/* Use a context on the stack with a copy of the key, which the context will
+	   destroy when it is finalised.
+	*/
+	xmlSecDSigCtx signature_context;
+	if (xmlSecDSigCtxInitialize (&signature_context, 0) < 0) {
+		throw MiscError ("could not create signature context");
+	}
+
+	try {
+		signature_context.signKey = key ();
+	} catch (...) {
+		xmlSecDSigCtxFinalize (&signature_context);
+		throw;
+	}
+
+	if (add_indentation) {
+		indent (parent, 2);
+	}
+	int const r = xmlSecDSigCtxSign (&signature_context, parent->cobj ());
+	xmlSecDSigCtxFinalize (&signature_context);
+
+	if (r < 0) {
+		throw MiscError (String::compose ("could not sign (%1)", r));
+	}
+}
@@ -0,0 +1,91 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/signer.h
+ *  @brief Signer class.
+ */
+
+#ifndef LIBDCP_SIGNER_H
+#define LIBDCP_SIGNER_H
+
+#include "types.h"
+#include <boost/noncopyable.hpp>
+#include <string>
+#include <vector>
+
+namespace xmlpp {
+	class Element;
+}
+
+struct _xmlSecKey;
+
+namespace dcp {
+
+class CertificateChain;
+
+/** @class Signer
+ *  @brief A certificate chain and private key which have been prepared for signing XML.
+ *
+ *  The private key is parsed, and the details of the certificates which go into each
+ *  signature are extracted, once when the Signer is created.  sign() and
+ *  add_signature_value() may then be called from several threads at once; each call
+ *  signs with its own copy of the key, which shares the parsed key data.
+ */
+class Signer : public boost::noncopyable
+{
+public:
+	explicit Signer (CertificateChain const & chain);
+	~Signer ();
+
+	void sign (xmlpp::Element* parent, Standard standard) const;
+	void add_signature_value (xmlpp::Element* parent, std::string ns, bool add_indentation) const;
+
+private:
+	_xmlSecKey* key () const;
+
+	struct CertificateDetails {
+		std::string issuer;
+		std::string serial;
+		std::string subject;
+		std::string certificate;
+	};
+
+	/** details of our certificates, from leaf to root */
+	std::vector<CertificateDetails> _certificates;
+	/** parsed private key, which is copied for each signature */
+	_xmlSecKey* _key;
+};
+
+}
+
+#endif
@@ -38,24 +38,28 @@
 #include "smpte_subtitle_asset.h"
 #include "smpte_load_font_node.h"
 #include "exceptions.h"
-#include "xml.h"
 #include "raw_convert.h"
 #include "dcp_assert.h"
 #include "util.h"
 #include "compose.hpp"
 #include "crypto_context.h"
 #include "subtitle_image.h"
+#include "xml_reader.h"
+#include "xml_writer.h"
 #include <asdcp/AS_DCP.h>
 #include <asdcp/KM_util.h>
 #include <asdcp/KM_log.h>
-#include <libxml++/libxml++.h>
 #include <boost/foreach.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <set>
 
 using std::string;
 using std::list;
 using std::vector;
 using std::map;
+using std::set;
 using boost::shared_ptr;
 using boost::split;
 using boost::is_any_of;
@@ -67,6 +71,70 @@ using namespace dcp;
 
 static string const subtitle_smpte_ns = "http://www.smpte-ra.org/schemas/428-7/2010/DCST";
 
+/** An open timed text MXF from which ancillary resources (fonts and PNGs) can be read,
+ *  shared by all the resources of an asset.
+ */
+class TimedTextResourceReader : public boost::noncopyable
+{
+public:
+	TimedTextResourceReader (shared_ptr<ASDCP::TimedText::MXFReader> reader, shared_ptr<DecryptionContext> dec, boost::filesystem::path file)
+		: _reader (reader)
+		, _dec (dec)
+		, _file (file)
+	{}
+
+	Data read (uint8_t const * id)
+	{
+		/* The reader and its decryption context can only be used by one thread at a time */
+		boost::mutex::scoped_lock lm (_mutex);
+
+		ASDCP::TimedText::FrameBuffer buffer;
+		buffer.Capacity (10 * 1024 * 1024);
+		Kumu::Result_t r = _reader->ReadAncillaryResource (id, buffer, _dec->context(), _dec->hmac());
+		if (ASDCP_FAILURE (r)) {
+			boost::throw_exception (MXFFileError ("could not read resource from timed text MXF", _file, r));
+		}
+		return Data (buffer.RoData(), buffer.Size());
+	}
+
+	boost::filesystem::path file () const {
+		return _file;
+	}
+
+private:
+	boost::mutex _mutex;
+	shared_ptr<ASDCP::TimedText::MXFReader> _reader;
+	shared_ptr<DecryptionContext> _dec;
+	boost::filesystem::path _file;
+};
+
+/** A DataSource for one ancillary resource in a timed text MXF */
+class TimedTextResourceSource : public DataSource
+{
+public:
+	TimedTextResourceSource (shared_ptr<TimedTextResourceReader> reader, uint8_t const * id)
+		: _reader (reader)
+	{
+		memcpy (_id, id, ASDCP::UUIDlen);
+	}
+
+	Data read () const
+	{
+		return _reader->read (_id);
+	}
+
+	string description () const
+	{
+		char id[64];
+		Kumu::bin2UUIDhex (_id, ASDCP::UUIDlen, id, sizeof (id));
+		return String::compose ("resource %1 in %2", id, _reader->file().string());
+	}
+
+private:
+	shared_ptr<TimedTextResourceReader> _reader;
+	uint8_t _id[ASDCP::UUIDlen];
+};
+
 SMPTESubtitleAsset::SMPTESubtitleAsset ()
 	: MXF (SMPTE)
 	, _intrinsic_duration (0)
@@ -83,8 +151,6 @@ SMPTESubtitleAsset::SMPTESubtitleAsset ()
 SMPTESubtitleAsset::SMPTESubtitleAsset (boost::filesystem::path file)
 	: SubtitleAsset (file)
 {
-	shared_ptr<cxml::Document> xml (new cxml::Document ("SubtitleReel"));
-
 	shared_ptr<ASDCP::TimedText::MXFReader> reader (new ASDCP::TimedText::MXFReader ());
 	Kumu::Result_t r = reader->OpenRead (_file->string().c_str ());
 	if (!ASDCP_FAILURE (r)) {
@@ -96,18 +162,17 @@ SMPTESubtitleAsset::SMPTESubtitleAsset (boost::filesystem::path file)
 			/* Not encrypted; read it in now */
 			string s;
 			reader->ReadTimedTextResource (s);
-			xml->read_string (s);
+			XMLReader xml (s.c_str(), s.length());
 			parse_xml (xml);
 			read_mxf_descriptor (reader, shared_ptr<DecryptionContext> (new DecryptionContext (optional<Key>(), SMPTE)));
 		}
 	} else {
 		/* Plain XML */
 		try {
-			xml.reset (new cxml::Document ("SubtitleReel"));
-			xml->read_file (file);
+			XMLReader xml (file);
 			parse_xml (xml);
-			_id = _xml_id = remove_urn_uuid (xml->string_child ("Id"));
-		} catch (cxml::Error& e) {
+			_id = _xml_id;
+		} catch (XMLError& e) {
 			boost::throw_exception (
 				DCPReadError (
 					String::compose (
@@ -123,7 +188,7 @@ SMPTESubtitleAsset::SMPTESubtitleAsset (boost::filesystem::path file)
 		*/
 		BOOST_FOREACH (shared_ptr<Subtitle> i, _subtitles) {
 			shared_ptr<SubtitleImage> im = dynamic_pointer_cast<SubtitleImage>(i);
-			if (im && im->png_image().size() == 0) {
+			if (im && !im->has_png_image()) {
 				/* Even more dubious; allow <id>.png or urn:uuid:<id>.png */
 				boost::filesystem::path p = file.parent_path() / String::compose("%1.png", im->id());
 				if (boost::filesystem::is_regular_file(p)) {
@@ -141,49 +206,79 @@ SMPTESubtitleAsset::SMPTESubtitleAsset (boost::filesystem::path file)
 	/* Check that all required image data have been found */
 	BOOST_FOREACH (shared_ptr<Subtitle> i, _subtitles) {
 		shared_ptr<SubtitleImage> im = dynamic_pointer_cast<SubtitleImage>(i);
-		if (im && im->png_image().size() == 0) {
+		if (im && !im->has_png_image()) {
 			throw MissingSubtitleImageError (im->id());
 		}
 	}
 }
 
+/** @return Text content of the current element of a reader, as an integer */
+static int
+int_content (XMLReader& reader)
+{
+	string s = reader.content ();
+	boost::erase_all (s, " ");
+	return raw_convert<int> (s);
+}
+
 void
-SMPTESubtitleAsset::parse_xml (shared_ptr<cxml::Document> xml)
+SMPTESubtitleAsset::parse_xml (XMLReader& xml)
 {
-	_xml_id = remove_urn_uuid(xml->string_child("Id"));
-	_load_font_nodes = type_children<dcp::SMPTELoadFontNode> (xml, "LoadFont");
-
-	_content_title_text = xml->string_child ("ContentTitleText");
-	_annotation_text = xml->optional_string_child ("AnnotationText");
-	_issue_date = LocalTime (xml->string_child ("IssueDate"));
-	_reel_number = xml->optional_number_child<int> ("ReelNumber");
-	_language = xml->optional_string_child ("Language");
-
-	/* This is supposed to be two numbers, but a single number has been seen in the wild */
-	string const er = xml->string_child ("EditRate");
-	vector<string> er_parts;
-	split (er_parts, er, is_any_of (" "));
-	if (er_parts.size() == 1) {
-		_edit_rate = Fraction (raw_convert<int> (er_parts[0]), 1);
-	} else if (er_parts.size() == 2) {
-		_edit_rate = Fraction (raw_convert<int> (er_parts[0]), raw_convert<int> (er_parts[1]));
-	} else {
-		throw XMLError ("malformed EditRate " + er);
-	}
+	xml.root ("SubtitleReel");
+
+	/* Names of the elements that we have read; the order of them is fixed by the schema */
+	set<string> seen;
+
+	while (xml.next_child (0)) {
+		string const name = xml.name ();
+		if (name == "Id") {
+			_xml_id = remove_urn_uuid (xml.content ());
+		} else if (name == "ContentTitleText") {
+			_content_title_text = xml.content ();
+		} else if (name == "AnnotationText") {
+			_annotation_text = xml.content ();
+		} else if (name == "IssueDate") {
+			_issue_date = LocalTime (xml.content ());
+		} else if (name == "ReelNumber") {
+			_reel_number = int_content (xml);
+		} else if (name == "Language") {
+			_language = xml.content ();
+		} else if (name == "EditRate") {
+			/* This is supposed to be two numbers, but a single number has been seen in the wild */
+			string const er = xml.content ();
+			vector<string> er_parts;
+			split (er_parts, er, is_any_of (" "));
+			if (er_parts.size() == 1) {
+				_edit_rate = Fraction (raw_convert<int> (er_parts[0]), 1);
+			} else if (er_parts.size() == 2) {
+				_edit_rate = Fraction (raw_convert<int> (er_parts[0]), raw_convert<int> (er_parts[1]));
+			} else {
+				throw XMLError ("malformed EditRate " + er);
+			}
+		} else if (name == "TimeCodeRate") {
+			_time_code_rate = int_content (xml);
+		} else if (name == "StartTime" || name == "SubtitleList") {
+			if (seen.find ("TimeCodeRate") == seen.end ()) {
+				throw XMLError (String::compose ("%1 before TimeCodeRate", name));
+			}
+			if (name == "StartTime") {
+				_start_time = Time (xml.content (), _time_code_rate);
+			} else {
+				parse_subtitles (xml, _time_code_rate, SMPTE);
+			}
+		} else if (name == "LoadFont") {
+			_load_font_nodes.push_back (
+				shared_ptr<SMPTELoadFontNode> (new SMPTELoadFontNode (xml.attribute ("ID"), remove_urn_uuid (xml.content ())))
+				);
+		}
 
-	_time_code_rate = xml->number_child<int> ("TimeCodeRate");
-	if (xml->optional_string_child ("StartTime")) {
-		_start_time = Time (xml->string_child ("StartTime"), _time_code_rate);
+		seen.insert (name);
 	}
 
-	/* Now we need to drop down to xmlpp */
-
-	list<ParseState> ps;
-	xmlpp::Node::NodeList c = xml->node()->get_children ();
-	for (xmlpp::Node::NodeList::const_iterator i = c.begin(); i != c.end(); ++i) {
-		xmlpp::Element const * e = dynamic_cast<xmlpp::Element const *> (*i);
-		if (e && e->get_name() == "SubtitleList") {
-			parse_subtitles (e, ps, _time_code_rate, SMPTE);
+	char const * required[] = { "Id", "ContentTitleText", "IssueDate", "EditRate", "TimeCodeRate", 0 };
+	for (int i = 0; required[i]; ++i) {
+		if (seen.find (required[i]) == seen.end ()) {
+			throw XMLError (String::compose ("missing XML tag %1", required[i]));
 		}
 	}
 
@@ -191,28 +286,33 @@ SMPTESubtitleAsset::parse_xml (shared_ptr<cxml::Document> xml)
 	_intrinsic_duration = latest_subtitle_out().as_editable_units (_edit_rate.numerator / _edit_rate.denominator);
 }
 
+/** Read our MXF descriptor and set up our fonts and images to be read from the MXF
+ *  when they are needed.
+ */
 void
 SMPTESubtitleAsset::read_mxf_descriptor (shared_ptr<ASDCP::TimedText::MXFReader> reader, shared_ptr<DecryptionContext> dec)
 {
 	ASDCP::TimedText::TimedTextDescriptor descriptor;
 	reader->FillTimedTextDescriptor (descriptor);
 
-	/* Load fonts and images */
+	shared_ptr<TimedTextResourceReader> resources (new TimedTextResourceReader (reader, dec, _file.get()));
+
+	map<string, shared_ptr<SubtitleImage> > images;
+	BOOST_FOREACH (shared_ptr<Subtitle> i, _subtitles) {
+		shared_ptr<SubtitleImage> si = dynamic_pointer_cast<SubtitleImage> (i);
+		if (si) {
+			images[si->id()] = si;
+		}
+	}
 
 	for (
 		ASDCP::TimedText::ResourceList_t::const_iterator i = descriptor.ResourceList.begin();
 		i != descriptor.ResourceList.end();
 		++i) {
 
-		ASDCP::TimedText::FrameBuffer buffer;
-		buffer.Capacity (10 * 1024 * 1024);
-		reader->ReadAncillaryResource (i->ResourceID, buffer, dec->context(), dec->hmac());
-
 		char id[64];
 		Kumu::bin2UUIDhex (i->ResourceID, ASDCP::UUIDlen, id, sizeof (id));
-
-		shared_array<uint8_t> data (new uint8_t[buffer.Size()]);
-		memcpy (data.get(), buffer.RoData(), buffer.Size());
+		LazyData data (shared_ptr<DataSource> (new TimedTextResourceSource (resources, i->ResourceID)));
 
 		switch (i->Type) {
 		case ASDCP::TimedText::MT_OPENTYPE:
@@ -223,19 +323,15 @@ SMPTESubtitleAsset::read_mxf_descriptor (shared_ptr<ASDCP::TimedText::MXFReader>
 			}
 
 			if (j != _load_font_nodes.end ()) {
-				_fonts.push_back (Font ((*j)->id, (*j)->urn, Data (data, buffer.Size ())));
+				_fonts.push_back (Font ((*j)->id, (*j)->urn, data));
 			}
 			break;
 		}
 		case ASDCP::TimedText::MT_PNG:
 		{
-			list<shared_ptr<Subtitle> >::const_iterator j = _subtitles.begin ();
-			while (j != _subtitles.end() && ((!dynamic_pointer_cast<SubtitleImage>(*j)) || dynamic_pointer_cast<SubtitleImage>(*j)->id() != id)) {
-				++j;
-			}
-
-			if (j != _subtitles.end()) {
-				dynamic_pointer_cast<SubtitleImage>(*j)->set_png_image (Data(data, buffer.Size()));
+			map<string, shared_ptr<SubtitleImage> >::const_iterator j = images.find (id);
+			if (j != images.end()) {
+				j->second->set_png_image (data);
 			}
 			break;
 		}
@@ -281,8 +377,7 @@ SMPTESubtitleAsset::set_key (Key key)
 	string s;
 	shared_ptr<DecryptionContext> dec (new DecryptionContext (key, SMPTE));
 	reader->ReadTimedTextResource (s, dec->context(), dec->hmac());
-	shared_ptr<cxml::Document> xml (new cxml::Document ("SubtitleReel"));
-	xml->read_string (s);
+	XMLReader xml (s.c_str(), s.length());
 	parse_xml (xml);
 	read_mxf_descriptor (reader, dec);
 }
@@ -308,38 +403,49 @@ SMPTESubtitleAsset::valid_mxf (boost::filesystem::path file)
 string
 SMPTESubtitleAsset::xml_as_string () const
 {
-	xmlpp::Document doc;
-	xmlpp::Element* root = doc.create_root_node ("dcst:SubtitleReel");
-	root->set_namespace_declaration (subtitle_smpte_ns, "dcst");
-	root->set_namespace_declaration ("http://www.w3.org/2001/XMLSchema", "xs");
+	XMLWriter writer;
+	write_xml (writer);
+	writer.finish ();
+	return writer.as_string ();
+}
 
-	root->add_child("Id", "dcst")->add_child_text ("urn:uuid:" + _xml_id);
-	root->add_child("ContentTitleText", "dcst")->add_child_text (_content_title_text);
+void
+SMPTESubtitleAsset::write_xml (XMLWriter& writer) const
+{
+	writer.start_element ("dcst:SubtitleReel");
+	writer.attribute ("xmlns:dcst", subtitle_smpte_ns);
+	writer.attribute ("xmlns:xs", "http://www.w3.org/2001/XMLSchema");
+
+	writer.element ("dcst:Id", "urn:uuid:" + _xml_id);
+	writer.element ("dcst:ContentTitleText", _content_title_text);
 	if (_annotation_text) {
-		root->add_child("AnnotationText", "dcst")->add_child_text (_annotation_text.get ());
+		writer.element ("dcst:AnnotationText", _annotation_text.get ());
 	}
-	root->add_child("IssueDate", "dcst")->add_child_text (_issue_date.as_string (true));
+	writer.element ("dcst:IssueDate", _issue_date.as_string (true));
 	if (_reel_number) {
-		root->add_child("ReelNumber", "dcst")->add_child_text (raw_convert<string> (_reel_number.get ()));
+		writer.element ("dcst:ReelNumber", raw_convert<string> (_reel_number.get ()));
 	}
 	if (_language) {
-		root->add_child("Language", "dcst")->add_child_text (_language.get ());
+		writer.element ("dcst:Language", _language.get ());
 	}
-	root->add_child("EditRate", "dcst")->add_child_text (_edit_rate.as_string ());
-	root->add_child("TimeCodeRate", "dcst")->add_child_text (raw_convert<string> (_time_code_rate));
+	writer.element ("dcst:EditRate", _edit_rate.as_string ());
+	writer.element ("dcst:TimeCodeRate", raw_convert<string> (_time_code_rate));
 	if (_start_time) {
-		root->add_child("StartTime", "dcst")->add_child_text (_start_time.get().as_string (SMPTE));
+		writer.element ("dcst:StartTime", _start_time.get().as_string (SMPTE));
 	}
 
 	BOOST_FOREACH (shared_ptr<SMPTELoadFontNode> i, _load_font_nodes) {
-		xmlpp::Element* load_font = root->add_child("LoadFont", "dcst");
-		load_font->add_child_text ("urn:uuid:" + i->urn);
-		load_font->set_attribute ("ID", i->id);
+		writer.start_element ("dcst:LoadFont");
+		writer.attribute ("ID", i->id);
+		writer.text ("urn:uuid:" + i->urn);
+		writer.end_element ();
 	}
 
-	subtitles_as_xml (root->add_child ("SubtitleList", "dcst"), _time_code_rate, SMPTE);
+	writer.start_element ("dcst:SubtitleList");
+	subtitles_as_xml (writer, _time_code_rate, SMPTE);
+	writer.end_element ();
 
-	return doc.write_to_string ("UTF-8");
+	writer.end_element ();
 }
 
 /** Write this content to a MXF file */
@@ -392,11 +498,19 @@ SMPTESubtitleAsset::write (boost::filesystem::path p) const
 	DCP_ASSERT (c == Kumu::UUID_Length);
 	descriptor.ContainerDuration = _intrinsic_duration;
 
+	/* If we are overwriting the file that our fonts and images are read from we write to a
+	   temporary file, so that they can still be read as we go.
+	*/
+	boost::filesystem::path out = p;
+	if (_file && boost::filesystem::exists (p) && boost::filesystem::equivalent (_file.get(), p)) {
+		out = p.string() + ".tmp";
+	}
+
 	ASDCP::TimedText::MXFWriter writer;
 	/* This header size is a guess.  Empirically it seems that each subtitle reference is 90 bytes, and we need some extra.
 	   The defualt size is not enough for some feature-length PNG sub projects (see DCP-o-matic #1561).
 	*/
-	ASDCP::Result_t r = writer.OpenWrite (p.string().c_str(), writer_info, descriptor, _subtitles.size() * 90 + 16384);
+	ASDCP::Result_t r = writer.OpenWrite (out.string().c_str(), writer_info, descriptor, _subtitles.size() * 90 + 16384);
 	if (ASDCP_FAILURE (r)) {
 		boost::throw_exception (FileError ("could not open subtitle MXF for writing", p.string(), r));
 	}
@@ -414,9 +528,10 @@ SMPTESubtitleAsset::write (boost::filesystem::path p) const
 			++j;
 		}
 		if (j != _fonts.end ()) {
+			Data const data = j->data.get ();
 			ASDCP::TimedText::FrameBuffer buffer;
-			buffer.SetData (j->data.data().get(), j->data.size());
-			buffer.Size (j->data.size());
+			buffer.SetData (data.data().get(), data.size());
+			buffer.Size (data.size());
 			r = writer.WriteAncillaryResource (buffer, enc.context(), enc.hmac());
 			if (ASDCP_FAILURE (r)) {
 				boost::throw_exception (MXFFileError ("could not write font to timed text resource", p.string(), r));
@@ -429,9 +544,10 @@ SMPTESubtitleAsset::write (boost::filesystem::path p) const
 	BOOST_FOREACH (shared_ptr<Subtitle> i, _subtitles) {
 		shared_ptr<SubtitleImage> si = dynamic_pointer_cast<SubtitleImage>(i);
 		if (si) {
+			Data const png = si->png_image ();
 			ASDCP::TimedText::FrameBuffer buffer;
-			buffer.SetData (si->png_image().data().get(), si->png_image().size());
-			buffer.Size (si->png_image().size());
+			buffer.SetData (png.data().get(), png.size());
+			buffer.Size (png.size());
 			r = writer.WriteAncillaryResource (buffer, enc.context(), enc.hmac());
 			if (ASDCP_FAILURE(r)) {
 				boost::throw_exception (MXFFileError ("could not write PNG data to timed text resource", p.string(), r));
@@ -441,6 +557,10 @@ SMPTESubtitleAsset::write (boost::filesystem::path p) const
 
 	writer.Finalize ();
 
+	if (out != p) {
+		boost::filesystem::rename (out, p);
+	}
+
 	_file = p;
 }
 
@@ -171,7 +171,8 @@ private:
 	friend struct ::write_smpte_subtitle_test2;
 
 	void read_fonts (boost::shared_ptr<ASDCP::TimedText::MXFReader>);
-	void parse_xml (boost::shared_ptr<cxml::Document> xml);
+	void parse_xml (XMLReader& xml);
+	void write_xml (XMLWriter& writer) const;
 	void read_mxf_descriptor (boost::shared_ptr<ASDCP::TimedText::MXFReader> reader, boost::shared_ptr<DecryptionContext> dec);
 
 	/** The total length of this content in video frames.  The amount of
@@ -0,0 +1,518 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/sound_analysis.cc
+ *  @brief SoundAnalysis class and analyse_sound method.
+ */
+
+#include "sound_analysis.h"
+#include "sound_asset.h"
+#include "sound_asset_reader.h"
+#include "sound_frame.h"
+#include "exceptions.h"
+#include "types.h"
+#include <boost/optional.hpp>
+#include <cmath>
+#ifdef LIBDCP_OPENMP
+#include <omp.h>
+#endif
+
+using std::vector;
+using std::string;
+using std::min;
+using std::max;
+using boost::shared_ptr;
+using boost::optional;
+using boost::function;
+using namespace dcp;
+
+/** Value of a full-scale 24-bit sample */
+static double const full_scale = 8388608;
+/** Absolute value of samples which we consider to be clipped */
+static int32_t const clip_level = 0x7fffff;
+/** Length in seconds of the steps that BS.1770 gating blocks are made from; a block
+ *  is 4 steps long and a new one starts every step, giving the 400ms blocks with 75%
+ *  overlap that the standard asks for.
+ */
+static double const step_length = 0.1;
+static int const steps_per_block = 4;
+/** Oversampling factor for true peak estimation */
+static int const oversampling = 4;
+/** Taps in each phase of the true peak interpolation filter */
+static int const taps_per_phase = 12;
+
+/** @return Weight for a channel when summing loudness; LFE and the HI/VI tracks
+ *  are left out and the surrounds get the BS.1770 boost.
+ */
+static double
+loudness_weight (int channel)
+{
+	switch (channel) {
+	case LEFT:
+	case RIGHT:
+	case CENTRE:
+	case LC:
+	case RC:
+		return 1;
+	case LS:
+	case RS:
+	case BSL:
+	case BSR:
+		return 1.41;
+	default:
+		return 0;
+	}
+}
+
+/** Biquad IIR coefficients, normalised so that a0 is 1 */
+struct Biquad
+{
+	double b0;
+	double b1;
+	double b2;
+	double a1;
+	double a2;
+};
+
+/** Work out the two stages of the BS.1770 K-weighting filter (a high shelf followed
+ *  by a high pass) for a given sampling rate.  At 48kHz these give the coefficients
+ *  that are tabulated in the standard.
+ */
+static void
+k_weighting (int sampling_rate, Biquad& shelf, Biquad& high_pass)
+{
+	double f0 = 1681.974450955533;
+	double const G = 3.999843853973347;
+	double Q = 0.7071752369554196;
+
+	double K = tan (M_PI * f0 / sampling_rate);
+	double const Vh = pow (10.0, G / 20.0);
+	double const Vb = pow (Vh, 0.4996667741545416);
+	double a0 = 1.0 + K / Q + K * K;
+
+	shelf.b0 = (Vh + Vb * K / Q + K * K) / a0;
+	shelf.b1 = 2.0 * (K * K - Vh) / a0;
+	shelf.b2 = (Vh - Vb * K / Q + K * K) / a0;
+	shelf.a1 = 2.0 * (K * K - 1.0) / a0;
+	shelf.a2 = (1.0 - K / Q + K * K) / a0;
+
+	f0 = 38.13547087602444;
+	Q = 0.5003270373238773;
+	K = tan (M_PI * f0 / sampling_rate);
+	a0 = 1.0 + K / Q + K * K;
+
+	high_pass.b0 = 1;
+	high_pass.b1 = -2;
+	high_pass.b2 = 1;
+	high_pass.a1 = 2.0 * (K * K - 1.0) / a0;
+	high_pass.a2 = (1.0 - K / Q + K * K) / a0;
+}
+
+/** @class Analyser
+ *  @brief Accumulator for the measurements of some contiguous range of a sound asset.
+ *
+ *  Filter state is kept for every channel side-by-side so that the inner loops
+ *  run across channels on contiguous arrays; these have no dependencies between
+ *  iterations and so are vectorised by the compiler.
+ */
+class Analyser
+{
+public:
+	Analyser (int channels, int sampling_rate, int64_t total_samples)
+		: _channels (channels)
+		, _step_samples (lrint (sampling_rate * step_length))
+		, _peak (channels, 0)
+		, _true_peak (channels, 0)
+		, _sum_squares (channels, 0)
+		, _clipped (channels, 0)
+		, _weight (channels)
+		, _shelf_z1 (channels, 0)
+		, _shelf_z2 (channels, 0)
+		, _high_pass_z1 (channels, 0)
+		, _high_pass_z2 (channels, 0)
+		, _history (channels * taps_per_phase * 2, 0)
+		, _history_position (0)
+		, _interpolated (channels)
+		, _steps (total_samples / _step_samples, 0)
+		, _samples (0)
+	{
+		for (int i = 0; i < channels; ++i) {
+			_weight[i] = loudness_weight (i);
+		}
+
+		k_weighting (sampling_rate, _shelf, _high_pass);
+
+		/* Hann-windowed sinc low-pass at the original Nyquist frequency, split into its
+		   polyphase components so that _phases[p * taps_per_phase + j] is the coefficient
+		   of the input sample j samples ago for output phase p.
+		*/
+		int const length = oversampling * taps_per_phase;
+		_phases.resize (length);
+		for (int p = 0; p < oversampling; ++p) {
+			for (int j = 0; j < taps_per_phase; ++j) {
+				int const n = p + j * oversampling;
+				double const t = (n - (length - 1) / 2.0) / oversampling;
+				double const sinc = fabs (t) < 1e-9 ? 1 : sin (M_PI * t) / (M_PI * t);
+				double const window = 0.5 - 0.5 * cos (2 * M_PI * (n + 1) / (length + 1));
+				_phases[p * taps_per_phase + j] = sinc * window;
+			}
+		}
+	}
+
+	/** Run a frame through the filters to settle them, without measuring it */
+	void prime (shared_ptr<const SoundFrame> frame)
+	{
+		process (frame, optional<int64_t> ());
+	}
+
+	/** Measure a frame.
+	 *  @param position Index of the frame's first sample within the asset.
+	 */
+	void analyse (shared_ptr<const SoundFrame> frame, int64_t position)
+	{
+		process (frame, position);
+	}
+
+	void merge (Analyser const & other)
+	{
+		for (int i = 0; i < _channels; ++i) {
+			_peak[i] = max (_peak[i], other._peak[i]);
+			_true_peak[i] = max (_true_peak[i], other._true_peak[i]);
+			_sum_squares[i] += other._sum_squares[i];
+			_clipped[i] += other._clipped[i];
+		}
+
+		/* A step which straddles the boundary between two ranges gets its energy from both */
+		for (size_t i = 0; i < _steps.size(); ++i) {
+			_steps[i] += other._steps[i];
+		}
+
+		_samples += other._samples;
+	}
+
+	SoundAnalysis result () const
+	{
+		SoundAnalysis r;
+		r.samples = _samples;
+
+		for (int i = 0; i < _channels; ++i) {
+			SoundAnalysis::Channel c;
+			c.peak = _peak[i] / full_scale;
+			c.true_peak = max (_true_peak[i], double (c.peak));
+			if (_samples > 0) {
+				c.rms = sqrt (_sum_squares[i] / _samples) / full_scale;
+			}
+			c.clipped_samples = _clipped[i];
+			r.channels.push_back (c);
+		}
+
+		/* Gating as described in BS.1770-4 section 2.8 */
+		vector<double> blocks;
+		double block_sum = 0;
+		for (size_t i = 0; i < _steps.size(); ++i) {
+			block_sum += _steps[i];
+			if (i >= size_t (steps_per_block)) {
+				block_sum -= _steps[i - steps_per_block];
+			}
+			if (i >= size_t (steps_per_block - 1)) {
+				double const z = block_sum / (steps_per_block * _step_samples);
+				if (z > 0 && loudness (z) > -70) {
+					blocks.push_back (z);
+				}
+			}
+		}
+
+		if (blocks.empty ()) {
+			return r;
+		}
+
+		double sum = 0;
+		for (vector<double>::const_iterator i = blocks.begin(); i != blocks.end(); ++i) {
+			sum += *i;
+		}
+
+		double const relative_gate = loudness (sum / blocks.size()) - 10;
+
+		sum = 0;
+		int n = 0;
+		for (vector<double>::const_iterator i = blocks.begin(); i != blocks.end(); ++i) {
+			if (loudness (*i) > relative_gate) {
+				sum += *i;
+				++n;
+			}
+		}
+
+		if (n > 0) {
+			r.integrated_loudness = loudness (sum / n);
+		}
+
+		return r;
+	}
+
+private:
+	static double loudness (double mean_square)
+	{
+		return -0.691 + 10 * log10 (mean_square);
+	}
+
+	void process (shared_ptr<const SoundFrame> frame, optional<int64_t> position)
+	{
+		int const samples = frame->samples ();
+		uint8_t const * p = frame->data ();
+
+		_input.resize (samples * _channels);
+		for (int i = 0; i < samples * _channels; ++i) {
+			int32_t s = p[0] | (p[1] << 8) | (p[2] << 16);
+			if (s & 0x800000) {
+				s -= 0x1000000;
+			}
+			_input[i] = s;
+			p += 3;
+		}
+
+		if (position) {
+			for (int i = 0; i < samples; ++i) {
+				double const * in = &_input[i * _channels];
+				for (int j = 0; j < _channels; ++j) {
+					double const a = fabs (in[j]);
+					_peak[j] = max (_peak[j], a);
+					_sum_squares[j] += in[j] * in[j];
+					if (a >= clip_level) {
+						++_clipped[j];
+					}
+				}
+			}
+			_samples += samples;
+		}
+
+		for (int i = 0; i < samples; ++i) {
+			double const * in = &_input[i * _channels];
+			double energy = 0;
+
+			for (int j = 0; j < _channels; ++j) {
+				double const x = in[j] / full_scale;
+
+				double const y = _shelf.b0 * x + _shelf_z1[j];
+				_shelf_z1[j] = _shelf.b1 * x - _shelf.a1 * y + _shelf_z2[j];
+				_shelf_z2[j] = _shelf.b2 * x - _shelf.a2 * y;
+
+				double const z = _high_pass.b0 * y + _high_pass_z1[j];
+				_high_pass_z1[j] = _high_pass.b1 * y - _high_pass.a1 * z + _high_pass_z2[j];
+				_high_pass_z2[j] = _high_pass.b2 * y - _high_pass.a2 * z;
+
+				energy += _weight[j] * z * z;
+
+				/* Each channel's history is stored twice over so that the last
+				   taps_per_phase samples are always contiguous.
+				*/
+				double* h = &_history[j * taps_per_phase * 2];
+				h[_history_position] = x;
+				h[_history_position + taps_per_phase] = x;
+			}
+
+			if (position) {
+				for (int k = 0; k < oversampling; ++k) {
+					double const * phase = &_phases[k * taps_per_phase];
+					for (int j = 0; j < _channels; ++j) {
+						double const * h = &_history[j * taps_per_phase * 2 + _history_position + taps_per_phase];
+						double sum = 0;
+						for (int l = 0; l < taps_per_phase; ++l) {
+							sum += phase[l] * h[-l];
+						}
+						_interpolated[j] = fabs (sum);
+					}
+					for (int j = 0; j < _channels; ++j) {
+						_true_peak[j] = max (_true_peak[j], _interpolated[j]);
+					}
+				}
+
+				int64_t const step = (*position + i) / _step_samples;
+				if (step < int64_t (_steps.size ())) {
+					_steps[step] += energy;
+				}
+			}
+
+			_history_position = (_history_position + 1) % taps_per_phase;
+		}
+	}
+
+	int _channels;
+	int _step_samples;
+
+	std::vector<double> _peak;
+	std::vector<double> _true_peak;
+	std::vector<double> _sum_squares;
+	std::vector<int64_t> _clipped;
+
+	std::vector<double> _weight;
+	Biquad _shelf;
+	Biquad _high_pass;
+	std::vector<double> _shelf_z1;
+	std::vector<double> _shelf_z2;
+	std::vector<double> _high_pass_z1;
+	std::vector<double> _high_pass_z2;
+
+	std::vector<double> _phases;
+	std::vector<double> _history;
+	int _history_position;
+	std::vector<double> _interpolated;
+
+	/** Sum of the weighted, K-filtered squared samples in each step */
+	std::vector<double> _steps;
+	int64_t _samples;
+
+	/** Scratch space for the current frame's samples */
+	std::vector<double> _input;
+};
+
+float
+SoundAnalysis::to_db (float linear)
+{
+	return 20 * log10 (linear);
+}
+
+/** Measure the peak, true peak, RMS level, clipping and integrated loudness of
+ *  a sound asset in a single pass over its frames.  If libdcp is built with OpenMP
+ *  the asset is split into contiguous ranges of frames which are analysed in parallel
+ *  and the results merged.  Each range runs half a second of the preceding audio
+ *  through its filters first so that the result is the same as that of a single pass.
+ *
+ *  @param asset Asset to analyse; if it is encrypted it must have its key set.
+ *  @param progress Optional progress handler, which will be called with values from 0 to 1.
+ */
+SoundAnalysis
+dcp::analyse_sound (shared_ptr<const SoundAsset> asset, function<void (float)> progress)
+{
+	int64_t const frames = asset->intrinsic_duration ();
+	Fraction const rate = asset->edit_rate ();
+	int64_t const samples_per_frame = int64_t (asset->sampling_rate()) * rate.denominator / rate.numerator;
+	int64_t const pre_roll = (rate.numerator + rate.denominator * 2 - 1) / (rate.denominator * 2);
+
+#ifdef LIBDCP_OPENMP
+	int const ranges = max (1, static_cast<int> (min (frames, static_cast<int64_t> (omp_get_max_threads ()))));
+#else
+	int const ranges = 1;
+#endif
+
+	vector<shared_ptr<Analyser> > analysers;
+	for (int i = 0; i < ranges; ++i) {
+		analysers.push_back (shared_ptr<Analyser> (new Analyser (asset->channels(), asset->sampling_rate(), frames * samples_per_frame)));
+	}
+
+	int64_t done = 0;
+	/* Exceptions must not escape an OpenMP parallel region, so catch them all and throw the first after it */
+	optional<DCPReadError> read_error;
+	optional<FileError> file_error;
+	optional<string> error;
+
+#ifdef LIBDCP_OPENMP
+#pragma omp parallel for
+#endif
+	for (int i = 0; i < ranges; ++i) {
+		try {
+			/* Readers can't be shared between threads */
+			shared_ptr<SoundAssetReader> reader = asset->start_read ();
+			int64_t const start = frames * i / ranges;
+			int64_t const end = frames * (i + 1) / ranges;
+
+			for (int64_t j = max (int64_t (0), start - pre_roll); j < start; ++j) {
+				analysers[i]->prime (reader->get_frame (j));
+			}
+
+			for (int64_t j = start; j < end; ++j) {
+				analysers[i]->analyse (reader->get_frame (j), j * samples_per_frame);
+				if (progress) {
+#ifdef LIBDCP_OPENMP
+#pragma omp critical
+#endif
+					{
+						++done;
+						progress (float (done) / frames);
+					}
+				}
+			}
+		} catch (DCPReadError& e) {
+#ifdef LIBDCP_OPENMP
+#pragma omp critical
+#endif
+			{
+				if (!read_error && !file_error && !error) {
+					read_error = e;
+				}
+			}
+		} catch (FileError& e) {
+#ifdef LIBDCP_OPENMP
+#pragma omp critical
+#endif
+			{
+				if (!read_error && !file_error && !error) {
+					file_error = e;
+				}
+			}
+		} catch (std::exception& e) {
+#ifdef LIBDCP_OPENMP
+#pragma omp critical
+#endif
+			{
+				if (!read_error && !file_error && !error) {
+					error = string (e.what ());
+				}
+			}
+		} catch (...) {
+#ifdef LIBDCP_OPENMP
+#pragma omp critical
+#endif
+			{
+				if (!read_error && !file_error && !error) {
+					error = string ("unknown error during sound analysis");
+				}
+			}
+		}
+	}
+
+	if (read_error) {
+		throw *read_error;
+	}
+	if (file_error) {
+		throw *file_error;
+	}
+	if (error) {
+		throw MiscError (*error);
+	}
+
+	for (int i = 1; i < ranges; ++i) {
+		analysers[0]->merge (*analysers[i]);
+	}
+
+	return analysers[0]->result ();
+}
@@ -0,0 +1,103 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/sound_analysis.h
+ *  @brief SoundAnalysis class and analyse_sound method.
+ */
+
+#ifndef LIBDCP_SOUND_ANALYSIS_H
+#define LIBDCP_SOUND_ANALYSIS_H
+
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/optional.hpp>
+#include <vector>
+#include <stdint.h>
+
+namespace dcp {
+
+class SoundAsset;
+
+/** @class SoundAnalysis
+ *  @brief The results of analysing the levels in a SoundAsset.
+ *
+ *  Levels are given as linear proportions of digital full scale; use
+ *  SoundAnalysis::to_db to convert them to dBFS.
+ */
+class SoundAnalysis
+{
+public:
+	class Channel
+	{
+	public:
+		Channel ()
+			: peak (0)
+			, true_peak (0)
+			, rms (0)
+			, clipped_samples (0)
+		{}
+
+		/** highest absolute sample value */
+		float peak;
+		/** estimate of the highest inter-sample value, from 4x oversampling */
+		float true_peak;
+		/** RMS level over the whole asset */
+		float rms;
+		/** number of samples at or beyond full scale */
+		int64_t clipped_samples;
+	};
+
+	SoundAnalysis ()
+		: samples (0)
+	{}
+
+	/** results for each channel, in the order that they appear in the asset */
+	std::vector<Channel> channels;
+	/** integrated loudness in LUFS as defined by ITU-R BS.1770-4 (and hence EBU R128),
+	 *  or empty if the asset is too short or too quiet to measure.
+	 */
+	boost::optional<float> integrated_loudness;
+	/** number of samples (per channel) that were analysed */
+	int64_t samples;
+
+	static float to_db (float linear);
+};
+
+extern SoundAnalysis analyse_sound (
+	boost::shared_ptr<const SoundAsset> asset,
+	boost::function<void (float)> progress = boost::function<void (float)> ()
+	);
+
+}
+
+#endif
@@ -37,12 +37,18 @@
 #include "dcp_assert.h"
 #include "compose.hpp"
 #include "crypto_context.h"
+#include "instrumentation.h"
+#include "ordered_writes.h"
 #include <asdcp/AS_DCP.h>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
 #include <iostream>
 
 using std::min;
+using std::string;
 using std::max;
 using std::cout;
+using boost::shared_ptr;
 using namespace dcp;
 
 struct SoundAssetWriter::ASDCPState
@@ -51,8 +57,14 @@ struct SoundAssetWriter::ASDCPState
 	ASDCP::PCM::FrameBuffer frame_buffer;
 	ASDCP::WriterInfo writer_info;
 	ASDCP::PCM::AudioDescriptor desc;
+	OrderedWrites<shared_ptr<ASDCP::PCM::FrameBuffer>, bool> ordered;
+	/** buffers for frames which are being copied from another asset */
+	std::vector<shared_ptr<ASDCP::PCM::FrameBuffer> > copy_buffers;
 };
 
+/** Number of frames that copy_frames() reads at once */
+static int const copy_batch = 16;
+
 SoundAssetWriter::SoundAssetWriter (SoundAsset* asset, boost::filesystem::path file)
 	: AssetWriter (asset, file)
 	, _state (new SoundAssetWriter::ASDCPState)
@@ -90,29 +102,51 @@ SoundAssetWriter::SoundAssetWriter (SoundAsset* asset, boost::filesystem::path f
 }
 
 void
-SoundAssetWriter::write (float const * const * data, int frames)
+SoundAssetWriter::start ()
 {
-	DCP_ASSERT (!_finalized);
-	DCP_ASSERT (frames > 0);
-
-	static float const clip = 1.0f - (1.0f / pow (2, 23));
+	Kumu::Result_t r = _state->mxf_writer.OpenWrite (_file.string().c_str(), _state->writer_info, _state->desc);
+	if (ASDCP_FAILURE (r)) {
+		boost::throw_exception (FileError ("could not open audio MXF for writing", _file.string(), r));
+	}
 
-	if (!_started) {
-		Kumu::Result_t r = _state->mxf_writer.OpenWrite (_file.string().c_str(), _state->writer_info, _state->desc);
-		if (ASDCP_FAILURE (r)) {
-			boost::throw_exception (FileError ("could not open audio MXF for writing", _file.string(), r));
-		}
+	_asset->set_file (_file);
+	_started = true;
+	preallocate ();
+}
 
-		_asset->set_file (_file);
-		_started = true;
-	}
+/** Say how long the asset being written is likely to be, so that disk space can be reserved
+ *  for it up-front.  This must be called before the first write.
+ *  @param frames Expected duration in frames (at the asset's edit rate).
+ */
+void
+SoundAssetWriter::set_duration_hint (int64_t frames)
+{
+	DCP_ASSERT (!_started);
+	/* 24-bit samples plus some slack for the KLV wrapping of each frame and the index */
+	_expected_size = frames * (_state->frame_buffer.Capacity() + 128) + 1024 * 1024;
+}
 
-	int const ch = _asset->channels ();
+/** @return Number of samples (per channel) in each MXF frame */
+int
+SoundAssetWriter::samples_per_frame () const
+{
+	return _state->frame_buffer.Capacity() / (3 * _asset->channels());
+}
 
-	for (int i = 0; i < frames; ++i) {
+/** Convert some samples to interleaved 24-bit, clipping if necessary.
+ *  @param data Samples, one array per channel.
+ *  @param offset Offset into each channel's array to start at.
+ *  @param frames Number of samples (per channel) to convert.
+ *  @param out Buffer to write to.
+ */
+void
+SoundAssetWriter::convert (float const * const * data, int offset, int frames, byte_t* out) const
+{
+	static float const clip = 1.0f - (1.0f / pow (2, 23));
 
-		byte_t* out = _state->frame_buffer.Data() + _frame_buffer_offset;
+	int const ch = _asset->channels ();
 
+	for (int i = offset; i < (offset + frames); ++i) {
 		/* Write one sample per channel */
 		for (int j = 0; j < ch; ++j) {
 			/* Convert sample to 24-bit int, clipping if necessary. */
@@ -127,6 +161,24 @@ SoundAssetWriter::write (float const * const * data, int frames)
 			*out++ = (s & 0xff00) >> 8;
 			*out++ = (s & 0xff0000) >> 16;
 		}
+	}
+}
+
+void
+SoundAssetWriter::write (float const * const * data, int frames)
+{
+	DCP_ASSERT (!_finalized);
+	DCP_ASSERT (frames > 0);
+
+	if (!_started) {
+		start ();
+	}
+
+	int const ch = _asset->channels ();
+
+	for (int i = 0; i < frames; ++i) {
+
+		convert (data, i, 1, _state->frame_buffer.Data() + _frame_buffer_offset);
 		_frame_buffer_offset += 3 * ch;
 
 		DCP_ASSERT (_frame_buffer_offset <= int (_state->frame_buffer.Capacity()));
@@ -140,10 +192,123 @@ SoundAssetWriter::write (float const * const * data, int frames)
 	}
 }
 
+/** Write a frame which may be given out of order; this method may be called
+ *  by several threads at once.  The samples are converted by the calling thread
+ *  and the frame is then written (and, if required, encrypted) once all the frames
+ *  before it have been written.
+ *  @param index Index of the frame within the asset, starting from 0.
+ *  @param data Samples, one array per channel, each of samples_per_frame() samples.
+ */
+void
+SoundAssetWriter::write_frame (int64_t index, float const * const * data)
+{
+	DCP_ASSERT (!_finalized);
+	DCP_ASSERT (_frame_buffer_offset == 0);
+
+	shared_ptr<ASDCP::PCM::FrameBuffer> buffer (new ASDCP::PCM::FrameBuffer (_state->frame_buffer.Capacity()));
+	buffer->Size (_state->frame_buffer.Capacity());
+	convert (data, 0, samples_per_frame(), buffer->Data());
+
+	_state->ordered.submit (index, buffer, boost::bind (&SoundAssetWriter::write_ordered_frame, this, _1));
+}
+
+/** As write_frame (int64_t, float const * const *) but with samples which are already
+ *  interleaved 24-bit little-endian, as they would be read from another sound asset.
+ *  @param index Index of the frame within the asset, starting from 0.
+ *  @param data Samples.
+ *  @param size Size of data in bytes; this must be the same as the size of this writer's frames.
+ */
+void
+SoundAssetWriter::write_frame (int64_t index, uint8_t const * data, int size)
+{
+	DCP_ASSERT (!_finalized);
+	DCP_ASSERT (_frame_buffer_offset == 0);
+
+	if (size != int (_state->frame_buffer.Capacity())) {
+		boost::throw_exception (MiscError (String::compose ("sound frame has %1 bytes rather than %2", size, _state->frame_buffer.Capacity())));
+	}
+
+	shared_ptr<ASDCP::PCM::FrameBuffer> buffer (new ASDCP::PCM::FrameBuffer (size));
+	buffer->Size (size);
+	memcpy (buffer->Data(), data, size);
+
+	_state->ordered.submit (index, buffer, boost::bind (&SoundAssetWriter::write_ordered_frame, this, _1));
+}
+
+/** Copy a range of frames from another asset, which must have the same sampling rate,
+ *  edit rate and channel count as this one.  The samples are read a batch of frames at a
+ *  time (see AssetReader::read_frames()) straight into buffers and written from there.
+ *  If the source asset is encrypted the reader must have its key.
+ *  @param reader Reader for the source asset.
+ *  @param from First frame index to copy.
+ *  @param to Frame index to stop copying at (so the last frame copied is to - 1).
+ */
+void
+SoundAssetWriter::copy_frames (shared_ptr<const SoundAssetReader> reader, int64_t from, int64_t to)
+{
+	DCP_ASSERT (!_finalized);
+	DCP_ASSERT (_frame_buffer_offset == 0);
+
+	if (!_started) {
+		start ();
+	}
+
+	int const size = _state->frame_buffer.Capacity ();
+
+	while (_state->copy_buffers.size() < size_t (copy_batch)) {
+		_state->copy_buffers.push_back (shared_ptr<ASDCP::PCM::FrameBuffer> (new ASDCP::PCM::FrameBuffer (size)));
+	}
+
+	for (int64_t i = from; i < to; i += copy_batch) {
+		std::vector<ASDCP::PCM::FrameBuffer*> buffers;
+		for (int j = 0; j < min (int64_t (copy_batch), to - i); ++j) {
+			buffers.push_back (_state->copy_buffers[j].get());
+		}
+
+		reader->read_frames (i, buffers);
+
+		BOOST_FOREACH (ASDCP::PCM::FrameBuffer* j, buffers) {
+			if (int (j->Size()) != size) {
+				boost::throw_exception (MiscError (String::compose ("sound frame has %1 bytes rather than %2", j->Size(), size)));
+			}
+			write_frame_buffer (*j);
+		}
+	}
+}
+
+/** Stop writing frames with write_frame(); any threads which are waiting in
+ *  write_frame(), or which call it later, will throw MiscError.
+ *  @param error Description of why writing has been stopped.
+ */
+void
+SoundAssetWriter::abort_frames (string error)
+{
+	_state->ordered.abort (error);
+}
+
+bool
+SoundAssetWriter::write_ordered_frame (shared_ptr<ASDCP::PCM::FrameBuffer> buffer)
+{
+	if (!_started) {
+		start ();
+	}
+
+	write_frame_buffer (*buffer);
+	return true;
+}
+
 void
 SoundAssetWriter::write_current_frame ()
 {
-	ASDCP::Result_t const r = _state->mxf_writer.WriteFrame (_state->frame_buffer, _crypto_context->context(), _crypto_context->hmac());
+	write_frame_buffer (_state->frame_buffer);
+}
+
+void
+SoundAssetWriter::write_frame_buffer (ASDCP::PCM::FrameBuffer const & buffer)
+{
+	Instrumentation::Span span (Instrumentation::MXF_WRITE, buffer.Size ());
+
+	ASDCP::Result_t const r = _state->mxf_writer.WriteFrame (buffer, _crypto_context->context(), _crypto_context->hmac());
 	if (ASDCP_FAILURE (r)) {
 		boost::throw_exception (MiscError (String::compose ("could not write audio MXF frame (%1)", int (r))));
 	}
@@ -154,6 +319,8 @@ SoundAssetWriter::write_current_frame ()
 bool
 SoundAssetWriter::finalize ()
 {
+	_state->ordered.check_complete ();
+
 	if (_frame_buffer_offset > 0) {
 		write_current_frame ();
 	}
@@ -163,6 +330,7 @@ SoundAssetWriter::finalize ()
 		if (ASDCP_FAILURE(r)) {
 			boost::throw_exception (MiscError (String::compose ("could not finalise audio MXF (%1)", int(r))));
 		}
+		release_preallocation ();
 	}
 
 	_asset->_intrinsic_duration = _frames_written;
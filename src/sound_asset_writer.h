@@ -38,6 +38,7 @@
 #include "asset_writer.h"
 #include "types.h"
 #include "sound_frame.h"
+#include "sound_asset_reader.h"
 #include <boost/shared_ptr.hpp>
 #include <boost/filesystem.hpp>
 
@@ -53,11 +54,26 @@ class SoundAsset;
  *  Sound samples can be written to the SoundAsset by calling write() with
  *  a buffer of float values.  finalize() must be called after the last samples
  *  have been written.
+ *
+ *  Alternatively, several threads may call write_frame() at the same time, each with
+ *  one whole MXF frame's worth of samples and the index of that frame; the samples are
+ *  converted on the calling threads and the frames written to the file in index order.
+ *  write() and write_frame() should not be used on the same writer.  If a thread cannot
+ *  produce its frame it should call abort_frames() so that the others do not wait for it
+ *  forever, and finalize() will throw if any frames were left waiting for a missing one.
+ *  As with MonoPictureAssetWriter, encryption is done by asdcplib one frame at a time as
+ *  the frames are written.
  */
 class SoundAssetWriter : public AssetWriter
 {
 public:
 	void write (float const * const *, int);
+	void write_frame (int64_t index, float const * const * data);
+	void write_frame (int64_t index, uint8_t const * data, int size);
+	void copy_frames (boost::shared_ptr<const SoundAssetReader> reader, int64_t from, int64_t to);
+	void abort_frames (std::string error);
+	int samples_per_frame () const;
+	void set_duration_hint (int64_t frames);
 	bool finalize ();
 
 private:
@@ -65,7 +81,11 @@ private:
 
 	SoundAssetWriter (SoundAsset *, boost::filesystem::path);
 
+	void start ();
+	void convert (float const * const * data, int offset, int frames, byte_t* out) const;
 	void write_current_frame ();
+	void write_frame_buffer (ASDCP::PCM::FrameBuffer const & buffer);
+	bool write_ordered_frame (boost::shared_ptr<ASDCP::PCM::FrameBuffer> buffer);
 
 	/* do this with an opaque pointer so we don't have to include
 	   ASDCP headers
@@ -38,8 +38,13 @@
 using std::cout;
 using namespace dcp;
 
-SoundFrame::SoundFrame (ASDCP::PCM::MXFReader* reader, int n, boost::shared_ptr<const DecryptionContext> c)
-	: Frame<ASDCP::PCM::MXFReader, ASDCP::PCM::FrameBuffer> (reader, n, c)
+SoundFrame::SoundFrame (
+	ASDCP::PCM::MXFReader* reader,
+	int n,
+	boost::shared_ptr<const DecryptionContext> c,
+	boost::shared_ptr<EssenceReader> essence
+	)
+	: Frame<ASDCP::PCM::MXFReader, ASDCP::PCM::FrameBuffer> (reader, n, c, essence)
 {
 	ASDCP::PCM::AudioDescriptor desc;
 	reader->FillAudioDescriptor (desc);
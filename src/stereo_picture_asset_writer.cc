@@ -36,6 +36,7 @@
 #include "dcp_assert.h"
 #include "picture_asset.h"
 #include "crypto_context.h"
+#include "instrumentation.h"
 #include <asdcp/AS_DCP.h>
 #include <asdcp/KM_fileio.h>
 
@@ -58,6 +59,12 @@ StereoPictureAssetWriter::StereoPictureAssetWriter (PictureAsset* mxf, boost::fi
 
 }
 
+StereoPictureAssetWriter::~StereoPictureAssetWriter ()
+{
+	/* Stop any write-behind thread before our state goes away */
+	stop_write_behind ();
+}
+
 void
 StereoPictureAssetWriter::start (uint8_t const * data, int size)
 {
@@ -73,6 +80,7 @@ FrameInfo
 StereoPictureAssetWriter::write (uint8_t const * data, int size)
 {
 	DCP_ASSERT (!_finalized);
+	wait_for_write_behind ();
 
 	if (!_started) {
 		start (data, size);
@@ -82,6 +90,8 @@ StereoPictureAssetWriter::write (uint8_t const * data, int size)
  		boost::throw_exception (MiscError ("could not parse J2K frame"));
  	}
 
+	Instrumentation::Span span (Instrumentation::MXF_WRITE, _state->frame_buffer.Size ());
+
 	uint64_t const before_offset = _state->mxf_writer.Tell ();
 
 	string hash;
@@ -109,8 +119,9 @@ StereoPictureAssetWriter::write (uint8_t const * data, int size)
 void
 StereoPictureAssetWriter::fake_write (int size)
 {
-	DCP_ASSERT (_started);
 	DCP_ASSERT (!_finalized);
+	wait_for_write_behind ();
+	DCP_ASSERT (_started);
 
 	Kumu::Result_t r = _state->mxf_writer.FakeWriteFrame (size, _next_eye == EYE_LEFT ? ASDCP::JP2K::SP_LEFT : ASDCP::JP2K::SP_RIGHT);
 	if (ASDCP_FAILURE (r)) {
@@ -126,11 +137,15 @@ StereoPictureAssetWriter::fake_write (int size)
 bool
 StereoPictureAssetWriter::finalize ()
 {
+	wait_for_write_behind ();
+	stop_write_behind ();
+
 	if (_started) {
 		Kumu::Result_t r = _state->mxf_writer.Finalize();
 		if (ASDCP_FAILURE (r)) {
 			boost::throw_exception (MXFFileError ("error in finalizing video MXF", _file.string(), r));
 		}
+		release_preallocation ();
 	}
 
 	_picture_asset->_intrinsic_duration = _frames_written;
@@ -54,6 +54,8 @@ namespace dcp {
 class StereoPictureAssetWriter : public PictureAssetWriter
 {
 public:
+	~StereoPictureAssetWriter ();
+
 	/** Write a frame for one eye.  Frames must be written left, then right, then left etc.
 	 *  @param data JPEG2000 data.
 	 *  @param size Size of data.
@@ -67,6 +69,9 @@ private:
 
 	StereoPictureAssetWriter (PictureAsset *, boost::filesystem::path file, bool);
 	void start (uint8_t const *, int);
+	int writes_per_frame () const {
+		return 2;
+	}
 
 	/* do this with an opaque pointer so we don't have to include
 	   ASDCP headers
@@ -38,6 +38,7 @@
 #include "colour_conversion.h"
 #include "compose.hpp"
 #include "j2k.h"
+#include "instrumentation.h"
 #include "crypto_context.h"
 #include <asdcp/AS_DCP.h>
 #include <asdcp/KM_fileio.h>
@@ -49,15 +50,32 @@ using namespace dcp;
 /** Make a picture frame from a 3D (stereoscopic) asset.
  *  @param reader Reader for the MXF file.
  *  @param n Frame within the asset, not taking EntryPoint into account.
+ *  @param essence Reader to use for unencrypted frames, or 0 to use asdcplib.
  */
-StereoPictureFrame::StereoPictureFrame (ASDCP::JP2K::MXFSReader* reader, int n, shared_ptr<DecryptionContext> c)
+StereoPictureFrame::StereoPictureFrame (ASDCP::JP2K::MXFSReader* reader, int n, shared_ptr<DecryptionContext> c, shared_ptr<EssenceReader> essence)
 {
+	Instrumentation::Span span (Instrumentation::MXF_READ);
+
 	/* XXX: unfortunate guesswork on this buffer size */
 	_buffer = new ASDCP::JP2K::SFrameBuffer (4 * Kumu::Megabyte);
 
-	if (ASDCP_FAILURE (reader->ReadFrame (n, *_buffer, c->context(), c->hmac()))) {
+	if (
+		essence &&
+		essence->read_frame (reader, n, ASDCP::JP2K::SP_LEFT, _buffer->Left) &&
+		essence->read_frame (reader, n, ASDCP::JP2K::SP_RIGHT, _buffer->Right)
+		) {
+		span.set_bytes (_buffer->Left.Size() + _buffer->Right.Size());
+		return;
+	}
+
+	if (
+		ASDCP_FAILURE (c->read_frame (reader, n, ASDCP::JP2K::SP_LEFT, _buffer->Left)) ||
+		ASDCP_FAILURE (c->read_frame (reader, n, ASDCP::JP2K::SP_RIGHT, _buffer->Right))
+		) {
 		boost::throw_exception (DCPReadError (String::compose ("could not read video frame %1 of %2", n)));
 	}
+
+	span.set_bytes (_buffer->Left.Size() + _buffer->Right.Size());
 }
 
 StereoPictureFrame::StereoPictureFrame ()
@@ -77,7 +77,7 @@ private:
 	*/
 	friend class AssetReader<ASDCP::JP2K::MXFSReader, StereoPictureFrame>;
 
-	StereoPictureFrame (ASDCP::JP2K::MXFSReader* reader, int n, boost::shared_ptr<DecryptionContext>);
+	StereoPictureFrame (ASDCP::JP2K::MXFSReader* reader, int n, boost::shared_ptr<DecryptionContext>, boost::shared_ptr<EssenceReader>);
 
 	ASDCP::JP2K::SFrameBuffer* _buffer;
 };
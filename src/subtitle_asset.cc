@@ -36,13 +36,13 @@
 #include "subtitle_asset.h"
 #include "subtitle_asset_internal.h"
 #include "util.h"
-#include "xml.h"
 #include "subtitle_string.h"
 #include "subtitle_image.h"
 #include "dcp_assert.h"
+#include "xml_reader.h"
+#include "xml_writer.h"
 #include <asdcp/AS_DCP.h>
 #include <asdcp/KM_util.h>
-#include <libxml++/nodes/element.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/shared_array.hpp>
@@ -53,6 +53,7 @@ using std::list;
 using std::cout;
 using std::cerr;
 using std::map;
+using std::vector;
 using boost::shared_ptr;
 using boost::shared_array;
 using boost::optional;
@@ -71,30 +72,10 @@ SubtitleAsset::SubtitleAsset (boost::filesystem::path file)
 
 }
 
-string
-string_attribute (xmlpp::Element const * node, string name)
+static optional<bool>
+optional_bool_attribute (XMLReader const & reader, string name)
 {
-	xmlpp::Attribute* a = node->get_attribute (name);
-	if (!a) {
-		throw XMLError (String::compose ("missing attribute %1", name));
-	}
-	return string (a->get_value ());
-}
-
-optional<string>
-optional_string_attribute (xmlpp::Element const * node, string name)
-{
-	xmlpp::Attribute* a = node->get_attribute (name);
-	if (!a) {
-		return optional<string>();
-	}
-	return string (a->get_value ());
-}
-
-optional<bool>
-optional_bool_attribute (xmlpp::Element const * node, string name)
-{
-	optional<string> s = optional_string_attribute (node, name);
+	optional<string> s = reader.optional_attribute (name);
 	if (!s) {
 		return optional<bool> ();
 	}
@@ -104,9 +85,9 @@ optional_bool_attribute (xmlpp::Element const * node, string name)
 
 template <class T>
 optional<T>
-optional_number_attribute (xmlpp::Element const * node, string name)
+optional_number_attribute (XMLReader const & reader, string name)
 {
-	boost::optional<std::string> s = optional_string_attribute (node, name);
+	boost::optional<std::string> s = reader.optional_attribute (name);
 	if (!s) {
 		return boost::optional<T> ();
 	}
@@ -116,34 +97,99 @@ optional_number_attribute (xmlpp::Element const * node, string name)
 	return raw_convert<T> (t);
 }
 
+/** Set anything in this state which is set in another.
+ *  @param other State of a node inside the one that this state is for.
+ */
+void
+SubtitleAsset::ParseState::apply (ParseState const & other)
+{
+	if (other.font_id) {
+		font_id = other.font_id.get();
+	}
+	if (other.size) {
+		size = other.size.get();
+	}
+	if (other.aspect_adjust) {
+		aspect_adjust = other.aspect_adjust.get();
+	}
+	if (other.italic) {
+		italic = other.italic.get();
+	}
+	if (other.bold) {
+		bold = other.bold.get();
+	}
+	if (other.underline) {
+		underline = other.underline.get();
+	}
+	if (other.colour) {
+		colour = other.colour.get();
+	}
+	if (other.effect) {
+		effect = other.effect.get();
+	}
+	if (other.effect_colour) {
+		effect_colour = other.effect_colour.get();
+	}
+	if (other.h_position) {
+		h_position = other.h_position.get();
+	}
+	if (other.h_align) {
+		h_align = other.h_align.get();
+	}
+	if (other.v_position) {
+		v_position = other.v_position.get();
+	}
+	if (other.v_align) {
+		v_align = other.v_align.get();
+	}
+	if (other.direction) {
+		direction = other.direction.get();
+	}
+	if (other.in) {
+		in = other.in.get();
+	}
+	if (other.out) {
+		out = other.out.get();
+	}
+	if (other.fade_up_time) {
+		fade_up_time = other.fade_up_time.get();
+	}
+	if (other.fade_down_time) {
+		fade_down_time = other.fade_down_time.get();
+	}
+	if (other.type) {
+		type = other.type.get();
+	}
+}
+
 SubtitleAsset::ParseState
-SubtitleAsset::font_node_state (xmlpp::Element const * node, Standard standard) const
+SubtitleAsset::font_node_state (XMLReader const & reader, Standard standard) const
 {
 	ParseState ps;
 
 	if (standard == INTEROP) {
-		ps.font_id = optional_string_attribute (node, "Id");
+		ps.font_id = reader.optional_attribute ("Id");
 	} else {
-		ps.font_id = optional_string_attribute (node, "ID");
+		ps.font_id = reader.optional_attribute ("ID");
 	}
-	ps.size = optional_number_attribute<int64_t> (node, "Size");
-	ps.aspect_adjust = optional_number_attribute<float> (node, "AspectAdjust");
-	ps.italic = optional_bool_attribute (node, "Italic");
-	ps.bold = optional_string_attribute(node, "Weight").get_value_or("normal") == "bold";
+	ps.size = optional_number_attribute<int64_t> (reader, "Size");
+	ps.aspect_adjust = optional_number_attribute<float> (reader, "AspectAdjust");
+	ps.italic = optional_bool_attribute (reader, "Italic");
+	ps.bold = reader.optional_attribute("Weight").get_value_or("normal") == "bold";
 	if (standard == INTEROP) {
-		ps.underline = optional_bool_attribute (node, "Underlined");
+		ps.underline = optional_bool_attribute (reader, "Underlined");
 	} else {
-		ps.underline = optional_bool_attribute (node, "Underline");
+		ps.underline = optional_bool_attribute (reader, "Underline");
 	}
-	optional<string> c = optional_string_attribute (node, "Color");
+	optional<string> c = reader.optional_attribute ("Color");
 	if (c) {
 		ps.colour = Colour (c.get ());
 	}
-	optional<string> const e = optional_string_attribute (node, "Effect");
+	optional<string> const e = reader.optional_attribute ("Effect");
 	if (e) {
 		ps.effect = string_to_effect (e.get ());
 	}
-	c = optional_string_attribute (node, "EffectColor");
+	c = reader.optional_attribute ("EffectColor");
 	if (c) {
 		ps.effect_colour = Colour (c.get ());
 	}
@@ -152,35 +198,35 @@ SubtitleAsset::font_node_state (xmlpp::Element const * node, Standard standard)
 }
 
 void
-SubtitleAsset::position_align (SubtitleAsset::ParseState& ps, xmlpp::Element const * node) const
+SubtitleAsset::position_align (SubtitleAsset::ParseState& ps, XMLReader const & reader) const
 {
-	optional<float> hp = optional_number_attribute<float> (node, "HPosition");
+	optional<float> hp = optional_number_attribute<float> (reader, "HPosition");
 	if (!hp) {
-		hp = optional_number_attribute<float> (node, "Hposition");
+		hp = optional_number_attribute<float> (reader, "Hposition");
 	}
 	if (hp) {
 		ps.h_position = hp.get () / 100;
 	}
 
-	optional<string> ha = optional_string_attribute (node, "HAlign");
+	optional<string> ha = reader.optional_attribute ("HAlign");
 	if (!ha) {
-		ha = optional_string_attribute (node, "Halign");
+		ha = reader.optional_attribute ("Halign");
 	}
 	if (ha) {
 		ps.h_align = string_to_halign (ha.get ());
 	}
 
-	optional<float> vp = optional_number_attribute<float> (node, "VPosition");
+	optional<float> vp = optional_number_attribute<float> (reader, "VPosition");
 	if (!vp) {
-		vp = optional_number_attribute<float> (node, "Vposition");
+		vp = optional_number_attribute<float> (reader, "Vposition");
 	}
 	if (vp) {
 		ps.v_position = vp.get () / 100;
 	}
 
-	optional<string> va = optional_string_attribute (node, "VAlign");
+	optional<string> va = reader.optional_attribute ("VAlign");
 	if (!va) {
-		va = optional_string_attribute (node, "Valign");
+		va = reader.optional_attribute ("Valign");
 	}
 	if (va) {
 		ps.v_align = string_to_valign (va.get ());
@@ -189,13 +235,13 @@ SubtitleAsset::position_align (SubtitleAsset::ParseState& ps, xmlpp::Element con
 }
 
 SubtitleAsset::ParseState
-SubtitleAsset::text_node_state (xmlpp::Element const * node) const
+SubtitleAsset::text_node_state (XMLReader const & reader) const
 {
 	ParseState ps;
 
-	position_align (ps, node);
+	position_align (ps, reader);
 
-	optional<string> d = optional_string_attribute (node, "Direction");
+	optional<string> d = reader.optional_attribute ("Direction");
 	if (d) {
 		ps.direction = string_to_direction (d.get ());
 	}
@@ -206,11 +252,11 @@ SubtitleAsset::text_node_state (xmlpp::Element const * node) const
 }
 
 SubtitleAsset::ParseState
-SubtitleAsset::image_node_state (xmlpp::Element const * node) const
+SubtitleAsset::image_node_state (XMLReader const & reader) const
 {
 	ParseState ps;
 
-	position_align (ps, node);
+	position_align (ps, reader);
 
 	ps.type = ParseState::IMAGE;
 
@@ -218,20 +264,20 @@ SubtitleAsset::image_node_state (xmlpp::Element const * node) const
 }
 
 SubtitleAsset::ParseState
-SubtitleAsset::subtitle_node_state (xmlpp::Element const * node, optional<int> tcr) const
+SubtitleAsset::subtitle_node_state (XMLReader const & reader, optional<int> tcr) const
 {
 	ParseState ps;
-	ps.in = Time (string_attribute(node, "TimeIn"), tcr);
-	ps.out = Time (string_attribute(node, "TimeOut"), tcr);
-	ps.fade_up_time = fade_time (node, "FadeUpTime", tcr);
-	ps.fade_down_time = fade_time (node, "FadeDownTime", tcr);
+	ps.in = Time (reader.attribute("TimeIn"), tcr);
+	ps.out = Time (reader.attribute("TimeOut"), tcr);
+	ps.fade_up_time = fade_time (reader, "FadeUpTime", tcr);
+	ps.fade_down_time = fade_time (reader, "FadeDownTime", tcr);
 	return ps;
 }
 
 Time
-SubtitleAsset::fade_time (xmlpp::Element const * node, string name, optional<int> tcr) const
+SubtitleAsset::fade_time (XMLReader const & reader, string name, optional<int> tcr) const
 {
-	string const u = optional_string_attribute(node, name).get_value_or ("");
+	string const u = reader.optional_attribute(name).get_value_or ("");
 	Time t;
 
 	if (u.empty ()) {
@@ -249,106 +295,71 @@ SubtitleAsset::fade_time (xmlpp::Element const * node, string name, optional<int
 	return t;
 }
 
+/** Read a Font, Subtitle, Text, Image or SubtitleList element and everything inside it,
+ *  adding subtitles as they are found.
+ *  @param reader Reader positioned at the start of the element; it is left at the end.
+ */
 void
-SubtitleAsset::parse_subtitles (xmlpp::Element const * node, list<ParseState>& state, optional<int> tcr, Standard standard)
+SubtitleAsset::parse_subtitles (XMLReader& reader, optional<int> tcr, Standard standard)
 {
-	if (node->get_name() == "Font") {
-		state.push_back (font_node_state (node, standard));
-	} else if (node->get_name() == "Subtitle") {
-		state.push_back (subtitle_node_state (node, tcr));
-	} else if (node->get_name() == "Text") {
-		state.push_back (text_node_state (node));
-	} else if (node->get_name() == "SubtitleList") {
-		state.push_back (ParseState ());
-	} else if (node->get_name() == "Image") {
-		state.push_back (image_node_state (node));
-	} else {
-		throw XMLError ("unexpected node " + node->get_name());
-	}
+	/* State of each open element, with the state of the elements that it is inside applied
+	   first so that the last one is everything that applies to any text we find.
+	*/
+	vector<ParseState> state;
+	int const depth = reader.depth ();
+
+	while (true) {
+		switch (reader.type ()) {
+		case XMLReader::ELEMENT:
+		{
+			string const name = reader.name ();
+			ParseState ps = state.empty() ? ParseState() : state.back();
+			if (name == "Font") {
+				ps.apply (font_node_state (reader, standard));
+			} else if (name == "Subtitle") {
+				ps.apply (subtitle_node_state (reader, tcr));
+			} else if (name == "Text") {
+				ps.apply (text_node_state (reader));
+			} else if (name == "Image") {
+				ps.apply (image_node_state (reader));
+			} else if (name != "SubtitleList") {
+				throw XMLError ("unexpected node " + name);
+			}
+			state.push_back (ps);
+			if (reader.empty ()) {
+				state.pop_back ();
+			}
+			break;
+		}
+		case XMLReader::TEXT:
+			DCP_ASSERT (!state.empty ());
+			maybe_add_subtitle (reader.value(), state.back(), standard);
+			break;
+		case XMLReader::END_ELEMENT:
+			DCP_ASSERT (!state.empty ());
+			state.pop_back ();
+			break;
+		case XMLReader::OTHER:
+			break;
+		}
 
-	xmlpp::Node::NodeList c = node->get_children ();
-	for (xmlpp::Node::NodeList::const_iterator i = c.begin(); i != c.end(); ++i) {
-		xmlpp::ContentNode const * v = dynamic_cast<xmlpp::ContentNode const *> (*i);
-		if (v) {
-			maybe_add_subtitle (v->get_content(), state, standard);
+		if (state.empty() && reader.depth() == depth) {
+			return;
 		}
-		xmlpp::Element const * e = dynamic_cast<xmlpp::Element const *> (*i);
-		if (e) {
-			parse_subtitles (e, state, tcr, standard);
+
+		if (!reader.read ()) {
+			throw XMLError ("unexpected end of subtitle XML");
 		}
 	}
-
-	state.pop_back ();
 }
 
 void
-SubtitleAsset::maybe_add_subtitle (string text, list<ParseState> const & parse_state, Standard standard)
+SubtitleAsset::maybe_add_subtitle (string text, ParseState const & ps, Standard standard)
 {
 	if (empty_or_white_space (text)) {
 		return;
 	}
 
-	ParseState ps;
-	BOOST_FOREACH (ParseState const & i, parse_state) {
-		if (i.font_id) {
-			ps.font_id = i.font_id.get();
-		}
-		if (i.size) {
-			ps.size = i.size.get();
-		}
-		if (i.aspect_adjust) {
-			ps.aspect_adjust = i.aspect_adjust.get();
-		}
-		if (i.italic) {
-			ps.italic = i.italic.get();
-		}
-		if (i.bold) {
-			ps.bold = i.bold.get();
-		}
-		if (i.underline) {
-			ps.underline = i.underline.get();
-		}
-		if (i.colour) {
-			ps.colour = i.colour.get();
-		}
-		if (i.effect) {
-			ps.effect = i.effect.get();
-		}
-		if (i.effect_colour) {
-			ps.effect_colour = i.effect_colour.get();
-		}
-		if (i.h_position) {
-			ps.h_position = i.h_position.get();
-		}
-		if (i.h_align) {
-			ps.h_align = i.h_align.get();
-		}
-		if (i.v_position) {
-			ps.v_position = i.v_position.get();
-		}
-		if (i.v_align) {
-			ps.v_align = i.v_align.get();
-		}
-		if (i.direction) {
-			ps.direction = i.direction.get();
-		}
-		if (i.in) {
-			ps.in = i.in.get();
-		}
-		if (i.out) {
-			ps.out = i.out.get();
-		}
-		if (i.fade_up_time) {
-			ps.fade_up_time = i.fade_up_time.get();
-		}
-		if (i.fade_down_time) {
-			ps.fade_down_time = i.fade_down_time.get();
-		}
-		if (i.type) {
-			ps.type = i.type.get();
-		}
-	}
-
 	if (!ps.in || !ps.out) {
 		/* We're not in a <Subtitle> node; just ignore this content */
 		return;
@@ -358,7 +369,7 @@ SubtitleAsset::maybe_add_subtitle (string text, list<ParseState> const & parse_s
 
 	switch (ps.type.get()) {
 	case ParseState::TEXT:
-		_subtitles.push_back (
+		SubtitleAsset::add (
 			shared_ptr<Subtitle> (
 				new SubtitleString (
 					ps.font_id,
@@ -386,10 +397,10 @@ SubtitleAsset::maybe_add_subtitle (string text, list<ParseState> const & parse_s
 		break;
 	case ParseState::IMAGE:
 		/* Add a subtitle with no image data and we'll fill that in later */
-		_subtitles.push_back (
+		SubtitleAsset::add (
 			shared_ptr<Subtitle> (
 				new SubtitleImage (
-					Data (),
+					LazyData (),
 					standard == INTEROP ? text.substr(0, text.size() - 4) : text,
 					ps.in.get(),
 					ps.out.get(),
@@ -406,36 +417,72 @@ SubtitleAsset::maybe_add_subtitle (string text, list<ParseState> const & parse_s
 	}
 }
 
+/** @return Our index, making it if required */
+shared_ptr<const SubtitleIndex>
+SubtitleAsset::index () const
+{
+	boost::mutex::scoped_lock lm (_index_mutex);
+	if (!_index) {
+		_index.reset (new SubtitleIndex (_subtitles));
+		_latest_subtitle_out = _index->latest_out ();
+	}
+	return _index;
+}
+
+/** The first call after the subtitles have been changed makes an index of them, so
+ *  later calls do not have to look at every subtitle.  If the times of subtitles which
+ *  are already in this asset are changed, call add() or the index will be out of date.
+ *
+ *  @param from Start of period.
+ *  @param to End of period.
+ *  @param starting true to return only subtitles which start in [from, to), false to
+ *  return subtitles which are on screen for any part of [from, to].
+ *  @return Subtitles, in the order that they were added to this asset.
+ */
 list<shared_ptr<Subtitle> >
 SubtitleAsset::subtitles_during (Time from, Time to, bool starting) const
 {
-	list<shared_ptr<Subtitle> > s;
-	BOOST_FOREACH (shared_ptr<Subtitle> i, _subtitles) {
-		if ((starting && from <= i->in() && i->in() < to) || (!starting && i->out() >= from && i->in() <= to)) {
-			s.push_back (i);
-		}
-	}
+	shared_ptr<const SubtitleIndex> i = index ();
+	return starting ? i->starting (from, to) : i->overlapping (from, to);
+}
 
-	return s;
+/** @return A cursor to find the subtitles during a sequence of periods which move forwards
+ *  through time; see SubtitleCursor.  The cursor will not see subtitles which are added
+ *  after it is made.
+ */
+SubtitleCursor
+SubtitleAsset::cursor () const
+{
+	return SubtitleCursor (index ());
 }
 
 void
 SubtitleAsset::add (shared_ptr<Subtitle> s)
 {
 	_subtitles.push_back (s);
+
+	boost::mutex::scoped_lock lm (_index_mutex);
+	_index.reset ();
+	if (_latest_subtitle_out && s->out() > *_latest_subtitle_out) {
+		_latest_subtitle_out = s->out ();
+	}
 }
 
 Time
 SubtitleAsset::latest_subtitle_out () const
 {
-	Time t;
-	BOOST_FOREACH (shared_ptr<Subtitle> i, _subtitles) {
-		if (i->out() > t) {
-			t = i->out ();
+	boost::mutex::scoped_lock lm (_index_mutex);
+	if (!_latest_subtitle_out) {
+		Time t;
+		BOOST_FOREACH (shared_ptr<Subtitle> i, _subtitles) {
+			if (i->out() > t) {
+				t = i->out ();
+			}
 		}
+		_latest_subtitle_out = t;
 	}
 
-	return t;
+	return *_latest_subtitle_out;
 }
 
 bool
@@ -556,22 +603,54 @@ SubtitleAsset::pull_fonts (shared_ptr<order::Part> part)
 	part->children = merged;
 }
 
+/** Write one order::Subtitle, pulling its font changes up as high as we can.  Fonts which
+ *  are common to consecutive subtitles are shared by putting those subtitles inside a single
+ *  Font element, which is left open in case the next subtitle can also go inside it.
+ *  @param subtitle Subtitle to write.
+ *  @param open_font Font of the Font element which is currently open, or an empty Font if there is none.
+ */
+void
+SubtitleAsset::write_subtitle (XMLWriter& writer, shared_ptr<order::Subtitle> subtitle, order::Font& open_font, order::Context& context)
+{
+	pull_fonts (subtitle);
+
+	if (!open_font.empty() && !(subtitle->font == open_font)) {
+		writer.end_element ();
+		open_font.clear ();
+	}
+
+	if (open_font.empty() && !subtitle->font.empty()) {
+		open_font = subtitle->font;
+		open_font.start_xml (writer, context);
+	}
+
+	subtitle->font.clear ();
+	subtitle->write_xml (writer, context);
+}
+
 /** @param standard Standard (INTEROP or SMPTE); this is used rather than putting things in the child
  *  class because the differences between the two are fairly subtle.
  */
 void
-SubtitleAsset::subtitles_as_xml (xmlpp::Element* xml_root, int time_code_rate, Standard standard) const
+SubtitleAsset::subtitles_as_xml (XMLWriter& writer, int time_code_rate, Standard standard) const
 {
 	list<shared_ptr<Subtitle> > sorted = _subtitles;
 	sorted.sort (SubtitleSorter ());
 
-	/* Gather our subtitles into a hierarchy of Subtitle/Text/String objects, writing
-	   font information into the bottom level (String) objects.
+	order::Context context;
+	context.time_code_rate = time_code_rate;
+	context.standard = standard;
+	context.spot_number = 1;
+
+	/* Gather each subtitle into a hierarchy of Subtitle/Text/String objects, writing
+	   font information into the bottom level (String) objects, then write it out before
+	   starting on the next one.
 	*/
 
 	shared_ptr<order::Part> root (new order::Part (shared_ptr<order::Part> ()));
 	shared_ptr<order::Subtitle> subtitle;
 	shared_ptr<order::Text> text;
+	order::Font open_font;
 
 	Time last_in;
 	Time last_out;
@@ -591,8 +670,11 @@ SubtitleAsset::subtitles_as_xml (xmlpp::Element* xml_root, int time_code_rate, S
 		     last_fade_down_time != i->fade_down_time())
 			) {
 
+			if (subtitle) {
+				write_subtitle (writer, subtitle, open_font, context);
+			}
+
 			subtitle.reset (new order::Subtitle (root, i->in(), i->out(), i->fade_up_time(), i->fade_down_time()));
-			root->children.push_back (subtitle);
 
 			last_in = i->in ();
 			last_out = i->out ();
@@ -627,23 +709,18 @@ SubtitleAsset::subtitles_as_xml (xmlpp::Element* xml_root, int time_code_rate, S
 		if (ii) {
 			text.reset ();
 			subtitle->children.push_back (
-				shared_ptr<order::Image> (new order::Image (subtitle, ii->id(), ii->png_image(), ii->h_align(), ii->h_position(), ii->v_align(), ii->v_position()))
+				shared_ptr<order::Image> (new order::Image (subtitle, ii->id(), ii->h_align(), ii->h_position(), ii->v_align(), ii->v_position()))
 				);
 		}
 	}
 
-	/* Pull font changes as high up the hierarchy as we can */
-
-	pull_fonts (root);
-
-	/* Write XML */
-
-	order::Context context;
-	context.time_code_rate = time_code_rate;
-	context.standard = standard;
-	context.spot_number = 1;
+	if (subtitle) {
+		write_subtitle (writer, subtitle, open_font, context);
+	}
 
-	root->write_xml (xml_root, context);
+	if (!open_font.empty ()) {
+		writer.end_element ();
+	}
 }
 
 map<string, Data>
@@ -651,7 +728,7 @@ SubtitleAsset::fonts_with_load_ids () const
 {
 	map<string, Data> out;
 	BOOST_FOREACH (Font const & i, _fonts) {
-		out[i.load_id] = i.data;
+		out[i.load_id] = i.data.get ();
 	}
 	return out;
 }
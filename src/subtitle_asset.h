@@ -38,14 +38,13 @@
 #include "dcp_time.h"
 #include "subtitle_string.h"
 #include "data.h"
+#include "lazy_data.h"
+#include "subtitle_index.h"
 #include <libcxml/cxml.h>
 #include <boost/shared_array.hpp>
+#include <boost/thread/mutex.hpp>
 #include <map>
 
-namespace xmlpp {
-	class Element;
-}
-
 struct interop_dcp_font_test;
 struct smpte_dcp_font_test;
 struct pull_fonts_test1;
@@ -61,9 +60,13 @@ class FontNode;
 class TextNode;
 class SubtitleNode;
 class LoadFontNode;
+class XMLReader;
+class XMLWriter;
 
 namespace order {
 	class Part;
+	class Subtitle;
+	class Font;
 	struct Context;
 }
 
@@ -88,6 +91,7 @@ public:
 		) const;
 
 	std::list<boost::shared_ptr<Subtitle> > subtitles_during (Time from, Time to, bool starting) const;
+	SubtitleCursor cursor () const;
 	std::list<boost::shared_ptr<Subtitle> > const & subtitles () const {
 		return _subtitles;
 	}
@@ -131,17 +135,19 @@ protected:
 			IMAGE
 		};
 		boost::optional<Type> type;
+
+		void apply (ParseState const & other);
 	};
 
-	void parse_subtitles (xmlpp::Element const * node, std::list<ParseState>& state, boost::optional<int> tcr, Standard standard);
-	ParseState font_node_state (xmlpp::Element const * node, Standard standard) const;
-	ParseState text_node_state (xmlpp::Element const * node) const;
-	ParseState image_node_state (xmlpp::Element const * node) const;
-	ParseState subtitle_node_state (xmlpp::Element const * node, boost::optional<int> tcr) const;
-	Time fade_time (xmlpp::Element const * node, std::string name, boost::optional<int> tcr) const;
-	void position_align (ParseState& ps, xmlpp::Element const * node) const;
+	void parse_subtitles (XMLReader& reader, boost::optional<int> tcr, Standard standard);
+	ParseState font_node_state (XMLReader const & reader, Standard standard) const;
+	ParseState text_node_state (XMLReader const & reader) const;
+	ParseState image_node_state (XMLReader const & reader) const;
+	ParseState subtitle_node_state (XMLReader const & reader, boost::optional<int> tcr) const;
+	Time fade_time (XMLReader const & reader, std::string name, boost::optional<int> tcr) const;
+	void position_align (ParseState& ps, XMLReader const & reader) const;
 
-	void subtitles_as_xml (xmlpp::Element* root, int time_code_rate, Standard standard) const;
+	void subtitles_as_xml (XMLWriter& writer, int time_code_rate, Standard standard) const;
 
 	/** All our subtitles, in no particular order */
 	std::list<boost::shared_ptr<Subtitle> > _subtitles;
@@ -152,11 +158,11 @@ protected:
 		Font (std::string load_id_, std::string uuid_, boost::filesystem::path file_)
 			: load_id (load_id_)
 			, uuid (uuid_)
-			, data (file_)
+			, data (boost::shared_ptr<DataSource> (new FileDataSource (file_)))
 			, file (file_)
 		{}
 
-		Font (std::string load_id_, std::string uuid_, Data data_)
+		Font (std::string load_id_, std::string uuid_, LazyData data_)
 			: load_id (load_id_)
 			, uuid (uuid_)
 			, data (data_)
@@ -164,7 +170,8 @@ protected:
 
 		std::string load_id;
 		std::string uuid;
-		Data data;
+		/** font data, read when they are first needed */
+		LazyData data;
 		/** .ttf file that this data was last written to, if applicable */
 		mutable boost::optional<boost::filesystem::path> file;
 	};
@@ -177,9 +184,18 @@ private:
 	friend struct ::pull_fonts_test2;
 	friend struct ::pull_fonts_test3;
 
-	void maybe_add_subtitle (std::string text, std::list<ParseState> const & parse_state, Standard standard);
+	void maybe_add_subtitle (std::string text, ParseState const & ps, Standard standard);
+	boost::shared_ptr<const SubtitleIndex> index () const;
 
 	static void pull_fonts (boost::shared_ptr<order::Part> part);
+	static void write_subtitle (XMLWriter& writer, boost::shared_ptr<order::Subtitle> subtitle, order::Font& open_font, order::Context& context);
+
+	/** mutex for _index and _latest_subtitle_out */
+	mutable boost::mutex _index_mutex;
+	/** index of _subtitles, made when it is first needed and dropped by add() */
+	mutable boost::shared_ptr<const SubtitleIndex> _index;
+	/** cached result of latest_subtitle_out() */
+	mutable boost::optional<Time> _latest_subtitle_out;
 };
 
 }
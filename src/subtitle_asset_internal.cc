@@ -33,6 +33,7 @@
 
 #include "subtitle_asset_internal.h"
 #include "subtitle_string.h"
+#include "xml_writer.h"
 #include "compose.hpp"
 #include <cmath>
 
@@ -41,10 +42,11 @@ using std::map;
 using boost::shared_ptr;
 using namespace dcp;
 
+/** @return Qualified name of an element called @p name in our standard's namespace */
 string
-order::Context::xmlns () const
+order::Context::element (string name) const
 {
-	return standard == SMPTE ? "dcst" : "";
+	return standard == SMPTE ? "dcst:" + name : name;
 }
 
 order::Font::Font (shared_ptr<SubtitleString> s, Standard standard)
@@ -71,14 +73,14 @@ order::Font::Font (shared_ptr<SubtitleString> s, Standard standard)
 	_values["Weight"] = s->bold() ? "bold" : "normal";
 }
 
-xmlpp::Element*
-order::Font::as_xml (xmlpp::Element* parent, Context& context) const
+/** Start a Font element with our values as its attributes */
+void
+order::Font::start_xml (XMLWriter& writer, Context& context) const
 {
-	xmlpp::Element* e = parent->add_child ("Font", context.xmlns());
+	writer.start_element (context.element ("Font"));
 	for (map<string, string>::const_iterator i = _values.begin(); i != _values.end(); ++i) {
-		e->set_attribute (i->first, i->second);
+		writer.attribute (i->first, i->second);
 	}
-	return e;
 }
 
 /** Modify our values so that they contain only those that are common to us and
@@ -119,105 +121,116 @@ order::Font::empty () const
 	return _values.empty ();
 }
 
-xmlpp::Element*
-order::Part::as_xml (xmlpp::Element* parent, Context &) const
+/** Write the start of this part's XML.
+ *  @return true if an element was started which must be ended after the children have been written.
+ */
+bool
+order::Part::start_xml (XMLWriter &, Context &) const
 {
-	return parent;
+	return false;
 }
 
-xmlpp::Element*
-order::String::as_xml (xmlpp::Element* parent, Context &) const
+bool
+order::String::start_xml (XMLWriter& writer, Context &) const
 {
-	parent->add_child_text (text);
-	return 0;
+	writer.text (text);
+	return false;
 }
 
 void
-order::Part::write_xml (xmlpp::Element* parent, order::Context& context) const
+order::Part::write_xml (XMLWriter& writer, order::Context& context) const
 {
 	if (!font.empty ()) {
-		parent = font.as_xml (parent, context);
+		font.start_xml (writer, context);
 	}
 
-	parent = as_xml (parent, context);
+	bool const element = start_xml (writer, context);
 
 	BOOST_FOREACH (boost::shared_ptr<order::Part> i, children) {
-		i->write_xml (parent, context);
+		i->write_xml (writer, context);
+	}
+
+	if (element) {
+		writer.end_element ();
+	}
+
+	if (!font.empty ()) {
+		writer.end_element ();
 	}
 }
 
 static void
-position_align (xmlpp::Element* e, order::Context& context, HAlign h_align, float h_position, VAlign v_align, float v_position)
+position_align (XMLWriter& writer, order::Context& context, HAlign h_align, float h_position, VAlign v_align, float v_position)
 {
 	if (h_align != HALIGN_CENTER) {
 		if (context.standard == SMPTE) {
-			e->set_attribute ("Halign", halign_to_string (h_align));
+			writer.attribute ("Halign", halign_to_string (h_align));
 		} else {
-			e->set_attribute ("HAlign", halign_to_string (h_align));
+			writer.attribute ("HAlign", halign_to_string (h_align));
 		}
 	}
 
 	if (fabs(h_position) > ALIGN_EPSILON) {
 		if (context.standard == SMPTE) {
-			e->set_attribute ("Hposition", raw_convert<string> (h_position * 100, 6));
+			writer.attribute ("Hposition", raw_convert<string> (h_position * 100, 6));
 		} else {
-			e->set_attribute ("HPosition", raw_convert<string> (h_position * 100, 6));
+			writer.attribute ("HPosition", raw_convert<string> (h_position * 100, 6));
 		}
 	}
 
 	if (context.standard == SMPTE) {
-		e->set_attribute ("Valign", valign_to_string (v_align));
+		writer.attribute ("Valign", valign_to_string (v_align));
 	} else {
-		e->set_attribute ("VAlign", valign_to_string (v_align));
+		writer.attribute ("VAlign", valign_to_string (v_align));
 	}
 
 	if (fabs(v_position) > ALIGN_EPSILON) {
 		if (context.standard == SMPTE) {
-			e->set_attribute ("Vposition", raw_convert<string> (v_position * 100, 6));
+			writer.attribute ("Vposition", raw_convert<string> (v_position * 100, 6));
 		} else {
-			e->set_attribute ("VPosition", raw_convert<string> (v_position * 100, 6));
+			writer.attribute ("VPosition", raw_convert<string> (v_position * 100, 6));
 		}
 	} else {
 		if (context.standard == SMPTE) {
-			e->set_attribute ("Vposition", "0");
+			writer.attribute ("Vposition", "0");
 		} else {
-			e->set_attribute ("VPosition", "0");
+			writer.attribute ("VPosition", "0");
 		}
 	}
 }
 
-xmlpp::Element*
-order::Text::as_xml (xmlpp::Element* parent, Context& context) const
+bool
+order::Text::start_xml (XMLWriter& writer, Context& context) const
 {
-	xmlpp::Element* e = parent->add_child ("Text", context.xmlns());
+	writer.start_element (context.element ("Text"));
 
-	position_align (e, context, _h_align, _h_position, _v_align, _v_position);
+	position_align (writer, context, _h_align, _h_position, _v_align, _v_position);
 
 	/* Interop only supports "horizontal" or "vertical" for direction, so only write this
 	   for SMPTE.
 	*/
 	if (_direction != DIRECTION_LTR && context.standard == SMPTE) {
-		e->set_attribute ("Direction", direction_to_string (_direction));
+		writer.attribute ("Direction", direction_to_string (_direction));
 	}
 
-	return e;
+	return true;
 }
 
-xmlpp::Element*
-order::Subtitle::as_xml (xmlpp::Element* parent, Context& context) const
+bool
+order::Subtitle::start_xml (XMLWriter& writer, Context& context) const
 {
-	xmlpp::Element* e = parent->add_child ("Subtitle", context.xmlns());
-	e->set_attribute ("SpotNumber", raw_convert<string> (context.spot_number++));
-	e->set_attribute ("TimeIn", _in.rebase(context.time_code_rate).as_string(context.standard));
-	e->set_attribute ("TimeOut", _out.rebase(context.time_code_rate).as_string(context.standard));
+	writer.start_element (context.element ("Subtitle"));
+	writer.attribute ("SpotNumber", raw_convert<string> (context.spot_number++));
+	writer.attribute ("TimeIn", _in.rebase(context.time_code_rate).as_string(context.standard));
+	writer.attribute ("TimeOut", _out.rebase(context.time_code_rate).as_string(context.standard));
 	if (context.standard == SMPTE) {
-		e->set_attribute ("FadeUpTime", _fade_up.rebase(context.time_code_rate).as_string(context.standard));
-		e->set_attribute ("FadeDownTime", _fade_down.rebase(context.time_code_rate).as_string(context.standard));
+		writer.attribute ("FadeUpTime", _fade_up.rebase(context.time_code_rate).as_string(context.standard));
+		writer.attribute ("FadeDownTime", _fade_down.rebase(context.time_code_rate).as_string(context.standard));
 	} else {
-		e->set_attribute ("FadeUpTime", raw_convert<string> (_fade_up.as_editable_units(context.time_code_rate)));
-		e->set_attribute ("FadeDownTime", raw_convert<string> (_fade_down.as_editable_units(context.time_code_rate)));
+		writer.attribute ("FadeUpTime", raw_convert<string> (_fade_up.as_editable_units(context.time_code_rate)));
+		writer.attribute ("FadeDownTime", raw_convert<string> (_fade_down.as_editable_units(context.time_code_rate)));
 	}
-	return e;
+	return true;
 }
 
 bool
@@ -232,17 +245,17 @@ order::Font::clear ()
 	_values.clear ();
 }
 
-xmlpp::Element *
-order::Image::as_xml (xmlpp::Element* parent, Context& context) const
+bool
+order::Image::start_xml (XMLWriter& writer, Context& context) const
 {
-	xmlpp::Element* e = parent->add_child ("Image", context.xmlns());
+	writer.start_element (context.element ("Image"));
 
-	position_align (e, context, _h_align, _h_position, _v_align, _v_position);
+	position_align (writer, context, _h_align, _h_position, _v_align, _v_position);
 	if (context.standard == SMPTE) {
-		e->add_child_text (_id);
+		writer.text (_id);
 	} else {
-		e->add_child_text (_id + ".png");
+		writer.text (_id + ".png");
 	}
 
-	return e;
+	return true;
 }
@@ -37,9 +37,11 @@
 #include "raw_convert.h"
 #include "types.h"
 #include "dcp_time.h"
-#include "data.h"
-#include <libxml++/libxml++.h>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
+#include <list>
+#include <map>
+#include <string>
 
 struct take_intersection_test;
 struct take_difference_test;
@@ -50,12 +52,13 @@ struct pull_fonts_test3;
 namespace dcp {
 
 class SubtitleString;
+class XMLWriter;
 
 namespace order {
 
 struct Context
 {
-	std::string xmlns () const;
+	std::string element (std::string name) const;
 
 	int time_code_rate;
 	Standard standard;
@@ -69,7 +72,7 @@ public:
 
 	Font (boost::shared_ptr<SubtitleString> s, Standard standard);
 
-	xmlpp::Element* as_xml (xmlpp::Element* parent, Context& context) const;
+	void start_xml (XMLWriter& writer, Context& context) const;
 
 	void take_intersection (Font other);
 	void take_difference (Font other);
@@ -101,8 +104,8 @@ public:
 
 	virtual ~Part () {}
 
-	virtual xmlpp::Element* as_xml (xmlpp::Element* parent, Context &) const;
-	void write_xml (xmlpp::Element* parent, order::Context& context) const;
+	virtual bool start_xml (XMLWriter& writer, Context &) const;
+	void write_xml (XMLWriter& writer, order::Context& context) const;
 
 	boost::shared_ptr<Part> parent;
 	Font font;
@@ -117,7 +120,7 @@ public:
 		, text (text_)
 	{}
 
-	virtual xmlpp::Element* as_xml (xmlpp::Element* parent, Context &) const;
+	virtual bool start_xml (XMLWriter& writer, Context &) const;
 
 	std::string text;
 };
@@ -134,7 +137,7 @@ public:
 		, _direction (direction)
 	{}
 
-	xmlpp::Element* as_xml (xmlpp::Element* parent, Context& context) const;
+	bool start_xml (XMLWriter& writer, Context& context) const;
 
 private:
 	HAlign _h_align;
@@ -155,7 +158,7 @@ public:
 		, _fade_down (fade_down)
 	{}
 
-	xmlpp::Element* as_xml (xmlpp::Element* parent, Context& context) const;
+	bool start_xml (XMLWriter& writer, Context& context) const;
 
 private:
 	Time _in;
@@ -167,9 +170,8 @@ private:
 class Image : public Part
 {
 public:
-	Image (boost::shared_ptr<Part> parent, std::string id, Data png_data, HAlign h_align, float h_position, VAlign v_align, float v_position)
+	Image (boost::shared_ptr<Part> parent, std::string id, HAlign h_align, float h_position, VAlign v_align, float v_position)
 		: Part (parent)
-		, _png_data (png_data)
 		, _id (id)
 		, _h_align (h_align)
 		, _h_position (h_position)
@@ -177,10 +179,9 @@ public:
 		, _v_position (v_position)
 	{}
 
-	xmlpp::Element* as_xml (xmlpp::Element* parent, Context& context) const;
+	bool start_xml (XMLWriter& writer, Context& context) const;
 
 private:
-	Data _png_data;
 	std::string _id; ///< the ID of this image
 	HAlign _h_align;
 	float _h_position;
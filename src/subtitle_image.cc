@@ -36,10 +36,11 @@
 
 using std::ostream;
 using std::string;
+using boost::shared_ptr;
 using namespace dcp;
 
 SubtitleImage::SubtitleImage (
-	Data png_image,
+	LazyData png_image,
 	Time in,
 	Time out,
 	float h_position,
@@ -57,7 +58,7 @@ SubtitleImage::SubtitleImage (
 }
 
 SubtitleImage::SubtitleImage (
-	Data png_image,
+	LazyData png_image,
 	string id,
 	Time in,
 	Time out,
@@ -75,11 +76,12 @@ SubtitleImage::SubtitleImage (
 
 }
 
+/** Set up to read our PNG data from a file when they are first needed */
 void
 SubtitleImage::read_png_file (boost::filesystem::path file)
 {
 	_file = file;
-	_png_image = Data (file);
+	_png_image = LazyData (shared_ptr<DataSource> (new FileDataSource (file)));
 }
 
 void
@@ -92,8 +94,8 @@ SubtitleImage::write_png_file (boost::filesystem::path file) const
 bool
 dcp::operator== (SubtitleImage const & a, SubtitleImage const & b)
 {
+	/* Compare the PNG data last, as they may have to be read */
 	return (
-		a.png_image() == b.png_image() &&
 		a.id() == b.id() &&
 		a.in() == b.in() &&
 		a.out() == b.out() &&
@@ -102,7 +104,8 @@ dcp::operator== (SubtitleImage const & a, SubtitleImage const & b)
 		a.v_position() == b.v_position() &&
 		a.v_align() == b.v_align() &&
 		a.fade_up_time() == b.fade_up_time() &&
-		a.fade_down_time() == b.fade_down_time()
+		a.fade_down_time() == b.fade_down_time() &&
+		a.png_image() == b.png_image()
 		);
 }
 
@@ -41,6 +41,7 @@
 #include "types.h"
 #include "subtitle.h"
 #include "data.h"
+#include "lazy_data.h"
 #include "dcp_time.h"
 #include <boost/optional.hpp>
 #include <string>
@@ -49,12 +50,15 @@ namespace dcp {
 
 /** @class SubtitleImage
  *  @brief A bitmap subtitle with all the associated attributes.
+ *
+ *  The PNG data may be held as a LazyData, in which case they are not read
+ *  until png_image() is first called.
  */
 class SubtitleImage : public Subtitle
 {
 public:
 	SubtitleImage (
-		Data png_image,
+		LazyData png_image,
 		Time in,
 		Time out,
 		float h_position,
@@ -66,7 +70,7 @@ public:
 		);
 
 	SubtitleImage (
-		Data png_image,
+		LazyData png_image,
 		std::string id,
 		Time in,
 		Time out,
@@ -79,10 +83,20 @@ public:
 		);
 
 	Data png_image () const {
-		return _png_image;
+		return _png_image.get ();
 	}
 
-	void set_png_image (Data png) {
+	/** @return true if we have PNG data, or know where to get them from */
+	bool has_png_image () const {
+		return !_png_image.empty ();
+	}
+
+	/** @return Digest of the PNG data, as returned by make_digest (Data) */
+	std::string png_image_digest () const {
+		return _png_image.digest ();
+	}
+
+	void set_png_image (LazyData png) {
 		_png_image = png;
 	}
 
@@ -99,7 +113,7 @@ public:
 	}
 
 private:
-	Data _png_image;
+	LazyData _png_image;
 	std::string _id;
 	mutable boost::optional<boost::filesystem::path> _file;
 };
@@ -0,0 +1,210 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/subtitle_index.cc
+ *  @brief SubtitleIndex and SubtitleCursor classes.
+ */
+
+#include "subtitle_index.h"
+#include "subtitle.h"
+#include <boost/foreach.hpp>
+#include <algorithm>
+
+using std::list;
+using std::map;
+using std::vector;
+using std::max;
+using boost::shared_ptr;
+using namespace dcp;
+
+SubtitleIndex::SubtitleIndex (list<shared_ptr<Subtitle> > const & subtitles)
+{
+	_by_in.reserve (subtitles.size ());
+	size_t n = 0;
+	BOOST_FOREACH (shared_ptr<Subtitle> i, subtitles) {
+		_by_in.push_back (Entry (i->in(), i->out(), n++, i));
+	}
+
+	/* stable_sort so that subtitles with the same in time stay in their original order */
+	std::stable_sort (_by_in.begin(), _by_in.end(), earlier_in);
+	_by_out = _by_in;
+	std::stable_sort (_by_out.begin(), _by_out.end(), earlier_out);
+
+	_max_out.resize (_by_in.size ());
+	_latest_out = build (0, _by_in.size ());
+}
+
+bool
+SubtitleIndex::earlier_in (Entry const & a, Entry const & b)
+{
+	return a.in < b.in;
+}
+
+bool
+SubtitleIndex::earlier_out (Entry const & a, Entry const & b)
+{
+	return a.out < b.out;
+}
+
+/** Fill in _max_out for the part of the tree covering _by_in[begin] to _by_in[end - 1].
+ *  @return Latest out time in that part of the tree.
+ */
+Time
+SubtitleIndex::build (size_t begin, size_t end)
+{
+	if (begin >= end) {
+		return Time ();
+	}
+
+	size_t const mid = begin + (end - begin) / 2;
+	Time t = _by_in[mid].out;
+	t = max (t, build (begin, mid));
+	t = max (t, build (mid + 1, end));
+	_max_out[mid] = t;
+	return t;
+}
+
+/** @return Subtitles which start in the period [from, to) */
+list<shared_ptr<Subtitle> >
+SubtitleIndex::starting (Time from, Time to) const
+{
+	vector<Entry>::const_iterator i = std::lower_bound (_by_in.begin(), _by_in.end(), Entry (from, from, 0, shared_ptr<Subtitle> ()), earlier_in);
+
+	map<size_t, shared_ptr<Subtitle> > result;
+	while (i != _by_in.end() && i->in < to) {
+		result[i->position] = i->subtitle;
+		++i;
+	}
+
+	list<shared_ptr<Subtitle> > s;
+	for (map<size_t, shared_ptr<Subtitle> >::const_iterator j = result.begin(); j != result.end(); ++j) {
+		s.push_back (j->second);
+	}
+	return s;
+}
+
+/** @return Subtitles which are on screen for any part of the period [from, to] */
+list<shared_ptr<Subtitle> >
+SubtitleIndex::overlapping (Time from, Time to) const
+{
+	map<size_t, shared_ptr<Subtitle> > result;
+	overlapping (0, _by_in.size(), from, to, result);
+
+	list<shared_ptr<Subtitle> > s;
+	for (map<size_t, shared_ptr<Subtitle> >::const_iterator i = result.begin(); i != result.end(); ++i) {
+		s.push_back (i->second);
+	}
+	return s;
+}
+
+void
+SubtitleIndex::overlapping (size_t begin, size_t end, Time from, Time to, map<size_t, shared_ptr<Subtitle> >& result) const
+{
+	if (begin >= end) {
+		return;
+	}
+
+	size_t const mid = begin + (end - begin) / 2;
+	if (_max_out[mid] < from) {
+		/* Everything in this part of the tree has finished before the period */
+		return;
+	}
+
+	overlapping (begin, mid, from, to, result);
+
+	Entry const & e = _by_in[mid];
+	if (e.in > to) {
+		/* This, and everything after it, starts after the period */
+		return;
+	}
+
+	if (e.out >= from) {
+		result[e.position] = e.subtitle;
+	}
+
+	overlapping (mid + 1, end, from, to, result);
+}
+
+SubtitleCursor::SubtitleCursor (shared_ptr<const SubtitleIndex> index)
+	: _index (index)
+{
+	reset ();
+}
+
+void
+SubtitleCursor::reset ()
+{
+	_next_in = 0;
+	_next_out = 0;
+	_from = Time ();
+	_to = Time ();
+	_active.clear ();
+}
+
+/** @return Subtitles which are on screen for any part of the period [from, to], in the
+ *  same order as SubtitleIndex::overlapping would give them.  If the period starts or
+ *  ends earlier than the one given to the previous call the cursor starts again from
+ *  the beginning.
+ */
+list<shared_ptr<Subtitle> >
+SubtitleCursor::next (Time from, Time to)
+{
+	if (from < _from || to < _to) {
+		reset ();
+	}
+	_from = from;
+	_to = to;
+
+	vector<SubtitleIndex::Entry> const & by_in = _index->_by_in;
+	vector<SubtitleIndex::Entry> const & by_out = _index->_by_out;
+
+	/* Remove subtitles which have finished */
+	while (_next_out < by_out.size() && by_out[_next_out].out < from) {
+		_active.erase (by_out[_next_out].position);
+		++_next_out;
+	}
+
+	/* Add subtitles which have started, skipping those which finished before this period */
+	while (_next_in < by_in.size() && by_in[_next_in].in <= to) {
+		if (by_in[_next_in].out >= from) {
+			_active[by_in[_next_in].position] = by_in[_next_in].subtitle;
+		}
+		++_next_in;
+	}
+
+	list<shared_ptr<Subtitle> > s;
+	for (map<size_t, shared_ptr<Subtitle> >::const_iterator i = _active.begin(); i != _active.end(); ++i) {
+		s.push_back (i->second);
+	}
+	return s;
+}
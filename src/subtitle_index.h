@@ -0,0 +1,141 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/subtitle_index.h
+ *  @brief SubtitleIndex and SubtitleCursor classes.
+ */
+
+#ifndef LIBDCP_SUBTITLE_INDEX_H
+#define LIBDCP_SUBTITLE_INDEX_H
+
+#include "dcp_time.h"
+#include <boost/shared_ptr.hpp>
+#include <list>
+#include <vector>
+#include <map>
+
+namespace dcp {
+
+class Subtitle;
+
+/** @class SubtitleIndex
+ *  @brief An index of a list of subtitles by time.
+ *
+ *  The subtitles are sorted by their in times, and each is given the latest out time
+ *  of the subtitles in its part of an implicit balanced tree over that order, so that
+ *  searches for subtitles which overlap a period can skip parts of the tree in which
+ *  everything has finished.  Results come back in the order of the original list.
+ *
+ *  An index is not changed after it has been made; if subtitles are added, or their
+ *  times changed, a new index must be made.
+ */
+class SubtitleIndex
+{
+public:
+	explicit SubtitleIndex (std::list<boost::shared_ptr<Subtitle> > const & subtitles);
+
+	std::list<boost::shared_ptr<Subtitle> > starting (Time from, Time to) const;
+	std::list<boost::shared_ptr<Subtitle> > overlapping (Time from, Time to) const;
+
+	/** @return Latest out time of any subtitle, or Time() if there are none */
+	Time latest_out () const {
+		return _latest_out;
+	}
+
+private:
+	friend class SubtitleCursor;
+
+	struct Entry
+	{
+		Entry (Time in_, Time out_, size_t position_, boost::shared_ptr<Subtitle> subtitle_)
+			: in (in_)
+			, out (out_)
+			, position (position_)
+			, subtitle (subtitle_)
+		{}
+
+		Time in;
+		Time out;
+		/** position of this subtitle in the list that the index was made from */
+		size_t position;
+		boost::shared_ptr<Subtitle> subtitle;
+	};
+
+	static bool earlier_in (Entry const & a, Entry const & b);
+	static bool earlier_out (Entry const & a, Entry const & b);
+
+	Time build (size_t begin, size_t end);
+	void overlapping (size_t begin, size_t end, Time from, Time to, std::map<size_t, boost::shared_ptr<Subtitle> >& result) const;
+
+	/** entries sorted by in time */
+	std::vector<Entry> _by_in;
+	/** _max_out[i] is the latest out time in the part of the tree whose root is _by_in[i] */
+	std::vector<Time> _max_out;
+	/** entries sorted by out time */
+	std::vector<Entry> _by_out;
+	Time _latest_out;
+};
+
+/** @class SubtitleCursor
+ *  @brief A helper to find the subtitles overlapping each of a sequence of periods
+ *  which move forwards through time, as during playback.
+ *
+ *  Each call to next() for a period which does not start or end earlier than the previous
+ *  one takes amortised constant time plus the time to return the results.
+ */
+class SubtitleCursor
+{
+public:
+	explicit SubtitleCursor (boost::shared_ptr<const SubtitleIndex> index);
+
+	std::list<boost::shared_ptr<Subtitle> > next (Time from, Time to);
+
+private:
+	void reset ();
+
+	boost::shared_ptr<const SubtitleIndex> _index;
+	/** index into _index->_by_in of the next subtitle to become active */
+	size_t _next_in;
+	/** index into _index->_by_out of the next subtitle to become inactive */
+	size_t _next_out;
+	/** start of the period passed to the last call to next() */
+	Time _from;
+	/** end of the period passed to the last call to next() */
+	Time _to;
+	/** subtitles which started in or before the last period and have not yet finished, by position */
+	std::map<size_t, boost::shared_ptr<Subtitle> > _active;
+};
+
+}
+
+#endif
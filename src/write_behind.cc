@@ -0,0 +1,145 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/write_behind.cc
+ *  @brief WriteBehind class.
+ */
+
+#include "write_behind.h"
+#include "exceptions.h"
+#include "dcp_assert.h"
+#include <boost/bind.hpp>
+
+using namespace dcp;
+
+/** @param queue_length Number of jobs which may be waiting before submit() blocks */
+WriteBehind::WriteBehind (int queue_length)
+	: _queue_length (queue_length)
+	, _busy (false)
+	, _stop (false)
+	, _thread (0)
+{
+	DCP_ASSERT (queue_length > 0);
+	_thread = new boost::thread (boost::bind (&WriteBehind::thread, this));
+}
+
+/** Stop the thread once it has finished its current job; any jobs still in the queue are not run */
+WriteBehind::~WriteBehind ()
+{
+	{
+		boost::mutex::scoped_lock lm (_mutex);
+		_stop = true;
+		_condition.notify_all ();
+	}
+
+	_thread->join ();
+	delete _thread;
+}
+
+void
+WriteBehind::thread ()
+{
+	while (true) {
+		boost::mutex::scoped_lock lm (_mutex);
+		while (_queue.empty() && !_stop) {
+			_condition.wait (lm);
+		}
+
+		if (_stop) {
+			return;
+		}
+
+		boost::function<void ()> job = _queue.front ();
+		_queue.pop_front ();
+		_busy = true;
+		_condition.notify_all ();
+		lm.unlock ();
+
+		try {
+			job ();
+		} catch (std::exception& e) {
+			lm.lock ();
+			if (!_error) {
+				_error = e.what ();
+			}
+			_queue.clear ();
+			lm.unlock ();
+		}
+
+		lm.lock ();
+		_busy = false;
+		_condition.notify_all ();
+	}
+}
+
+/** Add a job to the queue, waiting for there to be space in it */
+void
+WriteBehind::submit (boost::function<void ()> job)
+{
+	DCP_ASSERT (!in_thread ());
+
+	boost::mutex::scoped_lock lm (_mutex);
+	while (static_cast<int> (_queue.size()) >= _queue_length && !_error) {
+		_condition.wait (lm);
+	}
+
+	if (_error) {
+		throw MiscError (*_error);
+	}
+
+	_queue.push_back (job);
+	_condition.notify_all ();
+}
+
+/** Wait for all submitted jobs to be run */
+void
+WriteBehind::flush ()
+{
+	DCP_ASSERT (!in_thread ());
+
+	boost::mutex::scoped_lock lm (_mutex);
+	while (!_queue.empty() || _busy) {
+		_condition.wait (lm);
+	}
+
+	if (_error) {
+		throw MiscError (*_error);
+	}
+}
+
+/** @return true if the caller is our thread, i.e. it is running one of our jobs */
+bool
+WriteBehind::in_thread () const
+{
+	return boost::this_thread::get_id() == _thread->get_id();
+}
@@ -0,0 +1,87 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/write_behind.h
+ *  @brief WriteBehind class.
+ */
+
+#ifndef LIBDCP_WRITE_BEHIND_H
+#define LIBDCP_WRITE_BEHIND_H
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
+#include <list>
+#include <string>
+
+namespace dcp {
+
+/** @class WriteBehind
+ *  @brief A bounded queue of jobs which are run, in order, by a single thread of their own.
+ *
+ *  This is used so that threads which hand frames to a writer need not wait for them to
+ *  be written.  submit() only blocks if the queue is full.  If a job throws an exception
+ *  the jobs after it are dropped, and the next call to submit() or flush() throws a
+ *  MiscError with the exception's message.
+ */
+class WriteBehind : public boost::noncopyable
+{
+public:
+	explicit WriteBehind (int queue_length);
+	~WriteBehind ();
+
+	void submit (boost::function<void ()> job);
+	void flush ();
+	bool in_thread () const;
+
+private:
+	void thread ();
+
+	boost::mutex _mutex;
+	boost::condition_variable _condition;
+	std::list<boost::function<void ()> > _queue;
+	int _queue_length;
+	/** true if the thread is running a job */
+	bool _busy;
+	/** true if the thread should finish */
+	bool _stop;
+	boost::optional<std::string> _error;
+	boost::thread* _thread;
+};
+
+}
+
+#endif
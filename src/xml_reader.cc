@@ -0,0 +1,215 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/xml_reader.cc
+ *  @brief XMLReader class.
+ */
+
+#include "xml_reader.h"
+#include "exceptions.h"
+#include "compose.hpp"
+#include <boost/algorithm/string.hpp>
+
+using std::string;
+using boost::optional;
+using namespace dcp;
+
+XMLReader::XMLReader (boost::filesystem::path file)
+	: _source (file.string ())
+{
+	check (xmlReaderForFile (file.string().c_str(), 0, XML_PARSE_NONET));
+}
+
+XMLReader::XMLReader (char const * data, int size)
+	: _source ("XML in memory")
+{
+	check (xmlReaderForMemory (data, size, 0, 0, XML_PARSE_NONET));
+}
+
+void
+XMLReader::check (xmlTextReaderPtr reader)
+{
+	if (!reader) {
+		throw XMLError (String::compose ("could not open %1", _source));
+	}
+	_reader = reader;
+	xmlTextReaderSetErrorHandler (_reader, &XMLReader::error, this);
+}
+
+/** Handler for errors from libxml2, so that they are reported through XMLError
+ *  rather than printed to stderr.
+ */
+void
+XMLReader::error (void* self, char const * message, xmlParserSeverities severity, xmlTextReaderLocatorPtr)
+{
+	XMLReader* reader = reinterpret_cast<XMLReader*> (self);
+	if ((severity == XML_PARSER_SEVERITY_ERROR || severity == XML_PARSER_SEVERITY_VALIDITY_ERROR) && !reader->_error) {
+		reader->_error = message ? message : "unknown error";
+		boost::algorithm::trim (*reader->_error);
+	}
+}
+
+XMLReader::~XMLReader ()
+{
+	xmlFreeTextReader (_reader);
+}
+
+/** Move to the next node in the document.
+ *  @return false if there are no more nodes.
+ */
+bool
+XMLReader::read ()
+{
+	int const r = xmlTextReaderRead (_reader);
+	if (r == -1) {
+		throw XMLError (String::compose ("could not parse %1 (%2)", _source, _error.get_value_or ("unknown error")));
+	}
+	return r == 1;
+}
+
+/** Move to the root element of the document, which must be the next element.
+ *  @param name Expected local name of the root element.
+ */
+void
+XMLReader::root (string name)
+{
+	while (read ()) {
+		if (type() == ELEMENT) {
+			if (this->name() != name) {
+				throw XMLError (String::compose ("unrecognised root node %1 (expecting %2)", this->name(), name));
+			}
+			return;
+		}
+	}
+
+	throw XMLError (String::compose ("no root node in %1", _source));
+}
+
+/** Move to the next element which is a child of the element at a given depth, skipping
+ *  any part of the current element which has not been read.
+ *  @param depth Depth of the parent element.
+ *  @return false if the parent element ended before another child was found.
+ */
+bool
+XMLReader::next_child (int depth)
+{
+	while (read ()) {
+		int const d = this->depth ();
+		if (type() == ELEMENT && d == depth + 1) {
+			return true;
+		} else if (type() == END_ELEMENT && d == depth) {
+			return false;
+		}
+	}
+
+	return false;
+}
+
+XMLReader::Type
+XMLReader::type () const
+{
+	switch (xmlTextReaderNodeType (_reader)) {
+	case XML_READER_TYPE_ELEMENT:
+		return ELEMENT;
+	case XML_READER_TYPE_END_ELEMENT:
+		return END_ELEMENT;
+	case XML_READER_TYPE_TEXT:
+	case XML_READER_TYPE_CDATA:
+		return TEXT;
+	default:
+		return OTHER;
+	}
+}
+
+string
+XMLReader::name () const
+{
+	xmlChar const * n = xmlTextReaderConstLocalName (_reader);
+	return n ? reinterpret_cast<char const *> (n) : "";
+}
+
+int
+XMLReader::depth () const
+{
+	return xmlTextReaderDepth (_reader);
+}
+
+bool
+XMLReader::empty () const
+{
+	return xmlTextReaderIsEmptyElement (_reader) == 1;
+}
+
+/** @return Value of the current text node */
+string
+XMLReader::value () const
+{
+	xmlChar const * v = xmlTextReaderConstValue (_reader);
+	return v ? reinterpret_cast<char const *> (v) : "";
+}
+
+/** @return Text content of the current element and its children.  The reader is not moved. */
+string
+XMLReader::content ()
+{
+	xmlChar* c = xmlTextReaderReadString (_reader);
+	if (!c) {
+		return "";
+	}
+	string s = reinterpret_cast<char const *> (c);
+	xmlFree (c);
+	return s;
+}
+
+/** @return Value of an attribute of the current element; XMLError is thrown if it is not there */
+string
+XMLReader::attribute (string name) const
+{
+	optional<string> a = optional_attribute (name);
+	if (!a) {
+		throw XMLError (String::compose ("missing attribute %1", name));
+	}
+	return *a;
+}
+
+optional<string>
+XMLReader::optional_attribute (string name) const
+{
+	xmlChar* a = xmlTextReaderGetAttribute (_reader, reinterpret_cast<xmlChar const *> (name.c_str()));
+	if (!a) {
+		return optional<string> ();
+	}
+	string s = reinterpret_cast<char const *> (a);
+	xmlFree (a);
+	return s;
+}
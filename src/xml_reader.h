@@ -0,0 +1,103 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/xml_reader.h
+ *  @brief XMLReader class.
+ */
+
+#ifndef LIBDCP_XML_READER_H
+#define LIBDCP_XML_READER_H
+
+#include <libxml/xmlreader.h>
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
+#include <boost/filesystem.hpp>
+#include <string>
+
+namespace dcp {
+
+/** @class XMLReader
+ *  @brief A thin wrapper around libxml2's xmlTextReader, for reading large XML documents
+ *  in one pass without building a DOM.
+ *
+ *  The reader is always positioned on one node of the document; read() moves it to the next
+ *  node in document order.  Errors are reported by throwing XMLError.
+ */
+class XMLReader : public boost::noncopyable
+{
+public:
+	explicit XMLReader (boost::filesystem::path file);
+	XMLReader (char const * data, int size);
+	~XMLReader ();
+
+	enum Type {
+		ELEMENT,
+		END_ELEMENT,
+		TEXT,
+		OTHER
+	};
+
+	bool read ();
+	void root (std::string name);
+	bool next_child (int depth);
+
+	Type type () const;
+
+	/** @return Local name of the current node */
+	std::string name () const;
+
+	/** @return Depth of the current node; the root element is at depth 0 */
+	int depth () const;
+
+	/** @return true if the current node is an element with no content (e.g. <Foo/>) */
+	bool empty () const;
+
+	std::string value () const;
+	std::string content ();
+	std::string attribute (std::string name) const;
+	boost::optional<std::string> optional_attribute (std::string name) const;
+
+private:
+	void check (xmlTextReaderPtr reader);
+	static void error (void* self, char const * message, xmlParserSeverities severity, xmlTextReaderLocatorPtr);
+
+	xmlTextReaderPtr _reader;
+	/** file or description of what we are reading, for error messages */
+	std::string _source;
+	/** first error reported by libxml2, if any */
+	boost::optional<std::string> _error;
+};
+
+}
+
+#endif
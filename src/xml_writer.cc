@@ -0,0 +1,210 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/xml_writer.cc
+ *  @brief XMLWriter class.
+ */
+
+#include "xml_writer.h"
+#include "exceptions.h"
+#include "util.h"
+#include "dcp_assert.h"
+#include <cerrno>
+
+using std::string;
+using namespace dcp;
+
+/** Make an XMLWriter which writes to memory; the result can be obtained with as_string() */
+XMLWriter::XMLWriter ()
+	: _writer (0)
+	, _buffer (xmlBufferCreate ())
+	, _file (0)
+{
+	if (!_buffer) {
+		throw MiscError ("could not create XML buffer");
+	}
+
+	_writer = xmlNewTextWriterMemory (_buffer, 0);
+	if (!_writer) {
+		xmlBufferFree (_buffer);
+		throw MiscError ("could not create XML writer");
+	}
+
+	check (xmlTextWriterStartDocument (_writer, 0, "UTF-8", 0));
+}
+
+/** Make an XMLWriter which writes to a file */
+XMLWriter::XMLWriter (boost::filesystem::path file)
+	: _writer (0)
+	, _buffer (0)
+	, _file (fopen_boost (file, "wb"))
+	, _path (file)
+{
+	if (!_file) {
+		throw FileError ("could not open file for writing", file, errno);
+	}
+
+	/* The output buffer is freed, but the file is not closed, by xmlFreeTextWriter */
+	xmlOutputBufferPtr output = xmlOutputBufferCreateFile (_file, 0);
+	if (output) {
+		_writer = xmlNewTextWriter (output);
+	}
+	if (!_writer) {
+		if (output) {
+			xmlOutputBufferClose (output);
+		}
+		fclose (_file);
+		throw MiscError ("could not create XML writer");
+	}
+
+	check (xmlTextWriterStartDocument (_writer, 0, "UTF-8", 0));
+}
+
+XMLWriter::~XMLWriter ()
+{
+	xmlFreeTextWriter (_writer);
+	if (_buffer) {
+		xmlBufferFree (_buffer);
+	}
+	if (_file) {
+		fclose (_file);
+	}
+}
+
+void
+XMLWriter::check (int r)
+{
+	if (r >= 0) {
+		return;
+	}
+
+	if (_file) {
+		throw FileError ("could not write XML", _path, errno);
+	}
+
+	throw MiscError ("could not write XML");
+}
+
+void
+XMLWriter::start_element (string name)
+{
+	check (xmlTextWriterStartElement (_writer, reinterpret_cast<xmlChar const *> (name.c_str())));
+}
+
+/** Add an attribute to the element which was most recently started */
+void
+XMLWriter::attribute (string name, string value)
+{
+	check (
+		xmlTextWriterWriteAttribute (
+			_writer, reinterpret_cast<xmlChar const *> (name.c_str()), reinterpret_cast<xmlChar const *> (value.c_str())
+			)
+		);
+}
+
+/** Write some text, escaping it as required.  We do the escaping ourselves, rather than
+ *  using xmlTextWriterWriteString, so that the output is the same as libxml2 gives when
+ *  serialising a DOM (which does not escape quotes in text).
+ */
+void
+XMLWriter::text (string text)
+{
+	string escaped;
+	escaped.reserve (text.length ());
+	for (string::const_iterator i = text.begin(); i != text.end(); ++i) {
+		switch (*i) {
+		case '&':
+			escaped += "&amp;";
+			break;
+		case '<':
+			escaped += "&lt;";
+			break;
+		case '>':
+			escaped += "&gt;";
+			break;
+		case '\r':
+			escaped += "&#13;";
+			break;
+		default:
+			escaped += *i;
+		}
+	}
+
+	check (xmlTextWriterWriteRaw (_writer, reinterpret_cast<xmlChar const *> (escaped.c_str())));
+}
+
+void
+XMLWriter::end_element ()
+{
+	check (xmlTextWriterEndElement (_writer));
+}
+
+/** Write a complete element containing only some text */
+void
+XMLWriter::element (string name, string text)
+{
+	start_element (name);
+	this->text (text);
+	end_element ();
+}
+
+/** Close any open elements and flush everything to the file or buffer.  This must be
+ *  called when the document is complete; if it is not, a file's contents are undefined.
+ */
+void
+XMLWriter::finish ()
+{
+	check (xmlTextWriterEndDocument (_writer));
+	check (xmlTextWriterFlush (_writer));
+
+	if (_file) {
+		/* Free the writer so that it cannot write to the file once it is closed */
+		xmlFreeTextWriter (_writer);
+		_writer = 0;
+		FILE* f = _file;
+		_file = 0;
+		if (fclose (f)) {
+			throw FileError ("could not write XML", _path, errno);
+		}
+	}
+}
+
+/** @return XML that has been written; only valid for a writer made with the default
+ *  constructor, after finish() has been called.
+ */
+string
+XMLWriter::as_string () const
+{
+	DCP_ASSERT (_buffer);
+	return string (reinterpret_cast<char const *> (xmlBufferContent (_buffer)), xmlBufferLength (_buffer));
+}
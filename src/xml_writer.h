@@ -0,0 +1,84 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  src/xml_writer.h
+ *  @brief XMLWriter class.
+ */
+
+#ifndef LIBDCP_XML_WRITER_H
+#define LIBDCP_XML_WRITER_H
+
+#include <libxml/xmlwriter.h>
+#include <boost/noncopyable.hpp>
+#include <boost/filesystem.hpp>
+#include <string>
+
+namespace dcp {
+
+/** @class XMLWriter
+ *  @brief A thin wrapper around libxml2's xmlTextWriter, for writing large XML documents
+ *  straight to a file or memory buffer without building a DOM.
+ *
+ *  The output is not indented, and is the same as libxml++'s write_to_string() would give
+ *  for the equivalent document.  Errors are reported by throwing FileError or MiscError.
+ */
+class XMLWriter : public boost::noncopyable
+{
+public:
+	XMLWriter ();
+	explicit XMLWriter (boost::filesystem::path file);
+	~XMLWriter ();
+
+	void start_element (std::string name);
+	void attribute (std::string name, std::string value);
+	void text (std::string text);
+	void end_element ();
+	void element (std::string name, std::string text);
+
+	void finish ();
+	std::string as_string () const;
+
+private:
+	void check (int r);
+
+	xmlTextWriterPtr _writer;
+	/** buffer that we are writing to, or 0 if we are writing to a file */
+	xmlBufferPtr _buffer;
+	/** file that we are writing to, or 0 if we are writing to memory */
+	FILE* _file;
+	boost::filesystem::path _path;
+};
+
+}
+
+#endif
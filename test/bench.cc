@@ -31,85 +31,677 @@
     files in the program, then also delete it here.
 */
 
+/** @file  test/bench.cc
+ *  @brief Benchmarks of libdcp's main operations, for comparing one release with another.
+ *
+ *  All inputs (images, MXFs, certificates, KDMs, subtitles and DCPs) are generated when
+ *  the program starts, so no test data is needed.  Each benchmark is run a few times
+ *  without timing to warm up, then timed over a number of repetitions.  The median and
+ *  some other percentiles of the repetition times are printed and, with --json, written
+ *  to a file which can be kept and compared with the output from another build.
+ */
+
+#include "certificate_chain.h"
+#include "colour_conversion.h"
+#include "compose.hpp"
+#include "cpl.h"
 #include "data.h"
-#include "test.h"
-#include "util.h"
-#include "version.h"
+#include "dcp.h"
+#include "decrypted_kdm.h"
+#include "encrypted_kdm.h"
+#include "instrumentation.h"
+#include "interop_subtitle_asset.h"
 #include "j2k.h"
+#include "key.h"
+#include "mono_picture_asset.h"
+#include "mono_picture_asset_reader.h"
+#include "mono_picture_frame.h"
 #include "openjpeg_image.h"
-#include <sys/time.h>
-#include <iostream>
+#include "picture_asset_writer.h"
+#include "reel.h"
+#include "reel_mono_picture_asset.h"
+#include "reel_sound_asset.h"
+#include "rgb_xyz.h"
+#include "smpte_subtitle_asset.h"
+#include "sound_asset.h"
+#include "sound_asset_reader.h"
+#include "sound_asset_writer.h"
+#include "sound_frame.h"
+#include "stereo_picture_asset.h"
+#include "stereo_picture_asset_reader.h"
+#include "stereo_picture_frame.h"
+#include "subtitle_string.h"
+#include "util.h"
+#include "version.h"
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/function.hpp>
+#include <boost/optional.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/shared_array.hpp>
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
 
 using std::cout;
 using std::cerr;
+using std::min;
+using std::max;
+using std::sort;
+using std::string;
+using std::vector;
+using std::ofstream;
+using boost::bind;
+using boost::function;
+using boost::optional;
 using boost::shared_ptr;
+using boost::scoped_array;
+using boost::shared_array;
+
+/** @return monotonic time in seconds, so that adjustments to the wall clock do not skew results */
+static double
+seconds ()
+{
+	return dcp::Instrumentation::now () / 1e9;
+}
 
-class Timer
+/** Times for one benchmark */
+class Result
 {
 public:
-	Timer ()
-		: _total (0)
+	Result (string name_, double items_, string unit_)
+		: name (name_)
+		, items (items_)
+		, unit (unit_)
+	{}
+
+	/** @param p Percentile, from 0 to 100.
+	 *  @return Repetition time at that percentile, interpolating between the nearest two times.
+	 */
+	double percentile (double p) const
 	{
+		vector<double> sorted = times;
+		sort (sorted.begin(), sorted.end());
+		double const position = p * (sorted.size() - 1) / 100;
+		size_t const lower = static_cast<size_t> (floor (position));
+		size_t const upper = min (lower + 1, sorted.size() - 1);
+		return sorted[lower] + (sorted[upper] - sorted[lower]) * (position - lower);
+	}
 
+	double mean () const
+	{
+		double total = 0;
+		for (vector<double>::const_iterator i = times.begin(); i != times.end(); ++i) {
+			total += *i;
+		}
+		return total / times.size();
 	}
 
-	void start ()
+	string name;
+	/** amount of work done by each repetition, in units of `unit' */
+	double items;
+	string unit;
+	/** time taken by each repetition in seconds */
+	vector<double> times;
+};
+
+class Bench
+{
+public:
+	Bench ()
+		: repetitions (10)
+		, warm_up (1)
+		, frames (96)
+		, reels (100)
+		, keys (64)
+		, subtitles (10000)
+		, directory ("build/test/bench")
+	{}
+
+	/** @return true if any benchmarks in the given group will be run */
+	bool wanted (string group) const
 	{
-		gettimeofday (&_start, 0);
+		return filter.empty() || group.find(filter) == 0 || filter.find(group + "/") == 0;
 	}
 
-	void stop ()
+	/** Run a benchmark, unless it is filtered out.
+	 *  @param name Name of the form group/description.
+	 *  @param job Work to time.
+	 *  @param items Amount of work that one call of job does.
+	 *  @param unit Name for the items (e.g. frames).
+	 */
+	void run (string name, function<void ()> job, double items, string unit)
 	{
-		struct timeval stop;
-		gettimeofday (&stop, 0);
-		_total += (stop.tv_sec + stop.tv_usec / 1e6) - (_start.tv_sec + _start.tv_usec / 1e6);
+		if (name.find(filter) != 0) {
+			return;
+		}
+
+		for (int i = 0; i < warm_up; ++i) {
+			job ();
+		}
+
+		Result r (name, items, unit);
+		for (int i = 0; i < repetitions; ++i) {
+			double const start = seconds ();
+			job ();
+			r.times.push_back (seconds() - start);
+		}
+
+		double const median = r.percentile (50);
+		char buffer[256];
+		snprintf (
+			buffer, sizeof (buffer), "%-40s %10.3f %10.3f %10.3f %14.1f %s/s\n",
+			name.c_str(), median * 1000, r.percentile (90) * 1000, r.percentile (99) * 1000, items / median, unit.c_str()
+			);
+		cout << buffer;
+		cout.flush ();
+
+		results.push_back (r);
 	}
 
-	double get ()
+	void write_json (boost::filesystem::path file) const
 	{
-		return _total;
+		ofstream f (file.string().c_str());
+		f.precision (9);
+		f << "{\n"
+		  << "  \"libdcp_version\": \"" << dcp::version << "\",\n"
+		  << "  \"git_commit\": \"" << dcp::git_commit << "\",\n"
+		  << "  \"debug\": " << (dcp::built_with_debug ? "true" : "false") << ",\n"
+		  << "  \"repetitions\": " << repetitions << ",\n"
+		  << "  \"warm_up\": " << warm_up << ",\n"
+		  << "  \"benchmarks\": [\n";
+
+		for (vector<Result>::const_iterator i = results.begin(); i != results.end(); ++i) {
+			f << "    {\n"
+			  << "      \"name\": \"" << i->name << "\",\n"
+			  << "      \"unit\": \"" << i->unit << "\",\n"
+			  << "      \"items\": " << i->items << ",\n"
+			  << "      \"min\": " << i->percentile (0) << ",\n"
+			  << "      \"p50\": " << i->percentile (50) << ",\n"
+			  << "      \"p90\": " << i->percentile (90) << ",\n"
+			  << "      \"p99\": " << i->percentile (99) << ",\n"
+			  << "      \"max\": " << i->percentile (100) << ",\n"
+			  << "      \"mean\": " << i->mean () << ",\n"
+			  << "      \"throughput\": " << (i->items / i->percentile (50)) << ",\n"
+			  << "      \"times\": [";
+			for (vector<double>::const_iterator j = i->times.begin(); j != i->times.end(); ++j) {
+				if (j != i->times.begin()) {
+					f << ", ";
+				}
+				f << *j;
+			}
+			f << "]\n"
+			  << "    }";
+			if ((i + 1) != results.end()) {
+				f << ",";
+			}
+			f << "\n";
+		}
+
+		f << "  ]\n}\n";
 	}
 
+	int repetitions;
+	int warm_up;
+	/** number of frames to write to and read from each MXF */
+	int frames;
+	/** number of reels in the DCP for the DCP::read benchmark */
+	int reels;
+	/** number of keys in each KDM */
+	int keys;
+	/** number of subtitles in each subtitle asset */
+	int subtitles;
+	/** only benchmarks whose names start with this are run */
+	string filter;
+	optional<boost::filesystem::path> json;
+	boost::filesystem::path directory;
+
 private:
-	double _total;
-	struct timeval _start;
+	vector<Result> results;
 };
 
-/** Run some basic benchmarks of JPEG2000 encoding / decoding */
+/** @return A 48-bit RGB test card of gradients, with some noise so that it does not compress too well */
+static shared_array<uint16_t>
+make_rgb (dcp::Size size)
+{
+	shared_array<uint16_t> rgb (new uint16_t[size.width * size.height * 3]);
+	uint16_t* p = rgb.get ();
+	uint32_t noise = 1;
+	for (int y = 0; y < size.height; ++y) {
+		for (int x = 0; x < size.width; ++x) {
+			noise = noise * 1664525 + 1013904223;
+			*p++ = (x * 65535 / size.width) ^ (noise & 0xff);
+			*p++ = y * 65535 / size.height;
+			*p++ = ((x + y) * 32767 / (size.width + size.height)) + ((noise >> 8) & 0x3ff);
+		}
+	}
+	return rgb;
+}
+
+static shared_ptr<dcp::OpenJPEGImage>
+make_xyz (dcp::Size size)
+{
+	shared_array<uint16_t> rgb = make_rgb (size);
+	return dcp::rgb_to_xyz (reinterpret_cast<uint8_t const *> (rgb.get()), size, size.width * 6, dcp::ColourConversion::srgb_to_xyz ());
+}
+
+static void
+decode_j2k (dcp::Data const * j2k)
+{
+	dcp::decompress_j2k (*j2k, 0);
+}
+
+static void
+encode_j2k (shared_ptr<const dcp::OpenJPEGImage> xyz, bool fourk)
+{
+	dcp::compress_j2k (xyz, 250000000, 24, false, fourk);
+}
+
+static void
+rgb_to_xyz (uint16_t const * rgb, dcp::Size size)
+{
+	dcp::rgb_to_xyz (reinterpret_cast<uint8_t const *> (rgb), size, size.width * 6, dcp::ColourConversion::srgb_to_xyz ());
+}
+
+static void
+xyz_to_rgb (shared_ptr<const dcp::OpenJPEGImage> xyz, uint8_t* rgb)
+{
+	dcp::xyz_to_rgb (xyz, dcp::ColourConversion::srgb_to_xyz(), rgb, xyz->size().width * 3);
+}
+
+static void
+xyz_to_rgba (shared_ptr<const dcp::OpenJPEGImage> xyz, uint8_t* rgba)
+{
+	dcp::xyz_to_rgba (xyz, dcp::ColourConversion::srgb_to_xyz(), rgba, xyz->size().width * 4);
+}
+
+static void
+digest (dcp::Data const * data)
+{
+	dcp::make_digest (*data);
+}
+
+static void
+write_mono (boost::filesystem::path file, dcp::Data const * j2k, int frames, optional<dcp::Key> key)
+{
+	dcp::MonoPictureAsset asset (dcp::Fraction (24, 1), dcp::SMPTE);
+	if (key) {
+		asset.set_key (*key);
+	}
+	shared_ptr<dcp::PictureAssetWriter> writer = asset.start_write (file, false);
+	for (int i = 0; i < frames; ++i) {
+		writer->write (j2k->data().get(), j2k->size());
+	}
+	writer->finalize ();
+}
+
+static void
+read_mono (boost::filesystem::path file, optional<dcp::Key> key)
+{
+	dcp::MonoPictureAsset asset (file);
+	if (key) {
+		asset.set_key (*key);
+	}
+	shared_ptr<dcp::MonoPictureAssetReader> reader = asset.start_read ();
+	for (int64_t i = 0; i < asset.intrinsic_duration(); ++i) {
+		reader->get_frame(i)->j2k_size ();
+	}
+}
+
+static void
+write_stereo (boost::filesystem::path file, dcp::Data const * j2k, int frames, optional<dcp::Key> key)
+{
+	dcp::StereoPictureAsset asset (dcp::Fraction (24, 1), dcp::SMPTE);
+	if (key) {
+		asset.set_key (*key);
+	}
+	shared_ptr<dcp::PictureAssetWriter> writer = asset.start_write (file, false);
+	for (int i = 0; i < frames; ++i) {
+		/* Left then right */
+		writer->write (j2k->data().get(), j2k->size());
+		writer->write (j2k->data().get(), j2k->size());
+	}
+	writer->finalize ();
+}
+
+static void
+read_stereo (boost::filesystem::path file, optional<dcp::Key> key)
+{
+	dcp::StereoPictureAsset asset (file);
+	if (key) {
+		asset.set_key (*key);
+	}
+	shared_ptr<dcp::StereoPictureAssetReader> reader = asset.start_read ();
+	for (int64_t i = 0; i < asset.intrinsic_duration(); ++i) {
+		reader->get_frame(i)->right_j2k_size ();
+	}
+}
+
+static int const sound_channels = 6;
+static int const sound_rate = 48000;
+
+static void
+write_sound (boost::filesystem::path file, int frames, optional<dcp::Key> key)
+{
+	dcp::SoundAsset asset (dcp::Fraction (24, 1), sound_rate, sound_channels, dcp::SMPTE);
+	if (key) {
+		asset.set_key (*key);
+	}
+	shared_ptr<dcp::SoundAssetWriter> writer = asset.start_write (file);
+
+	int const frame_length = sound_rate / 24;
+	float* data[sound_channels];
+	for (int i = 0; i < sound_channels; ++i) {
+		data[i] = new float[frame_length];
+		for (int j = 0; j < frame_length; ++j) {
+			data[i][j] = sin (j * (i + 1) * 0.001);
+		}
+	}
+
+	for (int i = 0; i < frames; ++i) {
+		writer->write (data, frame_length);
+	}
+	writer->finalize ();
+
+	for (int i = 0; i < sound_channels; ++i) {
+		delete[] data[i];
+	}
+}
+
+static void
+read_sound (boost::filesystem::path file, optional<dcp::Key> key)
+{
+	dcp::SoundAsset asset (file);
+	if (key) {
+		asset.set_key (*key);
+	}
+	shared_ptr<dcp::SoundAssetReader> reader = asset.start_read ();
+	for (int64_t i = 0; i < asset.intrinsic_duration(); ++i) {
+		reader->get_frame(i)->size ();
+	}
+}
+
+static void
+encrypt_kdm (dcp::DecryptedKDM const * kdm, shared_ptr<const dcp::CertificateChain> signer, string* xml)
+{
+	*xml = kdm->encrypt(signer, signer->leaf(), vector<string>(), dcp::MODIFIED_TRANSITIONAL_1, true, 0).as_xml ();
+}
+
+static void
+decrypt_kdm (string const * xml, string private_key)
+{
+	dcp::DecryptedKDM kdm (dcp::EncryptedKDM (*xml), private_key);
+}
+
+/** Fill a subtitle asset with two-line subtitles of the kind found in a feature */
+static void
+add_subtitles (shared_ptr<dcp::SubtitleAsset> asset, int count)
+{
+	for (int i = 0; i < count; ++i) {
+		for (int j = 0; j < 2; ++j) {
+			asset->add (
+				shared_ptr<dcp::Subtitle> (
+					new dcp::SubtitleString (
+						string ("theFont"),
+						j == 1,
+						false,
+						false,
+						dcp::Colour (255, 255, 255),
+						42,
+						1.0,
+						dcp::Time (i * 48, 24, 24),
+						dcp::Time (i * 48 + 40, 24, 24),
+						0,
+						dcp::HALIGN_CENTER,
+						j == 0 ? 0.15 : 0.08,
+						dcp::VALIGN_BOTTOM,
+						dcp::DIRECTION_LTR,
+						dcp::String::compose ("Subtitle number %1, line %2", i, j + 1),
+						dcp::BORDER,
+						dcp::Colour (0, 0, 0),
+						dcp::Time (),
+						dcp::Time ()
+						)
+					)
+				);
+		}
+	}
+}
+
+static void
+subtitle_xml (shared_ptr<const dcp::SubtitleAsset> asset)
+{
+	asset->xml_as_string ();
+}
+
+static void
+parse_smpte_subtitles (boost::filesystem::path file)
+{
+	dcp::SMPTESubtitleAsset asset (file);
+}
+
+static void
+parse_interop_subtitles (boost::filesystem::path file)
+{
+	dcp::InteropSubtitleAsset asset (file);
+}
+
+/** Write a DCP with one CPL, each of whose reels has its own picture and sound MXF */
+static void
+make_dcp (boost::filesystem::path dir, dcp::Data const & j2k, int reels)
+{
+	boost::filesystem::remove_all (dir);
+	boost::filesystem::create_directories (dir);
+
+	dcp::DCP dcp (dir);
+	shared_ptr<dcp::CPL> cpl (new dcp::CPL ("Benchmark", dcp::FEATURE));
+
+	for (int i = 0; i < reels; ++i) {
+		boost::filesystem::path const picture_file = dir / dcp::String::compose ("video%1.mxf", i);
+		write_mono (picture_file, &j2k, 24, optional<dcp::Key> ());
+		shared_ptr<dcp::MonoPictureAsset> picture (new dcp::MonoPictureAsset (picture_file));
+
+		boost::filesystem::path const sound_file = dir / dcp::String::compose ("audio%1.mxf", i);
+		write_sound (sound_file, 24, optional<dcp::Key> ());
+		shared_ptr<dcp::SoundAsset> sound (new dcp::SoundAsset (sound_file));
+
+		cpl->add (
+			shared_ptr<dcp::Reel> (
+				new dcp::Reel (
+					shared_ptr<dcp::ReelMonoPictureAsset> (new dcp::ReelMonoPictureAsset (picture, 0)),
+					shared_ptr<dcp::ReelSoundAsset> (new dcp::ReelSoundAsset (sound, 0))
+					)
+				)
+			);
+	}
+
+	dcp.add (cpl);
+	dcp.write_xml (dcp::SMPTE);
+}
+
+static void
+read_dcp (boost::filesystem::path dir)
+{
+	dcp::DCP dcp (dir);
+	dcp.read ();
+}
+
+static void
+help (string n)
+{
+	cerr << "Syntax: " << n << " [OPTION]\n"
+	     << "  -r, --repetitions <n>  number of timed runs of each benchmark (default 10)\n"
+	     << "  -w, --warm-up <n>      number of untimed runs before timing (default 1)\n"
+	     << "  -f, --frames <n>       number of frames in each MXF (default 96)\n"
+	     << "      --reels <n>        number of reels in the DCP to read (default 100)\n"
+	     << "      --keys <n>         number of keys in each KDM (default 64)\n"
+	     << "      --subtitles <n>    number of subtitles in each subtitle asset (default 10000)\n"
+	     << "  -o, --only <text>      only run benchmarks whose names start with <text>, e.g. j2k or mxf/sound\n"
+	     << "  -j, --json <file>      write results as JSON to <file>\n";
+}
+
 int
 main (int argc, char* argv[])
 {
-	if (argc < 2) {
-		cerr << "Syntax: " << argv[0] << " private-test-path\n";
-		exit (EXIT_FAILURE);
+	Bench bench;
+
+	for (int i = 1; i < argc; ++i) {
+		string const a = argv[i];
+		bool const value = (i + 1) < argc;
+		if ((a == "-r" || a == "--repetitions") && value) {
+			bench.repetitions = max (1, atoi (argv[++i]));
+		} else if ((a == "-w" || a == "--warm-up") && value) {
+			bench.warm_up = max (0, atoi (argv[++i]));
+		} else if ((a == "-f" || a == "--frames") && value) {
+			bench.frames = max (1, atoi (argv[++i]));
+		} else if (a == "--reels" && value) {
+			bench.reels = max (1, atoi (argv[++i]));
+		} else if (a == "--keys" && value) {
+			bench.keys = max (1, atoi (argv[++i]));
+		} else if (a == "--subtitles" && value) {
+			bench.subtitles = max (1, atoi (argv[++i]));
+		} else if ((a == "-o" || a == "--only") && value) {
+			bench.filter = argv[++i];
+		} else if ((a == "-j" || a == "--json") && value) {
+			bench.json = boost::filesystem::path (argv[++i]);
+		} else {
+			help (argv[0]);
+			exit (EXIT_FAILURE);
+		}
 	}
 
-	int const count = 100;
-	int const j2k_bandwidth = 100000000;
+	dcp::init ();
+	boost::filesystem::create_directories (bench.directory);
 
-	dcp::Data j2k (boost::filesystem::path (argv[1]) / "thx.j2c");
+	cout << "libdcp " << dcp::version << " (" << dcp::git_commit << ")\n";
+	char buffer[256];
+	snprintf (buffer, sizeof (buffer), "%-40s %10s %10s %10s %14s\n", "", "p50 (ms)", "p90 (ms)", "p99 (ms)", "throughput");
+	cout << buffer;
 
-	Timer decompress;
-	Timer compress;
+	dcp::Size const size_2k (1998, 1080);
+	dcp::Size const size_4k (3996, 2160);
 
-	dcp::Data recomp;
-	for (int i = 0; i < count; ++i) {
-		decompress.start ();
-		shared_ptr<dcp::OpenJPEGImage> xyz = dcp::decompress_j2k (j2k, 0);
-		decompress.stop ();
-		compress.start ();
-		recomp = dcp::compress_j2k (xyz, j2k_bandwidth, 24, false, false);
-		compress.stop ();
-		cout << (i + 1) << " ";
-		cout.flush ();
+	shared_ptr<dcp::OpenJPEGImage> xyz_2k;
+	dcp::Data j2k_2k;
+	if (bench.wanted ("j2k") || bench.wanted ("mxf") || bench.wanted ("dcp")) {
+		xyz_2k = make_xyz (size_2k);
+		j2k_2k = dcp::compress_j2k (xyz_2k, 250000000, 24, false, false);
+	}
+
+	if (bench.wanted ("j2k")) {
+		shared_ptr<dcp::OpenJPEGImage> xyz_4k = make_xyz (size_4k);
+		dcp::Data const j2k_4k = dcp::compress_j2k (xyz_4k, 250000000, 24, false, true);
+
+		bench.run ("j2k/decode 2K", bind (&decode_j2k, &j2k_2k), 1, "frames");
+		bench.run ("j2k/decode 4K", bind (&decode_j2k, &j2k_4k), 1, "frames");
+		bench.run ("j2k/encode 2K", bind (&encode_j2k, xyz_2k, false), 1, "frames");
+		bench.run ("j2k/encode 4K", bind (&encode_j2k, xyz_4k, true), 1, "frames");
 	}
-	cout << "\n";
 
-	cout << "Decompress: " << count / decompress.get() << " fps.\n";
-	cout << "Compress:   " << count / compress.get() << " fps.\n";
+	if (bench.wanted ("rgb_xyz")) {
+		shared_array<uint16_t> rgb = make_rgb (size_2k);
+		shared_ptr<dcp::OpenJPEGImage> xyz = make_xyz (size_2k);
+		scoped_array<uint8_t> out (new uint8_t[size_2k.width * size_2k.height * 4]);
+
+		bench.run ("rgb_xyz/rgb_to_xyz 2K", bind (&rgb_to_xyz, rgb.get(), size_2k), 1, "frames");
+		bench.run ("rgb_xyz/xyz_to_rgb 2K", bind (&xyz_to_rgb, xyz, out.get()), 1, "frames");
+		bench.run ("rgb_xyz/xyz_to_rgba 2K", bind (&xyz_to_rgba, xyz, out.get()), 1, "frames");
+	}
+
+	if (bench.wanted ("digest")) {
+		dcp::Data data (64 * 1024 * 1024);
+		memset (data.data().get(), 0x5a, data.size());
+		bench.run ("digest/make_digest 64MB", bind (&digest, &data), data.size(), "bytes");
+	}
+
+	if (bench.wanted ("mxf")) {
+		dcp::Key const key;
+		optional<dcp::Key> const keys[2] = { optional<dcp::Key> (), key };
+		for (int i = 0; i < 2; ++i) {
+			string const suffix = keys[i] ? " encrypted" : "";
+			boost::filesystem::path const mono = bench.directory / ("mono" + suffix + ".mxf");
+			boost::filesystem::path const stereo = bench.directory / ("stereo" + suffix + ".mxf");
+			boost::filesystem::path const sound = bench.directory / ("sound" + suffix + ".mxf");
+
+			bench.run ("mxf/mono write" + suffix, bind (&write_mono, mono, &j2k_2k, bench.frames, keys[i]), bench.frames, "frames");
+			bench.run ("mxf/mono read" + suffix, bind (&read_mono, mono, keys[i]), bench.frames, "frames");
+			bench.run ("mxf/stereo write" + suffix, bind (&write_stereo, stereo, &j2k_2k, bench.frames, keys[i]), bench.frames, "frames");
+			bench.run ("mxf/stereo read" + suffix, bind (&read_stereo, stereo, keys[i]), bench.frames, "frames");
+			bench.run ("mxf/sound write" + suffix, bind (&write_sound, sound, bench.frames, keys[i]), bench.frames, "frames");
+			bench.run ("mxf/sound read" + suffix, bind (&read_sound, sound, keys[i]), bench.frames, "frames");
+
+			boost::filesystem::remove (mono);
+			boost::filesystem::remove (stereo);
+			boost::filesystem::remove (sound);
+		}
+	}
+
+	if (bench.wanted ("kdm")) {
+		shared_ptr<dcp::CertificateChain> signer (new dcp::CertificateChain (boost::filesystem::path ("openssl")));
+		string const cpl_id = dcp::make_uuid ();
+		dcp::DecryptedKDM kdm (
+			dcp::LocalTime ("2019-01-01T00:00:00+00:00"),
+			dcp::LocalTime ("2019-01-08T00:00:00+00:00"),
+			"libdcp",
+			"Benchmark",
+			"2019-01-01T00:00:00+00:00"
+			);
+		for (int i = 0; i < bench.keys; ++i) {
+			kdm.add_key (string (i % 2 ? "MDAK" : "MDIK"), dcp::make_uuid(), dcp::Key(), cpl_id, dcp::SMPTE);
+		}
+
+		string xml;
+		bench.run ("kdm/encrypt", bind (&encrypt_kdm, &kdm, signer, &xml), bench.keys, "keys");
+		if (xml.empty ()) {
+			encrypt_kdm (&kdm, signer, &xml);
+		}
+		bench.run ("kdm/decrypt", bind (&decrypt_kdm, &xml, signer->key().get()), bench.keys, "keys");
+	}
+
+	if (bench.wanted ("subtitle")) {
+		shared_ptr<dcp::SMPTESubtitleAsset> smpte (new dcp::SMPTESubtitleAsset ());
+		smpte->set_reel_number (1);
+		smpte->set_language ("en");
+		add_subtitles (smpte, bench.subtitles);
+
+		shared_ptr<dcp::InteropSubtitleAsset> interop (new dcp::InteropSubtitleAsset ());
+		interop->set_reel_number ("1");
+		interop->set_language ("English");
+		interop->set_movie_title ("Benchmark");
+		add_subtitles (interop, bench.subtitles);
+
+		bench.run ("subtitle/SMPTE write", bind (&subtitle_xml, smpte), bench.subtitles, "subtitles");
+		bench.run ("subtitle/Interop write", bind (&subtitle_xml, interop), bench.subtitles, "subtitles");
+
+		boost::filesystem::path const smpte_file = bench.directory / "smpte.xml";
+		boost::filesystem::path const interop_file = bench.directory / "interop.xml";
+		{
+			ofstream f (smpte_file.string().c_str());
+			f << smpte->xml_as_string ();
+		}
+		interop->write (interop_file);
+
+		bench.run ("subtitle/SMPTE parse", bind (&parse_smpte_subtitles, smpte_file), bench.subtitles, "subtitles");
+		bench.run ("subtitle/Interop parse", bind (&parse_interop_subtitles, interop_file), bench.subtitles, "subtitles");
+
+		boost::filesystem::remove (smpte_file);
+		boost::filesystem::remove (interop_file);
+	}
+
+	if (bench.wanted ("dcp")) {
+		boost::filesystem::path const dir = bench.directory / "dcp";
+		make_dcp (dir, j2k_2k, bench.reels);
+		bench.run ("dcp/read", bind (&read_dcp, dir), bench.reels, "reels");
+		boost::filesystem::remove_all (dir);
+	}
+
+	if (bench.json) {
+		bench.write_json (*bench.json);
+	}
 
-	FILE* f = fopen ("check.j2c", "wb");
-	fwrite (recomp.data().get(), 1, recomp.size(), f);
-	fclose (f);
+	return 0;
 }
@@ -35,12 +35,17 @@
 #include "certificate_chain.h"
 #include "util.h"
 #include "exceptions.h"
+#include "signer.h"
 #include "test.h"
+#include <libxml++/libxml++.h>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
 #include <iostream>
 
 using std::list;
 using std::string;
+using std::vector;
 using boost::shared_ptr;
 
 /** Check that loading certificates from files via strings works */
@@ -258,3 +263,105 @@ BOOST_AUTO_TEST_CASE (certificate_chain_from_string)
 	dcp::CertificateChain b (dcp::file_to_string ("test/ref/crypt/leaf.signed.pem"));
 	BOOST_CHECK_EQUAL (b.root_to_leaf().size(), 1);
 }
+
+static string
+signed_document (shared_ptr<const dcp::Signer> signer)
+{
+	xmlpp::Document doc;
+	xmlpp::Element* root = doc.create_root_node ("Test", "http://www.example.com/test");
+	root->add_child("Content")->add_child_text ("Some content to sign");
+	signer->sign (root, dcp::SMPTE);
+	return doc.write_to_string ("UTF-8");
+}
+
+static void
+sign_documents (shared_ptr<const dcp::Signer> signer, vector<string>* out)
+{
+	for (size_t i = 0; i < out->size(); ++i) {
+		(*out)[i] = signed_document (signer);
+	}
+}
+
+/** Check that a Signer gives the same signatures when used from several threads at once */
+BOOST_AUTO_TEST_CASE (signer_threads_test)
+{
+	dcp::CertificateChain chain;
+	chain.add (dcp::Certificate (dcp::file_to_string ("test/ref/crypt/ca.self-signed.pem")));
+	chain.add (dcp::Certificate (dcp::file_to_string ("test/ref/crypt/intermediate.signed.pem")));
+	chain.add (dcp::Certificate (dcp::file_to_string ("test/ref/crypt/leaf.signed.pem")));
+	chain.set_key (dcp::file_to_string ("test/ref/crypt/leaf.key"));
+
+	shared_ptr<const dcp::Signer> signer = chain.signer ();
+	BOOST_CHECK (chain.signer() == signer);
+
+	string const reference = signed_document (signer);
+
+	vector<vector<string> > results (4, vector<string> (8));
+	boost::thread_group group;
+	for (size_t i = 0; i < results.size(); ++i) {
+		group.create_thread (boost::bind (&sign_documents, signer, &results[i]));
+	}
+	group.join_all ();
+
+	for (size_t i = 0; i < results.size(); ++i) {
+		for (size_t j = 0; j < results[i].size(); ++j) {
+			BOOST_CHECK_EQUAL (results[i][j], reference);
+		}
+	}
+
+	/* Changing the key should give a new signer */
+	chain.set_key (dcp::file_to_string ("test/ref/crypt/leaf.key"));
+	BOOST_CHECK (chain.signer() != signer);
+}
+
+static void
+make_chain (shared_ptr<dcp::CertificateChain>* chain)
+{
+	chain->reset (new dcp::CertificateChain (boost::filesystem::path ("openssl")));
+}
+
+/** Check that chains can be made from several threads at once, and that they are valid */
+BOOST_AUTO_TEST_CASE (certificate_chain_generation_threads_test)
+{
+	vector<shared_ptr<dcp::CertificateChain> > chains (4);
+	boost::thread_group group;
+	for (size_t i = 0; i < chains.size(); ++i) {
+		group.create_thread (boost::bind (&make_chain, &chains[i]));
+	}
+	group.join_all ();
+
+	for (size_t i = 0; i < chains.size(); ++i) {
+		BOOST_REQUIRE (chains[i]);
+		BOOST_CHECK_EQUAL (chains[i]->root_to_leaf().size(), 3);
+		BOOST_CHECK (chains[i]->valid ());
+		BOOST_CHECK (!chains[i]->leaf().has_utf8_strings ());
+		if (i > 0) {
+			BOOST_CHECK (!(chains[i]->leaf() == chains[0]->leaf()));
+		}
+	}
+}
+
+/** Check that copies of a Certificate share their X509 and that re-reading one does not affect the others */
+BOOST_AUTO_TEST_CASE (certificate_copy_test)
+{
+	dcp::Certificate a (dcp::file_to_string ("test/ref/crypt/ca.self-signed.pem"));
+	string const thumbprint = a.thumbprint ();
+
+	dcp::Certificate b = a;
+	BOOST_CHECK (b.x509() == a.x509());
+	BOOST_CHECK_EQUAL (b.thumbprint(), thumbprint);
+	BOOST_CHECK_EQUAL (b.subject(), a.subject());
+	BOOST_CHECK_EQUAL (b.serial(), "5");
+	BOOST_CHECK (a == b);
+
+	dcp::Certificate c;
+	c = a;
+	BOOST_CHECK (c.x509() == a.x509());
+
+	c.read_string (dcp::file_to_string ("test/ref/crypt/leaf.signed.pem"));
+	BOOST_CHECK (c.x509() != a.x509());
+	BOOST_CHECK (!(c == a));
+	BOOST_CHECK_EQUAL (a.thumbprint(), thumbprint);
+	BOOST_CHECK_EQUAL (b.thumbprint(), thumbprint);
+	BOOST_CHECK (c.thumbprint() != thumbprint);
+}
@@ -0,0 +1,120 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+#include "sound_asset.h"
+#include "sound_asset_writer.h"
+#include "sound_asset_reader.h"
+#include "crypto_context.h"
+#include "key.h"
+#include "util.h"
+#include <boost/filesystem.hpp>
+#include <sys/time.h>
+#include <iostream>
+#include <cmath>
+
+using std::cout;
+using std::string;
+using boost::shared_ptr;
+
+static double
+seconds ()
+{
+	struct timeval t;
+	gettimeofday (&t, 0);
+	return t.tv_sec + t.tv_usec / 1e6;
+}
+
+static void
+time_read (shared_ptr<dcp::SoundAsset> asset, string name, dcp::DecryptionContext::Backend backend, bool check_hmac)
+{
+	shared_ptr<dcp::SoundAssetReader> reader = asset->start_read ();
+	reader->set_decryption (backend, check_hmac);
+
+	int64_t bytes = 0;
+	double const start = seconds ();
+	for (int64_t i = 0; i < asset->intrinsic_duration(); ++i) {
+		bytes += reader->get_frame(i)->size();
+	}
+	double const time = seconds() - start;
+
+	cout << name << ": " << (bytes / time / 1e6) << " MB/s\n";
+}
+
+/** Compare the speed of asdcplib's and OpenSSL's decryption of an encrypted asset.
+ *  A 16-channel 96kHz sound asset is used so that the frames are large and the test
+ *  needs no input files.
+ */
+int
+main (int argc, char* argv[])
+{
+	int const frames = argc > 1 ? atoi (argv[1]) : 1000;
+	int const channels = 16;
+	int const sampling_rate = 96000;
+	int const frame_length = sampling_rate / 24;
+
+	dcp::init ();
+
+	boost::filesystem::path file = "build/test/decryption_bench.mxf";
+	boost::filesystem::create_directories (file.parent_path ());
+
+	shared_ptr<dcp::SoundAsset> asset (new dcp::SoundAsset (dcp::Fraction (24, 1), sampling_rate, channels, dcp::SMPTE));
+	asset->set_key (dcp::Key ());
+	shared_ptr<dcp::SoundAssetWriter> writer = asset->start_write (file);
+
+	float* data[channels];
+	for (int i = 0; i < channels; ++i) {
+		data[i] = new float[frame_length];
+		for (int j = 0; j < frame_length; ++j) {
+			data[i][j] = sin (j * (i + 1) * 0.001);
+		}
+	}
+
+	for (int i = 0; i < frames; ++i) {
+		writer->write (data, frame_length);
+	}
+	writer->finalize ();
+
+	for (int i = 0; i < channels; ++i) {
+		delete[] data[i];
+	}
+
+	/* Read once to warm the cache */
+	time_read (asset, "warm-up", dcp::DecryptionContext::ASDCPLIB, true);
+
+	time_read (asset, "asdcplib with HMAC check", dcp::DecryptionContext::ASDCPLIB, true);
+	time_read (asset, "asdcplib without HMAC check", dcp::DecryptionContext::ASDCPLIB, false);
+	time_read (asset, "OpenSSL EVP", dcp::DecryptionContext::OPENSSL_EVP, false);
+
+	boost::filesystem::remove (file);
+	return 0;
+}
@@ -38,6 +38,11 @@
 #include "encrypted_kdm.h"
 #include "mono_picture_asset.h"
 #include "mono_picture_asset_reader.h"
+#include "picture_asset_writer.h"
+#include "sound_asset.h"
+#include "sound_asset_writer.h"
+#include "sound_asset_reader.h"
+#include "file.h"
 #include "reel_picture_asset.h"
 #include "reel.h"
 #include "test.h"
@@ -46,6 +51,7 @@
 #include "colour_conversion.h"
 #include <boost/test/unit_test.hpp>
 #include <boost/scoped_array.hpp>
+#include <cmath>
 
 using std::pair;
 using std::make_pair;
@@ -122,3 +128,78 @@ BOOST_AUTO_TEST_CASE (failing_kdm_test)
 		dcp::file_to_string ("test/data/private.key")
 		);
 }
+
+/** Write encrypted picture and sound assets and check that decrypting them with
+ *  OpenSSL gives the same frames as decrypting with asdcplib.
+ */
+BOOST_AUTO_TEST_CASE (openssl_decryption_test)
+{
+	boost::filesystem::path dir = "build/test/openssl_decryption_test";
+	boost::filesystem::remove_all (dir);
+	boost::filesystem::create_directories (dir);
+
+	dcp::Key key;
+
+	shared_ptr<dcp::MonoPictureAsset> picture (new dcp::MonoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	picture->set_key (key);
+	shared_ptr<dcp::PictureAssetWriter> picture_writer = picture->start_write (dir / "video.mxf", false);
+	dcp::File j2c ("test/data/32x32_red_square.j2c");
+	for (int i = 0; i < 24; ++i) {
+		picture_writer->write (j2c.data (), j2c.size ());
+	}
+	picture_writer->finalize ();
+
+	shared_ptr<dcp::SoundAsset> sound (new dcp::SoundAsset (dcp::Fraction (24, 1), 48000, 6, dcp::SMPTE));
+	sound->set_key (key);
+	shared_ptr<dcp::SoundAssetWriter> sound_writer = sound->start_write (dir / "audio.mxf");
+	float samples[6][2000];
+	float* channels[6];
+	for (int i = 0; i < 6; ++i) {
+		for (int j = 0; j < 2000; ++j) {
+			samples[i][j] = sin (j * (i + 1) * 0.01) * 0.5;
+		}
+		channels[i] = samples[i];
+	}
+	for (int i = 0; i < 24; ++i) {
+		sound_writer->write (channels, 2000);
+	}
+	sound_writer->finalize ();
+
+	shared_ptr<dcp::MonoPictureAssetReader> picture_asdcp = picture->start_read ();
+	shared_ptr<dcp::MonoPictureAssetReader> picture_openssl = picture->start_read ();
+	picture_openssl->set_decryption (dcp::DecryptionContext::OPENSSL_EVP, false);
+	for (int i = 0; i < 24; ++i) {
+		shared_ptr<const dcp::MonoPictureFrame> a = picture_asdcp->get_frame (i);
+		shared_ptr<const dcp::MonoPictureFrame> b = picture_openssl->get_frame (i);
+		BOOST_REQUIRE_EQUAL (a->j2k_size(), j2c.size());
+		BOOST_REQUIRE_EQUAL (b->j2k_size(), j2c.size());
+		BOOST_CHECK (memcmp (a->j2k_data(), b->j2k_data(), j2c.size()) == 0);
+	}
+
+	shared_ptr<dcp::SoundAssetReader> sound_asdcp = sound->start_read ();
+	shared_ptr<dcp::SoundAssetReader> sound_openssl = sound->start_read ();
+	sound_openssl->set_decryption (dcp::DecryptionContext::OPENSSL_EVP, false);
+	for (int i = 0; i < 24; ++i) {
+		shared_ptr<const dcp::SoundFrame> a = sound_asdcp->get_frame (i);
+		shared_ptr<const dcp::SoundFrame> b = sound_openssl->get_frame (i);
+		BOOST_REQUIRE_EQUAL (a->size(), 2000 * 6 * 3);
+		BOOST_REQUIRE_EQUAL (b->size(), a->size());
+		BOOST_CHECK (memcmp (a->data(), b->data(), a->size()) == 0);
+	}
+
+	/* copy_frames() reads into a buffer which is exactly the size of a frame */
+	dcp::SoundAsset copy (dcp::Fraction (24, 1), 48000, 6, dcp::SMPTE);
+	shared_ptr<dcp::SoundAssetWriter> copy_writer = copy.start_write (dir / "copy.mxf");
+	copy_writer->copy_frames (sound_openssl, 0, 24);
+	copy_writer->finalize ();
+	BOOST_CHECK_EQUAL (copy.intrinsic_duration(), 24);
+
+	/* HMACs can't be checked with OpenSSL */
+	BOOST_CHECK_THROW (sound_asdcp->set_decryption (dcp::DecryptionContext::OPENSSL_EVP, true), dcp::MiscError);
+
+	/* With the wrong key the check value should fail to decrypt */
+	sound->set_key (dcp::Key ());
+	shared_ptr<dcp::SoundAssetReader> wrong = sound->start_read ();
+	wrong->set_decryption (dcp::DecryptionContext::OPENSSL_EVP, false);
+	BOOST_CHECK_THROW (wrong->get_frame (0), dcp::DCPReadError);
+}
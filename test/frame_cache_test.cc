@@ -0,0 +1,196 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+#include "frame_cache.h"
+#include "mono_picture_asset.h"
+#include "picture_asset_writer.h"
+#include "openjpeg_image.h"
+#include "file.h"
+#include "key.h"
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+#include <cstring>
+
+using boost::shared_ptr;
+using boost::optional;
+
+static shared_ptr<dcp::MonoPictureAsset>
+make_asset (boost::filesystem::path file, optional<dcp::Key> key = optional<dcp::Key> ())
+{
+	boost::filesystem::create_directories (file.parent_path ());
+	shared_ptr<dcp::MonoPictureAsset> asset (new dcp::MonoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	if (key) {
+		asset->set_key (*key);
+	}
+	shared_ptr<dcp::PictureAssetWriter> writer = asset->start_write (file, false);
+	dcp::File j2c ("test/data/32x32_red_square.j2c");
+	for (int i = 0; i < 24; ++i) {
+		writer->write (j2c.data(), j2c.size());
+	}
+	writer->finalize ();
+	return asset;
+}
+
+/** Check hits, misses and LRU eviction */
+BOOST_AUTO_TEST_CASE (frame_cache_test)
+{
+	shared_ptr<dcp::MonoPictureAsset> asset = make_asset ("build/test/frame_cache_test.mxf");
+
+	/* Room for 3 32x32 XYZ frames */
+	int64_t const frame_memory = 32 * 32 * 3 * sizeof (int);
+	dcp::FrameCache cache (frame_memory * 3, 0);
+
+	shared_ptr<const dcp::CachedFrame> a = cache.get (asset, 0);
+	BOOST_REQUIRE (a->xyz ());
+	BOOST_CHECK (!a->rgba ());
+	BOOST_CHECK_EQUAL (a->size().width, 32);
+	BOOST_CHECK_EQUAL (a->memory(), frame_memory);
+	BOOST_CHECK_EQUAL (cache.misses(), 1);
+
+	shared_ptr<const dcp::CachedFrame> b = cache.get (asset, 0);
+	BOOST_CHECK (a == b);
+	BOOST_CHECK_EQUAL (cache.hits(), 1);
+
+	/* A different format is a different frame */
+	shared_ptr<const dcp::CachedFrame> c = cache.get (asset, 0, dcp::EYE_LEFT, 0, dcp::FrameCache::RGBA);
+	BOOST_CHECK (c->rgba ());
+	BOOST_CHECK (!c->xyz ());
+	BOOST_CHECK_EQUAL (cache.misses(), 2);
+
+	/* The eye is ignored for mono assets */
+	cache.get (asset, 0, dcp::EYE_RIGHT);
+	BOOST_CHECK_EQUAL (cache.hits(), 2);
+
+	for (int i = 1; i < 6; ++i) {
+		cache.get (asset, i);
+	}
+	BOOST_CHECK (cache.memory_used() <= frame_memory * 3);
+
+	/* 5 is still there but 0 has gone */
+	cache.get (asset, 5);
+	BOOST_CHECK_EQUAL (cache.hits(), 3);
+	int64_t const misses = cache.misses ();
+	cache.get (asset, 0);
+	BOOST_CHECK_EQUAL (cache.misses(), misses + 1);
+
+	cache.clear ();
+	BOOST_CHECK_EQUAL (cache.memory_used(), 0);
+}
+
+/** Check that frames are prefetched in the direction of travel */
+BOOST_AUTO_TEST_CASE (frame_cache_prefetch_test)
+{
+	shared_ptr<dcp::MonoPictureAsset> asset = make_asset ("build/test/frame_cache_prefetch_test.mxf");
+
+	int64_t const frame_memory = 32 * 32 * 3 * sizeof (int);
+	dcp::FrameCache cache (frame_memory * 100, 2);
+
+	/* Going backwards */
+	cache.get (asset, 10);
+	cache.set_prefetch (4);
+	cache.get (asset, 9);
+
+	/* Wait for 8, 7, 6 and 5 to be prefetched */
+	for (int i = 0; i < 1000 && cache.memory_used() < frame_memory * 6; ++i) {
+		boost::this_thread::sleep (boost::posix_time::milliseconds (10));
+	}
+
+	cache.set_prefetch (0);
+	int64_t const misses = cache.misses ();
+	for (int i = 8; i >= 5; --i) {
+		cache.get (asset, i);
+	}
+	BOOST_CHECK_EQUAL (cache.misses(), misses);
+
+	/* Nothing is prefetched off the start */
+	cache.clear ();
+	cache.get (asset, 1);
+	cache.set_prefetch (4);
+	cache.get (asset, 0);
+	boost::this_thread::sleep (boost::posix_time::milliseconds (100));
+	BOOST_CHECK_EQUAL (cache.memory_used(), frame_memory * 2);
+}
+
+static void
+check_frame (shared_ptr<const dcp::CachedFrame> frame, shared_ptr<const dcp::CachedFrame> reference)
+{
+	BOOST_REQUIRE (frame->xyz ());
+	BOOST_REQUIRE (frame->size() == reference->size());
+	for (int i = 0; i < 3; ++i) {
+		BOOST_CHECK (memcmp (frame->xyz()->data(i), reference->xyz()->data(i), frame->size().width * frame->size().height * sizeof (int)) == 0);
+	}
+}
+
+/** Check that neither a reader nor the frames that it decoded are re-used once its asset
+ *  has been given a key, or for another asset object with the same ID.
+ */
+BOOST_AUTO_TEST_CASE (frame_cache_key_test)
+{
+	int64_t const frame_memory = 32 * 32 * 3 * sizeof (int);
+
+	shared_ptr<const dcp::CachedFrame> reference;
+	{
+		dcp::FrameCache cache (frame_memory, 0);
+		reference = cache.get (make_asset ("build/test/frame_cache_key_test_plain.mxf"), 0);
+	}
+
+	dcp::Key key;
+	boost::filesystem::path const file = "build/test/frame_cache_key_test.mxf";
+	make_asset (file, key);
+
+	dcp::FrameCache cache (frame_memory * 100, 0);
+
+	/* This can't be decrypted, so whatever comes back is no use */
+	shared_ptr<dcp::MonoPictureAsset> a (new dcp::MonoPictureAsset (file));
+	try {
+		cache.get (a, 0);
+	} catch (...) {
+
+	}
+
+	a->set_key (key);
+	check_frame (cache.get (a, 0), reference);
+
+	/* Likewise a different object for the same asset, without a key */
+	shared_ptr<dcp::MonoPictureAsset> b (new dcp::MonoPictureAsset (file));
+	try {
+		cache.get (b, 0);
+	} catch (...) {
+
+	}
+
+	shared_ptr<dcp::MonoPictureAsset> c (new dcp::MonoPictureAsset (file));
+	c->set_key (key);
+	check_frame (cache.get (c, 0), reference);
+	BOOST_CHECK_EQUAL (cache.memory_used(), frame_memory);
+}
@@ -0,0 +1,178 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+#include "mono_picture_asset.h"
+#include "mono_picture_asset_writer.h"
+#include "mono_picture_asset_reader.h"
+#include "mono_picture_frame.h"
+#include "sound_asset.h"
+#include "sound_asset_writer.h"
+#include "sound_asset_reader.h"
+#include "sound_frame.h"
+#include "key.h"
+#include "file.h"
+#include "compose.hpp"
+#include <asdcp/AS_DCP.h>
+#include <boost/test/unit_test.hpp>
+
+using boost::shared_ptr;
+using boost::dynamic_pointer_cast;
+
+/** Copy a range of frames from an encrypted picture asset to an unencrypted one */
+BOOST_AUTO_TEST_CASE (picture_frame_copy_test)
+{
+	dcp::Key key;
+	dcp::File j2c ("test/data/32x32_red_square.j2c");
+
+	shared_ptr<dcp::MonoPictureAsset> in (new dcp::MonoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	in->set_key (key);
+	shared_ptr<dcp::PictureAssetWriter> in_writer = in->start_write ("build/test/picture_frame_copy_test_in.mxf", false);
+	for (int i = 0; i < 24; ++i) {
+		in_writer->write (j2c.data(), j2c.size());
+	}
+	in_writer->finalize ();
+
+	dcp::MonoPictureAsset out (dcp::Fraction (24, 1), dcp::SMPTE);
+	shared_ptr<dcp::MonoPictureAssetWriter> out_writer = dynamic_pointer_cast<dcp::MonoPictureAssetWriter> (
+		out.start_write ("build/test/picture_frame_copy_test_out.mxf", false)
+		);
+	shared_ptr<dcp::MonoPictureAssetReader> reader = in->start_read ();
+	out_writer->copy_frames (reader, 4, 10);
+	out_writer->copy_frames (reader, 20, 24);
+	/* Off the end of the source asset */
+	BOOST_CHECK_THROW (out_writer->copy_frames (reader, 24, 25), dcp::DCPReadError);
+	out_writer->finalize ();
+
+	BOOST_CHECK_EQUAL (out.intrinsic_duration(), 10);
+	BOOST_CHECK (out.size() == dcp::Size (32, 32));
+	BOOST_CHECK (!out.encrypted());
+
+	shared_ptr<dcp::MonoPictureAssetReader> check = out.start_read ();
+	for (int i = 0; i < 10; ++i) {
+		shared_ptr<const dcp::MonoPictureFrame> frame = check->get_frame (i);
+		BOOST_REQUIRE_EQUAL (frame->j2k_size(), j2c.size());
+		BOOST_CHECK (memcmp (frame->j2k_data(), j2c.data(), j2c.size()) == 0);
+	}
+}
+
+/** Copy frames from an unencrypted picture asset to an encrypted one; the codestream
+ *  headers must be left unencrypted, as they are when the frames are written with write().
+ */
+BOOST_AUTO_TEST_CASE (picture_frame_copy_encrypted_test)
+{
+	dcp::File j2c ("test/data/32x32_red_square.j2c");
+
+	dcp::MonoPictureAsset in (dcp::Fraction (24, 1), dcp::SMPTE);
+	shared_ptr<dcp::PictureAssetWriter> in_writer = in.start_write ("build/test/picture_frame_copy_encrypted_test_in.mxf", false);
+	for (int i = 0; i < 24; ++i) {
+		in_writer->write (j2c.data(), j2c.size());
+	}
+	in_writer->finalize ();
+
+	dcp::Key key;
+
+	dcp::MonoPictureAsset out (dcp::Fraction (24, 1), dcp::SMPTE);
+	out.set_key (key);
+	shared_ptr<dcp::MonoPictureAssetWriter> out_writer = dynamic_pointer_cast<dcp::MonoPictureAssetWriter> (
+		out.start_write ("build/test/picture_frame_copy_encrypted_test_out.mxf", false)
+		);
+	out_writer->copy_frames (in.start_read(), 0, 24);
+	out_writer->finalize ();
+
+	BOOST_CHECK (out.encrypted());
+	BOOST_CHECK_EQUAL (out.intrinsic_duration(), 24);
+
+	shared_ptr<dcp::MonoPictureAssetReader> check = out.start_read ();
+	for (int i = 0; i < 24; ++i) {
+		shared_ptr<const dcp::MonoPictureFrame> frame = check->get_frame (i);
+		BOOST_REQUIRE_EQUAL (frame->j2k_size(), j2c.size());
+		BOOST_CHECK (memcmp (frame->j2k_data(), j2c.data(), j2c.size()) == 0);
+	}
+
+	/* Read the frames without decrypting them and check that the codestream headers are
+	   in the clear, as they would be if the frames had been written with write()
+	*/
+	ASDCP::JP2K::MXFReader raw;
+	BOOST_REQUIRE (ASDCP_SUCCESS (raw.OpenRead ("build/test/picture_frame_copy_encrypted_test_out.mxf")));
+	ASDCP::JP2K::FrameBuffer buffer (4 * 1024 * 1024);
+	ASDCP::JP2K::CodestreamParser parser;
+	ASDCP::JP2K::FrameBuffer parsed (j2c.size());
+	BOOST_REQUIRE (ASDCP_SUCCESS (parser.OpenReadFrame (j2c.data(), j2c.size(), parsed)));
+	BOOST_REQUIRE (parsed.PlaintextOffset() > 0);
+	for (int i = 0; i < 24; ++i) {
+		BOOST_REQUIRE (ASDCP_SUCCESS (raw.ReadFrame (i, buffer, 0, 0)));
+		BOOST_REQUIRE_EQUAL (buffer.PlaintextOffset(), parsed.PlaintextOffset());
+		/* The IV and check value come first */
+		BOOST_CHECK (memcmp (buffer.RoData() + 2 * ASDCP::CBC_BLOCK_SIZE, j2c.data(), parsed.PlaintextOffset()) == 0);
+	}
+}
+
+/** Join ranges of frames from two sound assets */
+BOOST_AUTO_TEST_CASE (sound_frame_copy_test)
+{
+	shared_ptr<dcp::SoundAsset> in[2];
+	for (int i = 0; i < 2; ++i) {
+		in[i].reset (new dcp::SoundAsset (dcp::Fraction (24, 1), 48000, 6, dcp::SMPTE));
+		shared_ptr<dcp::SoundAssetWriter> writer = in[i]->start_write (dcp::String::compose ("build/test/sound_frame_copy_test_in%1.mxf", i));
+		float samples[6][2000];
+		float* channels[6];
+		for (int j = 0; j < 6; ++j) {
+			channels[j] = samples[j];
+		}
+		for (int j = 0; j < 24; ++j) {
+			/* Make each frame's samples identify the asset and frame */
+			for (int k = 0; k < 6; ++k) {
+				for (int l = 0; l < 2000; ++l) {
+					samples[k][l] = (i * 24 + j) / 128.0;
+				}
+			}
+			writer->write (channels, 2000);
+		}
+		writer->finalize ();
+	}
+
+	dcp::SoundAsset out (dcp::Fraction (24, 1), 48000, 6, dcp::SMPTE);
+	shared_ptr<dcp::SoundAssetWriter> writer = out.start_write ("build/test/sound_frame_copy_test_out.mxf");
+	writer->copy_frames (in[0]->start_read(), 12, 24);
+	writer->copy_frames (in[1]->start_read(), 0, 12);
+	writer->finalize ();
+
+	BOOST_CHECK_EQUAL (out.intrinsic_duration(), 24);
+
+	shared_ptr<dcp::SoundAssetReader> reader = out.start_read ();
+	for (int i = 0; i < 24; ++i) {
+		shared_ptr<const dcp::SoundFrame> frame = reader->get_frame (i);
+		BOOST_CHECK_EQUAL (frame->get (0, 0), (i + 12) * (1 << 16));
+		BOOST_CHECK_EQUAL (frame->get (5, 1999), (i + 12) * (1 << 16));
+	}
+}
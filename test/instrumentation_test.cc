@@ -0,0 +1,130 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+#include "instrumentation.h"
+#include "mono_picture_asset.h"
+#include "mono_picture_asset_reader.h"
+#include "mono_picture_frame.h"
+#include "picture_asset_writer.h"
+#include "openjpeg_image.h"
+#include "colour_conversion.h"
+#include "rgb_xyz.h"
+#include "file.h"
+#include "util.h"
+#include <boost/test/unit_test.hpp>
+#include <boost/scoped_array.hpp>
+
+using std::string;
+using boost::shared_ptr;
+using boost::scoped_array;
+
+static void
+write_and_read (boost::filesystem::path file)
+{
+	shared_ptr<dcp::MonoPictureAsset> asset (new dcp::MonoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	shared_ptr<dcp::PictureAssetWriter> writer = asset->start_write (file, false);
+	dcp::File j2c ("test/data/32x32_red_square.j2c");
+	for (int i = 0; i < 24; ++i) {
+		writer->write (j2c.data(), j2c.size());
+	}
+	writer->finalize ();
+
+	shared_ptr<dcp::MonoPictureAssetReader> reader = asset->start_read ();
+	for (int i = 0; i < 24; ++i) {
+		reader->get_frame (i);
+	}
+
+	shared_ptr<dcp::OpenJPEGImage> xyz = reader->get_frame(0)->xyz_image ();
+	scoped_array<uint8_t> rgba (new uint8_t[xyz->size().width * xyz->size().height * 4]);
+	dcp::xyz_to_rgba (xyz, dcp::ColourConversion::srgb_to_xyz(), rgba.get(), xyz->size().width * 4);
+}
+
+/** Check that nothing is counted while instrumentation is disabled */
+BOOST_AUTO_TEST_CASE (instrumentation_disabled_test)
+{
+	dcp::Instrumentation::reset ();
+	BOOST_REQUIRE (!dcp::Instrumentation::enabled ());
+
+	boost::filesystem::create_directories ("build/test");
+	write_and_read ("build/test/instrumentation_disabled_test.mxf");
+
+	for (int i = 0; i < dcp::Instrumentation::STAGES; ++i) {
+		BOOST_CHECK_EQUAL (dcp::Instrumentation::stats(static_cast<dcp::Instrumentation::Stage>(i)).count, 0);
+	}
+}
+
+/** Check the counts, histograms and trace from writing and reading a small picture asset */
+BOOST_AUTO_TEST_CASE (instrumentation_test)
+{
+	dcp::Instrumentation::reset ();
+	dcp::Instrumentation::set_enabled (true);
+	dcp::Instrumentation::set_tracing (true);
+
+	write_and_read ("build/test/instrumentation_test.mxf");
+
+	dcp::Instrumentation::set_enabled (false);
+	dcp::Instrumentation::set_tracing (false);
+
+	int const size = boost::filesystem::file_size ("test/data/32x32_red_square.j2c");
+
+	dcp::StageStats write = dcp::Instrumentation::stats (dcp::Instrumentation::MXF_WRITE);
+	BOOST_CHECK_EQUAL (write.count, 24);
+	BOOST_CHECK_EQUAL (write.bytes, 24 * size);
+
+	dcp::StageStats read = dcp::Instrumentation::stats (dcp::Instrumentation::MXF_READ);
+	BOOST_CHECK_EQUAL (read.count, 25);
+	BOOST_CHECK_EQUAL (read.bytes, 25 * size);
+	BOOST_CHECK (read.min <= read.max);
+	BOOST_CHECK (read.percentile (50) >= read.min);
+	BOOST_CHECK (read.percentile (50) <= read.max);
+
+	int64_t in_histogram = 0;
+	for (size_t i = 0; i < read.histogram.size(); ++i) {
+		in_histogram += read.histogram[i];
+	}
+	BOOST_CHECK_EQUAL (in_histogram, read.count);
+
+	BOOST_CHECK_EQUAL (dcp::Instrumentation::stats(dcp::Instrumentation::J2K_DECOMPRESS).count, 1);
+	BOOST_CHECK_EQUAL (dcp::Instrumentation::stats(dcp::Instrumentation::XYZ_TO_RGBA).count, 1);
+	BOOST_CHECK_EQUAL (dcp::Instrumentation::stats(dcp::Instrumentation::XYZ_TO_RGBA).bytes, 32 * 32 * 4);
+	BOOST_CHECK_EQUAL (dcp::Instrumentation::stats(dcp::Instrumentation::DECRYPT).count, 0);
+
+	dcp::Instrumentation::write_trace ("build/test/instrumentation_test.json");
+	string const trace = dcp::file_to_string ("build/test/instrumentation_test.json");
+	BOOST_CHECK (trace.find ("\"traceEvents\"") != string::npos);
+	BOOST_CHECK (trace.find ("\"name\":\"mxf_write\"") != string::npos);
+	BOOST_CHECK (trace.find ("\"name\":\"j2k_decompress\"") != string::npos);
+
+	dcp::Instrumentation::reset ();
+	BOOST_CHECK_EQUAL (dcp::Instrumentation::stats(dcp::Instrumentation::MXF_READ).count, 0);
+}
@@ -0,0 +1,183 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  test/io_backend_bench.cc
+ *  @brief Compare the speed of reading frames from MXFs with each IOBackend.
+ *
+ *  Frames are read in order and in a pseudo-random order from a sound asset (large frames)
+ *  and a picture asset (small frames, so per-frame overheads dominate).  The files are
+ *  read once before timing so the results are for a warm cache; to time cold reads,
+ *  drop the kernel's caches before each run and pass "cold" as the second argument
+ *  (which skips the warm-up).
+ */
+
+#include "io_backend.h"
+#include "sound_asset.h"
+#include "sound_asset_writer.h"
+#include "sound_asset_reader.h"
+#include "sound_frame.h"
+#include "mono_picture_asset.h"
+#include "mono_picture_asset_reader.h"
+#include "mono_picture_frame.h"
+#include "picture_asset_writer.h"
+#include "file.h"
+#include "util.h"
+#include <boost/filesystem.hpp>
+#include <sys/time.h>
+#include <iostream>
+#include <cstring>
+#include <cmath>
+
+using std::cout;
+using std::string;
+using boost::shared_ptr;
+
+static double
+seconds ()
+{
+	struct timeval t;
+	gettimeofday (&t, 0);
+	return t.tv_sec + t.tv_usec / 1e6;
+}
+
+/** @return Frame index to read at step i of n */
+static int64_t
+frame_index (int64_t i, int64_t n, bool random)
+{
+	if (!random) {
+		return i;
+	}
+
+	/* A prime step which is unlikely to divide n visits every frame in a scattered order */
+	return (i * 7919) % n;
+}
+
+static int
+frame_size (shared_ptr<const dcp::SoundFrame> frame)
+{
+	return frame->size ();
+}
+
+static int
+frame_size (shared_ptr<const dcp::MonoPictureFrame> frame)
+{
+	return frame->j2k_size ();
+}
+
+template <class A, class R>
+static void
+time_read (shared_ptr<A> asset, string name, dcp::IOBackend::Type type, int64_t readahead, bool random)
+{
+	shared_ptr<R> reader = asset->start_read ();
+	reader->set_io_backend (dcp::IOBackend::create (asset->file().get(), type, readahead));
+
+	int64_t const frames = asset->intrinsic_duration ();
+	int64_t bytes = 0;
+	double const start = seconds ();
+	for (int64_t i = 0; i < frames; ++i) {
+		bytes += frame_size (reader->get_frame (frame_index (i, frames, random)));
+	}
+	double const time = seconds() - start;
+
+	cout << name << (random ? " random" : " in order") << ": "
+	     << (bytes / time / 1e6) << " MB/s, "
+	     << (time * 1e6 / frames) << " us/frame\n";
+}
+
+template <class A, class R>
+static void
+time_all (shared_ptr<A> asset, string name, bool warm_up)
+{
+	if (warm_up) {
+		time_read<A, R> (asset, name + " warm-up", dcp::IOBackend::ASDCPLIB, 0, false);
+	}
+
+	for (int random = 0; random < 2; ++random) {
+		time_read<A, R> (asset, name + " asdcplib", dcp::IOBackend::ASDCPLIB, 0, random);
+		time_read<A, R> (asset, name + " pread", dcp::IOBackend::PREAD, 0, random);
+		time_read<A, R> (asset, name + " pread with 8MB readahead", dcp::IOBackend::PREAD, 8 * 1024 * 1024, random);
+		time_read<A, R> (asset, name + " mmap", dcp::IOBackend::MMAP, 0, random);
+		time_read<A, R> (asset, name + " io_uring", dcp::IOBackend::IO_URING, 0, random);
+	}
+}
+
+int
+main (int argc, char* argv[])
+{
+	int const frames = argc > 1 ? atoi (argv[1]) : 2000;
+	bool const warm_up = !(argc > 2 && strcmp (argv[2], "cold") == 0);
+	int const channels = 16;
+	int const sampling_rate = 96000;
+	int const frame_length = sampling_rate / 24;
+
+	dcp::init ();
+
+	boost::filesystem::path sound_file = "build/test/io_backend_bench_sound.mxf";
+	boost::filesystem::path picture_file = "build/test/io_backend_bench_picture.mxf";
+	boost::filesystem::create_directories (sound_file.parent_path ());
+
+	shared_ptr<dcp::SoundAsset> sound (new dcp::SoundAsset (dcp::Fraction (24, 1), sampling_rate, channels, dcp::SMPTE));
+	shared_ptr<dcp::SoundAssetWriter> sound_writer = sound->start_write (sound_file);
+
+	float* data[channels];
+	for (int i = 0; i < channels; ++i) {
+		data[i] = new float[frame_length];
+		for (int j = 0; j < frame_length; ++j) {
+			data[i][j] = sin (j * (i + 1) * 0.001);
+		}
+	}
+
+	for (int i = 0; i < frames; ++i) {
+		sound_writer->write (data, frame_length);
+	}
+	sound_writer->finalize ();
+
+	for (int i = 0; i < channels; ++i) {
+		delete[] data[i];
+	}
+
+	shared_ptr<dcp::MonoPictureAsset> picture (new dcp::MonoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	shared_ptr<dcp::PictureAssetWriter> picture_writer = picture->start_write (picture_file, false);
+	dcp::File j2c ("test/data/32x32_red_square.j2c");
+	for (int i = 0; i < frames * 10; ++i) {
+		picture_writer->write (j2c.data(), j2c.size());
+	}
+	picture_writer->finalize ();
+
+	time_all<dcp::SoundAsset, dcp::SoundAssetReader> (sound, "sound", warm_up);
+	time_all<dcp::MonoPictureAsset, dcp::MonoPictureAssetReader> (picture, "picture", warm_up);
+
+	boost::filesystem::remove (sound_file);
+	boost::filesystem::remove (picture_file);
+	return 0;
+}
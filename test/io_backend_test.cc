@@ -0,0 +1,257 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+#include "io_backend.h"
+#include "mono_picture_asset.h"
+#include "mono_picture_asset_reader.h"
+#include "mono_picture_frame.h"
+#include "stereo_picture_asset.h"
+#include "stereo_picture_asset_reader.h"
+#include "stereo_picture_frame.h"
+#include "picture_asset_writer.h"
+#include "sound_asset.h"
+#include "sound_asset_writer.h"
+#include "sound_asset_reader.h"
+#include "sound_frame.h"
+#include "openjpeg_image.h"
+#include "key.h"
+#include "file.h"
+#include <asdcp/AS_DCP.h>
+#include <boost/test/unit_test.hpp>
+#include <vector>
+
+using std::vector;
+using boost::shared_ptr;
+
+static dcp::IOBackend::Type const types[] = {
+	dcp::IOBackend::PREAD,
+	dcp::IOBackend::MMAP,
+	dcp::IOBackend::IO_URING
+};
+
+/** Write a sound asset and return it */
+static shared_ptr<dcp::SoundAsset>
+make_sound (boost::filesystem::path file, bool encrypt)
+{
+	shared_ptr<dcp::SoundAsset> sound (new dcp::SoundAsset (dcp::Fraction (24, 1), 48000, 6, dcp::SMPTE));
+	if (encrypt) {
+		sound->set_key (dcp::Key ());
+	}
+	shared_ptr<dcp::SoundAssetWriter> writer = sound->start_write (file);
+
+	vector<float> samples (2000);
+	float* channels[6];
+	for (int i = 0; i < 6; ++i) {
+		channels[i] = &samples[0];
+	}
+	for (int i = 0; i < 24; ++i) {
+		for (int j = 0; j < 2000; ++j) {
+			samples[j] = (i * 2000 + j) / 48000.0;
+		}
+		writer->write (channels, samples.size());
+	}
+	writer->finalize ();
+	return sound;
+}
+
+/** Check that each IOBackend gives the same sound frames as asdcplib, in and out of order */
+static void
+check_sound (shared_ptr<dcp::SoundAsset> sound)
+{
+	shared_ptr<dcp::SoundAssetReader> reference = sound->start_read ();
+	reference->set_io_backend (dcp::IOBackend::ASDCPLIB);
+
+	for (int i = 0; i < 3; ++i) {
+		for (int64_t readahead = 0; readahead <= 65536; readahead += 65536) {
+			shared_ptr<dcp::SoundAssetReader> reader = sound->start_read ();
+			reader->set_io_backend (dcp::IOBackend::create (sound->file().get(), types[i], readahead));
+			for (int j = 0; j < 48; ++j) {
+				int const n = (j * 7) % 24;
+				shared_ptr<const dcp::SoundFrame> a = reference->get_frame (n);
+				shared_ptr<const dcp::SoundFrame> b = reader->get_frame (n);
+				BOOST_REQUIRE_EQUAL (a->size(), b->size());
+				BOOST_CHECK (memcmp (a->data(), b->data(), a->size()) == 0);
+			}
+
+			/* Batches of frames, the last of which ends with the last frame in the asset */
+			vector<ASDCP::PCM::FrameBuffer*> buffers;
+			for (int j = 0; j < 5; ++j) {
+				buffers.push_back (new ASDCP::PCM::FrameBuffer (2000 * 6 * 3));
+			}
+			for (int j = 4; j < 24; j += 5) {
+				reader->read_frames (j, buffers);
+				for (int k = 0; k < 5; ++k) {
+					shared_ptr<const dcp::SoundFrame> a = reference->get_frame (j + k);
+					BOOST_REQUIRE_EQUAL (int (buffers[k]->Size()), a->size());
+					BOOST_CHECK (memcmp (a->data(), buffers[k]->RoData(), a->size()) == 0);
+				}
+			}
+			for (int j = 0; j < 5; ++j) {
+				delete buffers[j];
+			}
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE (io_backend_sound_test)
+{
+	check_sound (make_sound ("build/test/io_backend_sound_test.mxf", false));
+}
+
+/** Encrypted frames should be read (and decrypted) by asdcplib whatever backend is asked for */
+BOOST_AUTO_TEST_CASE (io_backend_encrypted_sound_test)
+{
+	check_sound (make_sound ("build/test/io_backend_encrypted_sound_test.mxf", true));
+}
+
+BOOST_AUTO_TEST_CASE (io_backend_picture_test)
+{
+	dcp::File j2c ("test/data/32x32_red_square.j2c");
+
+	shared_ptr<dcp::MonoPictureAsset> mono (new dcp::MonoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	shared_ptr<dcp::PictureAssetWriter> mono_writer = mono->start_write ("build/test/io_backend_picture_test_mono.mxf", false);
+	shared_ptr<dcp::StereoPictureAsset> stereo (new dcp::StereoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	shared_ptr<dcp::PictureAssetWriter> stereo_writer = stereo->start_write ("build/test/io_backend_picture_test_stereo.mxf", false);
+	for (int i = 0; i < 24; ++i) {
+		mono_writer->write (j2c.data(), j2c.size());
+		stereo_writer->write (j2c.data(), j2c.size());
+		stereo_writer->write (j2c.data(), j2c.size());
+	}
+	mono_writer->finalize ();
+	stereo_writer->finalize ();
+
+	for (int i = 0; i < 3; ++i) {
+		dcp::IOBackend::set_default (types[i], 4096);
+
+		shared_ptr<dcp::MonoPictureAssetReader> mono_reader = mono->start_read ();
+		shared_ptr<dcp::StereoPictureAssetReader> stereo_reader = stereo->start_read ();
+		for (int j = 23; j >= 0; --j) {
+			shared_ptr<const dcp::MonoPictureFrame> frame = mono_reader->get_frame (j);
+			BOOST_REQUIRE_EQUAL (frame->j2k_size(), j2c.size());
+			BOOST_CHECK (memcmp (frame->j2k_data(), j2c.data(), j2c.size()) == 0);
+
+			shared_ptr<const dcp::StereoPictureFrame> stereo_frame = stereo_reader->get_frame (j);
+			BOOST_REQUIRE_EQUAL (stereo_frame->left_j2k_size(), j2c.size());
+			BOOST_CHECK (memcmp (stereo_frame->left_j2k_data(), j2c.data(), j2c.size()) == 0);
+			BOOST_REQUIRE_EQUAL (stereo_frame->right_j2k_size(), j2c.size());
+			BOOST_CHECK (memcmp (stereo_frame->right_j2k_data(), j2c.data(), j2c.size()) == 0);
+		}
+
+		BOOST_CHECK_THROW (mono_reader->get_frame (24), dcp::DCPReadError);
+	}
+
+	dcp::IOBackend::set_default (dcp::IOBackend::ASDCPLIB);
+}
+
+/* Backends other than ASDCPLIB are only available on POSIX */
+#ifdef LIBDCP_POSIX
+
+/** Check reads from outside the file */
+BOOST_AUTO_TEST_CASE (io_backend_bounds_test)
+{
+	for (int i = 0; i < 3; ++i) {
+		shared_ptr<dcp::IOBackend> io = dcp::IOBackend::create ("test/data/32x32_red_square.j2c", types[i], 1024);
+		BOOST_REQUIRE (io);
+		BOOST_CHECK_EQUAL (io->size(), int64_t (boost::filesystem::file_size ("test/data/32x32_red_square.j2c")));
+
+		uint8_t buffer[64];
+		io->read (io->size() - 64, 64, buffer);
+		BOOST_CHECK_THROW (io->read (io->size() - 32, 64, buffer), dcp::FileError);
+		BOOST_CHECK_THROW (io->read (-1, 1, buffer), dcp::FileError);
+
+		/* More requests than io_uring's queue takes at once */
+		vector<uint8_t> batch (200 * 16);
+		vector<dcp::IOBackend::Request> requests;
+		for (int j = 0; j < 200; ++j) {
+			requests.push_back (dcp::IOBackend::Request ((j * 37) % (io->size() - 16), 16, &batch[j * 16]));
+		}
+		io->read (requests);
+		for (int j = 0; j < 200; ++j) {
+			io->read (requests[j].offset, 16, buffer);
+			BOOST_CHECK (memcmp (buffer, &batch[j * 16], 16) == 0);
+		}
+	}
+
+	BOOST_CHECK (!dcp::IOBackend::create ("test/data/32x32_red_square.j2c", dcp::IOBackend::ASDCPLIB));
+	BOOST_CHECK_THROW (dcp::IOBackend::create ("test/data/does_not_exist", dcp::IOBackend::PREAD), dcp::FileError);
+}
+
+/** Check that unencrypted picture frames read with MMAP point into the mapped file */
+BOOST_AUTO_TEST_CASE (mapped_picture_frame_test)
+{
+	dcp::File j2c ("test/data/32x32_red_square.j2c");
+
+	shared_ptr<dcp::MonoPictureAsset> plain (new dcp::MonoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	shared_ptr<dcp::PictureAssetWriter> writer = plain->start_write ("build/test/mapped_picture_frame_test.mxf", false);
+	for (int i = 0; i < 24; ++i) {
+		writer->write (j2c.data(), j2c.size());
+	}
+	writer->finalize ();
+
+	shared_ptr<dcp::MonoPictureAsset> encrypted (new dcp::MonoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	encrypted->set_key (dcp::Key ());
+	writer = encrypted->start_write ("build/test/mapped_picture_frame_test_encrypted.mxf", false);
+	for (int i = 0; i < 24; ++i) {
+		writer->write (j2c.data(), j2c.size());
+	}
+	writer->finalize ();
+
+	shared_ptr<const dcp::MonoPictureFrame> frame;
+	shared_ptr<const dcp::MonoPictureFrame> encrypted_frame;
+	{
+		shared_ptr<dcp::MonoPictureAssetReader> reader = plain->start_read ();
+		reader->set_io_backend (dcp::IOBackend::MMAP);
+		frame = reader->get_frame (5);
+		shared_ptr<dcp::MonoPictureAssetReader> encrypted_reader = encrypted->start_read ();
+		encrypted_reader->set_io_backend (dcp::IOBackend::MMAP);
+		encrypted_frame = encrypted_reader->get_frame (5);
+	}
+
+	/* The frame keeps the file mapped after its reader has gone */
+	BOOST_CHECK (frame->mapped ());
+	BOOST_REQUIRE_EQUAL (frame->j2k_size(), j2c.size());
+	BOOST_CHECK (memcmp (frame->j2k_data(), j2c.data(), j2c.size()) == 0);
+	BOOST_CHECK (frame->xyz_image()->size() == dcp::Size (32, 32));
+
+	/* Encrypted frames are copied */
+	BOOST_CHECK (!encrypted_frame->mapped ());
+
+	/* Asking for writable data gives a copy */
+	shared_ptr<dcp::MonoPictureFrame> writable = boost::const_pointer_cast<dcp::MonoPictureFrame> (frame);
+	writable->j2k_data()[0] = 0;
+	BOOST_CHECK (!frame->mapped ());
+	BOOST_CHECK_EQUAL (frame->j2k_size(), j2c.size());
+	BOOST_CHECK (memcmp (frame->j2k_data() + 1, j2c.data() + 1, j2c.size() - 1) == 0);
+}
+
+#endif
@@ -34,16 +34,32 @@
 #include "encrypted_kdm.h"
 #include "decrypted_kdm.h"
 #include "certificate_chain.h"
+#include "kdm_store.h"
+#include "reel.h"
+#include "reel_mono_picture_asset.h"
+#include "reel_sound_asset.h"
+#include "mono_picture_asset.h"
+#include "mono_picture_asset_reader.h"
+#include "mono_picture_frame.h"
+#include "picture_asset_writer.h"
+#include "sound_asset.h"
+#include "sound_asset_writer.h"
+#include "data.h"
+#include "file.h"
+#include "exceptions.h"
 #include "util.h"
 #include "test.h"
 #include <libcxml/cxml.h>
 #include <libxml++/libxml++.h>
 #include <boost/test/unit_test.hpp>
 #include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+#include <boost/algorithm/string.hpp>
 
 using std::list;
 using std::string;
 using std::vector;
+using std::map;
 using boost::shared_ptr;
 using boost::optional;
 
@@ -91,6 +107,34 @@ BOOST_AUTO_TEST_CASE (kdm_passthrough_test)
 #endif
 }
 
+/** Check that a KDM which has been read gives back exactly its original XML, that
+ *  copies share it, and that a KDM with a required node missing is rejected.
+ */
+BOOST_AUTO_TEST_CASE (kdm_read_test)
+{
+	string const xml = dcp::file_to_string ("test/data/kdm_TONEPLATES-SMPTE-ENC_.smpte-430-2.ROOT.NOT_FOR_PRODUCTION_20130706_20230702_CAR_OV_t1_8971c838.xml");
+	dcp::EncryptedKDM kdm (xml);
+	BOOST_CHECK_EQUAL (kdm.as_xml(), xml);
+
+	BOOST_CHECK_EQUAL (kdm.id(), "8971c838-d0c3-405d-bc57-43afa9d91242");
+	BOOST_CHECK_EQUAL (kdm.cpl_id(), "eece17de-77e8-4a55-9347-b6bab5724b9f");
+	BOOST_CHECK_EQUAL (kdm.keys().size(), 2);
+	BOOST_CHECK_EQUAL (kdm.not_valid_before(), dcp::LocalTime ("2013-07-06T20:04:58+00:00"));
+	BOOST_CHECK_EQUAL (kdm.not_valid_after(), dcp::LocalTime ("2023-07-02T20:04:56+00:00"));
+	BOOST_CHECK_EQUAL (kdm.signer_certificate_chain().unordered().size(), 3);
+
+	dcp::EncryptedKDM copy = kdm;
+	BOOST_CHECK (copy == kdm);
+	BOOST_CHECK_EQUAL (copy.as_xml(), xml);
+
+	string broken = xml;
+	boost::algorithm::replace_all (broken, "<ContentTitleText>", "<ContentTitleTextx>");
+	boost::algorithm::replace_all (broken, "</ContentTitleText>", "</ContentTitleTextx>");
+	BOOST_CHECK_THROW (dcp::EncryptedKDM k (broken), dcp::KDMFormatError);
+
+	BOOST_CHECK_THROW (dcp::EncryptedKDM k (xml.substr (0, xml.length() / 2)), dcp::KDMFormatError);
+}
+
 /** Test some of the utility methods of DecryptedKDM */
 BOOST_AUTO_TEST_CASE (decrypted_kdm_test)
 {
@@ -227,3 +271,191 @@ BOOST_AUTO_TEST_CASE (kdm_forensic_test5)
 	cxml::ConstNodePtr forensic = kdm_forensic_test(doc, false, optional<int>());
 	BOOST_CHECK (!forensic);
 }
+
+static void
+batch_kdm_handler (map<int, dcp::EncryptedKDM>* kdms, int index, dcp::EncryptedKDM const & kdm)
+{
+	BOOST_CHECK (kdms->find(index) == kdms->end());
+	kdms->insert (std::make_pair (index, kdm));
+}
+
+/** Check making a batch of KDMs for many recipients at once */
+BOOST_AUTO_TEST_CASE (kdm_batch_test)
+{
+	dcp::DecryptedKDM decrypted (
+		dcp::EncryptedKDM (
+			dcp::file_to_string ("test/data/kdm_TONEPLATES-SMPTE-ENC_.smpte-430-2.ROOT.NOT_FOR_PRODUCTION_20130706_20230702_CAR_OV_t1_8971c838.xml")
+			),
+		dcp::file_to_string ("test/data/private.key")
+		);
+
+	shared_ptr<dcp::CertificateChain> signer(new dcp::CertificateChain(dcp::file_to_string("test/data/certificate_chain")));
+	signer->set_key(dcp::file_to_string("test/data/private.key"));
+
+	vector<dcp::DecryptedKDM::Recipient> recipients;
+	for (int i = 0; i < 16; ++i) {
+		recipients.push_back (dcp::DecryptedKDM::Recipient (signer->leaf(), vector<string>()));
+	}
+
+	map<int, dcp::EncryptedKDM> kdms;
+	float const rate = decrypted.encrypt (
+		signer, recipients, dcp::MODIFIED_TRANSITIONAL_1, false, optional<int>(), boost::bind (&batch_kdm_handler, &kdms, _1, _2), 4
+		);
+
+	BOOST_CHECK (rate > 0);
+	BOOST_REQUIRE_EQUAL (kdms.size(), recipients.size());
+
+	/* Each KDM should decrypt to give the original keys */
+	for (map<int, dcp::EncryptedKDM>::const_iterator i = kdms.begin(); i != kdms.end(); ++i) {
+		dcp::DecryptedKDM check (i->second, dcp::file_to_string ("test/data/private.key"));
+		BOOST_REQUIRE_EQUAL (check.keys().size(), decrypted.keys().size());
+		BOOST_CHECK (check.keys() == decrypted.keys());
+	}
+}
+
+/** Check adding KDMs to a KDMStore, looking up keys and reading them back from its cache */
+BOOST_AUTO_TEST_CASE (kdm_store_test)
+{
+	dcp::EncryptedKDM const original (
+		dcp::file_to_string ("test/data/kdm_TONEPLATES-SMPTE-ENC_.smpte-430-2.ROOT.NOT_FOR_PRODUCTION_20130706_20230702_CAR_OV_t1_8971c838.xml")
+		);
+
+	string const private_key = dcp::file_to_string ("test/data/private.key");
+	dcp::DecryptedKDM const decrypted (original, private_key);
+
+	/* Make some more KDMs for the same keys with a later validity window */
+	shared_ptr<dcp::CertificateChain> signer (new dcp::CertificateChain (dcp::file_to_string ("test/data/certificate_chain")));
+	signer->set_key (private_key);
+
+	dcp::DecryptedKDM later (
+		dcp::LocalTime ("2030-01-01T00:00:00+00:00"),
+		dcp::LocalTime ("2031-01-01T00:00:00+00:00"),
+		"annotation", "content title", "2029-12-01T00:00:00+00:00"
+		);
+	BOOST_FOREACH (dcp::DecryptedKDMKey const & i, decrypted.keys()) {
+		later.add_key (i);
+	}
+
+	vector<dcp::EncryptedKDM> kdms;
+	kdms.push_back (original);
+	kdms.push_back (original);
+	for (int i = 0; i < 4; ++i) {
+		kdms.push_back (later.encrypt (signer, signer->leaf(), vector<string>(), dcp::MODIFIED_TRANSITIONAL_1, false, optional<int>()));
+	}
+
+	boost::filesystem::path const cache = "build/test/kdm_store.cache";
+	boost::filesystem::remove (cache);
+
+	string const cpl_id = "eece17de-77e8-4a55-9347-b6bab5724b9f";
+	string const key_id = "4ac4f922-8239-4831-b23b-31426d0542c4";
+	dcp::LocalTime const in_original ("2015-01-01T00:00:00+00:00");
+	dcp::LocalTime const in_neither ("2025-01-01T00:00:00+00:00");
+	dcp::LocalTime const in_later ("2030-06-01T00:00:00+00:00");
+
+	{
+		dcp::KDMStore store (private_key, cache);
+		BOOST_CHECK_EQUAL (store.add (kdms, 4), 5);
+		BOOST_CHECK_EQUAL (store.add (kdms, 4), 0);
+		BOOST_CHECK_EQUAL (store.kdms(), 5);
+		BOOST_CHECK (boost::filesystem::exists (cache));
+	}
+
+	/* A new store should get everything from the cache */
+	dcp::KDMStore store (private_key, cache);
+	BOOST_CHECK_EQUAL (store.kdms(), 5);
+	BOOST_CHECK_EQUAL (store.add (kdms, 4), 0);
+
+	BOOST_REQUIRE (store.key (key_id, in_original));
+	BOOST_CHECK_EQUAL (store.key (key_id, in_original)->hex(), "8a2729c3e5b65c45d78305462104c3fb");
+	BOOST_CHECK (!store.key (key_id, in_neither));
+	BOOST_REQUIRE (store.key (key_id, in_later));
+	BOOST_CHECK_EQUAL (store.key (key_id, in_later)->hex(), "8a2729c3e5b65c45d78305462104c3fb");
+	BOOST_CHECK (!store.key ("00000000-0000-0000-0000-000000000000", in_original));
+
+	list<dcp::DecryptedKDMKey> keys = store.keys (cpl_id, in_original);
+	BOOST_CHECK (keys == decrypted.keys());
+	BOOST_CHECK (store.keys (cpl_id, in_neither).empty());
+
+	/* A cache with any byte changed (IV, ciphertext or MAC) should be ignored */
+	dcp::Data const good (cache);
+	int const positions[] = { 0, good.size() / 2, good.size() - 1 };
+	BOOST_FOREACH (int i, positions) {
+		dcp::Data bad (good.data().get(), good.size());
+		bad.data()[i] ^= 0x01;
+		bad.write (cache);
+		dcp::KDMStore tampered (private_key, cache);
+		BOOST_CHECK_EQUAL (tampered.kdms(), 0);
+		BOOST_CHECK (!tampered.key (key_id, in_original));
+	}
+}
+
+static optional<dcp::Key>
+find_key (map<string, dcp::Key> const * keys, string id)
+{
+	map<string, dcp::Key>::const_iterator i = keys->find (id);
+	if (i == keys->end ()) {
+		return optional<dcp::Key> ();
+	}
+	return i->second;
+}
+
+/** Check that Reel::give_keys gives each encrypted asset the key for its ID, if it is known */
+BOOST_AUTO_TEST_CASE (reel_give_keys_test)
+{
+	boost::filesystem::path const dir = "build/test/reel_give_keys_test";
+	boost::filesystem::remove_all (dir);
+	boost::filesystem::create_directories (dir);
+
+	dcp::Key const picture_key;
+	dcp::Key const sound_key;
+	dcp::File j2c ("test/data/32x32_red_square.j2c");
+
+	{
+		dcp::MonoPictureAsset picture (dcp::Fraction (24, 1), dcp::SMPTE);
+		picture.set_key (picture_key);
+		shared_ptr<dcp::PictureAssetWriter> writer = picture.start_write (dir / "video.mxf", false);
+		for (int i = 0; i < 24; ++i) {
+			writer->write (j2c.data(), j2c.size());
+		}
+		writer->finalize ();
+
+		dcp::SoundAsset sound (dcp::Fraction (24, 1), 48000, 1, dcp::SMPTE);
+		sound.set_key (sound_key);
+		shared_ptr<dcp::SoundAssetWriter> sound_writer = sound.start_write (dir / "audio.mxf");
+		vector<float> samples (48000, 0);
+		float* data[] = { &samples[0] };
+		sound_writer->write (data, samples.size());
+		sound_writer->finalize ();
+	}
+
+	/* Read the assets back, so that they know their key IDs but not their keys */
+	shared_ptr<dcp::MonoPictureAsset> picture (new dcp::MonoPictureAsset (dir / "video.mxf"));
+	shared_ptr<dcp::SoundAsset> sound (new dcp::SoundAsset (dir / "audio.mxf"));
+	BOOST_REQUIRE (picture->key_id ());
+	BOOST_REQUIRE (sound->key_id ());
+	BOOST_CHECK (!picture->key ());
+
+	dcp::Reel reel (
+		shared_ptr<dcp::ReelMonoPictureAsset> (new dcp::ReelMonoPictureAsset (picture, 0)),
+		shared_ptr<dcp::ReelSoundAsset> (new dcp::ReelSoundAsset (sound, 0))
+		);
+
+	map<string, dcp::Key> keys;
+	BOOST_CHECK_EQUAL (reel.give_keys (boost::bind (&find_key, &keys, _1)), 0);
+
+	keys[picture->key_id().get()] = picture_key;
+	BOOST_CHECK_EQUAL (reel.give_keys (boost::bind (&find_key, &keys, _1)), 1);
+	BOOST_REQUIRE (picture->key ());
+	BOOST_CHECK (picture->key().get() == picture_key);
+	BOOST_CHECK (!sound->key ());
+
+	keys[sound->key_id().get()] = sound_key;
+	BOOST_CHECK_EQUAL (reel.give_keys (boost::bind (&find_key, &keys, _1)), 2);
+	BOOST_REQUIRE (sound->key ());
+	BOOST_CHECK (sound->key().get() == sound_key);
+
+	/* The picture can now be decrypted */
+	shared_ptr<const dcp::MonoPictureFrame> frame = picture->start_read()->get_frame (0);
+	BOOST_REQUIRE_EQUAL (frame->j2k_size(), j2c.size());
+	BOOST_CHECK (memcmp (frame->j2k_data(), j2c.data(), j2c.size()) == 0);
+}
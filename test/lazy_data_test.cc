@@ -0,0 +1,166 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+#include "lazy_data.h"
+#include "exceptions.h"
+#include "util.h"
+#include "subtitle_image.h"
+#include "interop_subtitle_asset.h"
+#include <boost/test/unit_test.hpp>
+#include <boost/shared_ptr.hpp>
+#include <vector>
+
+using std::vector;
+using boost::shared_ptr;
+
+/** A DataSource which counts how many times it has been read */
+class CountingDataSource : public dcp::DataSource
+{
+public:
+	CountingDataSource (int size, uint8_t value)
+		: reads (0)
+		, _size (size)
+		, _value (value)
+	{}
+
+	dcp::Data read () const
+	{
+		++reads;
+		dcp::Data data (_size);
+		memset (data.data().get(), _value, _size);
+		return data;
+	}
+
+	std::string description () const
+	{
+		return "test data";
+	}
+
+	mutable int reads;
+
+private:
+	int _size;
+	uint8_t _value;
+};
+
+/** Check that LazyData only reads when asked, and keeps within its memory budget */
+BOOST_AUTO_TEST_CASE (lazy_data_budget_test)
+{
+	dcp::LazyData::set_memory_budget (2500);
+
+	vector<shared_ptr<CountingDataSource> > sources;
+	vector<dcp::LazyData> data;
+	for (int i = 0; i < 4; ++i) {
+		sources.push_back (shared_ptr<CountingDataSource> (new CountingDataSource (1000, i)));
+		data.push_back (dcp::LazyData (sources.back ()));
+	}
+
+	for (int i = 0; i < 4; ++i) {
+		BOOST_CHECK (!data[i].empty ());
+		BOOST_CHECK (!data[i].loaded ());
+		BOOST_CHECK_EQUAL (sources[i]->reads, 0);
+	}
+
+	BOOST_CHECK_EQUAL (data[0].get().data()[0], 0);
+	BOOST_CHECK_EQUAL (data[1].get().data()[0], 1);
+	BOOST_CHECK_EQUAL (dcp::LazyData::memory_used(), 2000);
+
+	/* Using 0 again makes 1 the least-recently used, so 1 should go when 2 is read */
+	data[0].get ();
+	BOOST_CHECK_EQUAL (sources[0]->reads, 1);
+	BOOST_CHECK_EQUAL (data[2].get().data()[0], 2);
+	BOOST_CHECK (data[0].loaded ());
+	BOOST_CHECK (!data[1].loaded ());
+	BOOST_CHECK (data[2].loaded ());
+	BOOST_CHECK_EQUAL (dcp::LazyData::memory_used(), 2000);
+
+	/* Reading 1 again fetches it from its source */
+	BOOST_CHECK_EQUAL (data[1].get().data()[0], 1);
+	BOOST_CHECK_EQUAL (sources[1]->reads, 2);
+
+	/* A copy shares data with its original */
+	dcp::LazyData copy = data[1];
+	BOOST_CHECK (copy.loaded ());
+	copy.evict ();
+	BOOST_CHECK (!data[1].loaded ());
+
+	/* Data which were not fetched from a source are not counted or evicted */
+	dcp::LazyData fixed (dcp::Data (5000));
+	BOOST_CHECK (fixed.loaded ());
+	fixed.evict ();
+	BOOST_CHECK (fixed.loaded ());
+	BOOST_CHECK (dcp::LazyData::memory_used() <= 2500);
+
+	BOOST_CHECK (dcp::LazyData().empty ());
+	BOOST_CHECK_EQUAL (dcp::LazyData().get().size(), 0);
+
+	data.clear ();
+	BOOST_CHECK_EQUAL (dcp::LazyData::memory_used(), 0);
+
+	dcp::LazyData::set_memory_budget (256 * 1024 * 1024);
+}
+
+/** Check that data which change after they were first read are noticed */
+BOOST_AUTO_TEST_CASE (lazy_data_changed_test)
+{
+	boost::filesystem::path file = "build/test/lazy_data_changed_test.png";
+	boost::filesystem::create_directories (file.parent_path ());
+	boost::filesystem::copy_file ("test/data/sub.png", file, boost::filesystem::copy_option::overwrite_if_exists);
+
+	dcp::SubtitleImage image (
+		dcp::LazyData (), dcp::Time (), dcp::Time (1, 24, 24), 0, dcp::HALIGN_CENTER, 0, dcp::VALIGN_TOP, dcp::Time (), dcp::Time ()
+		);
+	BOOST_CHECK (!image.has_png_image ());
+
+	image.read_png_file (file);
+	BOOST_CHECK (image.has_png_image ());
+	BOOST_CHECK (image.png_image() == dcp::Data ("test/data/sub.png"));
+	BOOST_CHECK_EQUAL (image.png_image_digest(), dcp::make_digest (dcp::Data ("test/data/sub.png")));
+
+	dcp::LazyData lazy (shared_ptr<dcp::DataSource> (new dcp::FileDataSource (file)));
+	BOOST_CHECK_EQUAL (lazy.digest(), image.png_image_digest());
+	lazy.evict ();
+
+	dcp::Data (100).write (file);
+	BOOST_CHECK_THROW (lazy.get (), dcp::MiscError);
+}
+
+/** Check that a missing Interop subtitle PNG is reported when the XML is read */
+BOOST_AUTO_TEST_CASE (lazy_data_missing_png_test)
+{
+	boost::filesystem::path dir = "build/test/lazy_data_missing_png_test";
+	boost::filesystem::remove_all (dir);
+	boost::filesystem::create_directories (dir);
+	boost::filesystem::copy_file ("test/data/subs3.xml", dir / "subs.xml");
+	BOOST_CHECK_THROW (dcp::InteropSubtitleAsset (dir / "subs.xml"), dcp::MissingSubtitleImageError);
+}
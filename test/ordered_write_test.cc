@@ -0,0 +1,364 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+#include "mono_picture_asset.h"
+#include "mono_picture_asset_writer.h"
+#include "mono_picture_asset_reader.h"
+#include "mono_picture_frame.h"
+#include "picture_asset_writer.h"
+#include "sound_asset.h"
+#include "sound_asset_writer.h"
+#include "sound_asset_reader.h"
+#include "sound_frame.h"
+#include "key.h"
+#include "ordered_writes.h"
+#include "file.h"
+#include <asdcp/AS_DCP.h>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <vector>
+#ifdef LIBDCP_POSIX
+#include <sys/stat.h>
+#endif
+
+using std::vector;
+using boost::shared_ptr;
+using boost::dynamic_pointer_cast;
+
+static int const frames = 48;
+static int const threads = 4;
+
+static void
+write_pictures (shared_ptr<dcp::MonoPictureAssetWriter> writer, dcp::File const * j2c, int thread, vector<dcp::FrameInfo>* info)
+{
+	/* Each thread writes every threads'th frame, starting from the end so that
+	   most frames arrive out of order.
+	*/
+	for (int i = frames - threads + thread; i >= 0; i -= threads) {
+		(*info)[i] = writer->write_frame (i, j2c->data(), j2c->size());
+	}
+}
+
+static int
+throw_on_first (int frame)
+{
+	if (frame == 0) {
+		throw 42;
+	}
+	return frame;
+}
+
+static void
+submit_frame (dcp::OrderedWrites<int, int>* writes, int frame, bool* failed)
+{
+	try {
+		writes->submit (frame, frame, &throw_on_first);
+	} catch (dcp::MiscError& e) {
+		*failed = true;
+	}
+}
+
+/** Check that a write which throws something other than a std::exception does not
+ *  leave other submitters waiting forever.
+ */
+BOOST_AUTO_TEST_CASE (ordered_writes_unknown_exception_test)
+{
+	dcp::OrderedWrites<int, int> writes;
+	bool failed = false;
+	boost::thread waiter (boost::bind (&submit_frame, &writes, 1, &failed));
+
+	BOOST_CHECK_THROW (writes.submit (0, 0, &throw_on_first), int);
+
+	BOOST_REQUIRE (waiter.timed_join (boost::posix_time::seconds (10)));
+	BOOST_CHECK (failed);
+	BOOST_CHECK_THROW (writes.submit (2, 2, &throw_on_first), dcp::MiscError);
+}
+
+/** Write an encrypted picture asset from several threads at once and check the result */
+BOOST_AUTO_TEST_CASE (ordered_picture_write_test)
+{
+	shared_ptr<dcp::MonoPictureAsset> picture (new dcp::MonoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	picture->set_key (dcp::Key ());
+	shared_ptr<dcp::MonoPictureAssetWriter> writer = dynamic_pointer_cast<dcp::MonoPictureAssetWriter> (
+		picture->start_write ("build/test/ordered_picture_write_test.mxf", false)
+		);
+	BOOST_REQUIRE (writer);
+
+	dcp::File j2c ("test/data/32x32_red_square.j2c");
+	vector<dcp::FrameInfo> info (frames);
+
+	boost::thread_group group;
+	for (int i = 0; i < threads; ++i) {
+		group.create_thread (boost::bind (&write_pictures, writer, &j2c, i, &info));
+	}
+	group.join_all ();
+	writer->finalize ();
+
+	BOOST_CHECK_EQUAL (picture->intrinsic_duration(), frames);
+	for (int i = 1; i < frames; ++i) {
+		BOOST_CHECK_EQUAL (info[i].offset, info[i - 1].offset + info[i - 1].size);
+		BOOST_CHECK_EQUAL (info[i].hash, info[0].hash);
+	}
+
+	shared_ptr<dcp::MonoPictureAssetReader> reader = picture->start_read ();
+	for (int i = 0; i < frames; ++i) {
+		shared_ptr<const dcp::MonoPictureFrame> frame = reader->get_frame (i);
+		BOOST_REQUIRE_EQUAL (frame->j2k_size(), j2c.size());
+		BOOST_CHECK (memcmp (frame->j2k_data(), j2c.data(), j2c.size()) == 0);
+	}
+}
+
+/** Pass frames read from a plain picture asset straight to an encrypted one, re-using one buffer */
+BOOST_AUTO_TEST_CASE (ordered_picture_buffer_write_test)
+{
+	dcp::File j2c ("test/data/32x32_red_square.j2c");
+
+	dcp::MonoPictureAsset in (dcp::Fraction (24, 1), dcp::SMPTE);
+	shared_ptr<dcp::PictureAssetWriter> in_writer = in.start_write ("build/test/ordered_picture_buffer_write_test_in.mxf", false);
+	for (int i = 0; i < 4; ++i) {
+		in_writer->write (j2c.data(), j2c.size());
+	}
+	in_writer->finalize ();
+
+	shared_ptr<dcp::MonoPictureAsset> out (new dcp::MonoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	out->set_key (dcp::Key ());
+	shared_ptr<dcp::MonoPictureAssetWriter> out_writer = dynamic_pointer_cast<dcp::MonoPictureAssetWriter> (
+		out->start_write ("build/test/ordered_picture_buffer_write_test_out.mxf", false)
+		);
+
+	shared_ptr<dcp::MonoPictureAssetReader> reader = in.start_read ();
+	shared_ptr<ASDCP::JP2K::FrameBuffer> buffer (new ASDCP::JP2K::FrameBuffer (4 * 1024 * 1024));
+	for (int i = 0; i < 4; ++i) {
+		reader->read_frame (i, *buffer);
+		out_writer->write_frame (i, buffer);
+	}
+	out_writer->finalize ();
+
+	BOOST_CHECK_EQUAL (out->intrinsic_duration(), 4);
+	shared_ptr<dcp::MonoPictureAssetReader> check = out->start_read ();
+	for (int i = 0; i < 4; ++i) {
+		shared_ptr<const dcp::MonoPictureFrame> frame = check->get_frame (i);
+		BOOST_REQUIRE_EQUAL (frame->j2k_size(), j2c.size());
+		BOOST_CHECK (memcmp (frame->j2k_data(), j2c.data(), j2c.size()) == 0);
+	}
+}
+
+static void
+write_sound (shared_ptr<dcp::SoundAssetWriter> writer, int thread)
+{
+	int const channels = 6;
+	int const samples = writer->samples_per_frame ();
+
+	float* data[channels];
+	for (int i = 0; i < channels; ++i) {
+		data[i] = new float[samples];
+	}
+
+	for (int i = frames - threads + thread; i >= 0; i -= threads) {
+		/* Fill each frame with a value that identifies it */
+		for (int j = 0; j < channels; ++j) {
+			for (int k = 0; k < samples; ++k) {
+				data[j][k] = i / 128.0;
+			}
+		}
+		writer->write_frame (i, data);
+	}
+
+	for (int i = 0; i < channels; ++i) {
+		delete[] data[i];
+	}
+}
+
+/** Write a sound asset from several threads at once and check the frames come back in order */
+BOOST_AUTO_TEST_CASE (ordered_sound_write_test)
+{
+	shared_ptr<dcp::SoundAsset> sound (new dcp::SoundAsset (dcp::Fraction (24, 1), 48000, 6, dcp::SMPTE));
+	sound->set_key (dcp::Key ());
+	shared_ptr<dcp::SoundAssetWriter> writer = sound->start_write ("build/test/ordered_sound_write_test.mxf");
+	BOOST_CHECK_EQUAL (writer->samples_per_frame(), 2000);
+
+	boost::thread_group group;
+	for (int i = 0; i < threads; ++i) {
+		group.create_thread (boost::bind (&write_sound, writer, i));
+	}
+	group.join_all ();
+	writer->finalize ();
+
+	BOOST_CHECK_EQUAL (sound->intrinsic_duration(), frames);
+
+	shared_ptr<dcp::SoundAssetReader> reader = sound->start_read ();
+	for (int i = 0; i < frames; ++i) {
+		shared_ptr<const dcp::SoundFrame> frame = reader->get_frame (i);
+		BOOST_CHECK_EQUAL (frame->get (0, 0), i * (1 << 16));
+		BOOST_CHECK_EQUAL (frame->get (5, 1999), i * (1 << 16));
+	}
+}
+
+static void
+write_raw_sound (shared_ptr<dcp::SoundAssetWriter> writer, int64_t index, bool* threw)
+{
+	std::vector<uint8_t> data (2000 * 6 * 3, 0);
+	try {
+		writer->write_frame (index, &data[0], data.size());
+	} catch (dcp::MiscError& e) {
+		*threw = true;
+	}
+}
+
+/** Check that a thread waiting for an earlier frame is released by abort_frames(), and that
+ *  the writer then refuses to finalize.
+ */
+BOOST_AUTO_TEST_CASE (ordered_write_abort_test)
+{
+	shared_ptr<dcp::SoundAsset> sound (new dcp::SoundAsset (dcp::Fraction (24, 1), 48000, 6, dcp::SMPTE));
+	shared_ptr<dcp::SoundAssetWriter> writer = sound->start_write ("build/test/ordered_write_abort_test.mxf");
+
+	bool threw = false;
+	/* Frame 0 never arrives, so this thread waits until the abort */
+	boost::thread thread (boost::bind (&write_raw_sound, writer, 1, &threw));
+	writer->abort_frames ("frame 0 could not be made");
+	thread.join ();
+	BOOST_CHECK (threw);
+
+	std::vector<uint8_t> short_frame (42);
+	BOOST_CHECK_THROW (writer->write_frame (2, &short_frame[0], short_frame.size()), dcp::MiscError);
+
+	/* Frame 1 was never written, so the asset would be short */
+	BOOST_CHECK_THROW (writer->finalize (), dcp::MiscError);
+}
+
+static void
+note_frame_info (vector<dcp::FrameInfo>* info, dcp::FrameInfo frame)
+{
+	info->push_back (frame);
+}
+
+/** Write a picture asset with write_async() and check the result */
+BOOST_AUTO_TEST_CASE (async_picture_write_test)
+{
+	shared_ptr<dcp::MonoPictureAsset> picture (new dcp::MonoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	shared_ptr<dcp::PictureAssetWriter> writer = picture->start_write ("build/test/async_picture_write_test.mxf", false);
+	writer->set_write_behind_queue_length (4);
+
+	vector<dcp::FrameInfo> info;
+	{
+		dcp::File j2c ("test/data/32x32_red_square.j2c");
+		for (int i = 0; i < frames; ++i) {
+			writer->write_async (j2c.data(), j2c.size(), boost::bind (&note_frame_info, &info, _1));
+		}
+		/* A synchronous write goes after the queued frames */
+		info.push_back (writer->write (j2c.data(), j2c.size()));
+		/* The frames have been copied, so j2c can go before they are written */
+		writer->write_async (j2c.data(), j2c.size(), boost::bind (&note_frame_info, &info, _1));
+	}
+	writer->finalize ();
+
+	BOOST_CHECK_EQUAL (picture->intrinsic_duration(), frames + 2);
+	BOOST_REQUIRE_EQUAL (info.size(), frames + 2);
+	for (int i = 1; i < frames + 2; ++i) {
+		BOOST_CHECK_EQUAL (info[i].offset, info[i - 1].offset + info[i - 1].size);
+		BOOST_CHECK_EQUAL (info[i].hash, info[0].hash);
+	}
+
+	dcp::File j2c ("test/data/32x32_red_square.j2c");
+	shared_ptr<dcp::MonoPictureAssetReader> reader = picture->start_read ();
+	for (int i = 0; i < frames + 2; ++i) {
+		shared_ptr<const dcp::MonoPictureFrame> frame = reader->get_frame (i);
+		BOOST_REQUIRE_EQUAL (frame->j2k_size(), j2c.size());
+		BOOST_CHECK (memcmp (frame->j2k_data(), j2c.data(), j2c.size()) == 0);
+	}
+}
+
+/** Check that an error in writing a frame given to write_async() is reported */
+BOOST_AUTO_TEST_CASE (async_picture_write_error_test)
+{
+	shared_ptr<dcp::MonoPictureAsset> picture (new dcp::MonoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	shared_ptr<dcp::PictureAssetWriter> writer = picture->start_write ("build/test/async_picture_write_error_test.mxf", false);
+
+	std::vector<uint8_t> garbage (4096, 42);
+	writer->write_async (&garbage[0], garbage.size());
+	BOOST_CHECK_THROW (writer->finalize (), dcp::MiscError);
+}
+
+/** Check that giving a size hint does not change the size or contents of the MXFs that are
+ *  written, and that space reserved for them is given back.  The hints are a few MB; more
+ *  than a MB above what is actually written, but small enough to reserve on any build disk.
+ */
+BOOST_AUTO_TEST_CASE (size_hint_test)
+{
+	shared_ptr<dcp::MonoPictureAsset> picture (new dcp::MonoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	shared_ptr<dcp::PictureAssetWriter> picture_writer = picture->start_write ("build/test/size_hint_test.mxf", false);
+	/* About 5MB */
+	picture_writer->set_size_hint (frames * 2, 8000000);
+
+	dcp::File j2c ("test/data/32x32_red_square.j2c");
+	for (int i = 0; i < frames; ++i) {
+		picture_writer->write (j2c.data(), j2c.size());
+	}
+	picture_writer->finalize ();
+
+	shared_ptr<dcp::SoundAsset> sound (new dcp::SoundAsset (dcp::Fraction (24, 1), 48000, 6, dcp::SMPTE));
+	shared_ptr<dcp::SoundAssetWriter> sound_writer = sound->start_write ("build/test/size_hint_test_sound.mxf");
+	/* About 4.5MB */
+	sound_writer->set_duration_hint (frames * 4);
+
+	std::vector<float> samples (2000, 0.5);
+	float* channels[6];
+	for (int i = 0; i < 6; ++i) {
+		channels[i] = &samples[0];
+	}
+	for (int i = 0; i < frames; ++i) {
+		sound_writer->write (channels, samples.size());
+	}
+	sound_writer->finalize ();
+
+	BOOST_CHECK_EQUAL (picture->intrinsic_duration(), frames);
+	shared_ptr<dcp::MonoPictureAssetReader> reader = picture->start_read ();
+	for (int i = 0; i < frames; ++i) {
+		shared_ptr<const dcp::MonoPictureFrame> frame = reader->get_frame (i);
+		BOOST_REQUIRE_EQUAL (frame->j2k_size(), j2c.size());
+		BOOST_CHECK (memcmp (frame->j2k_data(), j2c.data(), j2c.size()) == 0);
+	}
+
+	BOOST_CHECK_EQUAL (sound->intrinsic_duration(), frames);
+
+#ifdef LIBDCP_POSIX
+	/* Nothing much beyond the end of each file should still be allocated */
+	struct stat st;
+	BOOST_REQUIRE_EQUAL (stat ("build/test/size_hint_test.mxf", &st), 0);
+	BOOST_CHECK (st.st_blocks * 512 < st.st_size + 1024 * 1024);
+	BOOST_REQUIRE_EQUAL (stat ("build/test/size_hint_test_sound.mxf", &st), 0);
+	BOOST_CHECK (st.st_blocks * 512 < st.st_size + 1024 * 1024);
+#endif
+}
@@ -0,0 +1,294 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+#include "player.h"
+#include "cpl.h"
+#include "reel.h"
+#include "reel_mono_picture_asset.h"
+#include "reel_sound_asset.h"
+#include "mono_picture_asset.h"
+#include "picture_asset_writer.h"
+#include "sound_asset.h"
+#include "sound_asset_writer.h"
+#include "file.h"
+#include "j2k.h"
+#include "openjpeg_image.h"
+#include "exceptions.h"
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+using std::vector;
+using boost::shared_ptr;
+
+/** Make a CPL of two reels using the same 24-frame assets: the first plays all of them,
+ *  the second plays frames 12 to 17.  The sound in each frame is that frame's index / 128.
+ */
+static shared_ptr<dcp::CPL>
+make_cpl (boost::filesystem::path dir)
+{
+	boost::filesystem::remove_all (dir);
+	boost::filesystem::create_directories (dir);
+
+	shared_ptr<dcp::MonoPictureAsset> picture (new dcp::MonoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	shared_ptr<dcp::PictureAssetWriter> picture_writer = picture->start_write (dir / "video.mxf", false);
+	dcp::File j2c ("test/data/32x32_red_square.j2c");
+	for (int i = 0; i < 24; ++i) {
+		picture_writer->write (j2c.data(), j2c.size());
+	}
+	picture_writer->finalize ();
+
+	int const channels = 2;
+	shared_ptr<dcp::SoundAsset> sound (new dcp::SoundAsset (dcp::Fraction (24, 1), 48000, channels, dcp::SMPTE));
+	shared_ptr<dcp::SoundAssetWriter> sound_writer = sound->start_write (dir / "audio.mxf");
+	int const samples = 48000 / 24;
+	vector<float> left (samples);
+	vector<float> right (samples);
+	float* data[channels] = { &left[0], &right[0] };
+	for (int i = 0; i < 24; ++i) {
+		for (int j = 0; j < samples; ++j) {
+			left[j] = right[j] = i / 128.0;
+		}
+		sound_writer->write (data, samples);
+	}
+	sound_writer->finalize ();
+
+	shared_ptr<dcp::CPL> cpl (new dcp::CPL ("Player test", dcp::FEATURE));
+	cpl->add (
+		shared_ptr<dcp::Reel> (
+			new dcp::Reel (
+				shared_ptr<dcp::ReelMonoPictureAsset> (new dcp::ReelMonoPictureAsset (picture, 0)),
+				shared_ptr<dcp::ReelSoundAsset> (new dcp::ReelSoundAsset (sound, 0))
+				)
+			)
+		);
+
+	shared_ptr<dcp::ReelMonoPictureAsset> reel_picture (new dcp::ReelMonoPictureAsset (picture, 12));
+	reel_picture->set_duration (6);
+	shared_ptr<dcp::ReelSoundAsset> reel_sound (new dcp::ReelSoundAsset (sound, 12));
+	reel_sound->set_duration (6);
+	cpl->add (shared_ptr<dcp::Reel> (new dcp::Reel (reel_picture, reel_sound)));
+
+	return cpl;
+}
+
+/** Make a CPL whose first reel has 12 2K frames of noise, which are slow to decode, and whose
+ *  second has 48 small frames which are quick.
+ */
+static shared_ptr<dcp::CPL>
+make_stall_cpl (boost::filesystem::path dir)
+{
+	boost::filesystem::remove_all (dir);
+	boost::filesystem::create_directories (dir);
+
+	shared_ptr<dcp::OpenJPEGImage> xyz (new dcp::OpenJPEGImage (dcp::Size (1998, 1080)));
+	unsigned int seed = 42;
+	for (int c = 0; c < 3; ++c) {
+		for (int p = 0; p < (1998 * 1080); ++p) {
+			xyz->data(c)[p] = rand_r (&seed) & 0xfff;
+		}
+	}
+	dcp::Data const big = dcp::compress_j2k (xyz, 250000000, 24, false, false);
+
+	shared_ptr<dcp::MonoPictureAsset> slow (new dcp::MonoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	shared_ptr<dcp::PictureAssetWriter> writer = slow->start_write (dir / "slow.mxf", false);
+	for (int i = 0; i < 12; ++i) {
+		writer->write (big.data().get(), big.size());
+	}
+	writer->finalize ();
+
+	shared_ptr<dcp::MonoPictureAsset> quick (new dcp::MonoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	writer = quick->start_write (dir / "quick.mxf", false);
+	dcp::File j2c ("test/data/32x32_red_square.j2c");
+	for (int i = 0; i < 48; ++i) {
+		writer->write (j2c.data(), j2c.size());
+	}
+	writer->finalize ();
+
+	shared_ptr<dcp::CPL> cpl (new dcp::CPL ("Player stall test", dcp::FEATURE));
+	cpl->add (
+		shared_ptr<dcp::Reel> (
+			new dcp::Reel (shared_ptr<dcp::ReelMonoPictureAsset> (new dcp::ReelMonoPictureAsset (slow, 0)), shared_ptr<dcp::ReelSoundAsset> ())
+			)
+		);
+	cpl->add (
+		shared_ptr<dcp::Reel> (
+			new dcp::Reel (shared_ptr<dcp::ReelMonoPictureAsset> (new dcp::ReelMonoPictureAsset (quick, 0)), shared_ptr<dcp::ReelSoundAsset> ())
+			)
+		);
+
+	return cpl;
+}
+
+struct Received
+{
+	vector<int64_t> pictures;
+	vector<int64_t> sounds;
+	/** asset frame index recovered from each sound */
+	vector<int> sound_values;
+	boost::mutex mutex;
+};
+
+static void
+picture (Received* r, int64_t frame, shared_ptr<const dcp::CachedFrame> image)
+{
+	BOOST_CHECK (image->rgba ());
+	BOOST_CHECK_EQUAL (image->size().width, 32);
+	boost::mutex::scoped_lock lm (r->mutex);
+	r->pictures.push_back (frame);
+}
+
+static void
+sound (Received* r, int64_t frame, shared_ptr<const dcp::PlayerSound> sound)
+{
+	BOOST_CHECK_EQUAL (sound->channels(), 2);
+	BOOST_CHECK_EQUAL (sound->samples(), 2000);
+	boost::mutex::scoped_lock lm (r->mutex);
+	r->sounds.push_back (frame);
+	r->sound_values.push_back (lrintf (sound->data(1)[1000] * 128));
+}
+
+static void
+picture_index (Received* r, int64_t frame, shared_ptr<const dcp::CachedFrame>)
+{
+	boost::mutex::scoped_lock lm (r->mutex);
+	r->pictures.push_back (frame);
+}
+
+static void
+throwing_picture (int64_t frame, shared_ptr<const dcp::CachedFrame>)
+{
+	if (frame == 3) {
+		throw 42;
+	}
+}
+
+static void
+slow_picture (int64_t frame, shared_ptr<const dcp::CachedFrame>)
+{
+	if (frame == 5) {
+		boost::this_thread::sleep (boost::posix_time::milliseconds (200));
+	}
+}
+
+/** Check that every frame of a two-reel CPL is delivered, in order, honouring entry points and durations */
+BOOST_AUTO_TEST_CASE (player_test)
+{
+	dcp::Player player (make_cpl ("build/test/player_test"), 2);
+	BOOST_CHECK_EQUAL (player.length(), 30);
+	BOOST_CHECK (player.edit_rate() == dcp::Fraction (24, 1));
+
+	Received r;
+	player.set_picture_handler (boost::bind (&picture, &r, _1, _2));
+	player.set_sound_handler (boost::bind (&sound, &r, _1, _2));
+	player.set_drop_policy (dcp::Player::NEVER_DROP);
+	player.start ();
+	player.wait ();
+
+	BOOST_REQUIRE_EQUAL (r.pictures.size(), 30U);
+	BOOST_REQUIRE_EQUAL (r.sounds.size(), 30U);
+	for (int i = 0; i < 30; ++i) {
+		BOOST_CHECK_EQUAL (r.pictures[i], i);
+		BOOST_CHECK_EQUAL (r.sounds[i], i);
+		BOOST_CHECK_EQUAL (r.sound_values[i], i < 24 ? i : i - 24 + 12);
+	}
+
+	dcp::PlayerStatistics const stats = player.statistics ();
+	BOOST_CHECK_EQUAL (stats.delivered, 30);
+	BOOST_CHECK_EQUAL (stats.dropped, 0);
+
+	/* Start part-way through the second reel */
+	r.pictures.clear ();
+	r.sounds.clear ();
+	r.sound_values.clear ();
+	player.start (27);
+	player.wait ();
+	BOOST_REQUIRE_EQUAL (r.sound_values.size(), 3U);
+	BOOST_CHECK_EQUAL (r.sound_values[0], 15);
+	BOOST_CHECK_EQUAL (r.sound_values[2], 17);
+}
+
+/** Check that a handler which holds up the clock is counted as lateness, and that
+ *  every frame is either delivered or dropped.
+ */
+BOOST_AUTO_TEST_CASE (player_lateness_test)
+{
+	dcp::Player player (make_cpl ("build/test/player_lateness_test"), 2);
+	player.set_picture_handler (boost::bind (&slow_picture, _1, _2));
+	player.start ();
+	player.wait ();
+
+	dcp::PlayerStatistics const stats = player.statistics ();
+	BOOST_CHECK_EQUAL (stats.delivered + stats.dropped, 30);
+	BOOST_CHECK (stats.late >= 1);
+	/* Frame 6 was due about 42ms after frame 5 but could not be handed over until about 200ms after */
+	BOOST_CHECK (stats.max_lateness >= 100000000);
+}
+
+/** Check that once a picture has been dropped the pictures which could not be decoded in time
+ *  are skipped, so that the player catches up when decoding is quick again.
+ */
+BOOST_AUTO_TEST_CASE (player_catch_up_test)
+{
+	dcp::Player player (make_stall_cpl ("build/test/player_catch_up_test"), 1);
+	BOOST_REQUIRE_EQUAL (player.length(), 60);
+
+	Received r;
+	player.set_picture_handler (boost::bind (&picture_index, &r, _1, _2));
+	player.start ();
+	player.wait ();
+
+	dcp::PlayerStatistics const stats = player.statistics ();
+	BOOST_CHECK_EQUAL (stats.delivered + stats.dropped, 60);
+	/* One thread cannot decode the 2K frames in real time */
+	BOOST_CHECK (stats.dropped > 0);
+	/* but everything from a second after the stall should be there */
+	for (int64_t i = 36; i < 60; ++i) {
+		BOOST_CHECK (std::find (r.pictures.begin(), r.pictures.end(), i) != r.pictures.end());
+	}
+}
+
+/** Check that an exception from a handler stops playback and is reported by wait() */
+BOOST_AUTO_TEST_CASE (player_handler_exception_test)
+{
+	dcp::Player player (make_cpl ("build/test/player_handler_exception_test"), 2);
+	player.set_picture_handler (boost::bind (&throwing_picture, _1, _2));
+	player.set_drop_policy (dcp::Player::NEVER_DROP);
+	player.start ();
+	BOOST_CHECK_THROW (player.wait (), dcp::MiscError);
+	BOOST_CHECK_EQUAL (player.statistics().delivered, 4);
+}
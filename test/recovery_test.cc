@@ -33,11 +33,14 @@
 
 #include "mono_picture_asset_writer.h"
 #include "mono_picture_asset.h"
+#include "mono_picture_asset_reader.h"
+#include "mono_picture_frame.h"
 #include <asdcp/KM_util.h>
 #include <boost/test/unit_test.hpp>
 #include <boost/filesystem.hpp>
 
 using std::string;
+using std::vector;
 using boost::shared_ptr;
 
 /** Check that recovery from a partially-written MXF works */
@@ -106,3 +109,78 @@ BOOST_AUTO_TEST_CASE (recovery)
 
 	writer->finalize ();
 }
+
+/** Check that PictureAssetWriter::resume picks up after the last complete frame
+ *  of a truncated MXF and that the result reads back properly.
+ */
+BOOST_AUTO_TEST_CASE (resume_test)
+{
+	string const picture = "test/data/32x32_red_square.j2c";
+	int const size = boost::filesystem::file_size (picture);
+	uint8_t* data = new uint8_t[size];
+	{
+		FILE* f = fopen (picture.c_str(), "rb");
+		BOOST_CHECK (f);
+		fread (data, 1, size, f);
+		fclose (f);
+	}
+
+	boost::filesystem::remove_all ("build/test/resume");
+	boost::filesystem::create_directories ("build/test/resume");
+	shared_ptr<dcp::MonoPictureAsset> mp (new dcp::MonoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	shared_ptr<dcp::PictureAssetWriter> writer = mp->start_write ("build/test/resume/video1.mxf", false);
+
+	vector<dcp::FrameInfo> infos;
+	for (int i = 0; i < 24; ++i) {
+		infos.push_back (writer->write (data, size));
+	}
+
+	writer->finalize ();
+	writer.reset ();
+
+	/* Cut the file off part-way through frame 11 */
+	boost::filesystem::copy_file ("build/test/resume/video1.mxf", "build/test/resume/video2.mxf");
+	boost::filesystem::resize_file ("build/test/resume/video2.mxf", infos[11].offset + 100);
+
+	mp.reset (new dcp::MonoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	writer = mp->start_write ("build/test/resume/video2.mxf", true);
+	BOOST_CHECK_EQUAL (writer->resume (infos), 11);
+
+	for (int i = 11; i < 24; ++i) {
+		writer->write (data, size);
+	}
+
+	writer->finalize ();
+	writer.reset ();
+
+	dcp::MonoPictureAsset check ("build/test/resume/video2.mxf");
+	BOOST_CHECK_EQUAL (check.intrinsic_duration(), 24);
+	shared_ptr<dcp::MonoPictureAssetReader> reader = check.start_read ();
+	for (int i = 0; i < 24; ++i) {
+		shared_ptr<const dcp::MonoPictureFrame> frame = reader->get_frame (i);
+		BOOST_REQUIRE_EQUAL (frame->j2k_size(), size);
+		BOOST_CHECK_EQUAL (memcmp (frame->j2k_data(), data, size), 0);
+	}
+
+	/* Damage frame 5; resume should only keep the frames before it */
+	boost::filesystem::copy_file ("build/test/resume/video1.mxf", "build/test/resume/video3.mxf");
+	{
+		FILE* f = fopen ("build/test/resume/video3.mxf", "rb+");
+		BOOST_REQUIRE (f);
+		fseek (f, infos[5].offset + infos[5].size - 8, SEEK_SET);
+		char zeros[4];
+		memset (zeros, 0, 4);
+		fwrite (zeros, 1, 4, f);
+		fclose (f);
+	}
+
+	mp.reset (new dcp::MonoPictureAsset (dcp::Fraction (24, 1), dcp::SMPTE));
+	writer = mp->start_write ("build/test/resume/video3.mxf", true);
+	BOOST_CHECK_EQUAL (writer->resume (infos), 5);
+	for (int i = 5; i < 24; ++i) {
+		writer->write (data, size);
+	}
+	writer->finalize ();
+
+	delete[] data;
+}
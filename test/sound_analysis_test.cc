@@ -0,0 +1,91 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+#include "sound_analysis.h"
+#include "sound_asset.h"
+#include "sound_asset_writer.h"
+#include <boost/test/unit_test.hpp>
+#include <cmath>
+
+using boost::shared_ptr;
+
+/** Write 5 seconds of 6-channel audio with a -20dBFS 1kHz tone in L and
+ *  a clipped tone in LFE, then check that analyse_sound measures it correctly.
+ */
+BOOST_AUTO_TEST_CASE (sound_analysis_test)
+{
+	int const channels = 6;
+	int const sampling_rate = 48000;
+	int const length = sampling_rate * 5;
+
+	shared_ptr<dcp::SoundAsset> asset (new dcp::SoundAsset (dcp::Fraction (24, 1), sampling_rate, channels, dcp::SMPTE));
+	shared_ptr<dcp::SoundAssetWriter> writer = asset->start_write ("build/test/sound_analysis_test.mxf");
+
+	float* buffers[channels];
+	for (int i = 0; i < channels; ++i) {
+		buffers[i] = new float[length];
+		for (int j = 0; j < length; ++j) {
+			buffers[i][j] = 0;
+		}
+	}
+
+	for (int i = 0; i < length; ++i) {
+		buffers[dcp::LEFT][i] = 0.1 * sin (2 * M_PI * 1000 * i / sampling_rate);
+		buffers[dcp::LFE][i] = 1.5 * sin (2 * M_PI * 50 * i / sampling_rate);
+	}
+
+	writer->write (buffers, length);
+	writer->finalize ();
+
+	for (int i = 0; i < channels; ++i) {
+		delete[] buffers[i];
+	}
+
+	dcp::SoundAnalysis analysis = dcp::analyse_sound (asset);
+	BOOST_REQUIRE_EQUAL (analysis.channels.size(), channels);
+	BOOST_CHECK_EQUAL (analysis.samples, length);
+
+	BOOST_CHECK_CLOSE (analysis.channels[dcp::LEFT].peak, 0.1, 0.1);
+	BOOST_CHECK_CLOSE (analysis.channels[dcp::LEFT].rms, 0.1 / sqrt(2), 0.1);
+	BOOST_CHECK_EQUAL (analysis.channels[dcp::LEFT].clipped_samples, 0);
+
+	BOOST_CHECK (analysis.channels[dcp::LFE].clipped_samples > 0);
+	BOOST_CHECK (analysis.channels[dcp::LFE].true_peak >= analysis.channels[dcp::LFE].peak);
+
+	BOOST_CHECK_EQUAL (analysis.channels[dcp::CENTRE].peak, 0);
+	BOOST_CHECK_EQUAL (analysis.channels[dcp::CENTRE].clipped_samples, 0);
+
+	/* A 1kHz sine at -20dBFS in one channel is -23.01 LUFS; the LFE should be ignored */
+	BOOST_REQUIRE (analysis.integrated_loudness);
+	BOOST_CHECK_CLOSE (analysis.integrated_loudness.get(), -23.01, 0.5);
+}
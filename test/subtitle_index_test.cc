@@ -0,0 +1,112 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+#include "interop_subtitle_asset.h"
+#include "subtitle_string.h"
+#include "subtitle_index.h"
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
+
+using std::list;
+using boost::shared_ptr;
+
+static shared_ptr<dcp::Subtitle>
+make_subtitle (dcp::Time in, dcp::Time out)
+{
+	return shared_ptr<dcp::Subtitle> (
+		new dcp::SubtitleString (
+			boost::optional<std::string>(), false, false, false, dcp::Colour (255, 255, 255), 42, 1, in, out,
+			0, dcp::HALIGN_CENTER, 0.8, dcp::VALIGN_TOP, dcp::DIRECTION_LTR, "Hello", dcp::NONE, dcp::Colour (0, 0, 0),
+			dcp::Time (), dcp::Time ()
+			)
+		);
+}
+
+/** The original, scanning implementation of SubtitleAsset::subtitles_during */
+static list<shared_ptr<dcp::Subtitle> >
+scan (dcp::SubtitleAsset const & asset, dcp::Time from, dcp::Time to, bool starting)
+{
+	list<shared_ptr<dcp::Subtitle> > s;
+	BOOST_FOREACH (shared_ptr<dcp::Subtitle> i, asset.subtitles()) {
+		if ((starting && from <= i->in() && i->in() < to) || (!starting && i->out() >= from && i->in() <= to)) {
+			s.push_back (i);
+		}
+	}
+	return s;
+}
+
+/** Check that the indexed SubtitleAsset::subtitles_during, latest_subtitle_out and
+ *  SubtitleCursor give the same answers as scanning all the subtitles.
+ */
+BOOST_AUTO_TEST_CASE (subtitle_index_test)
+{
+	srand (1);
+
+	dcp::InteropSubtitleAsset asset;
+	for (int i = 0; i < 2000; ++i) {
+		int const in = rand() % (24 * 600);
+		int const length = rand() % (24 * 20);
+		asset.add (make_subtitle (dcp::Time (in, 24, 24), dcp::Time (in + length, 24, 24)));
+	}
+
+	for (int i = 0; i < 24 * 600; i += 7) {
+		dcp::Time const from (i, 24, 24);
+		dcp::Time const to (i + 1, 24, 24);
+		BOOST_REQUIRE (asset.subtitles_during (from, to, false) == scan (asset, from, to, false));
+		BOOST_REQUIRE (asset.subtitles_during (from, to, true) == scan (asset, from, to, true));
+	}
+
+	dcp::Time latest;
+	BOOST_FOREACH (shared_ptr<dcp::Subtitle> i, asset.subtitles()) {
+		latest = std::max (latest, i->out ());
+	}
+	BOOST_CHECK_EQUAL (asset.latest_subtitle_out(), latest);
+
+	/* Adding a subtitle must be seen by the next query */
+	asset.add (make_subtitle (dcp::Time (0, 20, 0, 0, 24), dcp::Time (0, 20, 5, 0, 24)));
+	BOOST_CHECK_EQUAL (asset.subtitles_during (dcp::Time (0, 20, 1, 0, 24), dcp::Time (0, 20, 2, 0, 24), false).size(), 1);
+	BOOST_CHECK_EQUAL (asset.latest_subtitle_out(), dcp::Time (0, 20, 5, 0, 24));
+
+	/* Play through every frame, and then go back and check that the cursor starts again */
+	dcp::SubtitleCursor cursor = asset.cursor ();
+	for (int i = 0; i < 24 * 1210; ++i) {
+		dcp::Time const from (i, 24, 24);
+		dcp::Time const to (i + 1, 24, 24);
+		BOOST_REQUIRE (cursor.next (from, to) == scan (asset, from, to, false));
+	}
+
+	dcp::Time const from (24 * 60, 24, 24);
+	dcp::Time const to (24 * 60 + 1, 24, 24);
+	BOOST_CHECK (cursor.next (from, to) == scan (asset, from, to, false));
+}
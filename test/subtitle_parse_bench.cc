@@ -0,0 +1,154 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+#include "smpte_subtitle_asset.h"
+#include "interop_subtitle_asset.h"
+#include "util.h"
+#include <boost/filesystem.hpp>
+#include <sys/time.h>
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+
+using std::cout;
+using std::string;
+using std::ofstream;
+using boost::shared_ptr;
+
+static double
+seconds ()
+{
+	struct timeval t;
+	gettimeofday (&t, 0);
+	return t.tv_sec + t.tv_usec / 1e6;
+}
+
+/** @return SMPTE or Interop timecode for @p frame at 24fps */
+static string
+timecode (int frame, dcp::Standard standard)
+{
+	char buffer[64];
+	int const s = frame / 24;
+	if (standard == dcp::SMPTE) {
+		snprintf (buffer, sizeof (buffer), "%02d:%02d:%02d:%02d", s / 3600, (s / 60) % 60, s % 60, frame % 24);
+	} else {
+		snprintf (buffer, sizeof (buffer), "%02d:%02d:%02d:%03d", s / 3600, (s / 60) % 60, s % 60, (frame % 24) * 250 / 24);
+	}
+	return buffer;
+}
+
+/** Write @p count two-line subtitles, each inside its own <Font>, as the body of a subtitle file */
+static void
+write_subtitles (ofstream& f, int count, dcp::Standard standard)
+{
+	string const font = standard == dcp::SMPTE ? "ID" : "Id";
+	string const position = standard == dcp::SMPTE ? "Vposition" : "VPosition";
+	string const align = standard == dcp::SMPTE ? "Valign" : "VAlign";
+
+	for (int i = 0; i < count; ++i) {
+		f << "<Font " << font << "=\"theFont\" Size=\"42\" Color=\"FFFFFFFF\" Effect=\"border\" EffectColor=\"FF000000\" Italic=\"no\">"
+		  << "<Subtitle SpotNumber=\"" << (i + 1) << "\" TimeIn=\"" << timecode (i * 48, standard) << "\" "
+		  << "TimeOut=\"" << timecode (i * 48 + 40, standard) << "\" FadeUpTime=\"" << (standard == dcp::SMPTE ? "00:00:00:00" : "0") << "\" "
+		  << "FadeDownTime=\"" << (standard == dcp::SMPTE ? "00:00:00:00" : "0") << "\">"
+		  << "<Text " << position << "=\"15\" " << align << "=\"bottom\">Subtitle number " << i << ", first line</Text>"
+		  << "<Text " << position << "=\"8\" " << align << "=\"bottom\">and its <Font Italic=\"yes\">second</Font> line</Text>"
+		  << "</Subtitle></Font>\n";
+	}
+}
+
+static void
+report (string name, int count, double time)
+{
+	cout << name << ": " << count << " subtitles in " << time << "s (" << (count / time) << " subtitles/s)\n";
+}
+
+/** Time parsing and writing of large generated SMPTE and Interop subtitle files */
+int
+main (int argc, char* argv[])
+{
+	int const count = argc > 1 ? atoi (argv[1]) : 100000;
+
+	dcp::init ();
+
+	boost::filesystem::path dir = "build/test/subtitle_parse_bench";
+	boost::filesystem::create_directories (dir);
+
+	{
+		ofstream f ((dir / "smpte.xml").string().c_str());
+		f << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		  << "<SubtitleReel xmlns=\"http://www.smpte-ra.org/schemas/428-7/2010/DCST\">\n"
+		  << "<Id>urn:uuid:" << dcp::make_uuid() << "</Id>\n"
+		  << "<ContentTitleText>Benchmark</ContentTitleText>\n"
+		  << "<IssueDate>2019-01-01T00:00:00.000+00:00</IssueDate>\n"
+		  << "<ReelNumber>1</ReelNumber>\n"
+		  << "<Language>en</Language>\n"
+		  << "<EditRate>24 1</EditRate>\n"
+		  << "<TimeCodeRate>24</TimeCodeRate>\n"
+		  << "<LoadFont ID=\"theFont\">urn:uuid:" << dcp::make_uuid() << "</LoadFont>\n"
+		  << "<SubtitleList>\n";
+		write_subtitles (f, count, dcp::SMPTE);
+		f << "</SubtitleList>\n</SubtitleReel>\n";
+	}
+
+	{
+		ofstream f ((dir / "interop.xml").string().c_str());
+		f << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		  << "<DCSubtitle Version=\"1.0\">\n"
+		  << "<SubtitleID>" << dcp::make_uuid() << "</SubtitleID>\n"
+		  << "<MovieTitle>Benchmark</MovieTitle>\n"
+		  << "<ReelNumber>1</ReelNumber>\n"
+		  << "<Language>English</Language>\n"
+		  << "<LoadFont Id=\"theFont\" URI=\"font.ttf\"/>\n";
+		write_subtitles (f, count, dcp::INTEROP);
+		f << "</DCSubtitle>\n";
+	}
+
+	double start = seconds ();
+	dcp::SMPTESubtitleAsset smpte (dir / "smpte.xml");
+	report ("SMPTE", smpte.subtitles().size(), seconds() - start);
+
+	start = seconds ();
+	dcp::InteropSubtitleAsset interop (dir / "interop.xml");
+	report ("Interop", interop.subtitles().size(), seconds() - start);
+
+	start = seconds ();
+	string const xml = smpte.xml_as_string ();
+	report ("SMPTE XML write", smpte.subtitles().size(), seconds() - start);
+
+	start = seconds ();
+	interop.write (dir / "interop_out.xml");
+	report ("Interop XML write", interop.subtitles().size(), seconds() - start);
+
+	boost::filesystem::remove_all (dir);
+	return 0;
+}
@@ -35,6 +35,8 @@
 #include "dcp.h"
 
 using std::list;
+using std::string;
+using boost::optional;
 using boost::shared_ptr;
 using boost::dynamic_pointer_cast;
 
@@ -53,3 +55,36 @@ dcp::filter_errors (dcp::DCP::ReadErrors& errors, bool ignore_missing_assets)
 		i = tmp;
 	}
 }
+
+dcp::Jobs::Jobs (int64_t count)
+	: _next (0)
+	, _count (count)
+{
+
+}
+
+optional<int64_t>
+dcp::Jobs::get ()
+{
+	boost::mutex::scoped_lock lm (_mutex);
+	if (_error || _next >= _count) {
+		return optional<int64_t> ();
+	}
+	return _next++;
+}
+
+void
+dcp::Jobs::set_error (string e)
+{
+	boost::mutex::scoped_lock lm (_mutex);
+	if (!_error) {
+		_error = e;
+	}
+}
+
+optional<string>
+dcp::Jobs::error () const
+{
+	boost::mutex::scoped_lock lm (_mutex);
+	return _error;
+}
@@ -18,9 +18,34 @@
 */
 
 #include "exceptions.h"
+#include <boost/thread/mutex.hpp>
+#include <boost/optional.hpp>
+#include <stdint.h>
+#include <string>
 
 namespace dcp {
 
 extern void filter_errors (std::list<boost::shared_ptr<DCPReadError> >& errors, bool ignore_missing_assets);
 
+/** @class Jobs
+ *  @brief Hands out the indices of work items (frames, reels...) to worker threads
+ *  and records the first error that any of them hits.
+ */
+class Jobs
+{
+public:
+	explicit Jobs (int64_t count);
+
+	/** @return Index of the next item to process, or an empty optional if there is nothing more to do */
+	boost::optional<int64_t> get ();
+	void set_error (std::string e);
+	boost::optional<std::string> error () const;
+
+private:
+	mutable boost::mutex _mutex;
+	int64_t _next;
+	int64_t _count;
+	boost::optional<std::string> _error;
+};
+
 }
@@ -33,16 +33,28 @@
 
 #include "encrypted_kdm.h"
 #include "decrypted_kdm.h"
+#include "decrypted_kdm_key.h"
 #include "crypto_context.h"
 #include "key.h"
 #include "util.h"
+#include "raw_convert.h"
+#include "mono_picture_asset.h"
+#include "mono_picture_asset_writer.h"
+#include "sound_asset.h"
+#include "sound_asset_reader.h"
+#include "sound_asset_writer.h"
+#include "sound_frame.h"
 #include "atmos_asset.h"
 #include "atmos_frame.h"
 #include "atmos_asset_reader.h"
 #include "atmos_asset_writer.h"
+#include "asset_factory.h"
 #include "exceptions.h"
+#include "common.h"
 #include <asdcp/AS_DCP.h>
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
 #include <getopt.h>
 #include <string>
 
@@ -51,6 +63,7 @@ using std::cerr;
 using std::cout;
 using boost::optional;
 using boost::shared_ptr;
+using boost::dynamic_pointer_cast;
 
 static void
 help (string n)
@@ -60,7 +73,88 @@ help (string n)
 	     << "  -h, --help         show this help\n"
 	     << "  -o, --output       output filename\n"
 	     << "  -k, --kdm          KDM file\n"
-	     << "  -p, --private-key  private key file\n";
+	     << "  -p, --private-key  private key file\n"
+	     << "  -t, --threads      number of threads to decrypt with (defaults to the number of CPUs)\n";
+}
+
+/** Decrypt picture frames and give them to a writer.  Each thread has its own MXF reader
+ *  and decryption context, and reads the codestreams straight into a buffer which is
+ *  handed to the writer as it is and then re-used for the next frame.  The writer makes
+ *  sure the frames are written in order.
+ */
+static void
+decrypt_picture (boost::filesystem::path input, dcp::Key key, dcp::Standard standard, shared_ptr<dcp::MonoPictureAssetWriter> writer, dcp::Jobs* jobs)
+{
+	try {
+		ASDCP::JP2K::MXFReader reader;
+		Kumu::Result_t r = reader.OpenRead (input.string().c_str());
+		if (ASDCP_FAILURE (r)) {
+			throw dcp::FileError ("could not open MXF file for reading", input, r);
+		}
+
+		dcp::DecryptionContext context (key, standard, dcp::DecryptionContext::OPENSSL_EVP, false);
+		shared_ptr<ASDCP::JP2K::FrameBuffer> buffer (new ASDCP::JP2K::FrameBuffer (4 * Kumu::Megabyte));
+
+		while (optional<int64_t> n = jobs->get ()) {
+			r = context.read_frame (&reader, *n, *buffer);
+			if (ASDCP_FAILURE (r)) {
+				throw dcp::DCPReadError ("could not read video frame " + dcp::raw_convert<string> (*n));
+			}
+			writer->write_frame (*n, buffer);
+		}
+	} catch (std::exception& e) {
+		jobs->set_error (e.what ());
+		writer->abort_frames (e.what ());
+	}
+}
+
+/** Decrypt sound frames and give them to a writer, passing the 24-bit samples straight through */
+static void
+decrypt_sound (shared_ptr<dcp::SoundAsset> input, shared_ptr<dcp::SoundAssetWriter> writer, dcp::Jobs* jobs)
+{
+	try {
+		shared_ptr<dcp::SoundAssetReader> reader = input->start_read ();
+		reader->set_decryption (dcp::DecryptionContext::OPENSSL_EVP, false);
+		while (optional<int64_t> n = jobs->get ()) {
+			shared_ptr<const dcp::SoundFrame> frame = reader->get_frame (*n);
+			writer->write_frame (*n, frame->data(), frame->size());
+		}
+	} catch (std::exception& e) {
+		jobs->set_error (e.what ());
+		writer->abort_frames (e.what ());
+	}
+}
+
+/** Run some decryption threads and wait for them to finish.
+ *  @return Error from any of the threads.
+ */
+static optional<string>
+run (int threads, dcp::Jobs* jobs, boost::function<void ()> job)
+{
+	boost::thread_group group;
+	for (int i = 0; i < threads; ++i) {
+		group.create_thread (job);
+	}
+	group.join_all ();
+	return jobs->error ();
+}
+
+static dcp::Key
+find_key (dcp::DecryptedKDM const & kdm, dcp::MXF const & mxf)
+{
+	if (!mxf.key_id()) {
+		cerr << "MXF is not encrypted.\n";
+		exit (EXIT_FAILURE);
+	}
+
+	BOOST_FOREACH (dcp::DecryptedKDMKey const & i, kdm.keys()) {
+		if (i.id() == mxf.key_id().get()) {
+			return i.key ();
+		}
+	}
+
+	cerr << "Could not find key for MXF in the KDM.\n";
+	exit (EXIT_FAILURE);
 }
 
 int
@@ -69,6 +163,7 @@ main (int argc, char* argv[])
 	optional<boost::filesystem::path> output_file;
 	optional<boost::filesystem::path> kdm_file;
 	optional<boost::filesystem::path> private_key_file;
+	int threads = std::max (1U, boost::thread::hardware_concurrency ());
 
 	int option_index = 0;
 	while (true) {
@@ -78,10 +173,11 @@ main (int argc, char* argv[])
 			{ "output", required_argument, 0, 'o'},
 			{ "kdm", required_argument, 0, 'k'},
 			{ "private-key", required_argument, 0, 'p'},
+			{ "threads", required_argument, 0, 't'},
 			{ 0, 0, 0, 0 }
 		};
 
-		int c = getopt_long (argc, argv, "vho:k:p:", long_options, &option_index);
+		int c = getopt_long (argc, argv, "vho:k:p:t:", long_options, &option_index);
 
 		if (c == -1) {
 			break;
@@ -103,6 +199,9 @@ main (int argc, char* argv[])
 		case 'p':
 			private_key_file = optarg;
 			break;
+		case 't':
+			threads = std::max (1, atoi (optarg));
+			break;
 		}
 	}
 
@@ -131,27 +230,78 @@ main (int argc, char* argv[])
 	dcp::EncryptedKDM encrypted_kdm (dcp::file_to_string (kdm_file.get ()));
 	dcp::DecryptedKDM decrypted_kdm (encrypted_kdm, dcp::file_to_string (private_key_file.get()));
 
-	/* XXX: only works for Atmos! */
-
+	shared_ptr<dcp::Asset> asset;
 	try {
-		dcp::AtmosAsset in (input_file);
-		shared_ptr<dcp::AtmosAssetReader> reader = in.start_read ();
-		dcp::AtmosAsset out (
-			in.edit_rate(),
-			in.first_frame(),
-			in.max_channel_count(),
-			in.max_object_count(),
-			in.atmos_id(),
-			in.atmos_version()
-			);
-		shared_ptr<dcp::AtmosAssetWriter> writer = out.start_write (output_file.get());
-		for (int64_t i = 0; i < in.intrinsic_duration(); ++i) {
-			shared_ptr<const dcp::AtmosFrame> f = reader->get_frame (i);
-			writer->write (f->data(), f->size());
-		}
+		asset = dcp::asset_factory (input_file, true);
 	} catch (dcp::DCPReadError& e) {
 		cerr << "Unknown MXF format.\n";
 		return EXIT_FAILURE;
+	} catch (std::exception& e) {
+		cerr << "Error: " << e.what() << "\n";
+		return EXIT_FAILURE;
+	}
+
+	optional<string> error;
+
+	shared_ptr<dcp::MonoPictureAsset> picture = dynamic_pointer_cast<dcp::MonoPictureAsset> (asset);
+	shared_ptr<dcp::SoundAsset> sound = dynamic_pointer_cast<dcp::SoundAsset> (asset);
+	shared_ptr<dcp::AtmosAsset> atmos = dynamic_pointer_cast<dcp::AtmosAsset> (asset);
+
+	if (!picture && !sound && !atmos) {
+		cerr << "Unsupported MXF type.\n";
+		return EXIT_FAILURE;
+	}
+
+	try {
+		if (picture) {
+			dcp::Key key = find_key (decrypted_kdm, *picture);
+			dcp::MonoPictureAsset out (picture->edit_rate(), picture->standard());
+			shared_ptr<dcp::MonoPictureAssetWriter> writer = dynamic_pointer_cast<dcp::MonoPictureAssetWriter> (
+				out.start_write (output_file.get(), false)
+				);
+			dcp::Jobs jobs (picture->intrinsic_duration ());
+			error = run (threads, &jobs, boost::bind (&decrypt_picture, input_file, key, picture->standard(), writer, &jobs));
+			if (!error) {
+				writer->finalize ();
+			}
+		} else if (sound) {
+			sound->set_key (find_key (decrypted_kdm, *sound));
+			dcp::SoundAsset out (sound->edit_rate(), sound->sampling_rate(), sound->channels(), sound->standard());
+			shared_ptr<dcp::SoundAssetWriter> writer = out.start_write (output_file.get());
+			dcp::Jobs jobs (sound->intrinsic_duration ());
+			error = run (threads, &jobs, boost::bind (&decrypt_sound, sound, writer, &jobs));
+			if (!error) {
+				writer->finalize ();
+			}
+		} else if (atmos) {
+			atmos->set_key (find_key (decrypted_kdm, *atmos));
+			shared_ptr<dcp::AtmosAssetReader> reader = atmos->start_read ();
+			reader->set_decryption (dcp::DecryptionContext::OPENSSL_EVP, false);
+			dcp::AtmosAsset out (
+				atmos->edit_rate(),
+				atmos->first_frame(),
+				atmos->max_channel_count(),
+				atmos->max_object_count(),
+				atmos->atmos_id(),
+				atmos->atmos_version()
+				);
+			shared_ptr<dcp::AtmosAssetWriter> writer = out.start_write (output_file.get());
+			for (int64_t i = 0; i < atmos->intrinsic_duration(); ++i) {
+				shared_ptr<const dcp::AtmosFrame> f = reader->get_frame (i);
+				writer->write (f->data(), f->size());
+			}
+			writer->finalize ();
+		}
+	} catch (std::exception& e) {
+		error = e.what ();
+	}
+
+	if (error) {
+		/* Don't leave a partial MXF behind */
+		boost::system::error_code ec;
+		boost::filesystem::remove (output_file.get(), ec);
+		cerr << "Error: " << *error << "\n";
+		return EXIT_FAILURE;
 	}
 
 	return 0;
@@ -35,6 +35,7 @@
 #include "exceptions.h"
 #include "reel.h"
 #include "sound_asset.h"
+#include "sound_analysis.h"
 #include "picture_asset.h"
 #include "subtitle_asset.h"
 #include "reel_picture_asset.h"
@@ -76,6 +77,7 @@ help (string n)
 	     << "  -s, --subtitles              list all subtitles\n"
 	     << "  -p, --picture                analyse picture\n"
 	     << "  -d, --decompress             decompress picture when analysing (this is slow)\n"
+	     << "  -a, --analyse-sound          measure sound levels, clipping and loudness\n"
 	     << "  -k, --keep-going             carry on in the event of errors, if possible\n"
 	     << "      --kdm                    KDM to decrypt DCP\n"
 	     << "      --private-key            private key for the certificate that the KDM is targeted at\n"
@@ -149,7 +151,7 @@ main_picture (shared_ptr<Reel> reel, bool analyse, bool decompress)
 }
 
 static void
-main_sound (shared_ptr<Reel> reel)
+main_sound (shared_ptr<Reel> reel, bool analyse)
 {
 	if (reel->main_sound()) {
 		cout << "      Sound ID:    " << reel->main_sound()->id();
@@ -169,6 +171,22 @@ main_sound (shared_ptr<Reel> reel)
 				     << reel->main_sound()->asset()->channels()
 				     << " channels at "
 				     << reel->main_sound()->asset()->sampling_rate() << "Hz\n";
+
+				if (analyse) {
+					SoundAnalysis const a = analyse_sound (reel->main_sound()->asset());
+					for (size_t i = 0; i < a.channels.size(); ++i) {
+						SoundAnalysis::Channel const & c = a.channels[i];
+						printf(
+							"      Channel %2d:  peak %6.1fdBFS true peak %6.1fdBTP RMS %6.1fdBFS clipped samples %" PRId64 "\n",
+							int(i + 1), SoundAnalysis::to_db(c.peak), SoundAnalysis::to_db(c.true_peak), SoundAnalysis::to_db(c.rms), c.clipped_samples
+							);
+					}
+					if (a.integrated_loudness) {
+						printf("      Loudness:    %.1f LUFS integrated\n", a.integrated_loudness.get());
+					} else {
+						printf("      Loudness:    too quiet to measure\n");
+					}
+				}
 			}
 		} else {
 			cout << " - not present in this DCP.\n";
@@ -220,6 +238,7 @@ main (int argc, char* argv[])
 	bool keep_going = false;
 	bool picture = false;
 	bool decompress = false;
+	bool sound = false;
 	bool ignore_missing_assets = false;
 	optional<boost::filesystem::path> kdm;
 	optional<boost::filesystem::path> private_key;
@@ -233,13 +252,14 @@ main (int argc, char* argv[])
 			{ "keep-going", no_argument, 0, 'k' },
 			{ "picture", no_argument, 0, 'p' },
 			{ "decompress", no_argument, 0, 'd' },
+			{ "analyse-sound", no_argument, 0, 'a' },
 			{ "ignore-missing-assets", no_argument, 0, 'A' },
 			{ "kdm", required_argument, 0, 'B' },
 			{ "private-key", required_argument, 0, 'C' },
 			{ 0, 0, 0, 0 }
 		};
 
-		int c = getopt_long (argc, argv, "vhskpdAB:C:", long_options, &option_index);
+		int c = getopt_long (argc, argv, "vhskpdaAB:C:", long_options, &option_index);
 
 		if (c == -1) {
 			break;
@@ -264,6 +284,9 @@ main (int argc, char* argv[])
 		case 'd':
 			decompress = true;
 			break;
+		case 'a':
+			sound = true;
+			break;
 		case 'A':
 			ignore_missing_assets = true;
 			break;
@@ -341,7 +364,7 @@ main (int argc, char* argv[])
 			}
 
 			try {
-				main_sound (j);
+				main_sound (j, sound);
 			} catch (UnresolvedRefError& e) {
 				if (keep_going) {
 					if (!ignore_missing_assets) {
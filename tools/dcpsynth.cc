@@ -0,0 +1,604 @@
+/*
+    Copyright (C) 2019 Carl Hetherington <cth@carlh.net>
+
+    This file is part of libdcp.
+
+    libdcp is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    libdcp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libdcp.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations
+    including the two.
+
+    You must obey the GNU General Public License in all respects
+    for all of the code used other than OpenSSL.  If you modify
+    file(s) with this exception, you may extend this exception to your
+    version of the file(s), but you are not obligated to do so.  If you
+    do not wish to do so, delete this exception statement from your
+    version.  If you delete this exception statement from all source
+    files in the program, then also delete it here.
+*/
+
+/** @file  tools/dcpsynth.cc
+ *  @brief Generate large synthetic DCPs for scale and performance testing.
+ *
+ *  The shape of the DCP (number of reels and CPLs, audio channels, subtitles,
+ *  encryption and so on) is given by options or by a spec file which uses the same
+ *  names; for example
+ *
+ *    # 2 hour, 16-channel feature with two versions
+ *    reels 120
+ *    reel-length 1440
+ *    cpls 2
+ *    channels 16
+ *    subtitles 200
+ *    encrypt yes
+ *
+ *  Every picture frame is the same small JPEG2000 codestream, so even very long
+ *  DCPs are quick to write and take little space.  Reels are written in parallel.
+ */
+
+#include "certificate_chain.h"
+#include "compose.hpp"
+#include "cpl.h"
+#include "dcp.h"
+#include "data.h"
+#include "decrypted_kdm.h"
+#include "encrypted_kdm.h"
+#include "exceptions.h"
+#include "common.h"
+#include "interop_subtitle_asset.h"
+#include "j2k.h"
+#include "key.h"
+#include "metadata.h"
+#include "mono_picture_asset.h"
+#include "openjpeg_image.h"
+#include "picture_asset_writer.h"
+#include "raw_convert.h"
+#include "reel.h"
+#include "reel_mono_picture_asset.h"
+#include "reel_sound_asset.h"
+#include "reel_stereo_picture_asset.h"
+#include "reel_subtitle_asset.h"
+#include "smpte_subtitle_asset.h"
+#include "sound_asset.h"
+#include "sound_asset_writer.h"
+#include "stereo_picture_asset.h"
+#include "subtitle_string.h"
+#include "util.h"
+#include <asdcp/KM_util.h>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+#include <boost/optional.hpp>
+#include <boost/thread.hpp>
+#include <getopt.h>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::cout;
+using std::cerr;
+using std::max;
+using std::min;
+using std::string;
+using std::vector;
+using std::ifstream;
+using std::ofstream;
+using boost::optional;
+using boost::shared_ptr;
+using boost::dynamic_pointer_cast;
+
+/** Description of the DCP to make */
+class Spec
+{
+public:
+	Spec ()
+		: reels (100)
+		, reel_length (240)
+		, cpls (1)
+		, frame_rate (24)
+		, channels (16)
+		, sampling_rate (48000)
+		, subtitles (0)
+		, stereo (false)
+		, encrypt (false)
+		, standard (dcp::SMPTE)
+		, size (1998, 1080)
+		, reproducible (false)
+		, threads (max (1U, boost::thread::hardware_concurrency ()))
+	{}
+
+	int reels;
+	/** length of each reel in frames */
+	int reel_length;
+	/** number of CPLs, all of which use the same assets */
+	int cpls;
+	int frame_rate;
+	int channels;
+	int sampling_rate;
+	/** number of subtitles in each reel */
+	int subtitles;
+	bool stereo;
+	bool encrypt;
+	dcp::Standard standard;
+	dcp::Size size;
+	/** JPEG2000 file to use for every picture frame, or empty to generate one */
+	optional<boost::filesystem::path> j2k;
+	bool reproducible;
+	int threads;
+};
+
+static void
+help (string n)
+{
+	cerr << "Syntax: " << n << " [OPTION] <DCP>\n"
+	     << "  -V, --version          show libdcp version\n"
+	     << "  -h, --help             show this help\n"
+	     << "  -s, --spec <file>      read options from <file>, one `name value' per line\n"
+	     << "      --reels <n>        number of reels (default 100)\n"
+	     << "      --reel-length <n>  length of each reel in frames (default 240)\n"
+	     << "      --cpls <n>         number of CPLs, all sharing the same assets (default 1)\n"
+	     << "      --frame-rate <n>   frames per second (default 24)\n"
+	     << "      --channels <n>     number of sound channels (default 16)\n"
+	     << "      --sampling-rate <n> sound sampling rate (default 48000)\n"
+	     << "      --subtitles <n>    number of subtitles in each reel (default 0)\n"
+	     << "      --stereo           make 3D picture assets\n"
+	     << "      --encrypt          encrypt the assets and write KDMs to <DCP>_kdm\n"
+	     << "      --interop          make an Interop DCP (the default is SMPTE)\n"
+	     << "      --size <WxH>       picture size (default 1998x1080)\n"
+	     << "      --j2k <file>       JPEG2000 file to use for every frame (default is a generated flat frame)\n"
+	     << "      --reproducible     make the same IDs, keys and dates each time (implies --threads 1);\n"
+	     << "                         KDMs are still different every time\n"
+	     << "  -t, --threads <n>      number of reels to write at once (defaults to the number of CPUs)\n"
+	     << "\nLater options override earlier ones, including those from a spec file.\n";
+}
+
+static bool
+to_bool (string name, string value)
+{
+	if (value == "yes" || value == "true" || value == "1") {
+		return true;
+	} else if (value == "no" || value == "false" || value == "0") {
+		return false;
+	}
+
+	throw dcp::MiscError (dcp::String::compose ("bad value %1 for %2", value, name));
+}
+
+static int
+to_positive_int (string name, string value)
+{
+	int const n = dcp::raw_convert<int> (value);
+	if (n < 1) {
+		throw dcp::MiscError (dcp::String::compose ("bad value %1 for %2", value, name));
+	}
+	return n;
+}
+
+/** Set one thing in a Spec from its option name and value */
+static void
+set (Spec& spec, string name, string value)
+{
+	if (name == "reels") {
+		spec.reels = to_positive_int (name, value);
+	} else if (name == "reel-length") {
+		spec.reel_length = to_positive_int (name, value);
+	} else if (name == "cpls") {
+		spec.cpls = to_positive_int (name, value);
+	} else if (name == "frame-rate") {
+		spec.frame_rate = to_positive_int (name, value);
+	} else if (name == "channels") {
+		spec.channels = to_positive_int (name, value);
+	} else if (name == "sampling-rate") {
+		spec.sampling_rate = to_positive_int (name, value);
+	} else if (name == "subtitles") {
+		spec.subtitles = dcp::raw_convert<int> (value);
+	} else if (name == "stereo") {
+		spec.stereo = to_bool (name, value);
+	} else if (name == "encrypt") {
+		spec.encrypt = to_bool (name, value);
+	} else if (name == "interop") {
+		spec.standard = to_bool (name, value) ? dcp::INTEROP : dcp::SMPTE;
+	} else if (name == "size") {
+		size_t const x = value.find ('x');
+		if (x == string::npos) {
+			throw dcp::MiscError (dcp::String::compose ("bad value %1 for size", value));
+		}
+		spec.size = dcp::Size (
+			to_positive_int (name, value.substr (0, x)),
+			to_positive_int (name, value.substr (x + 1))
+			);
+	} else if (name == "j2k") {
+		spec.j2k = boost::filesystem::path (value);
+	} else if (name == "reproducible") {
+		spec.reproducible = to_bool (name, value);
+	} else if (name == "threads") {
+		spec.threads = to_positive_int (name, value);
+	} else {
+		throw dcp::MiscError (dcp::String::compose ("unknown option %1", name));
+	}
+}
+
+static void
+read_spec (Spec& spec, boost::filesystem::path file)
+{
+	ifstream f (file.string().c_str());
+	if (!f.good ()) {
+		throw dcp::FileError ("could not open spec file", file, errno);
+	}
+
+	string line;
+	while (getline (f, line)) {
+		size_t const hash = line.find ('#');
+		if (hash != string::npos) {
+			line = line.substr (0, hash);
+		}
+
+		std::istringstream s (line);
+		string name;
+		string value;
+		s >> name;
+		if (name.empty ()) {
+			continue;
+		}
+		if (!(s >> value)) {
+			/* A name on its own is a flag such as `stereo' */
+			value = "yes";
+		}
+		set (spec, name, value);
+	}
+}
+
+/** @return A codestream for a flat mid-grey frame, which compresses to almost nothing */
+static dcp::Data
+make_j2k (Spec const & spec)
+{
+	if (spec.j2k) {
+		return dcp::Data (*spec.j2k);
+	}
+
+	shared_ptr<dcp::OpenJPEGImage> xyz (new dcp::OpenJPEGImage (spec.size));
+	for (int c = 0; c < 3; ++c) {
+		int* p = xyz->data (c);
+		for (int i = 0; i < spec.size.width * spec.size.height; ++i) {
+			*p++ = 2048;
+		}
+	}
+
+	return dcp::compress_j2k (xyz, 100000000, spec.frame_rate, spec.stereo, spec.size.width > 2048);
+}
+
+/** The assets of one reel */
+struct ReelAssets
+{
+	shared_ptr<dcp::PictureAsset> picture;
+	shared_ptr<dcp::SoundAsset> sound;
+	shared_ptr<dcp::SubtitleAsset> subtitle;
+};
+
+static void
+write_picture (Spec const & spec, shared_ptr<dcp::PictureAsset> asset, boost::filesystem::path file, dcp::Data const & j2k)
+{
+	shared_ptr<dcp::PictureAssetWriter> writer = asset->start_write (file, false);
+	int const writes = spec.stereo ? 2 : 1;
+	for (int i = 0; i < spec.reel_length * writes; ++i) {
+		writer->write (j2k.data().get(), j2k.size());
+	}
+	writer->finalize ();
+}
+
+static void
+write_sound (Spec const & spec, shared_ptr<dcp::SoundAsset> asset, boost::filesystem::path file)
+{
+	shared_ptr<dcp::SoundAssetWriter> writer = asset->start_write (file);
+
+	/* A quiet tone at a different pitch in each channel, one second at a time */
+	int const block = spec.sampling_rate;
+	vector<float*> data (spec.channels);
+	for (int i = 0; i < spec.channels; ++i) {
+		data[i] = new float[block];
+		for (int j = 0; j < block; ++j) {
+			data[i][j] = 0.1 * sin (2 * M_PI * 110 * (i + 1) * j / spec.sampling_rate);
+		}
+	}
+
+	int64_t remaining = static_cast<int64_t> (spec.reel_length) * spec.sampling_rate / spec.frame_rate;
+	while (remaining > 0) {
+		int const this_time = min (static_cast<int64_t> (block), remaining);
+		writer->write (&data[0], this_time);
+		remaining -= this_time;
+	}
+	writer->finalize ();
+
+	for (int i = 0; i < spec.channels; ++i) {
+		delete[] data[i];
+	}
+}
+
+/** Add spec.subtitles two-line subtitles, spread evenly over the reel */
+static void
+fill_subtitles (Spec const & spec, shared_ptr<dcp::SubtitleAsset> asset, int reel)
+{
+	for (int i = 0; i < spec.subtitles; ++i) {
+		int64_t const in = static_cast<int64_t> (i) * spec.reel_length / spec.subtitles;
+		int64_t const out = max (in + 1, static_cast<int64_t> (i + 1) * spec.reel_length / spec.subtitles);
+		for (int j = 0; j < 2; ++j) {
+			asset->add (
+				shared_ptr<dcp::Subtitle> (
+					new dcp::SubtitleString (
+						optional<string> (),
+						false,
+						false,
+						false,
+						dcp::Colour (255, 255, 255),
+						42,
+						1.0,
+						dcp::Time (in, spec.frame_rate, spec.frame_rate),
+						dcp::Time (out, spec.frame_rate, spec.frame_rate),
+						0,
+						dcp::HALIGN_CENTER,
+						j == 0 ? 0.15 : 0.08,
+						dcp::VALIGN_BOTTOM,
+						dcp::DIRECTION_LTR,
+						dcp::String::compose ("Reel %1 subtitle %2 line %3", reel + 1, i + 1, j + 1),
+						dcp::BORDER,
+						dcp::Colour (0, 0, 0),
+						dcp::Time (),
+						dcp::Time ()
+						)
+					)
+				);
+		}
+	}
+}
+
+static void
+write_reels (Spec const * spec, vector<ReelAssets> const * assets, boost::filesystem::path dir, dcp::Data const * j2k, dcp::Jobs* jobs)
+{
+	try {
+		while (optional<int64_t> n = jobs->get ()) {
+			ReelAssets const & reel = (*assets)[*n];
+			write_picture (*spec, reel.picture, dir / dcp::String::compose ("picture_%1.mxf", *n + 1), *j2k);
+			write_sound (*spec, reel.sound, dir / dcp::String::compose ("sound_%1.mxf", *n + 1));
+			if (reel.subtitle) {
+				string const extension = spec->standard == dcp::SMPTE ? "mxf" : "xml";
+				reel.subtitle->write (dir / dcp::String::compose ("subtitle_%1.%2", *n + 1, extension));
+			}
+			cout << "Reel " << (*n + 1) << " of " << spec->reels << " written\n";
+		}
+	} catch (std::exception& e) {
+		jobs->set_error (e.what ());
+	}
+}
+
+int
+main (int argc, char* argv[])
+{
+	Spec spec;
+
+	try {
+		int option_index = 0;
+		while (true) {
+			static struct option long_options[] = {
+				{ "version", no_argument, 0, 'V' },
+				{ "help", no_argument, 0, 'h' },
+				{ "spec", required_argument, 0, 's' },
+				{ "reels", required_argument, 0, 'A' },
+				{ "reel-length", required_argument, 0, 'A' },
+				{ "cpls", required_argument, 0, 'A' },
+				{ "frame-rate", required_argument, 0, 'A' },
+				{ "channels", required_argument, 0, 'A' },
+				{ "sampling-rate", required_argument, 0, 'A' },
+				{ "subtitles", required_argument, 0, 'A' },
+				{ "stereo", no_argument, 0, 'A' },
+				{ "encrypt", no_argument, 0, 'A' },
+				{ "interop", no_argument, 0, 'A' },
+				{ "size", required_argument, 0, 'A' },
+				{ "j2k", required_argument, 0, 'A' },
+				{ "reproducible", no_argument, 0, 'A' },
+				{ "threads", required_argument, 0, 't' },
+				{ 0, 0, 0, 0 }
+			};
+
+			int c = getopt_long (argc, argv, "Vhs:t:", long_options, &option_index);
+
+			if (c == -1) {
+				break;
+			}
+
+			switch (c) {
+			case 'V':
+				cout << "dcpsynth version " << LIBDCP_VERSION << "\n";
+				exit (EXIT_SUCCESS);
+			case 'h':
+				help (argv[0]);
+				exit (EXIT_SUCCESS);
+			case 's':
+				read_spec (spec, optarg);
+				break;
+			case 't':
+				set (spec, "threads", optarg);
+				break;
+			case 'A':
+				set (spec, long_options[option_index].name, optarg ? optarg : "yes");
+				break;
+			default:
+				help (argv[0]);
+				exit (EXIT_FAILURE);
+			}
+		}
+	} catch (std::exception& e) {
+		cerr << e.what() << "\n";
+		exit (EXIT_FAILURE);
+	}
+
+	if (argc <= optind) {
+		help (argv[0]);
+		exit (EXIT_FAILURE);
+	}
+
+	boost::filesystem::path const dir = argv[optind];
+	if (boost::filesystem::exists (dir)) {
+		cerr << dir.string() << " already exists.\n";
+		exit (EXIT_FAILURE);
+	}
+
+	dcp::init ();
+
+	dcp::XMLMetadata metadata;
+	metadata.annotation_text = "Synthetic DCP";
+	metadata.creator = metadata.issuer = dcp::String::compose ("dcpsynth %1", LIBDCP_VERSION);
+
+	if (spec.reproducible) {
+		/* Make asdcplib's random numbers (from which IDs and keys come) the same every time.
+		   This only works if they are asked for in the same order, so use one thread.
+		*/
+		Kumu::cth_test = true;
+#ifdef LIBDCP_POSIX
+		Kumu::ResetTestRNG ();
+#endif
+		spec.threads = 1;
+		metadata.issue_date = "2019-01-01T00:00:00+00:00";
+	}
+
+	try {
+		boost::filesystem::create_directories (dir);
+		dcp::Data const j2k = make_j2k (spec);
+		dcp::Fraction const edit_rate (spec.frame_rate, 1);
+		dcp::Key const key;
+
+		/* Make the assets here, so that their IDs are given out in order */
+		vector<ReelAssets> assets (spec.reels);
+		for (int i = 0; i < spec.reels; ++i) {
+			ReelAssets& reel = assets[i];
+			if (spec.stereo) {
+				reel.picture.reset (new dcp::StereoPictureAsset (edit_rate, spec.standard));
+			} else {
+				reel.picture.reset (new dcp::MonoPictureAsset (edit_rate, spec.standard));
+			}
+			reel.sound.reset (new dcp::SoundAsset (edit_rate, spec.sampling_rate, spec.channels, spec.standard));
+
+			if (spec.subtitles > 0) {
+				if (spec.standard == dcp::SMPTE) {
+					shared_ptr<dcp::SMPTESubtitleAsset> s (new dcp::SMPTESubtitleAsset ());
+					s->set_reel_number (i + 1);
+					s->set_language ("en");
+					s->set_content_title_text ("Synthetic DCP");
+					s->set_edit_rate (edit_rate);
+					s->set_time_code_rate (spec.frame_rate);
+					s->set_intrinsic_duration (spec.reel_length);
+					s->set_issue_date (dcp::LocalTime (metadata.issue_date));
+					if (spec.encrypt) {
+						s->set_key (key);
+					}
+					reel.subtitle = s;
+				} else {
+					shared_ptr<dcp::InteropSubtitleAsset> s (new dcp::InteropSubtitleAsset ());
+					s->set_reel_number (dcp::raw_convert<string> (i + 1));
+					s->set_language ("English");
+					s->set_movie_title ("Synthetic DCP");
+					reel.subtitle = s;
+				}
+				fill_subtitles (spec, reel.subtitle, i);
+			}
+
+			if (spec.encrypt) {
+				reel.picture->set_key (key);
+				reel.sound->set_key (key);
+			}
+		}
+
+		dcp::Jobs jobs (spec.reels);
+		boost::thread_group group;
+		for (int i = 0; i < spec.threads; ++i) {
+			group.create_thread (boost::bind (&write_reels, &spec, &assets, dir, &j2k, &jobs));
+		}
+		group.join_all ();
+
+		if (jobs.error ()) {
+			cerr << "Error: " << *jobs.error() << "\n";
+			exit (EXIT_FAILURE);
+		}
+
+		dcp::DCP dcp (dir);
+		vector<shared_ptr<dcp::CPL> > cpls;
+		for (int i = 0; i < spec.cpls; ++i) {
+			shared_ptr<dcp::CPL> cpl (new dcp::CPL (dcp::String::compose ("Synthetic DCP version %1", i + 1), dcp::FEATURE));
+			cpl->set_metadata (metadata);
+			BOOST_FOREACH (ReelAssets const & j, assets) {
+				shared_ptr<dcp::ReelPictureAsset> picture;
+				shared_ptr<dcp::StereoPictureAsset> stereo = dynamic_pointer_cast<dcp::StereoPictureAsset> (j.picture);
+				if (stereo) {
+					picture.reset (new dcp::ReelStereoPictureAsset (stereo, 0));
+				} else {
+					picture.reset (new dcp::ReelMonoPictureAsset (dynamic_pointer_cast<dcp::MonoPictureAsset> (j.picture), 0));
+				}
+
+				shared_ptr<dcp::ReelSubtitleAsset> subtitle;
+				if (j.subtitle) {
+					subtitle.reset (new dcp::ReelSubtitleAsset (j.subtitle, edit_rate, spec.reel_length, 0));
+				}
+
+				cpl->add (
+					shared_ptr<dcp::Reel> (
+						new dcp::Reel (picture, shared_ptr<dcp::ReelSoundAsset> (new dcp::ReelSoundAsset (j.sound, 0)), subtitle)
+						)
+					);
+			}
+			dcp.add (cpl);
+			cpls.push_back (cpl);
+		}
+
+		dcp.write_xml (spec.standard, metadata);
+
+		if (spec.encrypt) {
+			/* One KDM per CPL, for the leaf of a new certificate chain whose private key is written alongside */
+			boost::filesystem::path const kdm_dir = dir.string() + "_kdm";
+			boost::filesystem::create_directories (kdm_dir);
+			shared_ptr<dcp::CertificateChain> chain (new dcp::CertificateChain (boost::filesystem::path ()));
+			{
+				ofstream f ((kdm_dir / "leaf.key").string().c_str());
+				f << chain->key().get();
+			}
+			{
+				ofstream f ((kdm_dir / "leaf.pem").string().c_str());
+				f << chain->leaf().certificate(true);
+			}
+			/* A long, fixed validity period keeps the KDMs usable.  They still differ from run to run, even
+			   with --reproducible, as the certificate chain is new each time (with a validity starting now)
+			   and the RSA encryption of the keys is randomly padded.
+			*/
+			dcp::LocalTime const from ("2019-01-01T00:00:00+00:00");
+			dcp::LocalTime const to ("2039-01-01T00:00:00+00:00");
+			BOOST_FOREACH (shared_ptr<dcp::CPL> i, cpls) {
+				dcp::DecryptedKDM kdm (i, key, from, to, "dcpsynth", i->content_title_text(), metadata.issue_date);
+				kdm.encrypt (chain, chain->leaf(), vector<string>(), dcp::MODIFIED_TRANSITIONAL_1, true, 0).as_xml (
+					kdm_dir / dcp::String::compose ("%1.xml", i->id())
+					);
+			}
+		}
+	} catch (std::exception& e) {
+		cerr << "Error: " << e.what() << "\n";
+		exit (EXIT_FAILURE);
+	}
+
+	return 0;
+}